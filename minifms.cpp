@@ -7,6 +7,7 @@
 #include <thread>
 #include <condition_variable>
 #include <map>
+#include <unordered_map>
 #include <sstream>
 #include <algorithm>
 #include <queue>
@@ -15,6 +16,12 @@
 #include <chrono>
 #include <memory>
 #include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <string_view>
+#include <functional>
+#include <numeric>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -23,20 +30,62 @@
 #else
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <errno.h>
 #endif
 
+// x86 平台使用 GCC/Clang 的 target 属性编译 SIMD 内核，运行时按CPU能力选择
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MINIFMS_X86_SIMD 1
+#endif
+
 using namespace std;
 
 // 系统常量定义
 #define VERSION "2.0"
-#define MAX_USERS 100
+#define MAX_USERS 4096
 #define MAX_FCBS 10000
 #define MAX_FILENAME_LEN 64 // 文件名最大长度
 #define MAX_BLOCKS 9216     // 最大块数
+#define BLOCK_SIZE 4096     // 数据块大小（字节）
+#define BITMAP_WORDS ((MAX_BLOCKS + 63) / 64) // 空闲位图的64位字数
+#define INLINE_DATA_SIZE 128 // 不超过该大小的文件内容直接存放在内联区，不占用数据块
+#define MAX_EXTENTS (MAX_BLOCKS * 2) // 区段表容量（复制出的文件与源文件共享数据块，各自占用区段）
+#define MAX_FILE_SIZE (1ULL << 40) // 单个文件的逻辑大小上限（稀疏文件可远大于块池）
+#define FILE_VISIT_CHUNK (256 << 10) // visitFileData 每次在锁内复制的最大字节数，回调在解锁后执行
+#define CONTENT_ROW_SIZE 4096    // v1数据文件中每个文件固定的内容行长度
+#define DATA_VERSION 3           // filesystem.dat 格式版本：1 原样写出结构体和定长内容行，2 逐字段写出、内容按实际大小存放，
+                                 // 3 在2的基础上每段带长度和CRC32C、每条用户和FCB记录带CRC32C
+#define USER_RECORD_TAG "USERREC1"  // v3数据文件中用户记录段的标识
+#define FCB_RECORD_TAG "FCBRECS1"   // v3数据文件中FCB记录段的标识
+#define SYSTEM_STATE_TAG "SYSSTAT1" // v3数据文件中系统状态段的标识
+#define DATA_END_TAG "DATAEND1"     // v3数据文件的结束段，缺失说明文件被截断
+#define DATA_VERIFY_CHUNK (1 << 20) // 加载时按该大小切块，多个线程并行计算校验值后合并
+#define FILE_DATA_TAG "FILEEXT1" // 数据文件中超长文件内容段的标识（按区段存放，空洞不落盘）
+#define FILE_DATA_TAG_FLAT "FILEBLK1" // 早期的超长文件内容段：剩余内容连续存放
+#define DEDUP_TABLE_SIZE 32768 // 去重指纹表槽数（2的幂，约为块数的3.5倍）
+#define DEDUP_BATCH_DEFAULT 64 // 维护线程空闲时每批检查的逻辑块数
+#define DEDUP_INTERVAL_DEFAULT 200 // 两批去重之间的间隔（毫秒）
+#define DEFRAG_BATCH_DEFAULT 32     // 后台整理每批最多移动的FCB数和数据块数
+#define DEFRAG_INTERVAL_DEFAULT 200 // 两批整理之间的间隔（毫秒）
+#define SCRUB_BATCH 512             // verify 后台校验每批检查的块数
+#define SCRUB_BAD_LIST 16           // 校验结果中保留的不一致块号个数
+#define FILE_SHARE_TAG "FILESHR1" // 数据文件中共享数据块段的标识（共享的块只保存一份内容）
+#define FRAME_BLOCKS 8                          // 压缩文件每帧包含的逻辑块数
+#define FRAME_SIZE (FRAME_BLOCKS * BLOCK_SIZE) // 压缩帧大小：随机读只解压涉及的帧
+#define MAX_FRAMES MAX_BLOCKS                   // 压缩帧表容量
+#define FILE_COMPRESS_TAG "FILECMP1"            // 数据文件中压缩存储设置段的标识
+#define DIR_HASH_SIZE 32768 // 目录项哈希表槽数（2的幂，装载率不超过约30%）
+#define DIR_HASH_EMPTY -1   // 哈希槽：从未使用
+#define DIR_HASH_DELETED -2 // 哈希槽：已删除（墓碑）
+#define FREE_LIST_TAG "FREEFCB1" // 数据文件中FCB空闲栈段的标识
+#define USER_HASH_SIZE 8192      // 用户名哈希表槽数（2的幂，不小于MAX_USERS的2倍）
+#define USER_ID_TABLE_SIZE (MAX_USERS * 2) // userId -> 用户槽位的直接映射表大小
 
 // 进程间通信常量
 #define SHARED_MEMORY_SIZE (sizeof(SharedData))
@@ -44,6 +93,22 @@ using namespace std;
 #define SHARED_MUTEX_NAME "MiniFMS_Mutex"
 #define CHANGE_EVENT_NAME "MiniFMS_ChangeEvent"
 #define MAX_PROCESSES 10
+#define IMAGE_FILE "filesystem.img"  // 映像模式：该文件直接映射为共享段（仅Linux）
+#define IMAGE_MAGIC "MINIFMSI"
+#define IMAGE_LAYOUT_VERSION 7  // SharedData 布局变化时递增，旧映像不再直接映射
+#define IMAGE_HEADER_SIZE 4096  // 映像头占一页，共享段从页边界开始映射
+#define STORE_FILE "filesystem.pages" // 页式存储：保存时只写回上次保存以来修改过的页
+#define STORE_MAGIC "MINIFMSP"
+#define STORE_VERSION 2 // 2 起带页校验表；1 的文件仍可加载，下次保存时完整写入
+#define STORE_JOURNAL_FILE "filesystem.pages.journal" // 增量保存先写入的页日志，原地写入完成后删除
+#define STORE_JOURNAL_MAGIC "MINIFMSJ"
+#define WAL_FILE "filesystem.wal"         // 预写日志：两次保存之间的修改逐条追加，启动时在页式存储之上重放
+#define WAL_OLD_FILE "filesystem.wal.old" // 保存开始时切换出的旧日志，保存完成后删除
+#define WAL_MAGIC "MINIFMSW"
+#define WAL_VERSION 1
+#define WAL_CHECKPOINT_BYTES (64LL << 20) // 日志超过该长度时提前保存，缩短重放时间
+#define WAL_SYNC_TIMEOUT_MS 2000          // 负责同步的进程超过该时间未完成时由其他进程接手
+#define DENTRY_CACHE_LIMIT 4096 // 每个进程路径解析缓存的最大条目数
 
 // 用户结构体
 struct User
@@ -75,7 +140,7 @@ struct FCB
     int type = 0; // 0=文件，1=目录
     int owner = 0;
     size_t size = 0;
-    int address = 0; // 文件在二进制文件中的起始地址
+    int address = -1; // 保留字段：文件数据由区段表记录，仅在v1数据文件中记录FCB槽位
     time_t createTime;
     time_t modifyTime;
     time_t accessTime;
@@ -103,2743 +168,9434 @@ struct FileDesc
     FileDesc(int fid, int uid, int m) : fcbId(fid), userId(uid), mode(m), isOpen(true) {}
 };
 
+// 文件内容视图回调：视图直接指向共享内存，仅在回调期间有效；返回 false 停止遍历
+typedef function<bool(string_view)> SpanVisitor;
+
+// 文件数据区段：逻辑块 [fileBlock, fileBlock + blockCount) 存放在物理块 [startBlock, startBlock + blockCount)
+struct Extent
+{
+    int fcbId;
+    int fileBlock;
+    int startBlock;
+    int blockCount;
+};
+
+// 去重指纹表项：块内容哈希 -> 物理块号，查到后仍需逐字节比较确认
+struct DedupEntry
+{
+    uint64_t hash;
+    int blockPlusOne; // 物理块号 + 1，0 表示空槽（全0的表不需要初始化）
+};
+
+// 压缩文件的帧：逻辑字节 [frame * FRAME_SIZE, frame * FRAME_SIZE + rawLength) 压缩后存放在 blocks 中，
+// 帧内 rawLength 之后读出为0；不存在的帧是空洞
+struct Frame
+{
+    int fcbId;
+    int frame;
+    int rawLength;
+    int packedLength; // 0 表示压缩无收益，原样存放
+    int blockCount;
+    int blocks[FRAME_BLOCKS];
+};
+
+// 一个文件内容的存放位置：forEachSpan 直接指向共享段中的表，写快照时指向锁内复制出的表
+struct FileLayout
+{
+    size_t size = 0;
+    const char *inlineData = nullptr; // 内联文件的内容
+    bool compressed = false;
+    const Extent *extents = nullptr; // 该文件的区段，按逻辑块号排列
+    int extentCount = 0;
+    const Frame *frames = nullptr; // 该文件的帧，按帧号排列
+    int frameCount = 0;
+};
+
+// 数据文件中的共享块记录：dstId 的逻辑块 [dstBlock, dstBlock + count) 与 srcId 的 [srcBlock, srcBlock + count) 共用物理块
+struct SharedRun
+{
+    int dstId;
+    int dstBlock;
+    int srcId;
+    int srcBlock;
+    int count;
+};
+
+// 映像文件头：其后紧跟 SharedData 的原样内容。SharedData 内部只用下标互相引用，
+// 映射到任意地址都有效；布局指纹不符的映像不映射，回退到页式存储或 filesystem.dat
+struct ImageHeader
+{
+    char magic[8];
+    uint32_t layoutVersion;
+    uint32_t clean;     // 1 表示最后一个进程正常退出前完成了同步
+    uint64_t dataSize;  // sizeof(SharedData)
+    uint64_t layoutHash;
+    uint64_t syncCount; // 累计同步次数
+    int64_t syncTime;   // 上次同步时间
+};
+
+// 页式存储文件头（第0页）：其后各段依次是共享段中用户表、FCB表、内联标记、内联区、压缩标记、区段表、帧表和
+// 数据块池的原样字节，每段从页边界开始，块 b 位于第 STORE_BLOCK_PAGE + b 页；块池之后是页校验表。
+// 派生的索引、块引用计数和位图不落盘，加载后由区段表和帧表重新统计
+struct StoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;  // CRC32C，覆盖文件头（本字段按0计算）和整个页校验表
+    uint64_t layoutHash;
+    uint64_t storeId;   // 完整写入时生成，共享段记录自己与哪个文件同步，不一致时下次保存完整写入
+    uint64_t saveCount; // 累计保存次数
+    int64_t saveTime;   // 上次保存时间
+    int32_t modifyCount;
+    int32_t nextUserId;
+    int32_t nextFcbId;
+    int32_t compressNewFiles;
+    int32_t extentCount;
+    int32_t frameCount;
+    uint64_t walId;         // 与之配套的日志文件标识
+    uint64_t walCheckpoint; // 该版本包含了日志中此位置之前的全部记录
+};
+
+// 增量保存的页日志：本次要写的页连同新的文件头先完整写入并落盘，之后才原地写入页式存储文件。
+// 其后依次是新的 StoreHeader、pageCount 个页号（uint64_t）和各页内容
+struct StoreJournalHeader
+{
+    char magic[8];
+    uint32_t pageCount;
+    uint32_t checksum; // CRC32C，覆盖页日志头之后的全部内容
+    uint64_t storeId;  // 页日志对应的页式存储文件，不一致时直接丢弃
+};
+
+// 预写日志文件头；记录从文件头之后开始，位置 lsn 的记录位于文件偏移 sizeof(WalHeader) + lsn - baseLsn
+struct WalHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t walId;
+    uint64_t baseLsn; // 文件中第一条记录的位置
+};
+
+// 日志记录头，其后是 length 字节的数据；各字段的含义由 type 决定（见 WalOp）
+struct WalRecord
+{
+    uint64_t lsn;      // 记录在日志中的位置，重放时据此确认记录连续
+    uint64_t checksum; // 记录头（本字段按0计算）与数据的校验和，崩溃时写了一半的记录在此失配
+    uint32_t length;
+    uint16_t type;
+    uint16_t flags;
+    int32_t fcbId;
+    int32_t arg;
+    int64_t value;
+};
+
+// 逻辑操作：重放时调用与原操作相同的函数，数据块位置由重放时的分配决定
+enum WalOp
+{
+    WAL_CREATE = 1, // fcbId 新建的槽位，数据为 FCB，flags 为压缩存储标记
+    WAL_RELEASE,    // fcbId
+    WAL_WRITE,      // fcbId 在 value 处覆盖写入数据
+    WAL_INSERT,     // fcbId 在 value 处插入数据
+    WAL_COPY,       // fcbId 源文件，arg 目标文件
+    WAL_MOVE,       // fcbId 移动到目录 arg
+    WAL_COMPRESS,   // fcbId 的存储方式，arg 为 1 表示压缩
+    WAL_VOLUME,     // 新建文件默认存储方式 arg
+    WAL_ATTR,       // fcbId 的锁定状态 flags、锁定者 arg、修改时间 value
+    WAL_USER,       // 用户表槽位 arg 的内容，value 为 nextUserId
+    WAL_RELOC       // FCB 槽位重定位表
+};
+
+#define STORE_SEGMENT_PAGES(bytes) (((bytes) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define STORE_BLOCK_PAGE (1 + STORE_SEGMENT_PAGES(sizeof(User) * MAX_USERS) + STORE_SEGMENT_PAGES(sizeof(FCB) * MAX_FCBS) + \
+                          2 * STORE_SEGMENT_PAGES(MAX_FCBS) + STORE_SEGMENT_PAGES(INLINE_DATA_SIZE * MAX_FCBS) +          \
+                          STORE_SEGMENT_PAGES(sizeof(Extent) * MAX_EXTENTS) + STORE_SEGMENT_PAGES(sizeof(Frame) * MAX_FRAMES))
+#define STORE_PAGES (STORE_BLOCK_PAGE + MAX_BLOCKS)
+#define STORE_CRC_PAGE STORE_PAGES // 页校验表的起始页：第 p 页内容的CRC32C位于表中第 p 项，空洞按全0页计算
+#define STORE_CRC_PAGES STORE_SEGMENT_PAGES(sizeof(uint32_t) * STORE_PAGES)
+#define STORE_FILE_PAGES (STORE_PAGES + STORE_CRC_PAGES)
+#define STORE_PAGE_WORDS ((STORE_PAGES + 63) / 64)
+
+// 目录子项链表节点（与 fcbs[] 下标一一对应，不改变FCB的磁盘布局）
+struct DirLink
+{
+    int firstChild = -1;  // 第一个子项（仅目录有效）
+    int lastChild = -1;   // 最后一个子项，追加时保持创建顺序
+    int nextSibling = -1; // 同一父目录下的下一个兄弟
+    int prevSibling = -1; // 同一父目录下的上一个兄弟
+    int childCount = 0;   // 直接子项数量（仅目录有效）
+};
+
 // 简化的共享数据结构
 struct SharedData
 {
     atomic<int> modifyCount{0};
     atomic<int> nextUserId{1};
     atomic<int> nextFcbId{1};
+    atomic<int> namespaceGen{0}; // 命名空间版本号，创建/删除/移动时递增
+    atomic<int> dirTreeGen{0};   // 目录结构版本号，仅在目录被删除/移动时递增
     User users[MAX_USERS];
     FCB fcbs[MAX_FCBS];
-    char fileContents[MAX_FCBS][4096];
+
+    // 热点元数据列（与 fcbs[] 并行）：全表扫描只读这些紧凑数组
+    unsigned char fcbUsed[MAX_FCBS];
+    unsigned char fcbType[MAX_FCBS];
+    int fcbParent[MAX_FCBS];
     bool initialized = false;
 
+    // 目录项索引：(parentDir, name) -> fcbId，开放寻址 + 线性探测
+    int dirHash[DIR_HASH_SIZE];
+    int dirHashTombstones = 0;
+
+    // 目录子项链表：目录操作只遍历实际子项
+    DirLink links[MAX_FCBS];
+
+    // 用户索引：用户名 -> 槽位（开放寻址，只增不删），userId -> 槽位（直接映射）
+    int userHash[USER_HASH_SIZE];
+    int userSlotById[USER_ID_TABLE_SIZE];
+
+    // 子树汇总：每个目录下（含所有子目录）的文件总字节数和文件数
+    long long subtreeBytes[MAX_FCBS];
+    int subtreeFiles[MAX_FCBS];
+
+    // 有序目录索引：按 (parentDir, name) 排序的FCB ID数组，同一目录的子项连续存放
+    int nameIndex[MAX_FCBS];
+    int nameIndexCount = 0;
+
+    // FCB空闲槽位栈：分配和释放均为O(1)，删除的槽位可被复用
+    int freeFcbStack[MAX_FCBS];
+    int freeFcbTop = 0;
+
+    // 块存储：所有进程共享的区段表、空闲位图和数据块池
+    // 区段表按 (fcbId, fileBlock) 排序，同一文件的区段连续存放；未被区段覆盖的逻辑块是空洞，读出为0
+    Extent extents[MAX_EXTENTS];
+    int extentCount = 0;
+
+    // 小文件内联区（与 fcbs[] 并行，每个文件两条缓存行）：fileInline[i] 为1时内容全部在 inlineData[i] 中，
+    // 文件末尾之后的字节保持为0；文件增长超过 INLINE_DATA_SIZE 时透明地迁移到数据块
+    unsigned char fileInline[MAX_FCBS];
+    alignas(64) char inlineData[MAX_FCBS][INLINE_DATA_SIZE];
+
+    uint64_t bitMap[BITMAP_WORDS];     // 1 表示块已分配
+    uint64_t staleBitmap[BITMAP_WORDS]; // 1 表示空闲块可能残留旧数据，分配时需要清零
+    unsigned short blockRefs[MAX_BLOCKS]; // 引用该块的区段数：复制文件时共享数据块，写入前才复制出私有块
+    int freeBlockCount = MAX_BLOCKS;
+    int blockHint = 0; // 下次分配时开始搜索的块号
+
+    // 后台去重：块内容指纹缓存（写入块时失效）、指纹表和扫描游标。
+    // 游标按 (fcbId, fileBlock) 顺序遍历区段表，每轮扫描开始时清空指纹表；
+    // 指纹表与块池一样依赖共享内存初始为0，不在构造函数中触碰
+    // 压缩存储：fileCompressed[i] 为1的文件内容按帧压缩存放在帧表中，不使用区段表；
+    // 帧表按 (fcbId, frame) 排序，帧的数据块同样计入 blockRefs
+    unsigned char fileCompressed[MAX_FCBS];
+    Frame frames[MAX_FRAMES];
+    int frameCount = 0;
+    int compressNewFiles = 0; // 卷级设置：新建文件默认使用压缩存储
+
+    uint64_t blockHash[MAX_BLOCKS];
+    uint64_t hashValid[BITMAP_WORDS]; // 1 表示 blockHash 与块内容一致
+    DedupEntry dedupTable[DEDUP_TABLE_SIZE];
+    int dedupTableUsed = 0;
+    int dedupCursorFcb = 0;
+    int dedupCursorBlock = 0;
+    int dedupBatch = DEDUP_BATCH_DEFAULT;       // 每批检查的块数，0 表示关闭
+    int dedupIntervalMs = DEDUP_INTERVAL_DEFAULT; // 两批之间的间隔
+    long long dedupMerged = 0;                // 累计合并的逻辑块数
+    long long dedupFreed = 0;                 // 累计因合并而释放的物理块数
+    long long dedupSweeps = 0;                // 已完成的扫描轮数
+
+    // 后台校验：blockCrc 记录块内容的CRC32C，与指纹缓存一同在块被写入或重新分配时失效。
+    // 保存时顺便封存写出的块；verify 扫描整个块池，失效的块重新封存，已封存的块重新计算并比较，
+    // 不一致说明块内容在没有经过写入路径的情况下被改动（映像文件或内存中的位翻转、越界写入）
+    uint32_t blockCrc[MAX_BLOCKS];
+    uint64_t crcValid[BITMAP_WORDS]; // 1 表示 blockCrc 与块内容一致
+    int scrubActive = 0;             // verify 发起的扫描进行中
+    int scrubCursor = 0;             // 下一批的起始块
+    long long scrubChecked = 0;      // 本轮比较过的块数
+    long long scrubSealed = 0;       // 本轮新封存的块数
+    long long scrubErrors = 0;       // 本轮发现的不一致块数
+    long long scrubStructErrors = 0; // 本轮发现的区段表、帧表引用错误数
+    long long scrubRounds = 0;       // 已完成的扫描轮数
+    int64_t scrubStartTime = 0;
+    int64_t scrubEndTime = 0;
+    int scrubBadCount = 0;
+    int scrubBadBlocks[SCRUB_BAD_LIST];
+
+    // 在线整理：FCB按目录顺序排列（同一目录的子项相邻），数据块按文件顺序连续存放。
+    // FCB槽位重排后发布重定位表（旧ID -> 新ID），各进程在执行下一条命令前或空闲时修正本进程持有的
+    // FCB ID（当前目录、打开的文件）并确认；只有其他进程都已确认上一批、没有命令在执行时
+    // 才发布下一批，因此任何进程都不会用旧ID访问重排后的表
+    int relocMap[MAX_FCBS];
+    int relocGen = 0;
+    int relocAck[MAX_PROCESSES];              // 各进程已应用的批次，-1 表示尚未登录、不持有FCB ID
+    unsigned char processBusy[MAX_PROCESSES]; // 进程正在执行命令
+    unsigned char snapshotPinned[MAX_PROCESSES]; // 进程正在写快照，固定了数据块：期间数据块不搬动
+    int layoutGen = 0;                        // 块分配/释放时递增，后台整理据此跳过没有变化的布局
+    int defragBatch = DEFRAG_BATCH_DEFAULT;
+    int defragIntervalMs = DEFRAG_INTERVAL_DEFAULT;
+    long long defragFcbMoves = 0;
+    long long defragBlockMoves = 0;
+
+    // 增量保存：storeDirty 按文件页号记录自上次保存以来被修改的页。保存时在共享内存锁内取出并清空，
+    // 复制出这些页的内容后即释放锁，写文件期间其他进程照常修改（再次修改的页留给下一次保存）
+    uint64_t storeDirty[STORE_PAGE_WORDS];
+    uint64_t storeId = 0;            // 已同步的页式存储文件标识，0 表示下次保存需要完整写入
+    int storeSaving = 0;             // 正在写页式存储文件的进程号（0 表示没有），其他进程的保存等待它完成
+    long long storeSaves = 0;        // 累计增量保存次数
+    long long storePagesWritten = 0; // 累计写入的页数
+    int storeLastPages = 0;          // 上次保存写入的页数
+
+    // 预写日志：修改共享段的操作在共享内存锁内把逻辑记录追加到日志文件，命令结束前等待记录落盘。
+    // 同一时间只有一个进程执行 fdatasync，等待中的进程在它完成后检查自己的记录是否已被覆盖，
+    // 没有覆盖的由下一次同步统一处理，多个进程的提交合并为一次磁盘同步
+    int walEnabled = 0;
+    int walSyncing = 0;               // 有进程正在执行 fdatasync
+    int walGeneration = 0;            // 日志文件切换时递增，各进程据此重新打开
+    int walOldPending = 0;            // 旧日志等待保存完成后删除
+    int64_t walSyncStart = 0;         // 同步开始时间（steady_clock 毫秒）
+    uint64_t walId = 0;
+    uint64_t walLsn = 0;              // 下一条记录的位置
+    uint64_t walSyncedLsn = 0;        // 此位置之前的记录已落盘
+    uint64_t walBaseLsn = 0;          // 当前日志文件第一条记录的位置
+    uint64_t walCheckpointLsn = 0;    // 最近一次保存包含了此位置之前的记录
+    long long walRecords = 0;         // 累计追加的记录数
+    long long walCommits = 0;         // 累计需要等待落盘的提交数
+    long long walSyncs = 0;           // 累计 fdatasync 次数
+#ifndef _WIN32
+    int walSyncWaiters = 0; // 等待其他进程同步完成的提交数
+    sem_t walSyncDone;      // 进程间共享的信号量：每次同步结束按等待数释放，等待者醒来后检查自己的记录是否已落盘
+#endif
+
     // 进程间同步字段
     atomic<int> processCount{0};
     atomic<int> lastChangeId{0};
     char processNames[MAX_PROCESSES][64];
     atomic<bool> processActive[MAX_PROCESSES];
 
+    // 数据块池放在末尾并按页对齐：构造函数不触碰它，页面只在写入数据时才真正提交，
+    // 释放的块通过 discardBlocks 归还给系统
+    alignas(4096) char blockPool[MAX_BLOCKS][BLOCK_SIZE];
+
     SharedData()
     {
+        // 块池本身不清零：新建的共享内存读出为0，只有残留旧数据的块在分配时清零
+        memset(bitMap, 0, sizeof(bitMap));
+        memset(staleBitmap, 0, sizeof(staleBitmap));
+        memset(blockRefs, 0, sizeof(blockRefs));
+        memset(hashValid, 0, sizeof(hashValid));
+        memset(crcValid, 0, sizeof(crcValid));
+        memset(fileCompressed, 0, sizeof(fileCompressed));
+        memset(storeDirty, 0, sizeof(storeDirty));
+        memset(fileInline, 0, sizeof(fileInline)); // 内联区同样依赖共享内存初始为0，不逐行清零
+        memset(subtreeBytes, 0, sizeof(subtreeBytes));
+        memset(subtreeFiles, 0, sizeof(subtreeFiles));
+        memset(fcbUsed, 0, sizeof(fcbUsed));
+        memset(fcbType, 0, sizeof(fcbType));
         for (int i = 0; i < MAX_FCBS; ++i)
         {
-            memset(fileContents[i], 0, sizeof(fileContents[i]));
+            fcbParent[i] = -1;
         }
         for (int i = 0; i < MAX_PROCESSES; ++i)
         {
             memset(processNames[i], 0, sizeof(processNames[i]));
             processActive[i] = false;
         }
+        for (int i = 0; i < DIR_HASH_SIZE; ++i)
+        {
+            dirHash[i] = DIR_HASH_EMPTY;
+        }
+        for (int i = 0; i < USER_HASH_SIZE; ++i)
+        {
+            userHash[i] = -1;
+        }
+        for (int i = 0; i < USER_ID_TABLE_SIZE; ++i)
+        {
+            userSlotById[i] = -1;
+        }
+        // 0号槽位固定为根目录，其余槽位按编号从小到大分配
+        for (int i = MAX_FCBS - 1; i >= 1; --i)
+        {
+            freeFcbStack[freeFcbTop++] = i;
+        }
     }
 };
 
-// 会话结构体
-struct Session
+// 映像布局指纹：由各结构体大小、容量常量和块池偏移混合而成，编译出的布局不同则指纹不同
+static uint64_t imageLayoutHash()
 {
-    User *user = nullptr;
-    int currentDirId = 0;
-    bool active = false;
-    vector<FileDesc> openFiles;
+    const uint64_t parts[] = {sizeof(SharedData), sizeof(User), sizeof(FCB), sizeof(Extent), sizeof(Frame),
+                              sizeof(DirLink), sizeof(DedupEntry), offsetof(SharedData, blockPool),
+                              MAX_USERS, MAX_FCBS, MAX_BLOCKS, BLOCK_SIZE, MAX_EXTENTS, MAX_FRAMES,
+                              INLINE_DATA_SIZE, DIR_HASH_SIZE, USER_HASH_SIZE, DEDUP_TABLE_SIZE, MAX_PROCESSES};
+    uint64_t h = 14695981039346656037ULL;
+    for (uint64_t part : parts)
+    {
+        h ^= part;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
 
-    int addOpenFile(int fcbId, int mode)
+// 页式存储文件各段在共享段中的位置和长度，顺序与 STORE_BLOCK_PAGE 的计算一致，块池必须是最后一段
+struct StoreSegment
+{
+    size_t offset;
+    size_t bytes;
+};
+
+static const StoreSegment STORE_SEGMENTS[] = {
+    {offsetof(SharedData, users), sizeof(User) * MAX_USERS},
+    {offsetof(SharedData, fcbs), sizeof(FCB) * MAX_FCBS},
+    {offsetof(SharedData, fileInline), MAX_FCBS},
+    {offsetof(SharedData, inlineData), INLINE_DATA_SIZE * MAX_FCBS},
+    {offsetof(SharedData, fileCompressed), MAX_FCBS},
+    {offsetof(SharedData, extents), sizeof(Extent) * MAX_EXTENTS},
+    {offsetof(SharedData, frames), sizeof(Frame) * MAX_FRAMES},
+    {offsetof(SharedData, blockPool), static_cast<size_t>(BLOCK_SIZE) * MAX_BLOCKS},
+};
+
+// 页式存储的布局指纹：只与落盘记录的大小和容量有关，SharedData 中索引等字段变化不影响已有文件
+static uint64_t storeLayoutHash()
+{
+    const uint64_t parts[] = {sizeof(StoreHeader), sizeof(User), sizeof(FCB), sizeof(Extent), sizeof(Frame),
+                              MAX_USERS, MAX_FCBS, MAX_BLOCKS, BLOCK_SIZE, MAX_EXTENTS, MAX_FRAMES, INLINE_DATA_SIZE,
+                              STORE_PAGES};
+    uint64_t h = 14695981039346656037ULL;
+    for (uint64_t part : parts)
     {
-        for (size_t i = 0; i < openFiles.size(); ++i)
-        {
-            if (!openFiles[i].isOpen)
-            {
-                openFiles[i] = FileDesc(fcbId, user->userId, mode);
-                return static_cast<int>(i);
-            }
-        }
-        openFiles.push_back(FileDesc(fcbId, user->userId, mode));
-        return static_cast<int>(openFiles.size() - 1);
+        h ^= part;
+        h *= 1099511628211ULL;
     }
+    return h;
+}
 
-    bool closeFile(int fd)
+// 页式存储文件第 page 页（page >= 1）对应的共享段内容，length 返回有效字节数（段末页可能不满一页）
+static const char *storePageData(const SharedData *data, size_t page, size_t &length)
+{
+    size_t first = 1;
+    for (const StoreSegment &seg : STORE_SEGMENTS)
     {
-        if (fd >= 0 && fd < static_cast<int>(openFiles.size()) && openFiles[fd].isOpen)
+        size_t count = STORE_SEGMENT_PAGES(seg.bytes);
+        if (page < first + count)
         {
-            openFiles[fd].isOpen = false;
-            return true;
+            size_t offset = (page - first) * BLOCK_SIZE;
+            length = min(static_cast<size_t>(BLOCK_SIZE), seg.bytes - offset);
+            return reinterpret_cast<const char *>(data) + seg.offset + offset;
         }
-        return false;
+        first += count;
     }
-};
+    length = 0;
+    return nullptr;
+}
 
-// 命令请求结构体
-struct CommandRequest
+// 日志记录校验和（FNV-1a），覆盖记录头和数据；记录头的 checksum 字段按0计算
+static uint64_t walChecksum(const WalRecord &rec, const char *data)
 {
-    Session *session;
-    string commandLine;
+    WalRecord head = rec;
+    head.checksum = 0;
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](const char *p, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            h ^= static_cast<unsigned char>(p[i]);
+            h *= 1099511628211ULL;
+        }
+    };
+    mix(reinterpret_cast<const char *>(&head), sizeof(head));
+    mix(data, rec.length);
+    return h;
+}
 
-    CommandRequest() = default;
-    CommandRequest(Session *s, const string &cmd) : session(s), commandLine(cmd) {}
-};
+// CRC32C（Castagnoli 多项式）：x86 上用 SSE4.2 的 crc32 指令每次处理8字节，不支持时按字节查表。
+// crc 参数是前一段的结果，crc32c(b, crc32c(a)) 等于 a、b 连接后的校验值
+typedef uint32_t (*Crc32cKernel)(uint32_t crc, const char *data, size_t length);
 
-// MiniFMS主类
-class MiniFMS
+static uint32_t crc32cScalar(uint32_t crc, const char *data, size_t length)
 {
-private:
-    SharedData *sharedData = nullptr; // 共享数据（用户、文件、文件内容）
-    atomic<bool> systemRunning{true}; // 系统运行标志，true运行，false退出
-    atomic<bool> shouldExit{false};   // 退出标志，true退出，false运行
+    static const vector<uint32_t> table = []()
+    {
+        vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c >> 1) ^ (0x82F63B78U & (0U - (c & 1)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = ~crc;
+    for (size_t i = 0; i < length; ++i)
+        c = table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+    return ~c;
+}
 
-#ifdef _WIN32
-    HANDLE hMapFile = nullptr;
-    HANDLE hMutex = nullptr;
-    HANDLE hChangeEvent = nullptr;
-#else
-    int shmFd = -1;
-    sem_t *mutex = nullptr;
-    sem_t *changeEvent = nullptr;
+#ifdef MINIFMS_X86_SIMD
+__attribute__((target("sse4.2"))) static uint32_t crc32cSSE42(uint32_t crc, const char *data, size_t length)
+{
+    uint64_t c = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for (; i < length; ++i)
+        c32 = _mm_crc32_u8(c32, static_cast<unsigned char>(data[i]));
+    return ~c32;
+}
 #endif
 
-    queue<CommandRequest> commandQueue; // 命令队列
-    mutex queueMutex;                   // 命令队列互斥锁
-    condition_variable queueCv;         // 命令队列条件变量
-    mutex diskMutex;                    // 本地文件互斥锁
-    bool ready = false;                 // 是否就绪判断
+// 按CPU能力选择校验内核（只在首次使用时检测一次）
+static Crc32cKernel selectCrc32cKernel(const char **kernelName)
+{
+#ifdef MINIFMS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        *kernelName = "SSE4.2";
+        return crc32cSSE42;
+    }
+#endif
+    *kernelName = "查表";
+    return crc32cScalar;
+}
 
-    // 持久化相关变量
-    const string DATA_FILE = "filesystem.dat"; // 本地文件名
-    atomic<bool> dataChanged{false};           // 数据是否改变，发生变化自动保存
-    thread autoSaveThreadHandle;               // 自动保存线程
-    thread diskMaintenanceThreadHandle;        // 磁盘维护线程
-    thread syncThreadHandle;                   // 同步监听线程
+static Crc32cKernel crc32cKernel(const char **kernelName = nullptr)
+{
+    static const char *name = nullptr;
+    static const Crc32cKernel kernel = selectCrc32cKernel(&name);
+    if (kernelName)
+        *kernelName = name;
+    return kernel;
+}
 
-    Session currentSession; // 当前会话
+static uint32_t crc32c(const char *data, size_t length, uint32_t crc = 0)
+{
+    return crc32cKernel()(crc, data, length);
+}
+
+// 由前后两段各自的校验值求连接后的校验值（GF(2) 上的矩阵乘方，做法同 zlib 的 crc32_combine），
+// 大段数据可以切块并行计算后按顺序合并
+static uint32_t gf2MatrixTimes(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, ++mat)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
 
-    int *fatBlock = nullptr; // FAT表，记录文件的地址
-    int *bitMap = nullptr;   // 位图，记录文件是否被使用
+static void gf2MatrixSquare(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; ++n)
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+}
 
-    // 检查文件访问权限
-    bool checkFileAccess(Session *session, int fileId, bool needWrite)
+static uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+    if (length2 == 0)
+        return crc1;
+    uint32_t even[32], odd[32];
+    odd[0] = 0x82F63B78U; // 移入一个0位的算子
+    for (int n = 1; n < 32; ++n)
+        odd[n] = 1U << (n - 1);
+    gf2MatrixSquare(even, odd); // 两个0位
+    gf2MatrixSquare(odd, even); // 四个0位
+    // 每轮把算子平方一次，按 length2 的二进制位把 crc1 向后移过 length2 个0字节
+    do
     {
-        if (!session || !sharedData || fileId < 0 || fileId >= MAX_FCBS)
-            return false;
+        gf2MatrixSquare(even, odd);
+        if (length2 & 1)
+            crc1 = gf2MatrixTimes(even, crc1);
+        length2 >>= 1;
+        if (length2 == 0)
+            break;
+        gf2MatrixSquare(odd, even);
+        if (length2 & 1)
+            crc1 = gf2MatrixTimes(odd, crc1);
+        length2 >>= 1;
+    } while (length2);
+    return crc1 ^ crc2;
+}
 
-        FCB &fcb = sharedData->fcbs[fileId];
+// 并行计算文件中各范围的CRC32C：范围切成 DATA_VERIFY_CHUNK 大小的块，至多8个线程各自打开文件读取计算，
+// 再按顺序合并为每个范围的校验值。readable[i] 为 0 表示第 i 个范围没能完整读出；返回使用的线程数
+struct FileRange
+{
+    uint64_t offset, length;
+};
 
-        // 检查文件是否被锁定
-        if (fcb.locked)
+static unsigned checksumFileRanges(const string &path, const vector<FileRange> &ranges, vector<uint32_t> &crcs,
+                                   vector<char> &readable)
+{
+    struct Chunk
+    {
+        size_t range;
+        uint64_t offset, length;
+    };
+    vector<Chunk> chunks;
+    for (size_t k = 0; k < ranges.size(); k++)
+    {
+        for (uint64_t done = 0; done < ranges[k].length; done += DATA_VERIFY_CHUNK)
+            chunks.push_back({k, ranges[k].offset + done, min<uint64_t>(DATA_VERIFY_CHUNK, ranges[k].length - done)});
+    }
+    vector<uint32_t> chunkCrc(chunks.size(), 0);
+    vector<char> chunkRead(chunks.size(), 0);
+    unsigned workers = max(1u, min(8u, thread::hardware_concurrency()));
+    workers = static_cast<unsigned>(max<size_t>(1, min<size_t>(workers, chunks.size())));
+    atomic<size_t> nextChunk{0};
+    auto verifyChunks = [&]()
+    {
+        ifstream in(path, ios::binary);
+        vector<char> buffer(DATA_VERIFY_CHUNK);
+        for (size_t c = nextChunk++; c < chunks.size() && in.is_open(); c = nextChunk++)
         {
-            // 如果是写操作，任何用户都不能修改
-            if (needWrite)
-            {
-                cout << " 错误：文件已被锁定，处于只读状态" << endl;
-                cout << " - 当前锁定者：";
-                for (int i = 0; i < MAX_USERS; i++)
-                {
-                    if (sharedData->users[i].isused &&
-                        sharedData->users[i].userId == fcb.lockOwner)
-                    {
-                        cout << sharedData->users[i].username << endl;
-                        break;
-                    }
-                }
-                return false;
-            }
+            in.seekg(static_cast<streamoff>(chunks[c].offset));
+            if (!in.read(buffer.data(), static_cast<streamsize>(chunks[c].length)))
+                break;
+            chunkCrc[c] = crc32c(buffer.data(), chunks[c].length);
+            chunkRead[c] = 1;
         }
-        return true;
+    };
+    vector<thread> pool;
+    for (unsigned t = 1; t < workers; t++)
+        pool.emplace_back(verifyChunks);
+    verifyChunks();
+    for (thread &worker : pool)
+        worker.join();
+
+    crcs.assign(ranges.size(), 0);
+    readable.assign(ranges.size(), 1);
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        crcs[chunks[c].range] = crc32cCombine(crcs[chunks[c].range], chunkCrc[c], chunks[c].length);
+        readable[chunks[c].range] &= chunkRead[c];
     }
+    return workers;
+}
 
-    // 清理资源
-    void cleanup()
-    {
-        // 设置退出标记
-        shouldExit = true;
-        systemRunning = false;
+// 页式存储文件头和页校验表的校验值，文件头的 checksum 字段按0计算
+static uint32_t storeHeaderChecksum(const StoreHeader &header, const vector<uint32_t> &pageCrcs)
+{
+    StoreHeader head = header;
+    head.checksum = 0;
+    uint32_t crc = crc32c(reinterpret_cast<const char *>(&head), sizeof(head));
+    return crc32c(reinterpret_cast<const char *>(pageCrcs.data()), sizeof(uint32_t) * pageCrcs.size(), crc);
+}
 
-        // 通知所有等待的线程
-        queueCv.notify_all();
+// 本进程的进程号，以及按进程号判断持有者是否仍在运行（用于接手异常退出的进程留下的租约）
+static int currentPid()
+{
+#ifdef _WIN32
+    return static_cast<int>(GetCurrentProcessId());
+#else
+    return static_cast<int>(getpid());
+#endif
+}
 
-        // 等待自动保存线程和磁盘更新线程结束
-        if (autoSaveThreadHandle.joinable())
-        {
-            autoSaveThreadHandle.join();
-        }
-        if (diskMaintenanceThreadHandle.joinable())
-        {
-            diskMaintenanceThreadHandle.join();
-        }
+static bool processAlive(int pid)
+{
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+    if (!process)
+        return false;
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#endif
+}
 
-        // 在退出前保存数据
-        if (sharedData && sharedData->initialized)
-        {
-            saveDataToDisk(false);
-        }
+// 把文件内容刷到磁盘；保存之后才删除的旧日志依赖它确认数据已落盘
+static bool syncFile(const char *path)
+{
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    bool ok = fd != -1 && fsync(fd) == 0;
+    if (fd != -1)
+        close(fd);
+    return ok;
+#endif
+}
 
-        // 不需要删除共享数据，因为它在共享内存中
+// 新建或改名后的文件在目录同步后才能保证崩溃后仍然存在
+static bool syncDirectory()
+{
+#ifdef _WIN32
+    return true;
+#else
+    int fd = open(".", O_RDONLY);
+    bool ok = fd != -1 && fsync(fd) == 0;
+    if (fd != -1)
+        close(fd);
+    return ok;
+#endif
+}
 
-        // 清理 FAT 表和位图
-        delete[] fatBlock;
-        delete[] bitMap;
+// 快照输出：内容直接写入底层文件，同时累计写出的总字节数，以及自 restart 以来的字节数和CRC32C，
+// v3的段头据此在整段写完后回填
+struct ChecksumWriter : streambuf
+{
+    explicit ChecksumWriter(streambuf *sink) : sink(sink) {}
+    void restart()
+    {
+        crc = 0;
+        count = 0;
     }
 
-public:
-    MiniFMS();  // 构造函数
-    ~MiniFMS(); // 析构函数
+    streambuf *sink;
+    uint32_t crc = 0;
+    uint64_t count = 0;
+    uint64_t total = 0;
 
-    // 用户管理
-    bool registerUser(const string &username, const string &password); // 注册用户
-    User *loginUser(const string &username, const string &password);   // 登录用户
-    bool checkUserConflict(const string &username);                    // 检查用户名是否冲突
+protected:
+    streamsize xsputn(const char *data, streamsize length) override
+    {
+        streamsize n = sink->sputn(data, length);
+        crc = crc32c(data, static_cast<size_t>(n), crc);
+        count += static_cast<uint64_t>(n);
+        total += static_cast<uint64_t>(n);
+        return n;
+    }
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        char c = traits_type::to_char_type(ch);
+        return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+    }
+    int sync() override { return sink->pubsync(); }
+};
 
-    // 文件管理
-    int findFCB(int parentDir, const string &name);
-    int createFCB(const string &name, int type, int owner, int parentDir);
-    string getCurrentPath(int fcbId, int userId);
-    string formatTime(time_t t);
+// v2数据文件逐字段写入固定宽度的整数，不依赖结构体的填充和 time_t 的宽度
+template <typename T>
+static void putField(ostream &out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
 
-    // 文件操作
-    void createFile(Session *session, const string &fileName);
-    void deleteFile(Session *session, const string &fileName);
-    void listDirectory(Session *session);
-    void showTree(Session *session);
-    void showTreeRecursive(int fcbId, int depth, int userId);
-    void showFileHead(Session *session, const string &fileName, int numLines);
-    void showFileTail(Session *session, const string &fileName, int numLines);
+template <typename T>
+static bool getField(istream &in, T &value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
 
-    // 用户交互
-    void showWelcome();
-    void showHelp();
-    void userInteractionThread(Session &session); // 用户交互线程
-    void diskMaintenanceThread();                 // 磁盘维护线程
-    void processCommand(CommandRequest &req);     // 处理命令
-    void run();                                   // 运行系统
+// 名称写为1字节长度加内容；读取时长度放不进缓冲区的记录视为损坏
+static void putName(ostream &out, const char *name, size_t capacity)
+{
+    uint8_t length = static_cast<uint8_t>(strnlen(name, capacity - 1));
+    putField(out, length);
+    out.write(name, length);
+}
 
-    // 持久化功能
-    bool saveDataToDisk(bool silent = false); // 保存数据到磁盘
-    bool loadDataFromDisk();                  // 从磁盘加载数据
-    void autoSaveThread();                    // 自动保存线程
+static bool getName(istream &in, char *name, size_t capacity)
+{
+    uint8_t length = 0;
+    if (!getField(in, length) || length >= capacity)
+        return false;
+    memset(name, 0, capacity);
+    return static_cast<bool>(in.read(name, length));
+}
 
-    void findAllFiles(vector<int> &files, int fcbId);
-    void deleteFCB(int fcbId);
+// v2用户记录：userId、用户名、密码、标志位（1 锁定，2 活跃）、登录失败次数、根目录、创建时间
+static void putUserRecord(ostream &out, const User &user)
+{
+    putField<int32_t>(out, user.userId);
+    putName(out, user.username, sizeof(user.username));
+    putName(out, user.password, sizeof(user.password));
+    putField<uint8_t>(out, static_cast<uint8_t>((user.locked ? 1 : 0) | (user.isActive ? 2 : 0)));
+    putField<int32_t>(out, user.loginFailCount);
+    putField<int32_t>(out, user.rootDirId);
+    putField<int64_t>(out, user.createTime);
+}
 
-    // 导入外部文件到文件系统
-    bool importFile(Session *session, const string &externalPath, const string &internalName);
-    // 导出文件到外部文件系统
-    bool exportFile(Session *session, const string &internalName, const string &externalPath);
+static bool getUserRecord(istream &in, User &user)
+{
+    int32_t userId, failCount, rootDirId;
+    uint8_t flags;
+    int64_t createTime;
+    if (!getField(in, userId) || !getName(in, user.username, sizeof(user.username)) ||
+        !getName(in, user.password, sizeof(user.password)) || !getField(in, flags) || !getField(in, failCount) ||
+        !getField(in, rootDirId) || !getField(in, createTime))
+        return false;
+    user.isused = 1;
+    user.userId = userId;
+    user.locked = (flags & 1) != 0;
+    user.isActive = (flags & 2) != 0;
+    user.loginFailCount = failCount;
+    user.rootDirId = rootDirId;
+    user.createTime = static_cast<time_t>(createTime);
+    return true;
+}
 
-    // 进程间通信方法
-    bool initSharedMemory();
-    bool connectToSharedMemory();
-    bool acquireProcessSlot();
-    void releaseProcessSlot();
-    void lockSharedMemory();
-    void unlockSharedMemory();
-    void notifyDataChange();
-    void syncDataChangeThread();
-    void broadcastMessage(const string &message);
-    void showConnectedProcesses();
+// v2 FCB记录：槽位、名称、类型、锁定标志、所有者、锁持有者、父目录和三个时间；大小由内容段给出
+static void putFcbRecord(ostream &out, int slot, const FCB &fcb)
+{
+    putField<int32_t>(out, slot);
+    putName(out, fcb.name, sizeof(fcb.name));
+    putField<uint8_t>(out, static_cast<uint8_t>(fcb.type));
+    putField<uint8_t>(out, fcb.locked ? 1 : 0);
+    putField<int32_t>(out, fcb.owner);
+    putField<int32_t>(out, fcb.lockOwner);
+    putField<int32_t>(out, fcb.parentDir);
+    putField<int64_t>(out, fcb.createTime);
+    putField<int64_t>(out, fcb.modifyTime);
+    putField<int64_t>(out, fcb.accessTime);
+}
 
-    // 通过路径查找FCB
-    int findFCBByPath(Session *session, const string &path);
+static bool getFcbRecord(istream &in, int &slot, FCB &fcb)
+{
+    int32_t slotField, owner, lockOwner, parentDir;
+    uint8_t type, locked;
+    int64_t times[3];
+    if (!getField(in, slotField) || !getName(in, fcb.name, sizeof(fcb.name)) || !getField(in, type) ||
+        !getField(in, locked) || !getField(in, owner) || !getField(in, lockOwner) || !getField(in, parentDir) ||
+        !getField(in, times[0]) || !getField(in, times[1]) || !getField(in, times[2]) || type > 1)
+        return false;
+    slot = slotField;
+    fcb.isused = 1;
+    fcb.type = type;
+    fcb.locked = locked != 0;
+    fcb.owner = owner;
+    fcb.lockOwner = lockOwner;
+    fcb.parentDir = parentDir;
+    fcb.createTime = static_cast<time_t>(times[0]);
+    fcb.modifyTime = static_cast<time_t>(times[1]);
+    fcb.accessTime = static_cast<time_t>(times[2]);
+    return true;
+}
 
-private:
-    // 进程间通信相关
-    int currentProcessId = -1;
-    atomic<int> lastKnownChangeId{0};
-    string processName;
-};
+// 名称哈希函数（FNV-1a）
+static inline unsigned int hashName(const char *name)
+{
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = reinterpret_cast<const unsigned char *>(name); *p; ++p)
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-// 构造函数和析构函数定义
-MiniFMS::MiniFMS()
+// 目录项哈希函数（混入父目录ID）
+static inline unsigned int hashDirEntry(int parentDir, const char *name)
 {
-    // 生成进程名称
-    auto now = chrono::system_clock::now();
-    auto time_t = chrono::system_clock::to_time_t(now);
-#ifdef _WIN32
-    processName = "MiniFMS_" + to_string(time_t) + "_" + to_string(GetCurrentProcessId());
-#else
-    processName = "MiniFMS_" + to_string(time_t) + "_" + to_string(getpid());
-#endif
+    unsigned int h = hashName(name);
+    h ^= static_cast<unsigned int>(parentDir) * 0x9E3779B1u;
+    h ^= h >> 16;
+    return h & (DIR_HASH_SIZE - 1);
+}
 
-    // 初始化 FAT 表和位图
-    fatBlock = new int[MAX_BLOCKS];
-    bitMap = new int[MAX_BLOCKS];
-    memset(fatBlock, 0, sizeof(int) * MAX_BLOCKS);
-    memset(bitMap, 0, sizeof(int) * MAX_BLOCKS);
+// 文件名子串搜索内核：在定长 MAX_FILENAME_LEN 字节的 FCB.name 中查找 pat
+typedef bool (*NameSearchKernel)(const char *name, const char *pat, size_t patLen);
 
-    // 尝试连接到共享内存，如果失败则创建新的
-    if (!connectToSharedMemory())
+static bool nameContainsScalar(const char *name, const char *pat, size_t patLen)
+{
+    size_t nameLen = strnlen(name, MAX_FILENAME_LEN);
+    for (size_t i = 0; i + patLen <= nameLen; ++i)
     {
-        if (!initSharedMemory())
-        {
-            throw runtime_error("无法初始化共享内存");
-        }
+        if (name[i] == pat[0] && memcmp(name + i, pat, patLen) == 0)
+            return true;
     }
+    return false;
+}
 
-    // 获取进程槽位
-    if (!acquireProcessSlot())
-    {
-        throw runtime_error("无法获取进程槽位，系统已满");
-    }
+#ifdef MINIFMS_X86_SIMD
+// 由首字节、末字节和结束符三个位掩码求出候选起点，再逐个精确比较
+static inline bool nameMatchFromMasks(uint64_t firstMask, uint64_t lastMask, uint64_t nulMask,
+                                      const char *name, const char *pat, size_t patLen)
+{
+    size_t nameLen = nulMask ? static_cast<size_t>(__builtin_ctzll(nulMask)) : MAX_FILENAME_LEN;
+    if (patLen > nameLen)
+        return false;
 
-    // 如果是第一个进程，初始化文件系统
-    if (sharedData->processCount == 1 && !sharedData->initialized)
-    {
-        // 尝试从磁盘加载数据
-        if (!loadDataFromDisk())
-        {
-            cout << "初始化新的文件系统..." << endl;
-            // 初始化根目录
-            FCB &rootFcb = sharedData->fcbs[0];
-            rootFcb.isused = 1;
-            strcpy(rootFcb.name, "/");
-            rootFcb.type = 1;
-            rootFcb.owner = 0;
-            rootFcb.createTime = rootFcb.modifyTime = rootFcb.accessTime = time(nullptr);
-            rootFcb.parentDir = -1;
-            sharedData->nextFcbId = 1;
-            sharedData->initialized = true;
+    uint64_t candidates = firstMask & (lastMask >> (patLen - 1));
+    size_t span = nameLen - patLen + 1; // 合法起点个数
+    if (span < 64)
+        candidates &= (1ULL << span) - 1;
 
-            // 为根目录分配第一个数据块
-            bitMap[0] = 1;
-            fatBlock[0] = -1; // 标记为链表结束
-        }
-        else
-        {
-            cout << "从磁盘加载文件系统数据成功!" << endl;
-        }
-    }
-    else if (sharedData->initialized)
+    while (candidates)
     {
-        cout << "连接到现有文件系统 (进程数: " << sharedData->processCount.load() << ")" << endl;
+        int i = __builtin_ctzll(candidates);
+        if (memcmp(name + i, pat, patLen) == 0)
+            return true;
+        candidates &= candidates - 1;
     }
-
-    // 启动同步监听线程
-    syncThreadHandle = thread(&MiniFMS::syncDataChangeThread, this);
+    return false;
 }
 
-MiniFMS::~MiniFMS()
+__attribute__((target("sse2"))) static bool nameContainsSSE2(const char *name, const char *pat, size_t patLen)
 {
-    // 释放进程槽位
-    releaseProcessSlot();
-
-    // 清理资源
-    delete[] fatBlock;
-    delete[] bitMap;
-    cleanup();
-
-    // 清理同步线程
-    if (syncThreadHandle.joinable())
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last = _mm_set1_epi8(pat[patLen - 1]);
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t firstMask = 0, lastMask = 0, nulMask = 0;
+    for (int k = 0; k < MAX_FILENAME_LEN / 16; ++k)
     {
-        syncThreadHandle.join();
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(name + 16 * k));
+        firstMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, first)))) << (16 * k);
+        lastMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, last)))) << (16 * k);
+        nulMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)))) << (16 * k);
     }
+    return nameMatchFromMasks(firstMask, lastMask, nulMask, name, pat, patLen);
+}
 
-#ifdef _WIN32
-    if (hChangeEvent)
-        CloseHandle(hChangeEvent);
-    if (hMutex)
-        CloseHandle(hMutex);
-    if (sharedData)
-        UnmapViewOfFile(sharedData);
-    if (hMapFile)
-        CloseHandle(hMapFile);
-#else
-    if (changeEvent)
+__attribute__((target("avx2"))) static bool nameContainsAVX2(const char *name, const char *pat, size_t patLen)
+{
+    const __m256i first = _mm256_set1_epi8(pat[0]);
+    const __m256i last = _mm256_set1_epi8(pat[patLen - 1]);
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t firstMask = 0, lastMask = 0, nulMask = 0;
+    for (int k = 0; k < MAX_FILENAME_LEN / 32; ++k)
     {
-        sem_close(changeEvent);
-        sem_unlink((CHANGE_EVENT_NAME + processName).c_str());
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(name + 32 * k));
+        firstMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, first)))) << (32 * k);
+        lastMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, last)))) << (32 * k);
+        nulMask |= static_cast<uint64_t>(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero)))) << (32 * k);
     }
-    if (mutex)
+    return nameMatchFromMasks(firstMask, lastMask, nulMask, name, pat, patLen);
+}
+#endif
+
+// 按CPU能力选择搜索内核（只在首次使用时检测一次）
+static NameSearchKernel selectNameSearchKernel(const char **kernelName)
+{
+#ifdef MINIFMS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
     {
-        sem_close(mutex);
-        sem_unlink(SHARED_MUTEX_NAME);
+        *kernelName = "AVX2";
+        return nameContainsAVX2;
     }
-    if (sharedData)
-        munmap(sharedData, SHARED_MEMORY_SIZE);
-    if (shmFd >= 0)
+    if (__builtin_cpu_supports("sse2"))
     {
-        close(shmFd);
-        shm_unlink(SHARED_MEMORY_NAME);
+        *kernelName = "SSE2";
+        return nameContainsSSE2;
     }
 #endif
+    *kernelName = "标量";
+    return nameContainsScalar;
 }
 
-int MiniFMS::findFCB(int parentDir, const string &name)
+// 通配符匹配：支持 * ? [abc] [a-z] [!abc]
+static bool globMatch(const char *pat, const char *str)
 {
-    if (!sharedData || parentDir < 0 || parentDir >= MAX_FCBS)
-        return -1;
-
-    for (int i = 0; i < MAX_FCBS; ++i)
+    const char *starPat = nullptr, *starStr = nullptr;
+    while (*str)
     {
-        if (sharedData->fcbs[i].isused &&
-            sharedData->fcbs[i].parentDir == parentDir &&
-            strcmp(sharedData->fcbs[i].name, name.c_str()) == 0)
+        bool matched = false;
+        const char *nextPat = pat + 1;
+        if (*pat == '[')
         {
-            return i;
+            const char *p = pat + 1;
+            bool negate = *p == '!';
+            if (negate)
+                p++;
+            bool inClass = false;
+            const char *classStart = p; // 紧跟在 [ 或 [! 之后的 ] 是普通成员
+            while (*p && (*p != ']' || p == classStart))
+            {
+                if (p[1] == '-' && p[2] && p[2] != ']')
+                {
+                    if (static_cast<unsigned char>(*str) >= static_cast<unsigned char>(p[0]) &&
+                        static_cast<unsigned char>(*str) <= static_cast<unsigned char>(p[2]))
+                        inClass = true;
+                    p += 3;
+                }
+                else
+                {
+                    if (*p == *str)
+                        inClass = true;
+                    p++;
+                }
+            }
+            if (*p == ']')
+            {
+                matched = inClass != negate;
+                nextPat = p + 1;
+            }
+            else
+            {
+                matched = *str == '['; // 未闭合的 [ 按普通字符处理
+            }
+        }
+        else if (*pat == '*')
+        {
+            starPat = pat++;
+            starStr = str;
+            continue;
+        }
+        else if (*pat)
+        {
+            matched = *pat == '?' || *pat == *str;
+        }
+
+        if (matched)
+        {
+            pat = nextPat;
+            str++;
+        }
+        else if (starPat)
+        {
+            pat = starPat + 1;
+            str = ++starStr;
+        }
+        else
+        {
+            return false;
         }
     }
-    return -1;
+    while (*pat == '*')
+        pat++;
+    return *pat == '\0';
 }
 
-int MiniFMS::createFCB(const string &name, int type, int owner, int parentDir)
+// 取出通配符模式中最长的一段普通字符，用于SIMD预筛选
+static string longestGlobLiteral(const string &pattern)
 {
-    if (!sharedData)
-        return -1;
-
-    lock_guard<mutex> lock(diskMutex);
-
-    int fcbId = -1;
-    for (int i = sharedData->nextFcbId; i < MAX_FCBS; ++i)
+    string best, current;
+    for (size_t i = 0; i < pattern.length(); ++i)
     {
-        if (!sharedData->fcbs[i].isused)
+        char c = pattern[i];
+        if (c == '*' || c == '?' || c == '[')
         {
-            fcbId = i;
-            break;
+            if (current.length() > best.length())
+                best = current;
+            current.clear();
+            if (c == '[')
+            {
+                size_t from = i + 1;
+                if (from < pattern.length() && pattern[from] == '!')
+                    from++;
+                size_t close = pattern.find(']', from + 1);
+                if (close != string::npos)
+                    i = close;
+            }
+        }
+        else
+        {
+            current += c;
         }
     }
+    return current.length() > best.length() ? current : best;
+}
 
-    if (fcbId == -1)
-        return -1;
-
-    FCB &fcb = sharedData->fcbs[fcbId];
-    fcb.isused = 1;
-    strncpy(fcb.name, name.c_str(), MAX_FILENAME_LEN - 1);
-    fcb.type = type;
-    fcb.owner = owner;
-    fcb.size = 0;
-    fcb.createTime = fcb.modifyTime = fcb.accessTime = time(nullptr);
-    fcb.locked = false;
-    fcb.lockOwner = -1;
-    fcb.parentDir = parentDir;
-    fcb.address = fcbId;
-
-    if (type == 0)
-    {
-        memset(sharedData->fileContents[fcbId], 0, sizeof(sharedData->fileContents[fcbId]));
-    }
-
-    sharedData->nextFcbId = fcbId + 1;
-    sharedData->modifyCount++;
-    dataChanged = true;
-    notifyDataChange();
+// 块压缩编解码器：LZ77，序列格式为 [令牌][字面量长度扩展][字面量][偏移(2字节)][匹配长度扩展]，
+// 令牌高4位是字面量长度、低4位是匹配长度减4，取值15时后跟255累加的扩展字节；最后一个序列只有字面量
+static const int LZ_HASH_BITS = 13;
+static const size_t LZ_MIN_MATCH = 4;
 
-    return fcbId;
+static inline uint32_t lzRead32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-bool MiniFMS::registerUser(const string &username, const string &password)
+// 压缩 n 字节（n 不超过64KB），输出超过 cap 时返回0
+static size_t lzCompress(const char *src, size_t n, char *dst, size_t cap)
 {
-    if (!sharedData)
-        return false;
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+    unsigned char *out = reinterpret_cast<unsigned char *>(dst);
+    int table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table)); // 存放位置 + 1，0 表示空
+    size_t ip = 0, anchor = 0, op = 0;
 
-    if (checkUserConflict(username))
+    auto putLength = [&](size_t len)
     {
-        cout << "用户名已存在!" << endl;
-        return false;
-    }
-
-    lock_guard<mutex> lock(diskMutex);
+        while (len >= 255)
+        {
+            out[op++] = 255;
+            len -= 255;
+        }
+        out[op++] = static_cast<unsigned char>(len);
+    };
+    auto emit = [&](size_t literals, size_t offset, size_t matchLength)
+    {
+        // 最坏情况：令牌 + 两段长度扩展 + 字面量 + 偏移
+        if (op + 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1 > cap)
+            return false;
+        size_t matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+        out[op++] = static_cast<unsigned char>((min<size_t>(literals, 15) << 4) | min<size_t>(matchCode, 15));
+        if (literals >= 15)
+            putLength(literals - 15);
+        memcpy(out + op, in + anchor, literals);
+        op += literals;
+        if (matchLength)
+        {
+            out[op++] = static_cast<unsigned char>(offset & 0xFF);
+            out[op++] = static_cast<unsigned char>(offset >> 8);
+            if (matchCode >= 15)
+                putLength(matchCode - 15);
+        }
+        return true;
+    };
 
-    int userId = -1;
-    for (int i = 0; i < MAX_USERS; i++)
+    while (ip + LZ_MIN_MATCH <= n)
     {
-        if (!sharedData->users[i].isused)
+        uint32_t v = lzRead32(in + ip);
+        uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h] - 1;
+        table[h] = static_cast<int>(ip) + 1;
+        if (ref < 0 || ip - ref > 65535 || lzRead32(in + ref) != v)
         {
-            userId = i;
-            break;
+            // 长时间找不到匹配时加大步长，不可压缩的数据很快扫过
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
         }
+        size_t length = LZ_MIN_MATCH;
+        while (ip + length < n && in[ref + length] == in[ip + length])
+            length++;
+        if (!emit(ip - anchor, ip - ref, length))
+            return 0;
+        ip += length;
+        anchor = ip;
     }
+    if (!emit(n - anchor, 0, 0))
+        return 0;
+    return op;
+}
 
-    if (userId == -1)
+// 解压到 dst，返回输出字节数；数据损坏或超出 cap 时返回 SIZE_MAX
+static size_t lzDecompress(const char *src, size_t n, char *dst, size_t cap)
+{
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+    unsigned char *out = reinterpret_cast<unsigned char *>(dst);
+    size_t ip = 0, op = 0;
+
+    auto getLength = [&](size_t &len)
     {
-        cout << "用户数量已达上限!" << endl;
-        return false;
-    }
+        unsigned char b;
+        do
+        {
+            if (ip >= n)
+                return false;
+            b = in[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
 
-    User &user = sharedData->users[userId];
-    user.isused = 1;
-    user.userId = sharedData->nextUserId++;
-    strncpy(user.username, username.c_str(), sizeof(user.username) - 1);
-    strncpy(user.password, password.c_str(), sizeof(user.password) - 1);
-    user.locked = false;
-    user.loginFailCount = 0;
-    user.createTime = time(nullptr);
-
-    int rootDirId = createFCB(username, 1, user.userId, 0);
-    if (rootDirId == -1)
-    {
-        user.isused = 0;
-        cout << "创建用户目录失败!" << endl;
-        return false;
-    }
-
-    user.rootDirId = rootDirId;
-    cout << "用户注册成功!" << endl;
-
-    // 立即保存数据到磁盘
-    sharedData->modifyCount++;
-    dataChanged = true;
-    notifyDataChange();
-    if (saveDataToDisk(true))
-    {
-        cout << "用户数据已保存到磁盘" << endl;
-    }
-    else
+    while (ip < n)
     {
-        cout << "警告：用户数据保存失败，请尽快手动保存！" << endl;
-    }
-
-    return true;
-}
-
-bool MiniFMS::checkUserConflict(const string &username)
-{
-    if (!sharedData)
-        return false;
+        unsigned char token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(literals))
+            return SIZE_MAX;
+        if (literals > n - ip || literals > cap - op)
+            return SIZE_MAX;
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == n)
+            break;
 
-    for (int i = 0; i < MAX_USERS; ++i)
-    {
-        if (sharedData->users[i].isused &&
-            strcmp(sharedData->users[i].username, username.c_str()) == 0)
+        if (n - ip < 2)
+            return SIZE_MAX;
+        size_t offset = in[ip] | (static_cast<size_t>(in[ip + 1]) << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !getLength(length))
+            return SIZE_MAX;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || length > cap - op)
+            return SIZE_MAX;
+        // 匹配与输出重叠（offset < length）时只能逐字节复制
+        if (offset >= length)
         {
-            return true;
+            memcpy(out + op, out + op - offset, length);
+            op += length;
         }
-    }
-    return false;
-}
-
-User *MiniFMS::loginUser(const string &username, const string &password)
-{
-    if (!sharedData)
-        return nullptr;
-
-    for (int i = 0; i < MAX_USERS; ++i)
-    {
-        User &user = sharedData->users[i];
-        if (user.isused && strcmp(user.username, username.c_str()) == 0)
+        else
         {
-            if (user.locked)
-            {
-                cout << "账号已锁定!" << endl;
-                return nullptr;
-            }
-
-            if (strcmp(user.password, password.c_str()) == 0)
-            {
-                user.loginFailCount = 0;
-                user.isActive = true;
-                cout << "登录成功!" << endl;
-                showWelcome();
-                return &user;
-            }
-            else
-            {
-                user.loginFailCount++;
-                cout << "密码错误!" << endl;
-                if (user.loginFailCount >= 3)
-                {
-                    user.locked = true;
-                    cout << "账号已锁定!" << endl;
-                }
-                return nullptr;
-            }
+            for (size_t i = 0; i < length; ++i, ++op)
+                out[op] = out[op - offset];
         }
     }
-
-    cout << "用户不存在!" << endl;
-    return nullptr;
+    return op;
 }
 
-string MiniFMS::getCurrentPath(int fcbId, int userId)
+// 会话结构体
+struct Session
 {
-    if (!sharedData || fcbId <= 0 || fcbId >= MAX_FCBS)
-        return "/";
+    User *user = nullptr;
+    int currentDirId = 0;
+    bool active = false;
+    vector<FileDesc> openFiles;
 
-    vector<string> pathParts;
-    int current = fcbId;
+    // 当前路径缓存：cd 时增量维护，目录结构版本号变化后重新计算
+    string currentPath = "/";
+    int pathDirId = -1; // currentPath 对应的目录ID
+    int pathGen = -1;   // 计算 currentPath 时的目录结构版本号
 
-    int userRootId = 0;
-    for (int i = 0; i < MAX_USERS; ++i)
+    int addOpenFile(int fcbId, int mode)
     {
-        if (sharedData->users[i].isused && sharedData->users[i].userId == userId)
+        for (size_t i = 0; i < openFiles.size(); ++i)
         {
-            userRootId = sharedData->users[i].rootDirId;
-            break;
+            if (!openFiles[i].isOpen)
+            {
+                openFiles[i] = FileDesc(fcbId, user->userId, mode);
+                return static_cast<int>(i);
+            }
         }
+        openFiles.push_back(FileDesc(fcbId, user->userId, mode));
+        return static_cast<int>(openFiles.size() - 1);
     }
 
-    while (current != 0 && current != userRootId && current != -1)
-    {
-        if (current >= MAX_FCBS || !sharedData->fcbs[current].isused)
-            break;
-        pathParts.push_back(string(sharedData->fcbs[current].name));
-        current = sharedData->fcbs[current].parentDir;
-    }
-
-    if (pathParts.empty())
-    {
-        return "/";
-    }
-
-    string path = "/";
-    for (auto it = pathParts.rbegin(); it != pathParts.rend(); ++it)
+    bool closeFile(int fd)
     {
-        path += *it;
-        if (it + 1 != pathParts.rend())
+        if (fd >= 0 && fd < static_cast<int>(openFiles.size()) && openFiles[fd].isOpen)
         {
-            path += "/";
+            openFiles[fd].isOpen = false;
+            return true;
         }
+        return false;
     }
-    return path;
-}
+};
 
-string MiniFMS::formatTime(time_t t)
+// 命令请求结构体
+struct CommandRequest
 {
-    char buffer[80];
-    struct tm *timeinfo = localtime(&t);
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-    return string(buffer);
-}
+    Session *session;
+    string commandLine;
 
-void MiniFMS::showWelcome()
+    CommandRequest() = default;
+    CommandRequest(Session *s, const string &cmd) : session(s), commandLine(cmd) {}
+};
+
+// dir 命令的列表选项
+struct DirListOptions
 {
-    cout << "\n╔══════════════════════════════════════╗" << endl;
-    cout << "║        Welcome to MiniFMS " << VERSION << "         ║" << endl;
-    cout << "║     Advanced File System Pro        ║" << endl;
-    cout << "║     Type 'help' for commands        ║" << endl;
-    cout << "╚══════════════════════════════════════╝" << endl
-         << endl;
-}
+    string prefix;    // 只列出以此为前缀的名称
+    string after;     // 分页游标：从该名称之后开始列出；按大小/时间排序时为“排序值:名称”
+    size_t limit = 0; // 最多列出的条目数，0 表示不限
+    int sortKey = 0;  // 0=名称，1=大小（从大到小），2=修改时间（从新到旧）
+};
 
-void MiniFMS::showHelp()
+// MiniFMS主类
+class MiniFMS
 {
-    cout << "\n═══════════════ 命令列表 ═══════════════\n"
-         << endl;
-    cout << " 目录操作:" << endl;
-    cout << "  cd [目录名]          切换目录 (.. 返回上级)" << endl;
-    cout << "  dir                 显示当前目录内容" << endl;
-    cout << "  mkdir [目录名]       创建目录" << endl;
-    cout << "  rmdir [目录名]       删除空目录" << endl;
+private:
+    SharedData *sharedData = nullptr; // 共享数据（用户、文件、文件内容）
+    atomic<bool> systemRunning{true}; // 系统运行标志，true运行，false退出
+    atomic<bool> shouldExit{false};   // 退出标志，true退出，false运行
 
-    cout << "\n 文件操作:" << endl;
-    cout << "  create [文件名]      创建文件" << endl;
-    cout << "  delete [文件名]      删除文件" << endl;
-    cout << "  open [文件名] [模式] 打开文件 (r/w/rw)" << endl;
-    cout << "  close [文件描述符]   关闭文件" << endl;
-    cout << "  read [文件描述符]    读取文件" << endl;
-    cout << "  write [文件描述符]   写入文件" << endl;
-    cout << "  copy [源] [目标]     复制文件" << endl;
-    cout << "  move [源] [目标]     移动文件" << endl;
-    cout << "  flock [文件名]       加锁/解锁文件" << endl;
-    cout << "  head -num [文件名]   显示文件前num行" << endl;
-    cout << "  tail -num [文件名]   显示文件后num行" << endl;
-    cout << "  lseek [文件描述符] [偏移量] 移动文件指针" << endl;
+#ifdef _WIN32
+    HANDLE hMapFile = nullptr;
+    HANDLE hMutex = nullptr;
+    HANDLE hChangeEvent = nullptr;
+#else
+    int shmFd = -1;
+    int imageFd = -1; // 映像模式下映射的 filesystem.img，持有其共享锁
+    int walFd = -1;   // 本进程打开的日志文件，walFdGeneration 落后于共享段时重新打开
+    int walFdGeneration = -1;
+    sem_t *shmMutex = nullptr;
+    sem_t *changeEvent = nullptr;
+#endif
+    bool imageMapped = false;        // 共享段是否为映像文件的映射
+    uint64_t walPending = 0;         // 本进程最后一条日志记录的结束位置，命令结束前等待它落盘
+    bool walCheckpointNeeded = true; // 开始新日志前需要先保存（重放过记录或页式存储中没有日志标识）
+    vector<char> walBuffer;          // 记录头与数据拼接后一次写入（在共享内存锁内使用）
 
-    cout << "\n 导入导出:" << endl;
-    cout << "  import [外部路径] [系统内文件名]  导入外部文件" << endl;
-    cout << "  export [系统内文件名] [外部路径]  导出文件到外部" << endl;
+    queue<CommandRequest> commandQueue; // 命令队列
+    mutex queueMutex;                   // 命令队列互斥锁
+    condition_variable queueCv;         // 命令队列条件变量
+    mutex diskMutex;                    // 本地文件互斥锁
+    mutex saveMutex;                    // 本进程同一时间只执行一次保存；写文件期间不持有 diskMutex
+    bool ready = false;                 // 是否就绪判断
 
-    cout << "\n 系统功能:" << endl;
-    cout << "  tree                显示目录树" << endl;
-    cout << "  save                手动保存数据到磁盘" << endl;
-    cout << "  processes/ps        显示连接的进程" << endl;
-    cout << "  help                显示本帮助" << endl;
-    cout << "  exit                退出系统" << endl;
-    cout << "\n═══════════════════════════════════════\n"
-         << endl;
-}
+    // 持久化相关变量
+    const string DATA_FILE = "filesystem.dat"; // 本地文件名
+    atomic<bool> dataChanged{false};           // 数据是否改变，发生变化自动保存
+    thread autoSaveThreadHandle;               // 自动保存线程
+    thread diskMaintenanceThreadHandle;        // 磁盘维护线程
+    thread syncThreadHandle;                   // 同步监听线程
 
-void MiniFMS::createFile(Session *session, const string &fileName)
-{
-    if (!session || !sharedData)
-        return;
+    Session currentSession; // 当前会话
 
-    if (findFCB(session->currentDirId, fileName) != -1)
+    // 检查文件访问权限
+    bool checkFileAccess(Session *session, int fileId, bool needWrite)
     {
-        cout << "文件已存在: " << fileName << endl;
-        return;
+        if (!session || !sharedData || fileId < 0 || fileId >= MAX_FCBS)
+            return false;
+
+        FCB &fcb = sharedData->fcbs[fileId];
+
+        // 检查文件是否被锁定
+        if (fcb.locked)
+        {
+            // 如果是写操作，任何用户都不能修改
+            if (needWrite)
+            {
+                cout << " 错误：文件已被锁定，处于只读状态" << endl;
+                cout << " - 当前锁定者：";
+                if (User *owner = findUserById(fcb.lockOwner))
+                {
+                    cout << owner->username << endl;
+                }
+                return false;
+            }
+        }
+        return true;
     }
 
-    int newFileId = createFCB(fileName, 0, session->user->userId, session->currentDirId);
-    if (newFileId != -1)
+    // 目录项索引维护（调用者需持有共享内存锁）
+    void dirHashInsert(int fcbId);
+    void dirHashRemove(int fcbId);
+    void rebuildDirHash();
+
+    // 目录子项链表维护（调用者需持有共享内存锁）
+    void linkChild(int fcbId);
+    void unlinkChild(int fcbId);
+    void rebuildDirLinks();
+
+    // 有序目录索引维护（调用者需持有共享内存锁）
+    int nameIndexLowerBound(int parentDir, const char *name);
+    void nameIndexInsert(int fcbId);
+    void nameIndexRemove(int fcbId);
+    void rebuildNameIndex();
+
+    // FCB空闲栈维护（调用者需持有共享内存锁）
+    int allocFcbSlot();
+    void freeFcbSlot(int fcbId);
+    void rebuildFreeFcbList();
+
+    // 释放FCB槽位并同步维护索引
+    void releaseFCB(int fcbId);
+
+    // 子树汇总维护：沿父目录链向上累加（调用者需持有共享内存锁）
+    void adjustAggregates(int dirId, long long deltaBytes, int deltaFiles);
+    void subtreeTotals(int fcbId, long long &bytes, int &files);
+    void applyFileSize(int fcbId, size_t newSize); // 更新文件大小并同步子树汇总（调用者需持有共享内存锁）
+
+    // 块存储：分配/释放连续块和文件区段（调用者需持有共享内存锁）
+    bool blockInUse(int blockId) const { return (sharedData->bitMap[blockId / 64] >> (blockId % 64)) & 1; }
+    int findFreeBlock(int from);
+    int allocRun(int goal, int wanted, int &got);
+    void freeRun(int startBlock, int count);
+    void releaseBlocks(int startBlock, int count); // 引用计数减一，归零的块归还块池
+    bool discardBlocks(int startBlock, int count); // 释放块对应的物理页，成功后这些块读出为0
+    int extentUpperBound(int fcbId, int fileBlock);
+    int findExtent(int fcbId, int fileBlock);
+    void insertExtent(int fcbId, int fileBlock, int startBlock, int blockCount);
+    bool mapFileBlocks(int fcbId, int firstBlock, int lastBlock);
+    void freeFileExtents(int fcbId);
+    void unmapFileBlocks(int fcbId, int firstBlock, int lastBlock); // 范围内的逻辑块变为空洞
+    bool shareFileBlocks(int srcId, int srcBlock, int dstId, int dstBlock, int count);
+    bool unshareFileBlocks(int fcbId, int firstBlock, int lastBlock); // 写入前为共享块复制出私有块
+    void invalidateBlockHashes(int startBlock, int count) // 块内容改变，指纹缓存和校验值失效，块记入增量保存
     {
-        cout << "文件创建成功: " << fileName << endl;
+        for (int b = startBlock; b < startBlock + count; ++b)
+        {
+            sharedData->hashValid[b / 64] &= ~(1ULL << (b % 64));
+            sharedData->crcValid[b / 64] &= ~(1ULL << (b % 64));
+        }
+        markBlocksDirty(startBlock, count);
     }
-    else
+    void sealBlock(int block) // 记录块当前内容的校验值（调用者需持有锁）
     {
-        cout << "文件创建失败" << endl;
+        sharedData->blockCrc[block] = crc32c(sharedData->blockPool[block], BLOCK_SIZE);
+        sharedData->crcValid[block / 64] |= 1ULL << (block % 64);
     }
-}
-
-void MiniFMS::deleteFile(Session *session, const string &fileName)
-{
-    if (!session || !sharedData)
-        return;
-
-    int fileId = findFCB(session->currentDirId, fileName);
-    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    int findFrame(int fcbId, int frame); // 第一个键不小于 (fcbId, frame) 的帧位置
+    bool decodeFrame(const Frame &f, char *raw); // 解压一帧到 FRAME_SIZE 字节的缓冲区
+    bool storeFrame(int fcbId, int frame, const char *raw, int rawLength); // 压缩并替换一帧
+    void freeFileFrames(int fcbId);
+    bool copyIntoFrames(int fcbId, size_t offset, const char *data, size_t length);
+    uint64_t blockFingerprint(int block); // 读取或计算块内容指纹
+    void dedupBlock(int fcbId, int fileBlock, int block);
+    void resetDedupTable();
+    bool promoteInlineFile(int fcbId); // 内联文件迁移到数据块
+    size_t forEachSpan(int fcbId, size_t offset, size_t length, const SpanVisitor &visitor);
+    size_t forEachSpan(const FileLayout &layout, size_t offset, size_t length, const SpanVisitor &visitor);
+    size_t copyFromFile(int fcbId, size_t offset, size_t length, char *out);
+    bool copyIntoFile(int fcbId, size_t offset, const char *data, size_t length);
+
+    // 文件内容读写（内部加锁）：写入失败表示块池空间不足，文件保持不变
+    size_t readFileRange(int fcbId, size_t offset, size_t length, char *out);
+    bool writeFileRange(int fcbId, size_t offset, const char *data, size_t length);
+    bool insertFileData(int fcbId, size_t offset, const string &data);
+    bool shiftFileTail(int fcbId, size_t offset, size_t gap); // 插入点之后的内容后移 gap 字节（调用者需持有锁）
+    vector<pair<size_t, size_t>> fileDataRanges(int fcbId, size_t from); // 已分配数据的 (偏移, 长度) 列表（调用者需持有锁）
+    size_t visitFileData(int fcbId, size_t offset, size_t length, const SpanVisitor &visitor); // 分段复制出锁后回调
+    bool copyFileData(int srcId, int dstId); // 与源文件共享数据块（写时复制），空洞保持为空洞
+    bool shareFileData(int srcId, int dstId); // copyFileData 的实现（调用者需持有共享内存锁）
+    vector<SharedRun> collectSharedRuns();   // 保存时每个共享块只写一次内容，其余引用记录为共享段（调用者需持有锁）
+    int dedupStep(int budget);               // 去重扫描前进至多 budget 个逻辑块，返回实际检查数（内部加锁）
+    bool setFileCompression(int fcbId, bool compressed); // 在压缩/普通存储之间转换（内部加锁）
+    void showFileStorage(int fcbId, const string &name);
+    void showDedupStats();
+    void startScrub();           // verify：从块池开头开始一轮后台校验
+    int scrubStep(int budget);   // 后台校验前进至多 budget 个已分配块，返回实际检查数（内部加锁）
+    long long countReferenceErrors(bool allocated = true); // 区段表、帧表、父目录和用户根目录中越界或归属错误的引用数；
+                                                           // allocated 为 false 时位图尚未重建，只检查块号范围（调用者需持有锁）
+    void showScrubStatus();
+
+    // 在线整理（前六个调用者需持有共享内存锁）
+    void defragFcbOrder(vector<int> &order);                           // 目标FCB顺序：从根目录按层遍历，子项按名称相邻
+    void defragBlockOrder(const vector<int> &order, vector<int> &blocks); // 目标块顺序：按FCB顺序，文件内按逻辑顺序
+    bool fcbRelocationAllowed();                                       // 其他进程都已应用上一批重定位且空闲
+    void relocateFcbs(const vector<int> &to);                          // 按 to[旧ID] = 新ID 重排槽位并发布重定位表
+    bool relocateBlocks(const vector<int> &content, const vector<int> &newPos, // 块 s 改存原来位于 content[s] 的内容，newPos 为其逆置换；
+                        const vector<int> &moved);                             // moved 列出所有 content[s] != s 的 s（可有重复）
+    void applyRelocation();                                 // 修正本进程持有的FCB ID
+    int defragStep(int budget, bool &blocked);              // 整理前进至多 budget 次移动，返回实际移动数（内部加锁）
+    void showDefragStats();
+    size_t countFileLines(int fcbId);
+    vector<string> readFileLines(int fcbId, size_t firstLine, size_t maxLines);
+
+    // 增量保存的脏页记录：修改落盘的记录后调用（调用者需持有共享内存锁）
+    void markStoreDirty(const void *data, size_t length);
+    void markFcbDirty(int fcbId) // FCB记录及其内联内容、存储方式
     {
-        cout << "文件不存在: " << fileName << endl;
-        return;
+        markStoreDirty(&sharedData->fcbs[fcbId], sizeof(FCB));
+        markStoreDirty(&sharedData->fileInline[fcbId], 1);
+        markStoreDirty(sharedData->inlineData[fcbId], INLINE_DATA_SIZE);
+        markStoreDirty(&sharedData->fileCompressed[fcbId], 1);
     }
-
-    // 检查文件访问权限
-    if (!checkFileAccess(session, fileId, true))
+    void markUserDirty(int slot) { markStoreDirty(&sharedData->users[slot], sizeof(User)); }
+    void markBlocksDirty(int startBlock, int count)
     {
-        return;
+        markStoreDirty(sharedData->blockPool[startBlock], static_cast<size_t>(count) * BLOCK_SIZE);
     }
-
-    // 检查文件是否被打开
-    for (const auto &openFile : session->openFiles)
+    void markExtentsDirty(int from) // 区段表从 from 起的部分（插入删除使其后的表项整体移动）
     {
-        if (openFile.isOpen && openFile.fcbId == fileId)
+        markStoreDirty(sharedData->extents + from, sizeof(Extent) * max(0, sharedData->extentCount - from));
+    }
+    void markFramesDirty(int from)
+    {
+        markStoreDirty(sharedData->frames + from, sizeof(Frame) * max(0, sharedData->frameCount - from));
+    }
+    template <typename T>
+    void markChangedRecords(const vector<T> &before, const T *now, int count) // 整表重写后只记录内容变化的表项
+    {
+        for (int i = 0; i < count; ++i)
         {
-            cout << " 错误：文件正在使用中，请先关闭文件" << endl;
-            return;
+            if (i >= static_cast<int>(before.size()) || memcmp(&before[i], &now[i], sizeof(T)) != 0)
+                markStoreDirty(&now[i], sizeof(T));
         }
     }
 
-    sharedData->fcbs[fileId].isused = 0;
-    memset(sharedData->fileContents[fileId], 0, sizeof(sharedData->fileContents[fileId]));
+    void touchFcb(int fcbId, bool modified); // 更新访问或修改时间并记入增量保存（内部加锁）
+    void moveFCB(int fcbId, int targetDirId); // 移动到另一目录，同步目录项索引和汇总（内部加锁）
 
-    cout << "文件删除成功: " << fileName << endl;
-    sharedData->modifyCount++;
-    dataChanged = true;
-    notifyDataChange();
-}
+    // 预写日志（walAppend/walOpen/walRotate 的调用者需持有共享内存锁）
+    void walAppend(int type, int fcbId, int arg = 0, int64_t value = 0, const void *data = nullptr, size_t length = 0,
+                   int flags = 0);
+    void walLogAttr(int fcbId) // 锁定状态和修改时间
+    {
+        const FCB &fcb = sharedData->fcbs[fcbId];
+        walAppend(WAL_ATTR, fcbId, fcb.lockOwner, fcb.modifyTime, nullptr, 0, fcb.locked ? 1 : 0);
+    }
+    void walLogUser(int slot) { walAppend(WAL_USER, -1, slot, sharedData->nextUserId, &sharedData->users[slot], sizeof(User)); }
+    bool walCommit();                       // 等待本进程追加的记录落盘；日志未启用或同步失败时返回 false
+    bool walOpen();                         // 确保本进程持有当前的日志文件
+    bool walCreate(uint64_t baseLsn);       // 新建空日志文件，成为当前日志
+    bool walRotate();                       // 保存开始时把当前日志切换为旧日志
+    void recoverWal();                      // 加载页式存储后重放检查点之后的记录
+    void startWal();                        // 开始新的日志，必要时先保存检查点（仅第一个进程）
+    bool replayWalFile(const char *path, uint64_t &next, int &replayed, int &failed);
+    bool replayWalRecord(const WalRecord &rec, const char *data);
+
+    // 热点元数据列维护：FCB的 isused/type/parentDir 变化后调用
+    void syncFcbColumns(int fcbId);
+    void rebuildFcbColumns();
+
+    // 用户索引维护与查询
+    void userIndexInsert(int slot); // 调用者需持有共享内存锁
+    void rebuildUserIndex();
+    int findUserSlot(const string &username);
+    User *findUserById(int userId);
 
-void MiniFMS::listDirectory(Session *session)
-{
-    if (!session || !sharedData)
-        return;
+    // 清理资源
+    void cleanup()
+    {
+        // 设置退出标记
+        shouldExit = true;
+        systemRunning = false;
 
-    cout << "\n目录内容 - " << getCurrentPath(session->currentDirId, session->user->userId) << "\n"
-         << endl;
-    cout << "类型\t名称\t\t大小\t\t修改时间" << endl;
-    cout << "────────────────────────────────────────────────────────" << endl;
+        // 通知所有等待的线程
+        queueCv.notify_all();
 
-    bool hasContent = false;
-    for (int i = 0; i < MAX_FCBS; ++i)
-    {
-        if (sharedData->fcbs[i].isused &&
-            sharedData->fcbs[i].parentDir == session->currentDirId)
+        // 等待自动保存线程和磁盘更新线程结束
+        if (autoSaveThreadHandle.joinable())
         {
-            hasContent = true;
-
-            string type = sharedData->fcbs[i].type == 1 ? "DIR" : "FILE";
-            string name = string(sharedData->fcbs[i].name);
-            string size = sharedData->fcbs[i].type == 1 ? "<DIR>" : to_string(sharedData->fcbs[i].size) + " bytes";
-            string mtime = formatTime(sharedData->fcbs[i].modifyTime);
+            autoSaveThreadHandle.join();
+        }
+        if (diskMaintenanceThreadHandle.joinable())
+        {
+            diskMaintenanceThreadHandle.join();
+        }
 
-            cout << type << "\t" << setw(15) << left << name << "\t"
-                 << setw(12) << left << size << "\t" << mtime << endl;
+        // 在退出前保存数据
+        if (sharedData && sharedData->initialized)
+        {
+            saveDataToDisk(false);
         }
-    }
 
-    if (!hasContent)
-    {
-        cout << "目录为空" << endl;
+        // 不需要删除共享数据（包括FAT表和位图），因为它在共享内存中
     }
-    cout << endl;
-}
 
-void MiniFMS::showTree(Session *session)
-{
-    if (!session || !sharedData)
-        return;
+public:
+    MiniFMS();  // 构造函数
+    ~MiniFMS(); // 析构函数
 
-    cout << "\n 目录树结构\n"
-         << endl;
-    showTreeRecursive(session->currentDirId, 0, session->user->userId);
-    cout << endl;
-}
+    // 用户管理
+    bool registerUser(const string &username, const string &password); // 注册用户
+    User *loginUser(const string &username, const string &password);   // 登录用户
+    bool checkUserConflict(const string &username);                    // 检查用户名是否冲突
 
-void MiniFMS::showTreeRecursive(int fcbId, int depth, int userId)
-{
-    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
-        return;
+    // 文件管理
+    int findFCB(int parentDir, const string &name);
+    int createFCB(const string &name, int type, int owner, int parentDir, int fcbId = -1); // fcbId 指定槽位（日志重放）
+    string getCurrentPath(int fcbId, int userId);
+    const string &sessionPath(Session *session);       // 会话当前路径（带缓存）
+    void changeDirectory(Session *session, int dirId); // 切换当前目录并维护路径缓存
+    string formatTime(time_t t);
 
-    for (int i = 0; i < depth; ++i)
-    {
-        cout << "│   ";
-    }
+    // 文件操作
+    void createFile(Session *session, const string &fileName);
+    void deleteFile(Session *session, const string &fileName);
+    void listDirectory(Session *session, const DirListOptions &options = DirListOptions());
+    void showTree(Session *session, bool withSizes = false);
+    void showTreeRecursive(int fcbId, int depth, int userId, bool withSizes = false);
+    void showDiskUsage(Session *session, const string &dirPath);
+    bool verifyAggregates(bool report); // 并行重算子树汇总，比对并修复维护值
+    void showFileHead(Session *session, const string &fileName, int numLines);
+    void showFileTail(Session *session, const string &fileName, int numLines);
 
-    FCB &fcb = sharedData->fcbs[fcbId];
-    if (fcb.type == 1)
-    {
-        cout << "├──" << fcb.name << "/" << endl;
+    // 用户交互
+    void showWelcome();
+    void showHelp();
+    void userInteractionThread(Session &session); // 用户交互线程
+    void diskMaintenanceThread();                 // 磁盘维护线程
+    void processCommand(CommandRequest &req);     // 处理命令
+    void run();                                   // 运行系统
 
-        for (int i = 0; i < MAX_FCBS; ++i)
-        {
-            if (sharedData->fcbs[i].isused && sharedData->fcbs[i].parentDir == fcbId)
-            {
-                showTreeRecursive(i, depth + 1, userId);
-            }
-        }
-    }
-    else
-    {
-        cout << "├──  " << fcb.name
-             << " (size: " << fcb.size
-             << ", mtime: " << formatTime(fcb.modifyTime) << ")" << endl;
-    }
-}
+    // 持久化功能
+    bool saveDataToDisk(bool silent = false); // 保存数据到磁盘
+    bool loadDataFromDisk();                  // 从磁盘加载数据
+    bool saveSnapshot(bool silent, int version = DATA_VERSION); // 完整写出 filesystem.dat 快照（调用者需持有 saveMutex）
+    bool saveStore(bool silent);              // 增量保存到页式存储文件（调用者需持有 saveMutex）
+    bool loadStore();                         // 从页式存储文件加载，文件不可用时返回 false
+    bool recoverStoreJournal();               // 按页日志补完上次中断的增量保存，页式存储不可用时返回 false
+    // 以下读取函数从段标识之后开始读，返回 false 表示该段不完整，之后的内容不再读取
+    bool loadChecksummedData(ifstream &file, bool &truncated, bool &freeListLoaded); // 并行校验并读取v3数据文件
+    void placeLoadedFcb(int slot, FCB fcb);                         // 把读入的FCB放入槽位，内容随后写入
+    bool loadTailSegment(ifstream &file, const char *tag, bool &truncated, bool &freeListLoaded); // 按标识读取一个附加段
+    bool loadFreeFcbList(ifstream &file);                           // 读取并校验FCB空闲栈
+    bool loadLongFileData(ifstream &file, bool flat, bool &truncated); // 读取超长文件的剩余内容
+    bool loadCompressionSettings(ifstream &file);                   // 恢复压缩存储设置
+    bool loadSharedBlocks(ifstream &file);                          // 恢复文件之间共享的数据块
+    void autoSaveThread();                    // 自动保存线程
 
-void MiniFMS::userInteractionThread(Session &session)
-{
-    string inputBuffer;
-    getline(cin, inputBuffer);
+    void findAllFiles(vector<int> &files, int fcbId);
+    void deleteFCB(int fcbId);
 
-    while (session.active && !shouldExit)
-    {
-        cout << "\033[1;32m" << session.user->username << "@MiniFMS\033[0m:"
-             << "\033[1;34m" << getCurrentPath(session.currentDirId, session.user->userId) << "\033[0m$ ";
+    // 导入外部文件到文件系统
+    bool importFile(Session *session, const string &externalPath, const string &internalName);
+    // 导出文件到外部文件系统
+    bool exportFile(Session *session, const string &internalName, const string &externalPath);
 
-        string cmdline;
-        getline(cin, cmdline);
+    // 进程间通信方法
+    bool initSharedMemory();
+    bool connectToSharedMemory();
+    bool acquireProcessSlot();
+    void releaseProcessSlot();
+    void lockSharedMemory();
+    void unlockSharedMemory();
+    void notifyDataChange();
+    void syncDataChangeThread();
+    void broadcastMessage(const string &message);
+    void showConnectedProcesses();
 
-        if (cmdline == "exit" || shouldExit)
-        {
-            // 用户退出时保存数据
-            if (dataChanged)
-            {
-                cout << "正在保存会话数据..." << endl;
-                if (saveDataToDisk(true))
-                {
-                    cout << "会话数据已保存" << endl;
-                }
-                else
-                {
-                    cout << "警告：数据保存失败！" << endl;
-                }
-            }
-            session.active = false;
-            cout << "Bye! 感谢使用 MiniFMS." << endl;
-            shouldExit = true;
-            break;
-        }
+    // 映像模式：filesystem.img 直接作为共享段映射，启动时不加载，保存时只写回修改过的页
+    bool attachImage();                 // 映射已有的映像（冷启动或连接到正在使用它的进程）
+    bool syncImage(bool silent);        // 写回映像的脏页并更新映像头（调用者需持有 saveMutex）
+    bool switchImageMode(bool enable);  // 在共享内存与映像之间原地切换（仅限单进程）
+    void recoverImageState();           // 映像未正常关闭时重建块状态和各项索引
+    void showImageStatus();
 
-        if (cmdline.empty())
-            continue;
+    // 通过路径查找FCB
+    int findFCBByPath(Session *session, const string &path);
 
-        {
-            lock_guard<mutex> lock(queueMutex);
-            commandQueue.push(CommandRequest(&session, cmdline));
-        }
-        queueCv.notify_one();
+    // 在子树中按文件名查找（通配符或子串）
+    void findByName(Session *session, const string &dirPath, const string &pattern);
 
-        {
-            unique_lock<mutex> lock(queueMutex);
-            queueCv.wait(lock, [this]
-                         { return ready || shouldExit; });
-            if (shouldExit)
-            {
-                break;
-            }
-            ready = false;
-        }
-    }
-}
+    // 性能测试
+    void runBenchmark(Session *session, const vector<string> &args);
+    void runIoBenchmark(Session *session, int megabytes); // 普通存储与压缩存储的读写吞吐量对比
 
-void MiniFMS::diskMaintenanceThread()
-{
-    while (!shouldExit)
-    {
-        CommandRequest req;
-        {
-            unique_lock<mutex> lock(queueMutex);
-            queueCv.wait(lock, [this]
-                         { return !commandQueue.empty() || shouldExit; });
+private:
+    // 进程间通信相关
+    int currentProcessId = -1;
+    atomic<int> lastKnownChangeId{0};
+    string processName;
 
-            if (shouldExit)
-            {
-                break;
-            }
+    // 路径解析缓存（dentry cache）：规范化路径 -> FCB ID，命名空间版本号变化时整体失效
+    unordered_map<string, int> dentryCache;
+    int dentryCacheGen = -1;
 
-            req = commandQueue.front();
-            commandQueue.pop();
-        }
+    // 上次后台整理无事可做时的命名空间和块布局版本，两者都未变化时跳过
+    int defragCheckedNamespace = -1;
+    int defragCheckedLayout = -1;
 
-        processCommand(req);
+    // 整理用的临时数组：首次使用时分配，之后每批复用（只在持有共享内存锁时访问）；
+    // 置换表平时保持为恒等排列、标记数组平时全为 0，用完只复原改动过的位置
+    vector<int> defragOrder, defragBlocks, defragTouched;
+    vector<int> defragSlot, defragAt, defragContent, defragWhere;
+    vector<char> defragFcbMark, defragBlockMark;
+};
+
+// 构造函数和析构函数定义
+MiniFMS::MiniFMS()
+{
+    // 生成进程名称
+    auto now = chrono::system_clock::now();
+    auto time_t = chrono::system_clock::to_time_t(now);
+#ifdef _WIN32
+    processName = "MiniFMS_" + to_string(time_t) + "_" + to_string(GetCurrentProcessId());
+#else
+    processName = "MiniFMS_" + to_string(time_t) + "_" + to_string(getpid());
+#endif
 
+    // 尝试连接到共享内存，如果失败则创建新的
+    if (!connectToSharedMemory())
+    {
+        if (!initSharedMemory())
         {
-            lock_guard<mutex> lock(queueMutex);
-            ready = true;
+            throw runtime_error("无法初始化共享内存");
         }
-        queueCv.notify_one();
     }
-}
 
-void MiniFMS::processCommand(CommandRequest &req)
-{
-    istringstream iss(req.commandLine);
-    string cmd;
-    vector<string> args;
-    iss >> cmd;
-    string arg;
-    while (iss >> arg)
-        args.push_back(arg); // 将命令行参数分割成多个字符串
-    if (cmd == "help")
-    {
-        showHelp();
-    }
-    else if (cmd == "dir")
+    // 获取进程槽位
+    if (!acquireProcessSlot())
     {
-        listDirectory(req.session);
+        throw runtime_error("无法获取进程槽位，系统已满");
     }
-    else if (cmd == "mkdir")
+
+    // 如果是第一个进程，初始化文件系统
+    if (sharedData->processCount == 1 && !sharedData->initialized)
     {
-        if (args.empty())
+        // 尝试从磁盘加载数据
+        if (!loadDataFromDisk())
         {
-            cout << " 用法: mkdir [目录名]" << endl;
+            cout << "初始化新的文件系统..." << endl;
+            // 初始化根目录
+            FCB &rootFcb = sharedData->fcbs[0];
+            rootFcb.isused = 1;
+            strcpy(rootFcb.name, "/");
+            rootFcb.type = 1;
+            rootFcb.owner = 0;
+            rootFcb.createTime = rootFcb.modifyTime = rootFcb.accessTime = time(nullptr);
+            rootFcb.parentDir = -1;
+            rootFcb.address = -1; // 目录不占用数据块
+            syncFcbColumns(0);
+            sharedData->nextFcbId = 1;
+            sharedData->initialized = true;
         }
         else
         {
-            if (findFCB(req.session->currentDirId, args[0]) != -1)
-            {
-                cout << " 目录已存在: " << args[0] << endl;
-            }
-            else
-            {
-                int newDirId = createFCB(args[0], 1, req.session->user->userId, req.session->currentDirId);
-                if (newDirId != -1)
-                {
-                    cout << " 目录创建成功: " << args[0] << endl;
-                }
-                else
-                {
-                    cout << " 目录创建失败" << endl;
-                }
-            }
+            cout << "从磁盘加载文件系统数据成功!" << endl;
         }
+        startWal();
     }
-    else if (cmd == "rmdir")
+    else if (imageMapped && sharedData->processCount == 1)
     {
-        if (args.empty())
-        {
-            cout << " 用法: rmdir [目录名]" << endl;
-            cout << " 说明: 删除指定的目录" << endl;
-            cout << " 选项: -f  强制删除非空目录" << endl;
-            return;
-        }
+        cout << "已映射文件系统映像 " << IMAGE_FILE << "，无需加载数据" << endl;
+    }
+    else if (sharedData->initialized)
+    {
+        cout << "连接到现有文件系统 (进程数: " << sharedData->processCount.load() << ")" << endl;
+    }
 
-        bool forceDelete = false;
-        string dirName = args[0];
+    // 启动同步监听线程
+    syncThreadHandle = thread(&MiniFMS::syncDataChangeThread, this);
+}
 
-        // 检查是否有 -f 选项
-        if (args.size() > 1 && args[1] == "-f")
-        {
-            forceDelete = true;
-        }
+MiniFMS::~MiniFMS()
+{
+    // 释放进程槽位
+    releaseProcessSlot();
 
-        int dirId = findFCB(req.session->currentDirId, dirName);
-        if (dirId == -1)
+    // 清理资源
+    cleanup();
+
+    // 清理同步线程
+    if (syncThreadHandle.joinable())
+    {
+        syncThreadHandle.join();
+    }
+
+#ifdef _WIN32
+    if (hChangeEvent)
+        CloseHandle(hChangeEvent);
+    if (hMutex)
+        CloseHandle(hMutex);
+    if (sharedData)
+        UnmapViewOfFile(sharedData);
+    if (hMapFile)
+        CloseHandle(hMapFile);
+#else
+    if (changeEvent)
+    {
+        sem_close(changeEvent);
+        sem_unlink((CHANGE_EVENT_NAME + processName).c_str());
+    }
+    if (shmMutex)
+    {
+        sem_close(shmMutex);
+        sem_unlink(SHARED_MUTEX_NAME);
+    }
+    if (sharedData)
+        munmap(sharedData, SHARED_MEMORY_SIZE);
+    if (shmFd >= 0)
+    {
+        close(shmFd);
+        shm_unlink(SHARED_MEMORY_NAME);
+    }
+    if (imageFd >= 0)
+        close(imageFd); // 同时释放映像上的共享锁
+    if (walFd >= 0)
+        close(walFd);
+#endif
+}
+
+int MiniFMS::findFCB(int parentDir, const string &name)
+{
+    if (!sharedData || parentDir < 0 || parentDir >= MAX_FCBS)
+        return -1;
+
+    unsigned int slot = hashDirEntry(parentDir, name.c_str());
+    for (int probe = 0; probe < DIR_HASH_SIZE; ++probe)
+    {
+        int id = sharedData->dirHash[slot];
+        if (id == DIR_HASH_EMPTY)
+            break;
+        if (id >= 0 &&
+            sharedData->fcbs[id].isused &&
+            sharedData->fcbs[id].parentDir == parentDir &&
+            strcmp(sharedData->fcbs[id].name, name.c_str()) == 0)
         {
-            cout << " 错误: 目录不存在: " << dirName << endl;
-            return;
+            return id;
         }
+        slot = (slot + 1) & (DIR_HASH_SIZE - 1);
+    }
+    return -1;
+}
 
-        if (sharedData->fcbs[dirId].type != 1)
+void MiniFMS::dirHashInsert(int fcbId)
+{
+    FCB &fcb = sharedData->fcbs[fcbId];
+    if (fcb.parentDir < 0)
+        return; // 根目录不参与按名查找
+
+    unsigned int slot = hashDirEntry(fcb.parentDir, fcb.name);
+    for (int probe = 0; probe < DIR_HASH_SIZE; ++probe)
+    {
+        int id = sharedData->dirHash[slot];
+        if (id == DIR_HASH_EMPTY || id == DIR_HASH_DELETED)
         {
-            cout << " 错误: " << dirName << " 不是一个目录" << endl;
+            if (id == DIR_HASH_DELETED)
+                sharedData->dirHashTombstones--;
+            sharedData->dirHash[slot] = fcbId;
             return;
         }
+        slot = (slot + 1) & (DIR_HASH_SIZE - 1);
+    }
+}
 
-        // 检查是否有权限删除
-        if (sharedData->fcbs[dirId].owner != req.session->user->userId)
-        {
-            cout << " 错误: 权限不足，无法删除其他用户的目录" << endl;
+void MiniFMS::dirHashRemove(int fcbId)
+{
+    FCB &fcb = sharedData->fcbs[fcbId];
+    if (fcb.parentDir < 0)
+        return;
+
+    unsigned int slot = hashDirEntry(fcb.parentDir, fcb.name);
+    for (int probe = 0; probe < DIR_HASH_SIZE; ++probe)
+    {
+        int id = sharedData->dirHash[slot];
+        if (id == DIR_HASH_EMPTY)
             return;
+        if (id == fcbId)
+        {
+            sharedData->dirHash[slot] = DIR_HASH_DELETED;
+            sharedData->dirHashTombstones++;
+            break;
         }
+        slot = (slot + 1) & (DIR_HASH_SIZE - 1);
+    }
 
-        // 检查目录是否为空
-        bool isEmpty = true;
-        int fileCount = 0;
-        vector<pair<int, string>> contents; // <fcbId, name>
+    // 墓碑过多会拉长探测链，达到阈值时整体重建
+    if (sharedData->dirHashTombstones > DIR_HASH_SIZE / 4)
+    {
+        rebuildDirHash();
+    }
+}
 
-        for (int i = 0; i < MAX_FCBS; i++)
+void MiniFMS::rebuildDirHash()
+{
+    for (int i = 0; i < DIR_HASH_SIZE; ++i)
+    {
+        sharedData->dirHash[i] = DIR_HASH_EMPTY;
+    }
+    sharedData->dirHashTombstones = 0;
+
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        if (sharedData->fcbUsed[i])
         {
-            if (sharedData->fcbs[i].isused && sharedData->fcbs[i].parentDir == dirId)
-            {
-                isEmpty = false;
-                fileCount++;
-                contents.push_back({i, string(sharedData->fcbs[i].name)});
-            }
+            dirHashInsert(i);
         }
+    }
+}
 
-        if (!isEmpty)
+void MiniFMS::linkChild(int fcbId)
+{
+    int parentDir = sharedData->fcbs[fcbId].parentDir;
+    if (parentDir < 0 || parentDir >= MAX_FCBS)
+        return;
+
+    DirLink &parent = sharedData->links[parentDir];
+    DirLink &node = sharedData->links[fcbId];
+    node.prevSibling = parent.lastChild;
+    node.nextSibling = -1;
+    if (parent.lastChild != -1)
+        sharedData->links[parent.lastChild].nextSibling = fcbId;
+    else
+        parent.firstChild = fcbId;
+    parent.lastChild = fcbId;
+    parent.childCount++;
+}
+
+void MiniFMS::unlinkChild(int fcbId)
+{
+    int parentDir = sharedData->fcbs[fcbId].parentDir;
+    if (parentDir < 0 || parentDir >= MAX_FCBS)
+        return;
+
+    DirLink &parent = sharedData->links[parentDir];
+    DirLink &node = sharedData->links[fcbId];
+    if (node.prevSibling != -1)
+        sharedData->links[node.prevSibling].nextSibling = node.nextSibling;
+    else
+        parent.firstChild = node.nextSibling;
+    if (node.nextSibling != -1)
+        sharedData->links[node.nextSibling].prevSibling = node.prevSibling;
+    else
+        parent.lastChild = node.prevSibling;
+    parent.childCount--;
+    node.prevSibling = node.nextSibling = -1;
+}
+
+void MiniFMS::rebuildDirLinks()
+{
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        sharedData->links[i] = DirLink();
+    }
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        if (sharedData->fcbUsed[i])
         {
-            if (!forceDelete)
-            {
-                cout << " 错误: 目录不为空，使用 rmdir " << dirName << " -f 强制删除" << endl;
-                return;
-            }
+            linkChild(i);
+        }
+    }
+}
 
-            cout << " 警告: 目录 " << dirName << " 不为空" << endl;
-            cout << " 包含 " << fileCount << " 个文件/子目录:" << endl;
-            for (const auto &item : contents)
-            {
-                string itemType = sharedData->fcbs[item.first].type == 1 ? "目录" : "文件";
-                cout << "   - " << itemType << ": " << item.second << endl;
-            }
+int MiniFMS::nameIndexLowerBound(int parentDir, const char *name)
+{
+    int lo = 0, hi = sharedData->nameIndexCount;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        const FCB &fcb = sharedData->fcbs[sharedData->nameIndex[mid]];
+        if (fcb.parentDir < parentDir ||
+            (fcb.parentDir == parentDir && strcmp(fcb.name, name) < 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-            cout << "\n 确认要删除此目录及其所有内容吗? (y/n): ";
-            string confirm;
-            if (!getline(cin, confirm))
-            {
-                cout << " 输入错误，操作已取消" << endl;
-                return;
-            }
+void MiniFMS::nameIndexInsert(int fcbId)
+{
+    const FCB &fcb = sharedData->fcbs[fcbId];
+    if (fcb.parentDir < 0 || sharedData->nameIndexCount >= MAX_FCBS)
+        return;
 
-            if (confirm != "y" && confirm != "Y")
-            {
-                cout << " 操作已取消" << endl;
-                return;
-            }
+    int pos = nameIndexLowerBound(fcb.parentDir, fcb.name);
+    int *index = sharedData->nameIndex;
+    memmove(index + pos + 1, index + pos, sizeof(int) * (sharedData->nameIndexCount - pos));
+    index[pos] = fcbId;
+    sharedData->nameIndexCount++;
+}
 
-            cout << "\n 正在删除目录 " << dirName << " 及其内容..." << endl;
+void MiniFMS::nameIndexRemove(int fcbId)
+{
+    const FCB &fcb = sharedData->fcbs[fcbId];
+    if (fcb.parentDir < 0)
+        return;
 
-            // 删除所有内容
-            for (const auto &item : contents)
-            {
-                int fcbId = item.first;
-                string itemType = sharedData->fcbs[fcbId].type == 1 ? "目录" : "文件";
-                cout << " - 删除" << itemType << ": " << item.second << endl;
+    int pos = nameIndexLowerBound(fcb.parentDir, fcb.name);
+    if (pos >= sharedData->nameIndexCount || sharedData->nameIndex[pos] != fcbId)
+        return;
 
-                // 清理FCB
-                sharedData->fcbs[fcbId].isused = 0;
-                memset(sharedData->fcbs[fcbId].name, 0, MAX_FILENAME_LEN);
-                sharedData->fcbs[fcbId].type = 0;
-                sharedData->fcbs[fcbId].size = 0;
-                sharedData->fcbs[fcbId].parentDir = -1;
-                sharedData->fcbs[fcbId].owner = -1;
+    int *index = sharedData->nameIndex;
+    memmove(index + pos, index + pos + 1, sizeof(int) * (sharedData->nameIndexCount - pos - 1));
+    sharedData->nameIndexCount--;
+}
 
-                // 如果是文件，清空内容
-                if (sharedData->fcbs[fcbId].type == 0)
-                {
-                    memset(sharedData->fileContents[fcbId], 0, sizeof(sharedData->fileContents[fcbId]));
-                }
-            }
+void MiniFMS::rebuildNameIndex()
+{
+    int count = 0;
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        if (sharedData->fcbUsed[i] && sharedData->fcbParent[i] >= 0)
+        {
+            sharedData->nameIndex[count++] = i;
         }
+    }
+    FCB *fcbs = sharedData->fcbs;
+    sort(sharedData->nameIndex, sharedData->nameIndex + count, [fcbs](int a, int b)
+         {
+             if (fcbs[a].parentDir != fcbs[b].parentDir)
+                 return fcbs[a].parentDir < fcbs[b].parentDir;
+             return strcmp(fcbs[a].name, fcbs[b].name) < 0; });
+    sharedData->nameIndexCount = count;
+}
 
-        // 删除目录本身
-        sharedData->fcbs[dirId].isused = 0;
-        memset(sharedData->fcbs[dirId].name, 0, MAX_FILENAME_LEN);
-        sharedData->fcbs[dirId].type = 0;
-        sharedData->fcbs[dirId].size = 0;
-        sharedData->fcbs[dirId].parentDir = -1;
-        sharedData->fcbs[dirId].owner = -1;
+int MiniFMS::allocFcbSlot()
+{
+    if (sharedData->freeFcbTop <= 0)
+        return -1;
+    return sharedData->freeFcbStack[--sharedData->freeFcbTop];
+}
 
-        cout << " 目录删除成功: " << dirName << endl;
+void MiniFMS::freeFcbSlot(int fcbId)
+{
+    if (fcbId <= 0 || fcbId >= MAX_FCBS || sharedData->freeFcbTop >= MAX_FCBS)
+        return;
+    sharedData->freeFcbStack[sharedData->freeFcbTop++] = fcbId;
+}
 
-        // 保存更改
-        sharedData->modifyCount++;
-        dataChanged = true;
-        saveDataToDisk(true);
+void MiniFMS::rebuildFreeFcbList()
+{
+    sharedData->freeFcbTop = 0;
+    for (int i = MAX_FCBS - 1; i >= 1; --i)
+    {
+        if (!sharedData->fcbUsed[i])
+        {
+            sharedData->freeFcbStack[sharedData->freeFcbTop++] = i;
+        }
     }
-    else if (cmd == "tree")
+}
+
+void MiniFMS::adjustAggregates(int dirId, long long deltaBytes, int deltaFiles)
+{
+    if (deltaBytes == 0 && deltaFiles == 0)
+        return;
+    for (int steps = 0; dirId >= 0 && dirId < MAX_FCBS && steps < MAX_FCBS; ++steps)
     {
-        showTree(req.session);
+        sharedData->subtreeBytes[dirId] += deltaBytes;
+        sharedData->subtreeFiles[dirId] += deltaFiles;
+        dirId = sharedData->fcbParent[dirId];
     }
-    else if (cmd == "save")
+}
+
+void MiniFMS::subtreeTotals(int fcbId, long long &bytes, int &files)
+{
+    if (sharedData->fcbs[fcbId].type == 1)
     {
-        cout << " 正在保存数据到磁盘..." << endl;
-        if (saveDataToDisk(false)) // 显式使用非静默模式
+        bytes = sharedData->subtreeBytes[fcbId];
+        files = sharedData->subtreeFiles[fcbId];
+    }
+    else
+    {
+        bytes = static_cast<long long>(sharedData->fcbs[fcbId].size);
+        files = 1;
+    }
+}
+
+void MiniFMS::applyFileSize(int fcbId, size_t newSize)
+{
+    FCB &fcb = sharedData->fcbs[fcbId];
+    long long delta = static_cast<long long>(newSize) - static_cast<long long>(fcb.size);
+    fcb.size = newSize;
+    adjustAggregates(fcb.parentDir, delta, 0);
+    markFcbDirty(fcbId);
+}
+
+int MiniFMS::findFreeBlock(int from)
+{
+    if (sharedData->freeBlockCount <= 0)
+        return -1;
+
+    // 按64位字搜索空闲位，到达末尾后回绕
+    int startWord = from / 64;
+    for (int n = 0; n <= BITMAP_WORDS; ++n)
+    {
+        int w = (startWord + n) % BITMAP_WORDS;
+        uint64_t freeBits = ~sharedData->bitMap[w];
+        if (n == 0)
+            freeBits &= ~0ULL << (from % 64);
+        if (w == BITMAP_WORDS - 1 && MAX_BLOCKS % 64 != 0)
+            freeBits &= (1ULL << (MAX_BLOCKS % 64)) - 1;
+        if (freeBits)
+            return w * 64 + __builtin_ctzll(freeBits);
+    }
+    return -1;
+}
+
+int MiniFMS::allocRun(int goal, int wanted, int &got)
+{
+    got = 0;
+    if (goal < 0 || goal >= MAX_BLOCKS)
+        goal = sharedData->blockHint;
+
+    // 先从 goal 开始找一段足够长的连续空闲块，找不到再退而使用第一段空闲块
+    int firstStart = -1, firstLength = 0;
+    int pos = goal;
+    for (int scanned = 0; scanned < MAX_BLOCKS;)
+    {
+        int start = findFreeBlock(pos);
+        if (start == -1)
+            break;
+        scanned += (start - pos + MAX_BLOCKS) % MAX_BLOCKS;
+        if (scanned >= MAX_BLOCKS)
+            break;
+        int length = 0;
+        while (start + length < MAX_BLOCKS && length < wanted && !blockInUse(start + length))
+            length++;
+        if (firstStart == -1)
         {
-            cout << " 数据保存成功!" << endl;
+            firstStart = start;
+            firstLength = length;
         }
-        else
+        if (length == wanted)
         {
-            cout << " 数据保存失败!" << endl;
+            firstStart = start;
+            firstLength = length;
+            break;
         }
+        scanned += length;
+        pos = (start + length) % MAX_BLOCKS;
     }
-    else if (cmd == "create")
+    if (firstStart == -1)
+        return -1;
+
+    for (int b = firstStart; b < firstStart + firstLength; ++b)
     {
-        if (args.empty())
+        sharedData->bitMap[b / 64] |= 1ULL << (b % 64);
+        sharedData->blockRefs[b] = 1;
+    }
+    invalidateBlockHashes(firstStart, firstLength);
+    sharedData->freeBlockCount -= firstLength;
+    sharedData->blockHint = (firstStart + firstLength) % MAX_BLOCKS;
+    sharedData->layoutGen++;
+    // 未写入的部分必须读出为0：从未使用或已归还物理页的块本来就是0，不去触碰，
+    // 只清零残留旧数据的块
+    for (int b = firstStart; b < firstStart + firstLength; ++b)
+    {
+        uint64_t bit = 1ULL << (b % 64);
+        if (sharedData->staleBitmap[b / 64] & bit)
         {
-            cout << " 用法: create [文件名]" << endl;
+            memset(sharedData->blockPool[b], 0, BLOCK_SIZE);
+            sharedData->staleBitmap[b / 64] &= ~bit;
         }
-        else
+    }
+    got = firstLength;
+    return firstStart;
+}
+
+void MiniFMS::freeRun(int startBlock, int count)
+{
+    count = min(count, MAX_BLOCKS - startBlock);
+    bool discarded = count > 0 && discardBlocks(startBlock, count);
+    sharedData->layoutGen++;
+    for (int b = startBlock; b < startBlock + count; ++b)
+    {
+        uint64_t bit = 1ULL << (b % 64);
+        if (sharedData->bitMap[b / 64] & bit)
         {
-            createFile(req.session, args[0]);
+            sharedData->bitMap[b / 64] &= ~bit;
+            sharedData->freeBlockCount++;
         }
+        if (!discarded)
+            sharedData->staleBitmap[b / 64] |= bit;
     }
-    else if (cmd == "delete")
+}
+
+void MiniFMS::releaseBlocks(int startBlock, int count)
+{
+    // 只有最后一个引用消失的块才真正释放，连续的此类块合并成一次 freeRun
+    int runStart = -1;
+    for (int b = startBlock; b <= startBlock + count; ++b)
     {
-        if (args.empty())
+        bool freed = b < startBlock + count && --sharedData->blockRefs[b] == 0;
+        if (freed && runStart == -1)
+            runStart = b;
+        if (!freed && runStart != -1)
         {
-            cout << " 用法: delete [文件名]" << endl;
+            freeRun(runStart, b - runStart);
+            runStart = -1;
         }
+    }
+}
+
+bool MiniFMS::discardBlocks(int startBlock, int count)
+{
+#if !defined(_WIN32) && defined(MADV_REMOVE)
+    // MADV_REMOVE 在共享内存对象中打洞：物理页立即释放，所有进程再读到的都是0
+    static const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize > 0 && BLOCK_SIZE % pageSize == 0)
+    {
+        return madvise(sharedData->blockPool[startBlock], static_cast<size_t>(count) * BLOCK_SIZE, MADV_REMOVE) == 0;
+    }
+#else
+    (void)startBlock;
+    (void)count;
+#endif
+    return false;
+}
+
+int MiniFMS::extentUpperBound(int fcbId, int fileBlock)
+{
+    // 第一个键大于 (fcbId, fileBlock) 的区段位置
+    int lo = 0, hi = sharedData->extentCount;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        const Extent &e = sharedData->extents[mid];
+        if (e.fcbId < fcbId || (e.fcbId == fcbId && e.fileBlock <= fileBlock))
+            lo = mid + 1;
         else
+            hi = mid;
+    }
+    return lo;
+}
+
+int MiniFMS::findExtent(int fcbId, int fileBlock)
+{
+    // 覆盖 fileBlock 的区段位置；返回值不覆盖时，表示其后第一个区段的位置（可能属于其他文件）
+    int idx = extentUpperBound(fcbId, fileBlock) - 1;
+    if (idx >= 0)
+    {
+        const Extent &e = sharedData->extents[idx];
+        if (e.fcbId == fcbId && fileBlock < e.fileBlock + e.blockCount)
+            return idx;
+    }
+    return idx + 1;
+}
+
+void MiniFMS::insertExtent(int fcbId, int fileBlock, int startBlock, int blockCount)
+{
+    int idx = extentUpperBound(fcbId, fileBlock);
+    Extent *ext = sharedData->extents;
+
+    // 与逻辑和物理上都相邻的前一个区段合并，顺序写入因此只会延长同一个区段
+    if (idx > 0 && ext[idx - 1].fcbId == fcbId &&
+        ext[idx - 1].fileBlock + ext[idx - 1].blockCount == fileBlock &&
+        ext[idx - 1].startBlock + ext[idx - 1].blockCount == startBlock)
+    {
+        ext[idx - 1].blockCount += blockCount;
+        markStoreDirty(&ext[idx - 1], sizeof(Extent));
+        return;
+    }
+
+    memmove(ext + idx + 1, ext + idx, sizeof(Extent) * (sharedData->extentCount - idx));
+    ext[idx].fcbId = fcbId;
+    ext[idx].fileBlock = fileBlock;
+    ext[idx].startBlock = startBlock;
+    ext[idx].blockCount = blockCount;
+    sharedData->extentCount++;
+    markExtentsDirty(idx);
+}
+
+bool MiniFMS::mapFileBlocks(int fcbId, int firstBlock, int lastBlock)
+{
+    // 收集范围内尚未分配的空洞
+    vector<pair<int, int>> holes;
+    int next = firstBlock;
+    for (int idx = findExtent(fcbId, firstBlock); idx < sharedData->extentCount && next <= lastBlock; ++idx)
+    {
+        const Extent &e = sharedData->extents[idx];
+        if (e.fcbId != fcbId || e.fileBlock > lastBlock)
+            break;
+        if (e.fileBlock > next)
+            holes.push_back(make_pair(next, e.fileBlock - 1));
+        next = max(next, e.fileBlock + e.blockCount);
+    }
+    if (next <= lastBlock)
+        holes.push_back(make_pair(next, lastBlock));
+
+    long long needed = 0;
+    for (const auto &hole : holes)
+    {
+        needed += hole.second - hole.first + 1;
+    }
+    // 新区段数不超过新分配的块数
+    if (needed > sharedData->freeBlockCount || sharedData->extentCount + needed > MAX_EXTENTS)
+        return false;
+
+    for (const auto &hole : holes)
+    {
+        for (int b = hole.first; b <= hole.second;)
         {
-            deleteFile(req.session, args[0]);
+            // 优先紧接逻辑上前一块的物理位置分配，使文件数据保持连续
+            int goal = -1;
+            int prev = findExtent(fcbId, b - 1);
+            if (b > 0 && prev < sharedData->extentCount && sharedData->extents[prev].fcbId == fcbId &&
+                sharedData->extents[prev].fileBlock <= b - 1)
+            {
+                const Extent &e = sharedData->extents[prev];
+                goal = e.startBlock + (b - e.fileBlock);
+            }
+
+            int got;
+            int start = allocRun(goal, hole.second - b + 1, got);
+            if (start == -1)
+                return false;
+            insertExtent(fcbId, b, start, got);
+            b += got;
         }
     }
-    else if (cmd == "open")
+    return true;
+}
+
+void MiniFMS::freeFileExtents(int fcbId)
+{
+    int lo = extentUpperBound(fcbId - 1, INT_MAX);
+    int hi = extentUpperBound(fcbId, INT_MAX);
+    if (lo >= hi)
+        return;
+
+    Extent *ext = sharedData->extents;
+    for (int i = lo; i < hi; ++i)
     {
-        if (args.size() < 2)
+        releaseBlocks(ext[i].startBlock, ext[i].blockCount);
+    }
+    memmove(ext + lo, ext + hi, sizeof(Extent) * (sharedData->extentCount - hi));
+    sharedData->extentCount -= hi - lo;
+    markExtentsDirty(lo);
+}
+
+void MiniFMS::unmapFileBlocks(int fcbId, int firstBlock, int lastBlock)
+{
+    // 最多把一个区段拆成两段，调用者需保证区段表至少还有一个空位
+    Extent *ext = sharedData->extents;
+    int idx = findExtent(fcbId, firstBlock);
+    int first = idx;
+    while (idx < sharedData->extentCount && ext[idx].fcbId == fcbId && ext[idx].fileBlock <= lastBlock)
+    {
+        Extent e = ext[idx];
+        int from = max(firstBlock, e.fileBlock);
+        int to = min(lastBlock, e.fileBlock + e.blockCount - 1);
+        int headCount = from - e.fileBlock;
+        int tailCount = e.fileBlock + e.blockCount - 1 - to;
+        releaseBlocks(e.startBlock + headCount, to - from + 1);
+
+        if (headCount > 0)
         {
-            cout << " 用法: open [文件名] [模式] (r/w/rw)" << endl;
-            cout << " 示例: open test.txt r  # 以只读模式打开文件" << endl;
-            cout << " 注意: 同一文件不能重复打开，需要先close后才能重新open" << endl;
+            ext[idx].blockCount = headCount;
+            idx++;
         }
         else
         {
-            int fileId = findFCB(req.session->currentDirId, args[0]);
-            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
-            {
-                cout << " 文件不存在: " << args[0] << endl;
-            }
-            else
-            {
-                int mode = 0;
-                if (args[1] == "w")
-                    mode = 1;
-                else if (args[1] == "rw")
-                    mode = 2;
-                else if (args[1] != "r")
-                {
-                    cout << " 无效的打开模式，请使用 r/w/rw" << endl;
-                    return;
-                }
+            memmove(ext + idx, ext + idx + 1, sizeof(Extent) * (sharedData->extentCount - idx - 1));
+            sharedData->extentCount--;
+        }
+        if (tailCount > 0)
+        {
+            memmove(ext + idx + 1, ext + idx, sizeof(Extent) * (sharedData->extentCount - idx));
+            ext[idx].fcbId = fcbId;
+            ext[idx].fileBlock = to + 1;
+            ext[idx].startBlock = e.startBlock + (to + 1 - e.fileBlock);
+            ext[idx].blockCount = tailCount;
+            sharedData->extentCount++;
+            idx++;
+        }
+    }
+    markExtentsDirty(first);
+}
 
-                // 检查文件是否已经被打开
-                bool alreadyOpen = false;
-                int existingFd = -1;
-                for (size_t i = 0; i < req.session->openFiles.size(); ++i)
-                {
-                    if (req.session->openFiles[i].isOpen &&
-                        req.session->openFiles[i].fcbId == fileId)
-                    {
-                        alreadyOpen = true;
-                        existingFd = static_cast<int>(i);
-                        break;
-                    }
-                }
+bool MiniFMS::shareFileBlocks(int srcId, int srcBlock, int dstId, int dstBlock, int count)
+{
+    // 源文件在范围内必须全部已分配；目标范围原有的块先释放，再指向源文件的物理块
+    vector<Extent> pieces;
+    int next = srcBlock;
+    for (int idx = findExtent(srcId, srcBlock); next < srcBlock + count; ++idx)
+    {
+        if (idx >= sharedData->extentCount)
+            return false;
+        const Extent &e = sharedData->extents[idx];
+        if (e.fcbId != srcId || e.fileBlock > next)
+            return false;
+        Extent piece;
+        piece.fcbId = dstId;
+        piece.fileBlock = dstBlock + (next - srcBlock);
+        piece.startBlock = e.startBlock + (next - e.fileBlock);
+        piece.blockCount = min(e.fileBlock + e.blockCount, srcBlock + count) - next;
+        pieces.push_back(piece);
+        next += piece.blockCount;
+    }
+    if (sharedData->extentCount + static_cast<int>(pieces.size()) + 1 > MAX_EXTENTS)
+        return false;
 
-                if (alreadyOpen)
-                {
-                    string currentMode;
-                    switch (req.session->openFiles[existingFd].mode)
-                    {
-                    case 0:
-                        currentMode = "只读";
-                        break;
-                    case 1:
-                        currentMode = "只写";
-                        break;
-                    case 2:
-                        currentMode = "读写";
-                        break;
-                    }
-                    cout << " 错误：文件 " << args[0] << " 已经被打开" << endl;
-                    cout << " 当前打开状态：文件描述符 = " << existingFd << ", 模式 = " << currentMode << endl;
-                    cout << " 提示：如需以其他模式打开，请先使用 close " << existingFd << " 关闭文件" << endl;
-                }
-                else
-                {
-                    int fd = req.session->addOpenFile(fileId, mode);
-                    cout << " 文件打开成功，文件描述符: " << fd << endl;
-                }
-            }
+    unmapFileBlocks(dstId, dstBlock, dstBlock + count - 1);
+    for (const Extent &piece : pieces)
+    {
+        for (int b = piece.startBlock; b < piece.startBlock + piece.blockCount; ++b)
+        {
+            sharedData->blockRefs[b]++;
         }
+        insertExtent(dstId, piece.fileBlock, piece.startBlock, piece.blockCount);
     }
-    else if (cmd == "close")
+    return true;
+}
+
+bool MiniFMS::unshareFileBlocks(int fcbId, int firstBlock, int lastBlock)
+{
+    // 收集范围内与其他文件共享的逻辑块，连续的逻辑块合并为一段
+    vector<pair<int, int>> runs;
+    vector<int> physical;
+    for (int idx = findExtent(fcbId, firstBlock); idx < sharedData->extentCount; ++idx)
     {
-        if (args.empty())
+        const Extent &e = sharedData->extents[idx];
+        if (e.fcbId != fcbId || e.fileBlock > lastBlock)
+            break;
+        int from = max(firstBlock, e.fileBlock);
+        int to = min(lastBlock, e.fileBlock + e.blockCount - 1);
+        for (int b = from; b <= to; ++b)
         {
-            cout << " 用法: close [文件描述符]" << endl;
+            int block = e.startBlock + (b - e.fileBlock);
+            if (sharedData->blockRefs[block] < 2)
+                continue;
+            if (!runs.empty() && runs.back().first + runs.back().second == b)
+                runs.back().second++;
+            else
+                runs.push_back(make_pair(b, 1));
+            physical.push_back(block);
         }
-        else
+    }
+    if (runs.empty())
+        return true;
+
+    // 先确认空间足够，保证不会在复制到一半时失败
+    int needed = static_cast<int>(physical.size());
+    if (needed > sharedData->freeBlockCount ||
+        sharedData->extentCount + static_cast<int>(runs.size()) + needed > MAX_EXTENTS)
+        return false;
+
+    size_t next = 0;
+    vector<char> saved;
+    for (const auto &run : runs)
+    {
+        saved.resize(static_cast<size_t>(run.second) * BLOCK_SIZE);
+        for (int i = 0; i < run.second; ++i)
         {
-            try
-            {
-                int fd = stoi(args[0]);
-                if (req.session->closeFile(fd))
-                {
-                    cout << " 文件已关闭" << endl;
-                }
-                else
-                {
-                    cout << " 无效的文件描述符" << endl;
-                }
-            }
-            catch (const std::invalid_argument &e)
+            memcpy(&saved[static_cast<size_t>(i) * BLOCK_SIZE], sharedData->blockPool[physical[next + i]], BLOCK_SIZE);
+        }
+        next += run.second;
+
+        // 放弃对共享块的引用，重新分配私有块并写回原内容
+        unmapFileBlocks(fcbId, run.first, run.first + run.second - 1);
+        if (!mapFileBlocks(fcbId, run.first, run.first + run.second - 1))
+            return false;
+        int done = 0;
+        for (int idx = findExtent(fcbId, run.first); done < run.second; ++idx)
+        {
+            const Extent &e = sharedData->extents[idx];
+            int from = max(run.first, e.fileBlock);
+            int n = min(e.fileBlock + e.blockCount - from, run.second - done);
+            memcpy(sharedData->blockPool[e.startBlock + (from - e.fileBlock)], &saved[static_cast<size_t>(done) * BLOCK_SIZE],
+                   static_cast<size_t>(n) * BLOCK_SIZE);
+            done += n;
+        }
+    }
+    return true;
+}
+
+bool MiniFMS::promoteInlineFile(int fcbId)
+{
+    char saved[INLINE_DATA_SIZE];
+    size_t size = sharedData->fcbs[fcbId].size;
+    memcpy(saved, sharedData->inlineData[fcbId], INLINE_DATA_SIZE);
+
+    sharedData->fileInline[fcbId] = 0;
+    if (size > 0 && !copyIntoFile(fcbId, 0, saved, size))
+    {
+        // 块池空间不足，保持内联状态
+        sharedData->fileInline[fcbId] = 1;
+        return false;
+    }
+    memset(sharedData->inlineData[fcbId], 0, INLINE_DATA_SIZE);
+    markFcbDirty(fcbId);
+    return true;
+}
+
+size_t MiniFMS::forEachSpan(int fcbId, size_t offset, size_t length, const SpanVisitor &visitor)
+{
+    // 布局直接指向共享段中该文件的区段或帧，不复制
+    FileLayout layout;
+    layout.size = sharedData->fcbs[fcbId].size;
+    if (sharedData->fileInline[fcbId])
+    {
+        layout.inlineData = sharedData->inlineData[fcbId];
+    }
+    else if (sharedData->fileCompressed[fcbId])
+    {
+        int lo = findFrame(fcbId, 0);
+        layout.compressed = true;
+        layout.frames = sharedData->frames + lo;
+        layout.frameCount = findFrame(fcbId + 1, 0) - lo;
+    }
+    else
+    {
+        int lo = extentUpperBound(fcbId - 1, INT_MAX);
+        layout.extents = sharedData->extents + lo;
+        layout.extentCount = extentUpperBound(fcbId, INT_MAX) - lo;
+    }
+    return forEachSpan(layout, offset, length, visitor);
+}
+
+size_t MiniFMS::forEachSpan(const FileLayout &layout, size_t offset, size_t length, const SpanVisitor &visitor)
+{
+    static const char zeroBlock[BLOCK_SIZE] = {};
+
+    if (offset >= layout.size)
+        return 0;
+    length = min(length, layout.size - offset);
+
+    // 内联文件：内容就在FCB旁的内联区，不查区段表
+    if (layout.inlineData)
+    {
+        visitor(string_view(layout.inlineData + offset, length));
+        return length;
+    }
+
+    // 压缩文件：只解压读取范围涉及的帧
+    if (layout.compressed)
+    {
+        vector<char> raw(FRAME_SIZE);
+        const Frame *frames = layout.frames, *framesEnd = layout.frames + layout.frameCount;
+        const Frame *f = lower_bound(frames, framesEnd, static_cast<int>(offset / FRAME_SIZE), [](const Frame &a, int frame)
+                                     { return a.frame < frame; });
+        size_t pos = offset, done = 0;
+        while (done < length)
+        {
+            int frame = static_cast<int>(pos / FRAME_SIZE);
+            size_t within = pos - static_cast<size_t>(frame) * FRAME_SIZE;
+            size_t n = min(FRAME_SIZE - within, length - done);
+            while (f < framesEnd && f->frame < frame)
+                ++f;
+            string_view span;
+            if (f < framesEnd && f->frame == frame)
             {
-                cout << " 文件描述符必须是数字: " << args[0] << endl;
+                decodeFrame(*f, raw.data());
+                span = string_view(raw.data() + within, n);
             }
-            catch (const std::out_of_range &e)
+            else
             {
-                cout << " 文件描述符超出范围: " << args[0] << endl;
+                span = string_view(zeroBlock, min(n, sizeof(zeroBlock)));
             }
+            done += span.size();
+            pos += span.size();
+            if (!visitor(span))
+                break;
         }
+        return done;
     }
-    else if (cmd == "read")
+
+    // 一次二分查找定位起始区段，之后按顺序向后走
+    const Extent *e = upper_bound(layout.extents, layout.extents + layout.extentCount, static_cast<int>(offset / BLOCK_SIZE),
+                                  [](int block, const Extent &a)
+                                  { return block < a.fileBlock; });
+    if (e > layout.extents && static_cast<size_t>(e[-1].fileBlock + e[-1].blockCount) * BLOCK_SIZE > offset)
+        --e;
+    const Extent *extentsEnd = layout.extents + layout.extentCount;
+    size_t pos = offset, done = 0;
+    while (done < length)
     {
-        if (args.empty())
+        size_t extStart = e < extentsEnd ? static_cast<size_t>(e->fileBlock) * BLOCK_SIZE : layout.size;
+        string_view span;
+        if (pos < extStart)
         {
-            cout << " 用法: read [文件描述符] [可选:要读取的字节数]" << endl;
-            cout << " 示例: read 0     # 从当前位置读取到文件末尾" << endl;
-            cout << "       read 0 10  # 从当前位置读取10个字节" << endl;
+            // 空洞读出为0，按块大小分段给出
+            span = string_view(zeroBlock, min(min(extStart - pos, length - done), sizeof(zeroBlock)));
         }
         else
         {
-            try
-            {
-                int fd = stoi(args[0]);
-                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
-                    req.session->openFiles[fd].isOpen)
+            // 区段内的物理块连续，整个区段是一段视图
+            size_t extEnd = extStart + static_cast<size_t>(e->blockCount) * BLOCK_SIZE;
+            span = string_view(sharedData->blockPool[e->startBlock] + (pos - extStart), min(extEnd - pos, length - done));
+            e++;
+        }
+        done += span.size();
+        pos += span.size();
+        if (!visitor(span))
+            break;
+    }
+    return done;
+}
+
+size_t MiniFMS::copyFromFile(int fcbId, size_t offset, size_t length, char *out)
+{
+    size_t done = 0;
+    forEachSpan(fcbId, offset, length, [&](string_view span)
                 {
-                    FileDesc &fileDesc = req.session->openFiles[fd];
-                    if (fileDesc.mode == 1)
-                    {
-                        cout << " 文件以只写模式打开" << endl;
-                    }
-                    else
-                    {
-                        int fcbId = fileDesc.fcbId;
-                        string content = string(sharedData->fileContents[fcbId]);
+                    memcpy(out + done, span.data(), span.size());
+                    done += span.size();
+                    return true; });
+    return done;
+}
 
-                        // 如果指定了读取长度
-                        if (args.size() > 1)
-                        {
-                            size_t length = stoi(args[1]);
-                            if (fileDesc.position + length > content.length())
-                            {
-                                cout << " 警告：请求读取的长度超出文件末尾，将只读取到文件末尾" << endl;
-                                length = content.length() - fileDesc.position;
-                            }
-                            cout << " 从位置 " << fileDesc.position << " 读取 " << length << " 个字节:" << endl;
-                            cout << content.substr(fileDesc.position, length) << endl;
-                            fileDesc.position += length;
-                        }
-                        else
-                        {
-                            // 读取从当前位置到文件末尾的所有内容
-                            if (fileDesc.position >= content.length())
-                            {
-                                cout << " 已到达文件末尾" << endl;
-                            }
-                            else
-                            {
-                                cout << " 从位置 " << fileDesc.position << " 读取到文件末尾:" << endl;
-                                cout << content.substr(fileDesc.position) << endl;
-                                fileDesc.position = content.length();
-                            }
-                        }
+bool MiniFMS::copyIntoFile(int fcbId, size_t offset, const char *data, size_t length)
+{
+    if (offset + length > MAX_FILE_SIZE)
+        return false;
 
-                        sharedData->fcbs[fcbId].accessTime = time(nullptr);
-                        cout << " 当前文件指针位置：" << fileDesc.position << endl;
-                    }
-                }
-                else
-                {
-                    cout << " 无效的文件描述符" << endl;
-                }
-            }
-            catch (const std::invalid_argument &e)
-            {
-                cout << " 文件描述符必须是数字: " << args[0] << endl;
-            }
-            catch (const std::out_of_range &e)
-            {
-                cout << " 文件描述符超出范围: " << args[0] << endl;
-            }
-        }
-    }
-    else if (cmd == "write")
+    FCB &fcb = sharedData->fcbs[fcbId];
+    size_t newSize = max(fcb.size, offset + length);
+    if (sharedData->fileInline[fcbId])
     {
-        if (args.empty())
+        if (newSize <= INLINE_DATA_SIZE)
         {
-            cout << " 用法: write [文件描述符] [-a/-o]" << endl;
-            cout << " 选项: -a 从当前位置追加内容" << endl;
-            cout << "       -o 覆盖当前位置的内容" << endl;
-            cout << " 示例: write 0 -a  # 在当前位置追加内容" << endl;
-            cout << "       write 0 -o  # 覆盖当前位置的内容" << endl;
+            if (length > 0)
+                memcpy(sharedData->inlineData[fcbId] + offset, data, length);
+            applyFileSize(fcbId, newSize);
+            return true;
         }
-        else
-        {
-            try
-            {
-                int fd = stoi(args[0]);
-                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
-                    req.session->openFiles[fd].isOpen)
-                {
-                    FileDesc &fileDesc = req.session->openFiles[fd];
-                    if (fileDesc.mode == 0)
-                    {
-                        cout << " 文件以只读模式打开" << endl;
-                        return;
-                    }
-
-                    // 检查文件访问权限
-                    if (!checkFileAccess(req.session, fileDesc.fcbId, true))
-                    {
-                        return;
-                    }
-
-                    bool isOverwrite = args.size() > 1 && args[1] == "-o";
-
-                    cout << " 请输入内容 (以EOF或单独的.结束): " << endl;
-                    string content, line;
-                    while (getline(cin, line) && line != ".")
-                    {
-                        content += line + "\n";
-                    }
-
-                    int fcbId = fileDesc.fcbId;
-                    string fileContent = string(sharedData->fileContents[fcbId]);
-
-                    // 根据写入模式处理内容
-                    if (isOverwrite)
-                    {
-                        // 如果是覆盖模式，检查是否会超出文件大小限制
-                        size_t newSize;
-                        if (fileDesc.position + content.length() > fileContent.length())
-                        {
-                            newSize = fileDesc.position + content.length();
-                        }
-                        else
-                        {
-                            newSize = fileContent.length();
-                        }
+        if (!promoteInlineFile(fcbId))
+            return false;
+    }
 
-                        if (newSize >= sizeof(sharedData->fileContents[fcbId]))
-                        {
-                            cout << " 错误：写入后文件大小超出限制" << endl;
-                            return;
-                        }
+    if (sharedData->fileCompressed[fcbId])
+    {
+        if (length > 0 && !copyIntoFrames(fcbId, offset, data, length))
+            return false;
+        applyFileSize(fcbId, newSize);
+        return true;
+    }
 
-                        // 如果需要，扩展文件大小
-                        if (fileDesc.position > fileContent.length())
-                        {
-                            fileContent.append(fileDesc.position - fileContent.length(), '\0');
-                        }
+    if (length > 0)
+    {
+        // 只为实际写入的块分配空间，文件末尾与写入位置之间保留为空洞；
+        // 与其他文件共享的块先复制出私有块（写时复制）
+        int firstBlock = static_cast<int>(offset / BLOCK_SIZE);
+        int lastBlock = static_cast<int>((offset + length - 1) / BLOCK_SIZE);
+        if (!unshareFileBlocks(fcbId, firstBlock, lastBlock) || !mapFileBlocks(fcbId, firstBlock, lastBlock))
+            return false;
 
-                        // 覆盖内容
-                        fileContent.replace(fileDesc.position, content.length(), content);
-                    }
-                    else
-                    {
-                        // 追加模式
-                        if (fileDesc.position + content.length() >= sizeof(sharedData->fileContents[fcbId]))
-                        {
-                            cout << " 错误：写入后文件大小超出限制" << endl;
-                            return;
-                        }
+        int idx = findExtent(fcbId, firstBlock);
+        size_t pos = offset, done = 0;
+        while (done < length)
+        {
+            const Extent &e = sharedData->extents[idx++];
+            size_t extStart = static_cast<size_t>(e.fileBlock) * BLOCK_SIZE;
+            size_t extEnd = extStart + static_cast<size_t>(e.blockCount) * BLOCK_SIZE;
+            size_t n = min(extEnd - pos, length - done);
+            memcpy(sharedData->blockPool[e.startBlock] + (pos - extStart), data + done, n);
+            int firstTouched = static_cast<int>((pos - extStart) / BLOCK_SIZE);
+            invalidateBlockHashes(e.startBlock + firstTouched, static_cast<int>((pos - extStart + n - 1) / BLOCK_SIZE) - firstTouched + 1);
+            done += n;
+            pos += n;
+        }
+    }
 
-                        // 如果文件指针不在文件末尾，先移动到文件末尾
-                        if (fileDesc.position < fileContent.length())
-                        {
-                            fileContent.insert(fileDesc.position, content);
-                        }
-                        else
-                        {
-                            // 如果文件指针超出文件末尾，先填充空字符
-                            if (fileDesc.position > fileContent.length())
-                            {
-                                fileContent.append(fileDesc.position - fileContent.length(), '\0');
-                            }
-                            fileContent.append(content);
-                        }
-                    }
+    applyFileSize(fcbId, newSize);
+    return true;
+}
 
-                    // 更新文件内容
-                    strncpy(sharedData->fileContents[fcbId], fileContent.c_str(),
-                            sizeof(sharedData->fileContents[fcbId]) - 1);
-                    sharedData->fcbs[fcbId].size = fileContent.length();
-                    sharedData->fcbs[fcbId].modifyTime = time(nullptr);
+size_t MiniFMS::readFileRange(int fcbId, size_t offset, size_t length, char *out)
+{
+    lockSharedMemory();
+    size_t n = copyFromFile(fcbId, offset, length, out);
+    unlockSharedMemory();
+    return n;
+}
 
-                    // 更新文件指针位置
-                    fileDesc.position += content.length();
+size_t MiniFMS::visitFileData(int fcbId, size_t offset, size_t length, const SpanVisitor &visitor)
+{
+    // 每次只在锁内复制一段，输出到终端或外部文件等慢操作在解锁后进行，不阻塞其他进程
+    vector<char> buffer;
+    size_t done = 0;
+    while (done < length)
+    {
+        lockSharedMemory();
+        size_t size = sharedData->fcbs[fcbId].size, pos = offset + done;
+        size_t n = pos < size ? min(min(length - done, size - pos), static_cast<size_t>(FILE_VISIT_CHUNK)) : 0;
+        buffer.resize(max(buffer.size(), n));
+        n = copyFromFile(fcbId, pos, n, buffer.data());
+        unlockSharedMemory();
+        if (n == 0)
+            break;
+        done += n;
+        if (!visitor(string_view(buffer.data(), n)))
+            break;
+    }
+    return done;
+}
 
-                    cout << " 写入成功" << endl;
-                    cout << " - 写入字节数：" << content.length() << endl;
-                    cout << " - 当前文件指针位置：" << fileDesc.position << endl;
-                    cout << " - 当前文件大小：" << sharedData->fcbs[fcbId].size << endl;
+bool MiniFMS::copyFileData(int srcId, int dstId)
+{
+    lockSharedMemory();
+    bool ok = shareFileData(srcId, dstId);
+    if (ok)
+        walAppend(WAL_COPY, srcId, dstId);
+    unlockSharedMemory();
+    return ok;
+}
 
-                    sharedData->modifyCount++;
-                    dataChanged = true;
-                }
-                else
-                {
-                    cout << " 无效的文件描述符" << endl;
-                }
-            }
-            catch (const exception &e)
-            {
-                cout << " 参数错误: " << e.what() << endl;
-            }
-        }
-    }
-    else if (cmd == "copy")
+bool MiniFMS::shareFileData(int srcId, int dstId)
+{
+    bool ok = true;
+    size_t srcSize = sharedData->fcbs[srcId].size;
+    if (sharedData->fileInline[srcId])
+        return copyIntoFile(dstId, 0, sharedData->inlineData[srcId], srcSize);
+    if (sharedData->fileInline[dstId])
+        ok = promoteInlineFile(dstId);
+
+    if (ok && sharedData->fileCompressed[srcId])
     {
-        if (args.size() < 2)
-        {
-            cout << " 用法: copy [源文件名] [目标目录路径]" << endl;
-            cout << " 支持的路径格式：" << endl;
-            cout << "   - 相对路径: docs/backup/     # 当前目录下的子目录" << endl;
-            cout << "   - 上级目录: ../backup/       # 返回上级目录" << endl;
-            cout << "   - 绝对路径: /docs/backup/    # 从根目录开始" << endl;
-            cout << "   - 当前目录: ./backup/        # 当前目录" << endl;
-        }
-        else
+        // 压缩文件复制帧表项，同样只增加块引用计数；storeFrame 总是写入新块，写时复制自然成立
+        int lo = findFrame(srcId, 0), hi = findFrame(srcId + 1, 0);
+        vector<Frame> copied(sharedData->frames + lo, sharedData->frames + hi);
+        ok = sharedData->frameCount + (hi - lo) <= MAX_FRAMES;
+        if (ok)
         {
-            // 检查源文件是否存在
-            int srcId = findFCB(req.session->currentDirId, args[0]);
-            if (srcId == -1 || sharedData->fcbs[srcId].type != 0)
-            {
-                cout << " 源文件不存在: " << args[0] << endl;
-                return;
-            }
-
-            // 解析目标路径
-            string targetPath = args[1];
-            if (targetPath.empty())
-            {
-                cout << " 错误：目标路径不能为空" << endl;
-                return;
-            }
-
-            // 确保路径以/结尾
-            if (targetPath[targetPath.length() - 1] != '/')
-            {
-                targetPath += '/';
-            }
-
-            // 移除末尾的/并查找目标目录
-            string pathForSearch = targetPath.substr(0, targetPath.length() - 1);
-            int targetDirId = findFCBByPath(req.session, pathForSearch);
-            if (targetDirId == -1)
+            freeFileExtents(dstId);
+            freeFileFrames(dstId);
+            sharedData->fileCompressed[dstId] = 1;
+            int at = findFrame(dstId, 0);
+            Frame *frames = sharedData->frames;
+            memmove(frames + at + copied.size(), frames + at, sizeof(Frame) * (sharedData->frameCount - at));
+            for (size_t i = 0; i < copied.size(); ++i)
             {
-                cout << " 目标目录不存在: " << pathForSearch << endl;
-                return;
+                copied[i].fcbId = dstId;
+                for (int k = 0; k < copied[i].blockCount; ++k)
+                    sharedData->blockRefs[copied[i].blocks[k]]++;
+                frames[at + i] = copied[i];
             }
+            sharedData->frameCount += static_cast<int>(copied.size());
+            markFramesDirty(at);
+            markFcbDirty(dstId);
+            ok = copyIntoFile(dstId, srcSize, nullptr, 0);
+        }
+        return ok;
+    }
 
-            // 确认是目录
-            if (sharedData->fcbs[targetDirId].type != 1)
-            {
-                cout << " 错误：" << pathForSearch << " 不是一个目录" << endl;
-                return;
-            }
+    // 目标文件直接引用源文件的每个区段，只增加块的引用计数，任一方写入时才复制；
+    // 区段表放不下时退回逐段拷贝数据
+    vector<Extent> srcExtents;
+    for (int idx = findExtent(srcId, 0); idx < sharedData->extentCount && sharedData->extents[idx].fcbId == srcId; ++idx)
+    {
+        srcExtents.push_back(sharedData->extents[idx]);
+    }
+    for (const Extent &e : srcExtents)
+    {
+        if (!ok)
+            break;
+        if (shareFileBlocks(srcId, e.fileBlock, dstId, e.fileBlock, e.blockCount))
+            continue;
+        size_t begin = static_cast<size_t>(e.fileBlock) * BLOCK_SIZE;
+        size_t end = min(srcSize, begin + static_cast<size_t>(e.blockCount) * BLOCK_SIZE);
+        if (begin < end)
+            ok = copyIntoFile(dstId, begin, sharedData->blockPool[e.startBlock], end - begin);
+    }
+    if (ok)
+        ok = copyIntoFile(dstId, srcSize, nullptr, 0);
+    return ok;
+}
 
-            // 检查目标目录中是否已存在同名文件
-            if (findFCB(targetDirId, args[0]) != -1)
+vector<SharedRun> MiniFMS::collectSharedRuns()
+{
+    // 按区段表顺序扫描，共享块的第一个引用者负责保存内容，之后的引用者记录为指向它的共享段
+    vector<SharedRun> runs;
+    vector<pair<int, int>> owner(MAX_BLOCKS, make_pair(-1, 0));
+    for (int i = 0; i < sharedData->extentCount; ++i)
+    {
+        const Extent &e = sharedData->extents[i];
+        for (int k = 0; k < e.blockCount; ++k)
+        {
+            int block = e.startBlock + k;
+            if (sharedData->blockRefs[block] < 2)
+                continue;
+            if (owner[block].first == -1)
             {
-                cout << " 目标目录中已存在同名文件: " << args[0] << endl;
-                return;
+                owner[block] = make_pair(e.fcbId, e.fileBlock + k);
+                continue;
             }
-
-            // 在目标目录中创建新文件
-            int newFileId = createFCB(args[0], 0, req.session->user->userId, targetDirId);
-            if (newFileId != -1)
+            int srcId = owner[block].first, srcBlock = owner[block].second, dstBlock = e.fileBlock + k;
+            if (!runs.empty() && runs.back().dstId == e.fcbId && runs.back().srcId == srcId &&
+                runs.back().dstBlock + runs.back().count == dstBlock && runs.back().srcBlock + runs.back().count == srcBlock)
             {
-                // 复制文件内容
-                memcpy(sharedData->fileContents[newFileId],
-                       sharedData->fileContents[srcId],
-                       sizeof(sharedData->fileContents[srcId]));
-                sharedData->fcbs[newFileId].size = sharedData->fcbs[srcId].size;
-                sharedData->fcbs[newFileId].modifyTime = time(nullptr);
-
-                cout << " 文件复制成功: " << endl;
-                cout << " - 源文件: " << args[0] << endl;
-                cout << " - 目标位置: " << pathForSearch << "/" << args[0] << endl;
-                cout << " - 文件大小: " << sharedData->fcbs[newFileId].size << " 字节" << endl;
-
-                sharedData->modifyCount++;
-                dataChanged = true;
+                runs.back().count++;
             }
             else
             {
-                cout << " 文件复制失败" << endl;
+                runs.push_back(SharedRun{e.fcbId, dstBlock, srcId, srcBlock, 1});
             }
         }
     }
-    else if (cmd == "move")
+    return runs;
+}
+
+int MiniFMS::findFrame(int fcbId, int frame)
+{
+    int lo = 0, hi = sharedData->frameCount;
+    while (lo < hi)
     {
-        if (args.size() < 2)
+        int mid = (lo + hi) / 2;
+        const Frame &f = sharedData->frames[mid];
+        if (f.fcbId < fcbId || (f.fcbId == fcbId && f.frame < frame))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool MiniFMS::decodeFrame(const Frame &f, char *raw)
+{
+    bool ok = true;
+    if (f.packedLength == 0)
+    {
+        for (int i = 0; i < f.blockCount; ++i)
         {
-            cout << " 用法: move [源文件名] [目标目录路径]" << endl;
-            cout << " 支持的路径格式：" << endl;
-            cout << "   - 相对路径: docs/backup/     # 当前目录下的子目录" << endl;
-            cout << "   - 上级目录: ../backup/       # 返回上级目录" << endl;
-            cout << "   - 绝对路径: /docs/backup/    # 从根目录开始" << endl;
-            cout << "   - 当前目录: ./backup/        # 当前目录" << endl;
+            size_t n = min(static_cast<size_t>(BLOCK_SIZE), static_cast<size_t>(f.rawLength) - static_cast<size_t>(i) * BLOCK_SIZE);
+            memcpy(raw + static_cast<size_t>(i) * BLOCK_SIZE, sharedData->blockPool[f.blocks[i]], n);
         }
-        else
+    }
+    else
+    {
+        // 压缩数据分散在不连续的块中，先拼成一段再解压
+        char packed[FRAME_SIZE];
+        for (int i = 0; i < f.blockCount; ++i)
         {
-            // 检查源文件是否存在
-            int srcId = findFCB(req.session->currentDirId, args[0]);
-            if (srcId == -1 || sharedData->fcbs[srcId].type != 0)
-            {
-                cout << " 源文件不存在: " << args[0] << endl;
-                return;
-            }
-
-            // 解析目标路径
-            string targetPath = args[1];
-            if (targetPath.empty())
-            {
-                cout << " 错误：目标路径不能为空" << endl;
-                return;
-            }
+            memcpy(packed + static_cast<size_t>(i) * BLOCK_SIZE, sharedData->blockPool[f.blocks[i]], BLOCK_SIZE);
+        }
+        ok = lzDecompress(packed, f.packedLength, raw, FRAME_SIZE) == static_cast<size_t>(f.rawLength);
+    }
+    // 帧内有效长度之后读出为0；数据损坏时整帧按0处理
+    size_t valid = ok ? f.rawLength : 0;
+    memset(raw + valid, 0, FRAME_SIZE - valid);
+    return ok;
+}
 
-            // 确保路径以/结尾
-            if (targetPath[targetPath.length() - 1] != '/')
-            {
-                targetPath += '/';
-            }
+bool MiniFMS::storeFrame(int fcbId, int frame, const char *raw, int rawLength)
+{
+    // 末尾的0不必保存，全0的帧成为空洞
+    while (rawLength > 0 && raw[rawLength - 1] == 0)
+        rawLength--;
+
+    int idx = findFrame(fcbId, frame);
+    Frame *frames = sharedData->frames;
+    bool exists = idx < sharedData->frameCount && frames[idx].fcbId == fcbId && frames[idx].frame == frame;
+
+    // 至少省下一个块才压缩存放，否则原样存放
+    char packed[FRAME_SIZE];
+    int rawBlocks = (rawLength + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t packedLength = rawBlocks > 1 ? lzCompress(raw, rawLength, packed, static_cast<size_t>(rawBlocks - 1) * BLOCK_SIZE) : 0;
+    const char *payload = packedLength ? packed : raw;
+    size_t payloadLength = packedLength ? packedLength : static_cast<size_t>(rawLength);
+    int needed = static_cast<int>((payloadLength + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    // 旧帧只被本文件引用的块会先归还，可以计入可用空间
+    int reclaimable = 0;
+    if (exists)
+    {
+        for (int i = 0; i < frames[idx].blockCount; ++i)
+            reclaimable += sharedData->blockRefs[frames[idx].blocks[i]] == 1 ? 1 : 0;
+    }
+    if (needed > sharedData->freeBlockCount + reclaimable || (!exists && needed > 0 && sharedData->frameCount >= MAX_FRAMES))
+        return false;
 
-            // 移除末尾的/并查找目标目录
-            string pathForSearch = targetPath.substr(0, targetPath.length() - 1);
-            int targetDirId = findFCBByPath(req.session, pathForSearch);
-            if (targetDirId == -1)
-            {
-                cout << " 目标目录不存在: " << pathForSearch << endl;
-                return;
-            }
-
-            // 确认是目录
-            if (sharedData->fcbs[targetDirId].type != 1)
-            {
-                cout << " 错误：" << pathForSearch << " 不是一个目录" << endl;
-                return;
-            }
+    int goal = -1;
+    if (exists)
+    {
+        goal = frames[idx].blocks[0];
+        for (int i = 0; i < frames[idx].blockCount; ++i)
+            releaseBlocks(frames[idx].blocks[i], 1);
+    }
+    if (needed == 0)
+    {
+        if (exists)
+        {
+            memmove(frames + idx, frames + idx + 1, sizeof(Frame) * (sharedData->frameCount - idx - 1));
+            sharedData->frameCount--;
+            markFramesDirty(idx);
+        }
+        return true;
+    }
 
-            // 检查目标目录中是否已存在同名文件
-            if (findFCB(targetDirId, args[0]) != -1)
-            {
-                cout << " 目标目录中已存在同名文件: " << args[0] << endl;
-                return;
-            }
+    Frame f;
+    f.fcbId = fcbId;
+    f.frame = frame;
+    f.rawLength = rawLength;
+    f.packedLength = static_cast<int>(packedLength);
+    f.blockCount = 0;
+    while (f.blockCount < needed)
+    {
+        int got;
+        int start = allocRun(goal, needed - f.blockCount, got);
+        if (start == -1)
+            return false;
+        for (int k = 0; k < got; ++k)
+            f.blocks[f.blockCount++] = start + k;
+        goal = start + got;
+    }
+    for (int i = 0; i < needed; ++i)
+    {
+        size_t from = static_cast<size_t>(i) * BLOCK_SIZE;
+        memcpy(sharedData->blockPool[f.blocks[i]], payload + from, min(static_cast<size_t>(BLOCK_SIZE), payloadLength - from));
+    }
 
-            // 移动文件（更新父目录）
-            sharedData->fcbs[srcId].parentDir = targetDirId;
-            sharedData->fcbs[srcId].modifyTime = time(nullptr);
+    if (!exists)
+    {
+        memmove(frames + idx + 1, frames + idx, sizeof(Frame) * (sharedData->frameCount - idx));
+        sharedData->frameCount++;
+    }
+    frames[idx] = f;
+    if (exists)
+        markStoreDirty(&frames[idx], sizeof(Frame));
+    else
+        markFramesDirty(idx);
+    return true;
+}
 
-            cout << " 文件移动成功: " << endl;
-            cout << " - 源文件: " << args[0] << endl;
-            cout << " - 目标位置: " << pathForSearch << "/" << args[0] << endl;
+void MiniFMS::freeFileFrames(int fcbId)
+{
+    int lo = findFrame(fcbId, 0);
+    int hi = findFrame(fcbId + 1, 0);
+    if (lo >= hi)
+        return;
 
-            sharedData->modifyCount++;
-            dataChanged = true;
-        }
+    Frame *frames = sharedData->frames;
+    for (int i = lo; i < hi; ++i)
+    {
+        for (int k = 0; k < frames[i].blockCount; ++k)
+            releaseBlocks(frames[i].blocks[k], 1);
     }
-    else if (cmd == "flock")
+    memmove(frames + lo, frames + hi, sizeof(Frame) * (sharedData->frameCount - hi));
+    sharedData->frameCount -= hi - lo;
+    markFramesDirty(lo);
+}
+
+bool MiniFMS::copyIntoFrames(int fcbId, size_t offset, const char *data, size_t length)
+{
+    // 压缩后的大小事先未知，按每帧都不可压缩的最坏情况检查空间，保证不会写到一半失败
+    int firstFrame = static_cast<int>(offset / FRAME_SIZE);
+    int lastFrame = static_cast<int>((offset + length - 1) / FRAME_SIZE);
+    long long worst = 0;
+    int newFrames = 0;
+    for (int frame = firstFrame; frame <= lastFrame; ++frame)
     {
-        if (args.empty())
+        int idx = findFrame(fcbId, frame);
+        worst += FRAME_BLOCKS;
+        if (idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId && sharedData->frames[idx].frame == frame)
         {
-            cout << " 用法: flock [文件名]" << endl;
-            cout << " 功能: 锁定/解锁文件，将文件设置为只读状态" << endl;
-            cout << " 说明: - 锁定的文件所有用户（包括锁定者）都只能读取" << endl;
-            cout << "       - 任何用户都不能修改锁定的文件" << endl;
-            cout << "       - 只有锁定者可以解锁文件" << endl;
-            cout << "       - 使用相同命令可以解锁文件" << endl;
+            const Frame &f = sharedData->frames[idx];
+            for (int i = 0; i < f.blockCount; ++i)
+                worst -= sharedData->blockRefs[f.blocks[i]] == 1 ? 1 : 0;
         }
         else
         {
-            int fileId = findFCB(req.session->currentDirId, args[0]);
-            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
-            {
-                cout << " 文件不存在: " << args[0] << endl;
-            }
-            else
-            {
-                FCB &fcb = sharedData->fcbs[fileId];
-
-                // 检查文件是否已经被打开
-                bool isFileOpen = false;
-                for (const auto &openFile : req.session->openFiles)
-                {
-                    if (openFile.isOpen && openFile.fcbId == fileId)
-                    {
-                        isFileOpen = true;
-                        break;
-                    }
-                }
-
-                if (fcb.locked)
-                {
-                    if (fcb.lockOwner == req.session->user->userId)
-                    {
-                        fcb.locked = false;
-                        fcb.lockOwner = -1;
-                        cout << " 文件解锁成功: " << args[0] << endl;
-
-                        // 显示文件状态
-                        cout << " 当前状态：" << endl;
-                        cout << " - 锁定状态：未锁定" << endl;
-                        cout << " - 文件现在可以读写" << endl;
-                    }
-                    else
-                    {
-                        cout << " 错误：文件当前被其他用户锁定" << endl;
-                        // 显示锁定信息
-                        for (int i = 0; i < MAX_USERS; i++)
-                        {
-                            if (sharedData->users[i].isused &&
-                                sharedData->users[i].userId == fcb.lockOwner)
-                            {
-                                cout << " - 锁定者：" << sharedData->users[i].username << endl;
-                                break;
-                            }
-                        }
-                        cout << " - 锁定时间：" << formatTime(fcb.modifyTime) << endl;
-                        cout << " - 文件处于只读状态" << endl;
-                    }
-                }
-                else
-                {
-                    if (isFileOpen)
-                    {
-                        cout << " 警告：文件已打开，建议先关闭文件再加锁" << endl;
-                    }
-
-                    fcb.locked = true;
-                    fcb.lockOwner = req.session->user->userId;
-                    fcb.modifyTime = time(nullptr);
-                    cout << " 文件加锁成功: " << args[0] << endl;
-
-                    // 显示文件状态
-                    cout << " 当前状态：" << endl;
-                    cout << " - 锁定状态：已锁定（只读）" << endl;
-                    cout << " - 锁定者：" << req.session->user->username << endl;
-                    cout << " - 锁定时间：" << formatTime(fcb.modifyTime) << endl;
-                    cout << " - 所有用户（包括锁定者）只能读取此文件" << endl;
-                }
-
-                // 标记数据已修改
-                sharedData->modifyCount++;
-                dataChanged = true;
-            }
+            newFrames++;
         }
     }
-    else if (cmd == "head")
+    if (worst > sharedData->freeBlockCount || sharedData->frameCount + newFrames > MAX_FRAMES)
+        return false;
+
+    // 逐帧解压、修改、重新压缩；整帧覆盖时不必解压旧内容
+    vector<char> raw(FRAME_SIZE);
+    size_t pos = offset, done = 0;
+    while (done < length)
     {
-        if (args.size() < 2)
+        int frame = static_cast<int>(pos / FRAME_SIZE);
+        size_t within = pos - static_cast<size_t>(frame) * FRAME_SIZE;
+        size_t n = min(FRAME_SIZE - within, length - done);
+        int idx = findFrame(fcbId, frame);
+        int rawLength = 0;
+        if (idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId && sharedData->frames[idx].frame == frame)
         {
-            cout << " 用法: head -num [文件名]" << endl;
-            cout << " 示例: head -5 test.txt  # 显示文件前5行" << endl;
+            rawLength = sharedData->frames[idx].rawLength;
+            if (n < FRAME_SIZE)
+                decodeFrame(sharedData->frames[idx], raw.data());
         }
-        else
+        else if (n < FRAME_SIZE)
         {
-            try
+            fill(raw.begin(), raw.end(), 0);
+        }
+        memcpy(&raw[within], data + done, n);
+        if (!storeFrame(fcbId, frame, raw.data(), max(rawLength, static_cast<int>(within + n))))
+            return false;
+        pos += n;
+        done += n;
+    }
+    return true;
+}
+
+bool MiniFMS::setFileCompression(int fcbId, bool compressed)
+{
+    lockSharedMemory();
+    bool ok = true;
+    if (sharedData->fileCompressed[fcbId] == (compressed ? 1 : 0))
+    {
+        // 已是目标存储方式
+    }
+    else if (sharedData->fileInline[fcbId])
+    {
+        // 内联文件只记录设置，迁出内联区时按该设置存放
+        sharedData->fileCompressed[fcbId] = compressed ? 1 : 0;
+    }
+    else if (compressed)
+    {
+        // 先逐帧压缩已分配的数据，全部成功后再释放区段；空间不足时撤销已生成的帧
+        vector<int> touched;
+        for (int idx = findExtent(fcbId, 0); idx < sharedData->extentCount && sharedData->extents[idx].fcbId == fcbId; ++idx)
+        {
+            const Extent &e = sharedData->extents[idx];
+            for (int frame = e.fileBlock / FRAME_BLOCKS; frame <= (e.fileBlock + e.blockCount - 1) / FRAME_BLOCKS; ++frame)
             {
-                string numStr = args[0];
-                if (numStr[0] != '-')
-                {
-                    cout << " 参数格式错误，应为 -num" << endl;
-                    return;
-                }
-                int numLines = stoi(numStr.substr(1));
-                if (numLines <= 0)
-                {
-                    cout << " 行数必须大于0" << endl;
-                    return;
-                }
-                showFileHead(req.session, args[1], numLines);
+                if (touched.empty() || touched.back() != frame)
+                    touched.push_back(frame);
             }
-            catch (const exception &e)
+        }
+        vector<char> raw(FRAME_SIZE);
+        for (int frame : touched)
+        {
+            fill(raw.begin(), raw.end(), 0);
+            size_t n = copyFromFile(fcbId, static_cast<size_t>(frame) * FRAME_SIZE, FRAME_SIZE, raw.data());
+            if (!storeFrame(fcbId, frame, raw.data(), static_cast<int>(n)))
             {
-                cout << " 参数错误: " << e.what() << endl;
+                ok = false;
+                break;
             }
         }
+        if (ok)
+        {
+            freeFileExtents(fcbId);
+            sharedData->fileCompressed[fcbId] = 1;
+        }
+        else
+        {
+            freeFileFrames(fcbId);
+        }
     }
-    else if (cmd == "tail")
+    else
     {
-        if (args.size() < 2)
+        // 解压回区段存储，失败时释放已写入的区段，保留压缩帧
+        vector<Frame> stored;
+        for (int idx = findFrame(fcbId, 0); idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId; ++idx)
         {
-            cout << " 用法: tail -num [文件名]" << endl;
-            cout << " 示例: tail -5 test.txt  # 显示文件后5行" << endl;
+            stored.push_back(sharedData->frames[idx]);
         }
-        else
+        sharedData->fileCompressed[fcbId] = 0;
+        vector<char> raw(FRAME_SIZE);
+        for (const Frame &f : stored)
         {
-            try
-            {
-                string numStr = args[0];
-                if (numStr[0] != '-')
-                {
-                    cout << " 参数格式错误，应为 -num" << endl;
-                    return;
-                }
-                int numLines = stoi(numStr.substr(1));
-                if (numLines <= 0)
-                {
-                    cout << " 行数必须大于0" << endl;
-                    return;
-                }
-                showFileTail(req.session, args[1], numLines);
-            }
-            catch (const exception &e)
+            decodeFrame(f, raw.data());
+            if (!copyIntoFile(fcbId, static_cast<size_t>(f.frame) * FRAME_SIZE, raw.data(), f.rawLength))
             {
-                cout << " 参数错误: " << e.what() << endl;
+                ok = false;
+                break;
             }
         }
+        if (ok)
+        {
+            freeFileFrames(fcbId);
+        }
+        else
+        {
+            freeFileExtents(fcbId);
+            sharedData->fileCompressed[fcbId] = 1;
+        }
     }
-    else if (cmd == "lseek")
+    markFcbDirty(fcbId);
+    if (ok)
+        walAppend(WAL_COMPRESS, fcbId, compressed ? 1 : 0);
+    unlockSharedMemory();
+    return ok;
+}
+
+void MiniFMS::showFileStorage(int fcbId, const string &name)
+{
+    lockSharedMemory();
+    size_t size = sharedData->fcbs[fcbId].size;
+    bool isInline = sharedData->fileInline[fcbId], compressed = sharedData->fileCompressed[fcbId];
+    long long blocks = 0, sharedBlocks = 0, rawBytes = 0, packedBytes = 0;
+    int pieces = 0;
+    auto countBlock = [&](int block)
     {
-        if (args.size() < 2)
+        blocks++;
+        sharedBlocks += sharedData->blockRefs[block] > 1 ? 1 : 0;
+    };
+    if (compressed && !isInline)
+    {
+        for (int idx = findFrame(fcbId, 0); idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId; ++idx)
         {
-            cout << " 用法: lseek [文件描述符] [偏移量]" << endl;
-            cout << " 示例: lseek 0 10  # 从当前位置向后移动10个字节" << endl;
-            cout << "       lseek 0 -5  # 从当前位置向前移动5个字节" << endl;
+            const Frame &f = sharedData->frames[idx];
+            for (int i = 0; i < f.blockCount; ++i)
+                countBlock(f.blocks[i]);
+            rawBytes += f.rawLength;
+            packedBytes += f.packedLength ? f.packedLength : f.rawLength;
+            pieces++;
         }
-        else
+    }
+    else if (!isInline)
+    {
+        for (int idx = findExtent(fcbId, 0); idx < sharedData->extentCount && sharedData->extents[idx].fcbId == fcbId; ++idx)
         {
-            try
-            {
-                int fd = stoi(args[0]);
-                int offset = stoi(args[1]);
+            const Extent &e = sharedData->extents[idx];
+            for (int i = 0; i < e.blockCount; ++i)
+                countBlock(e.startBlock + i);
+            pieces++;
+        }
+    }
+    unlockSharedMemory();
 
-                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
-                    req.session->openFiles[fd].isOpen)
-                {
-                    FileDesc &fileDesc = req.session->openFiles[fd];
-                    int fcbId = fileDesc.fcbId;
+    cout << " 文件: " << name << endl;
+    cout << " - 大小: " << size << " 字节" << endl;
+    if (isInline)
+    {
+        cout << " - 存储方式: 内联（不占用数据块）" << (compressed ? "，超出内联区后压缩存放" : "") << endl;
+        return;
+    }
+    cout << " - 存储方式: " << (compressed ? "压缩（每帧 " + to_string(FRAME_SIZE / 1024) + " KB）" : string("普通区段")) << endl;
+    cout << " - 数据块: " << blocks << " 块（" << blocks * BLOCK_SIZE << " 字节），其中 " << sharedBlocks << " 块与其他文件共享" << endl;
+    if (compressed)
+    {
+        cout << " - 压缩帧: " << pieces << " 个，原始 " << rawBytes << " 字节 -> 压缩后 " << packedBytes << " 字节" << endl;
+        if (packedBytes > 0)
+            cout << " - 压缩比: " << fixed << setprecision(2) << static_cast<double>(rawBytes) / packedBytes
+                 << "（按块计 " << static_cast<double>(rawBytes) / max(1LL, blocks * BLOCK_SIZE) << "）" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+    else
+    {
+        cout << " - 区段: " << pieces << " 个" << endl;
+    }
+}
 
-                    // 检查文件访问权限
-                    if (!checkFileAccess(req.session, fcbId, true))
-                    {
-                        return;
-                    }
+uint64_t MiniFMS::blockFingerprint(int block)
+{
+    uint64_t bit = 1ULL << (block % 64);
+    if (sharedData->hashValid[block / 64] & bit)
+        return sharedData->blockHash[block];
+
+    // 按64位字做乘法-异或混合，候选块最终还要逐字节比较，指纹只需分布均匀
+    const uint64_t *words = reinterpret_cast<const uint64_t *>(sharedData->blockPool[block]);
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < BLOCK_SIZE / sizeof(uint64_t); ++i)
+    {
+        h = (h ^ words[i]) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    sharedData->blockHash[block] = h;
+    sharedData->hashValid[block / 64] |= bit;
+    return h;
+}
 
-                    // 计算新位置
-                    size_t newPosition = fileDesc.position + offset;
-                    size_t fileSize = sharedData->fcbs[fcbId].size;
+void MiniFMS::resetDedupTable()
+{
+    // 空表不重写，没有文件数据时不会提交指纹表的页面
+    if (sharedData->dedupTableUsed == 0)
+        return;
+    memset(sharedData->dedupTable, 0, sizeof(sharedData->dedupTable));
+    sharedData->dedupTableUsed = 0;
+}
 
-                    // 检查新位置是否有效
-                    if (newPosition > fileSize)
-                    {
-                        cout << " 错误：移动位置超出文件范围" << endl;
-                        cout << " - 当前位置：" << fileDesc.position << endl;
-                        cout << " - 文件大小：" << fileSize << endl;
-                        cout << " - 请求偏移：" << offset << endl;
-                        return;
-                    }
+void MiniFMS::dedupBlock(int fcbId, int fileBlock, int block)
+{
+    uint64_t h = blockFingerprint(block);
+    for (int probe = 0, slot = static_cast<int>(h & (DEDUP_TABLE_SIZE - 1)); probe < DEDUP_TABLE_SIZE;
+         ++probe, slot = (slot + 1) & (DEDUP_TABLE_SIZE - 1))
+    {
+        DedupEntry &entry = sharedData->dedupTable[slot];
+        if (entry.blockPlusOne == 0)
+        {
+            // 没有相同内容的块，登记本块
+            entry.hash = h;
+            entry.blockPlusOne = block + 1;
+            sharedData->dedupTableUsed++;
+            return;
+        }
+        int other = entry.blockPlusOne - 1;
+        if (other == block)
+            return;
+        // 表项可能已过期（块被释放或改写），以当前指纹缓存和内容为准
+        if (entry.hash != h || !blockInUse(other) || !(sharedData->hashValid[other / 64] >> (other % 64) & 1) ||
+            sharedData->blockHash[other] != h || memcmp(sharedData->blockPool[other], sharedData->blockPool[block], BLOCK_SIZE) != 0)
+            continue;
 
-                    // 更新文件指针位置
-                    fileDesc.position = newPosition;
-                    cout << " 文件指针已移动到：" << newPosition << endl;
+        // 内容相同：这个逻辑块改为引用已登记的块，原块的最后一个引用消失时归还块池
+        if (sharedData->extentCount + 2 > MAX_EXTENTS || sharedData->blockRefs[other] == USHRT_MAX)
+            return;
+        bool lastRef = sharedData->blockRefs[block] == 1;
+        unmapFileBlocks(fcbId, fileBlock, fileBlock);
+        sharedData->blockRefs[other]++;
+        insertExtent(fcbId, fileBlock, other, 1);
+        sharedData->dedupMerged++;
+        sharedData->dedupFreed += lastRef ? 1 : 0;
+        return;
+    }
+}
 
-                    // 如果需要写入内容
-                    cout << " 是否要在当前位置写入内容？(y/n): ";
-                    string choice;
-                    getline(cin, choice);
+int MiniFMS::dedupStep(int budget)
+{
+    lockSharedMemory();
+    int examined = 0;
+    while (examined < budget)
+    {
+        int idx = findExtent(sharedData->dedupCursorFcb, sharedData->dedupCursorBlock);
+        if (idx >= sharedData->extentCount)
+        {
+            // 一轮结束，下一轮从头开始并重建指纹表
+            sharedData->dedupCursorFcb = 0;
+            sharedData->dedupCursorBlock = 0;
+            sharedData->dedupSweeps++;
+            resetDedupTable();
+            break;
+        }
+        const Extent &e = sharedData->extents[idx];
+        int fileBlock = e.fcbId == sharedData->dedupCursorFcb && e.fileBlock <= sharedData->dedupCursorBlock
+                            ? sharedData->dedupCursorBlock
+                            : e.fileBlock;
+        int fcbId = e.fcbId;
+        int block = e.startBlock + (fileBlock - e.fileBlock);
+        sharedData->dedupCursorFcb = fcbId;
+        sharedData->dedupCursorBlock = fileBlock + 1;
+        examined++;
+
+        // 表太满时探测链变长，提前清空，相当于开始新一轮登记
+        if (sharedData->dedupTableUsed >= DEDUP_TABLE_SIZE * 3 / 4)
+            resetDedupTable();
+        dedupBlock(fcbId, fileBlock, block);
+    }
+    unlockSharedMemory();
+    return examined;
+}
 
-                    if (choice == "y" || choice == "Y")
-                    {
-                        if (fileDesc.mode == 0)
-                        {
-                            cout << " 错误：文件以只读模式打开" << endl;
-                            return;
-                        }
+void MiniFMS::showDedupStats()
+{
+    lockSharedMemory();
+    long long references = 0, sharedBlocks = 0, hashed = 0;
+    int usedBlocks = MAX_BLOCKS - sharedData->freeBlockCount;
+    for (int b = 0; b < MAX_BLOCKS; ++b)
+    {
+        references += sharedData->blockRefs[b];
+        sharedBlocks += sharedData->blockRefs[b] > 1 ? 1 : 0;
+    }
+    for (int w = 0; w < BITMAP_WORDS; ++w)
+    {
+        hashed += __builtin_popcountll(sharedData->hashValid[w] & sharedData->bitMap[w]);
+    }
+    long long merged = sharedData->dedupMerged, freed = sharedData->dedupFreed, sweeps = sharedData->dedupSweeps;
+    int tableUsed = sharedData->dedupTableUsed, batch = sharedData->dedupBatch, interval = sharedData->dedupIntervalMs;
+    unlockSharedMemory();
 
-                        cout << " 请输入要写入的内容：";
-                        string content;
-                        getline(cin, content);
+    cout << " 数据块共享与去重统计：" << endl;
+    cout << " - 已分配数据块：" << usedBlocks << " 块（" << static_cast<long long>(usedBlocks) * BLOCK_SIZE << " 字节）" << endl;
+    cout << " - 文件引用的数据块：" << references << " 块，其中 " << sharedBlocks << " 块被多个文件共享" << endl;
+    cout << " - 共享节省：" << (references - usedBlocks) * BLOCK_SIZE << " 字节（含写时复制的副本）" << endl;
+    cout << " - 去重累计合并：" << merged << " 块，释放 " << freed << " 块（" << freed * BLOCK_SIZE << " 字节）" << endl;
+    cout << " - 指纹缓存：" << hashed << " 块，指纹表 " << tableUsed << "/" << DEDUP_TABLE_SIZE << "，已完成 " << sweeps << " 轮扫描" << endl;
+    if (batch > 0)
+        cout << " - 节流设置：每批 " << batch << " 块，间隔 " << interval << " 毫秒" << endl;
+    else
+        cout << " - 节流设置：后台去重已关闭" << endl;
+}
 
-                        // 获取原文件内容
-                        string fileContent = string(sharedData->fileContents[fcbId]);
+void MiniFMS::startScrub()
+{
+    lockSharedMemory();
+    bool running = sharedData->scrubActive != 0;
+    if (!running)
+    {
+        sharedData->scrubActive = 1;
+        sharedData->scrubCursor = 0;
+        sharedData->scrubChecked = sharedData->scrubSealed = 0;
+        sharedData->scrubErrors = sharedData->scrubStructErrors = 0;
+        sharedData->scrubBadCount = 0;
+        sharedData->scrubStartTime = time(nullptr);
+        sharedData->scrubEndTime = 0;
+    }
+    unlockSharedMemory();
 
-                        // 在指定位置插入新内容
-                        if (newPosition == fileSize)
-                        {
-                            fileContent += content;
-                        }
-                        else
-                        {
-                            fileContent.insert(newPosition, content);
-                        }
+    if (running)
+        cout << " 后台校验已在进行中，用 verify status 查看进度" << endl;
+    else
+        cout << " 已开始后台校验：空闲时每批检查 " << SCRUB_BATCH << " 块，用 verify status 查看进度与结果" << endl;
+}
 
-                        // 检查文件大小限制
-                        if (fileContent.length() >= sizeof(sharedData->fileContents[fcbId]))
-                        {
-                            cout << " 错误：写入后文件大小超出限制" << endl;
-                            return;
-                        }
+int MiniFMS::scrubStep(int budget)
+{
+    // 每批在锁内完成：写入路径在同一个锁内修改块内容并使校验值失效，扫描不会看到写了一半的块
+    lockSharedMemory();
+    if (!sharedData->scrubActive)
+    {
+        unlockSharedMemory();
+        return 0;
+    }
+    int examined = 0, b = sharedData->scrubCursor;
+    for (; b < MAX_BLOCKS && examined < budget; ++b)
+    {
+        if (!blockInUse(b))
+            continue;
+        examined++;
+        if (!((sharedData->crcValid[b / 64] >> (b % 64)) & 1))
+        {
+            // 写入后还没有封存的块只能记录当前内容
+            sealBlock(b);
+            sharedData->scrubSealed++;
+            continue;
+        }
+        sharedData->scrubChecked++;
+        if (crc32c(sharedData->blockPool[b], BLOCK_SIZE) != sharedData->blockCrc[b])
+        {
+            if (sharedData->scrubBadCount < SCRUB_BAD_LIST)
+                sharedData->scrubBadBlocks[sharedData->scrubBadCount++] = b;
+            sharedData->scrubErrors++;
+        }
+    }
+    sharedData->scrubCursor = b;
+    if (b >= MAX_BLOCKS)
+    {
+        sharedData->scrubStructErrors = countReferenceErrors();
+        sharedData->scrubActive = 0;
+        sharedData->scrubRounds++;
+        sharedData->scrubEndTime = time(nullptr);
+    }
+    unlockSharedMemory();
+    return examined;
+}
 
-                        // 更新文件内容
-                        strncpy(sharedData->fileContents[fcbId], fileContent.c_str(),
-                                sizeof(sharedData->fileContents[fcbId]) - 1);
-                        sharedData->fcbs[fcbId].size = fileContent.length();
-                        sharedData->fcbs[fcbId].modifyTime = time(nullptr);
+long long MiniFMS::countReferenceErrors(bool allocated)
+{
+    long long errors = 0;
+    auto validFile = [this](int id)
+    { return id >= 0 && id < MAX_FCBS && sharedData->fcbs[id].isused && sharedData->fcbs[id].type == 0; };
+    auto validDir = [this](int id)
+    { return id >= 0 && id < MAX_FCBS && sharedData->fcbs[id].isused && sharedData->fcbs[id].type == 1; };
+    auto validBlock = [this, allocated](int block)
+    { return block >= 0 && block < MAX_BLOCKS && (!allocated || blockInUse(block)); };
+    for (int i = 0; i < sharedData->extentCount; ++i)
+    {
+        const Extent &e = sharedData->extents[i];
+        bool ok = validFile(e.fcbId) && !sharedData->fileCompressed[e.fcbId] && e.blockCount > 0;
+        for (int k = 0; ok && k < e.blockCount; ++k)
+            ok = validBlock(e.startBlock + k);
+        errors += ok ? 0 : 1;
+    }
+    for (int i = 0; i < sharedData->frameCount; ++i)
+    {
+        const Frame &f = sharedData->frames[i];
+        bool ok = validFile(f.fcbId) && sharedData->fileCompressed[f.fcbId] && f.blockCount >= 0 && f.blockCount <= FRAME_BLOCKS;
+        for (int k = 0; ok && k < f.blockCount; ++k)
+            ok = validBlock(f.blocks[k]);
+        errors += ok ? 0 : 1;
+    }
+    // 根目录必须存在，其余每个FCB的父目录必须是在用的目录，每个用户的根目录同样
+    errors += validDir(0) ? 0 : 1;
+    for (int i = 1; i < MAX_FCBS; ++i)
+    {
+        if (sharedData->fcbs[i].isused)
+            errors += (sharedData->fcbs[i].type == 0 || sharedData->fcbs[i].type == 1) && validDir(sharedData->fcbs[i].parentDir) ? 0 : 1;
+    }
+    for (int i = 0; i < MAX_USERS; ++i)
+    {
+        if (sharedData->users[i].isused)
+            errors += validDir(sharedData->users[i].rootDirId) ? 0 : 1;
+    }
+    return errors;
+}
 
-                        // 更新文件指针位置
-                        fileDesc.position += content.length();
+void MiniFMS::showScrubStatus()
+{
+    const char *kernelName = nullptr;
+    crc32cKernel(&kernelName);
 
-                        cout << " 内容写入成功" << endl;
-                        cout << " - 当前文件指针位置：" << fileDesc.position << endl;
-                        cout << " - 当前文件大小：" << sharedData->fcbs[fcbId].size << endl;
+    lockSharedMemory();
+    long long sealedBlocks = 0;
+    int usedBlocks = MAX_BLOCKS - sharedData->freeBlockCount;
+    for (int w = 0; w < BITMAP_WORDS; ++w)
+        sealedBlocks += __builtin_popcountll(sharedData->crcValid[w] & sharedData->bitMap[w]);
+    bool active = sharedData->scrubActive != 0;
+    int cursor = sharedData->scrubCursor;
+    long long checked = sharedData->scrubChecked, sealed = sharedData->scrubSealed, errors = sharedData->scrubErrors;
+    long long structErrors = sharedData->scrubStructErrors, rounds = sharedData->scrubRounds;
+    time_t startTime = static_cast<time_t>(sharedData->scrubStartTime), endTime = static_cast<time_t>(sharedData->scrubEndTime);
+    // 不一致的块按区段表和帧表找出所属文件
+    vector<pair<int, string>> bad;
+    for (int k = 0; k < sharedData->scrubBadCount; ++k)
+    {
+        int block = sharedData->scrubBadBlocks[k];
+        string owner;
+        for (int i = 0; i < sharedData->extentCount && owner.empty(); ++i)
+        {
+            const Extent &e = sharedData->extents[i];
+            if (block >= e.startBlock && block < e.startBlock + e.blockCount)
+                owner = sharedData->fcbs[e.fcbId].name;
+        }
+        for (int i = 0; i < sharedData->frameCount && owner.empty(); ++i)
+        {
+            const Frame &f = sharedData->frames[i];
+            if (find(f.blocks, f.blocks + f.blockCount, block) != f.blocks + f.blockCount)
+                owner = sharedData->fcbs[f.fcbId].name;
+        }
+        bad.push_back(make_pair(block, owner.empty() ? string("（未被引用）") : owner));
+    }
+    unlockSharedMemory();
 
-                        sharedData->modifyCount++;
-                        dataChanged = true;
-                    }
-                }
-                else
-                {
-                    cout << " 无效的文件描述符" << endl;
-                }
-            }
-            catch (const std::invalid_argument &e)
-            {
-                cout << " 参数必须是数字" << endl;
-            }
-            catch (const std::out_of_range &e)
+    cout << " 数据校验（CRC32C，" << kernelName << " 内核）：" << endl;
+    cout << " - 已封存校验值：" << sealedBlocks << "/" << usedBlocks << " 个已分配块" << endl;
+    if (startTime == 0)
+    {
+        cout << " - 尚未运行过 verify" << endl;
+        return;
+    }
+    if (active)
+        cout << " - 状态：进行中，已扫描到第 " << cursor << "/" << MAX_BLOCKS << " 块" << endl;
+    else
+        cout << " - 状态：已完成（" << formatTime(endTime) << "，累计 " << rounds << " 轮）" << endl;
+    cout << " - 本轮：比较 " << checked << " 块，新封存 " << sealed << " 块，校验不一致 " << errors << " 块";
+    if (!active)
+        cout << "，引用错误 " << structErrors << " 处";
+    cout << endl;
+    for (const auto &entry : bad)
+        cout << "   块 " << entry.first << " 内容与校验值不符，所属文件: " << entry.second << endl;
+    if (errors > static_cast<long long>(bad.size()))
+        cout << "   ……另有 " << errors - static_cast<long long>(bad.size()) << " 块" << endl;
+}
+
+void MiniFMS::defragFcbOrder(vector<int> &order)
+{
+    // 从根目录按层遍历：每个目录的子项整体相邻，且与有序目录索引一样按名称排列
+    vector<char> &placed = defragFcbMark;
+    if (placed.empty())
+        placed.assign(MAX_FCBS, 0);
+    order.clear();
+    if (sharedData->fcbUsed[0])
+    {
+        order.push_back(0);
+        placed[0] = 1;
+    }
+    for (size_t head = 0; head < order.size(); ++head)
+    {
+        int dir = order[head];
+        if (sharedData->fcbType[dir] != 1)
+            continue;
+        for (int i = nameIndexLowerBound(dir, ""); i < sharedData->nameIndexCount; ++i)
+        {
+            int child = sharedData->nameIndex[i];
+            if (sharedData->fcbParent[child] != dir)
+                break;
+            if (!placed[child])
             {
-                cout << " 参数超出范围" << endl;
+                placed[child] = 1;
+                order.push_back(child);
             }
         }
     }
-    else if (cmd == "cd")
+    // 不在目录树中的FCB（正常情况下不存在）保持相对顺序排在最后
+    for (int i = 0; i < MAX_FCBS; ++i)
     {
-        if (args.empty())
+        if (sharedData->fcbUsed[i] && !placed[i])
+            order.push_back(i);
+    }
+    for (int id : order)
+        placed[id] = 0;
+}
+
+void MiniFMS::defragBlockOrder(const vector<int> &order, vector<int> &blocks)
+{
+    // 按FCB目标顺序排列各文件的物理块，文件内按逻辑顺序；共享块只在第一次出现时计入
+    vector<char> &seen = defragBlockMark;
+    if (seen.empty())
+        seen.assign(MAX_BLOCKS, 0);
+    blocks.clear();
+    auto add = [&](int block)
+    {
+        if (block >= 0 && block < MAX_BLOCKS && !seen[block])
         {
-            cout << " 用法: cd [目录名]" << endl;
+            seen[block] = 1;
+            blocks.push_back(block);
         }
-        else
+    };
+    for (int id : order)
+    {
+        if (sharedData->fcbType[id] != 0)
+            continue;
+        if (sharedData->fileCompressed[id])
         {
-            if (args[0] == "..")
-            {
-                if (req.session->currentDirId != req.session->user->rootDirId)
-                {
-                    int parentId = sharedData->fcbs[req.session->currentDirId].parentDir;
-                    if (parentId >= 0)
-                    {
-                        req.session->currentDirId = parentId;
-                        cout << " 已切换到上级目录" << endl;
-                    }
-                }
-                else
-                {
-                    cout << " 已在根目录" << endl;
-                }
-            }
-            else
+            for (int i = findFrame(id, 0); i < sharedData->frameCount && sharedData->frames[i].fcbId == id; ++i)
             {
-                int targetDir = findFCB(req.session->currentDirId, args[0]);
-                if (targetDir != -1 && sharedData->fcbs[targetDir].type == 1)
-                {
-                    req.session->currentDirId = targetDir;
-                    sharedData->fcbs[targetDir].accessTime = time(nullptr);
-                    cout << " 已切换到目录: " << args[0] << endl;
-                }
-                else
-                {
-                    cout << " 目录不存在: " << args[0] << endl;
-                }
+                const Frame &f = sharedData->frames[i];
+                for (int k = 0; k < f.blockCount; ++k)
+                    add(f.blocks[k]);
             }
+            continue;
+        }
+        int hi = extentUpperBound(id, INT_MAX);
+        for (int i = extentUpperBound(id - 1, INT_MAX); i < hi; ++i)
+        {
+            const Extent &e = sharedData->extents[i];
+            for (int k = 0; k < e.blockCount; ++k)
+                add(e.startBlock + k);
         }
     }
-    else if (cmd.empty())
+    for (int block : blocks)
+        seen[block] = 0;
+}
+
+bool MiniFMS::fcbRelocationAllowed()
+{
+    // 其他进程必须已应用上一批重定位，且没有正在执行的命令
+    for (int i = 0; i < MAX_PROCESSES; ++i)
     {
-        // 空命令不处理
+        if (i == currentProcessId || !sharedData->processActive[i] || sharedData->relocAck[i] < 0)
+            continue;
+        if (sharedData->relocAck[i] != sharedData->relocGen || sharedData->processBusy[i])
+            return false;
     }
-    else if (cmd == "import")
+    return true;
+}
+
+void MiniFMS::relocateFcbs(const vector<int> &to)
+{
+    // 与 fcbs[] 并行的数组按置换 to 逐环交换，只触碰位置变化的槽位
+    vector<char> &done = defragFcbMark;
+    if (done.empty())
+        done.assign(MAX_FCBS, 0);
+    auto permute = [&](auto *arr)
     {
-        if (args.empty())
+        fill(done.begin(), done.end(), 0);
+        for (int i = 0; i < MAX_FCBS; ++i)
         {
-            cout << " 用法: import [外部文件路径] [系统内文件名]" << endl;
-            cout << " 说明: 将外部文件导入到文件系统中" << endl;
-            return;
+            if (done[i] || to[i] == i)
+                continue;
+            done[i] = 1;
+            for (int j = to[i]; j != i; j = to[j])
+            {
+                swap(arr[i], arr[j]);
+                done[j] = 1;
+            }
         }
-
-        string externalPath = args[0];
-        string internalName = args.size() > 1 ? args[1] : externalPath.substr(externalPath.find_last_of("/\\") + 1);
-        importFile(req.session, externalPath, internalName);
+    };
+    vector<Extent> oldExtents(sharedData->extents, sharedData->extents + sharedData->extentCount);
+    vector<Frame> oldFrames(sharedData->frames, sharedData->frames + sharedData->frameCount);
+    permute(sharedData->fcbs);
+    permute(sharedData->fcbUsed);
+    permute(sharedData->fcbType);
+    permute(sharedData->fcbParent);
+    permute(sharedData->links);
+    permute(sharedData->subtreeBytes);
+    permute(sharedData->subtreeFiles);
+    permute(sharedData->fileInline);
+    permute(sharedData->inlineData);
+    permute(sharedData->fileCompressed);
+    fill(done.begin(), done.end(), 0);
+
+    // 修正所有引用FCB ID的字段
+    auto map = [&to](int id)
+    { return id >= 0 && id < MAX_FCBS ? to[id] : id; };
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        int parent = sharedData->fcbs[i].parentDir;
+        sharedData->fcbs[i].parentDir = map(parent);
+        if (to[i] != i || sharedData->fcbs[i].parentDir != parent)
+            markFcbDirty(i);
+        sharedData->fcbParent[i] = map(sharedData->fcbParent[i]);
+        DirLink &link = sharedData->links[i];
+        link.firstChild = map(link.firstChild);
+        link.lastChild = map(link.lastChild);
+        link.nextSibling = map(link.nextSibling);
+        link.prevSibling = map(link.prevSibling);
     }
-    else if (cmd == "export")
+    for (int i = 0; i < MAX_USERS; ++i)
     {
-        if (args.empty())
+        if (sharedData->users[i].isused && map(sharedData->users[i].rootDirId) != sharedData->users[i].rootDirId)
         {
-            cout << " 用法: export [系统内文件名] [外部文件路径]" << endl;
-            cout << " 说明: 将文件系统中的文件导出到外部" << endl;
-            return;
+            sharedData->users[i].rootDirId = map(sharedData->users[i].rootDirId);
+            markUserDirty(i);
         }
-
-        string internalName = args[0];
-        string externalPath = args.size() > 1 ? args[1] : internalName;
-        exportFile(req.session, internalName, externalPath);
     }
-    else if (cmd == "processes" || cmd == "ps")
+    for (int i = 0; i < sharedData->extentCount; ++i)
     {
-        showConnectedProcesses();
+        sharedData->extents[i].fcbId = map(sharedData->extents[i].fcbId);
     }
-    else
+    sort(sharedData->extents, sharedData->extents + sharedData->extentCount, [](const Extent &a, const Extent &b)
+         { return a.fcbId != b.fcbId ? a.fcbId < b.fcbId : a.fileBlock < b.fileBlock; });
+    for (int i = 0; i < sharedData->frameCount; ++i)
     {
-        cout << " " << cmd << ": command not found" << endl;
-        cout << " 输入 'help' 查看可用命令" << endl;
+        sharedData->frames[i].fcbId = map(sharedData->frames[i].fcbId);
     }
+    sort(sharedData->frames, sharedData->frames + sharedData->frameCount, [](const Frame &a, const Frame &b)
+         { return a.fcbId != b.fcbId ? a.fcbId < b.fcbId : a.frame < b.frame; });
+    markChangedRecords(oldExtents, sharedData->extents, sharedData->extentCount);
+    markChangedRecords(oldFrames, sharedData->frames, sharedData->frameCount);
+    rebuildNameIndex();
+    rebuildDirHash();
+    rebuildFreeFcbList(); // 最小的空闲槽位在栈顶，新建的FCB紧接在整理好的区域之后
+    sharedData->dedupCursorFcb = 0;
+    sharedData->dedupCursorBlock = 0;
+
+    walAppend(WAL_RELOC, -1, 0, 0, to.data(), sizeof(int) * MAX_FCBS);
+
+    // 发布重定位表；目录结构没有变化，路径缓存仍然有效
+    memcpy(sharedData->relocMap, to.data(), sizeof(int) * MAX_FCBS);
+    sharedData->relocGen++;
+    applyRelocation();
 }
 
-void MiniFMS::run()
+void MiniFMS::applyRelocation()
 {
-    cout << "\n正在启动 MiniFMS Pro...\n"
-         << endl;
-
-    while (!shouldExit)
+    if (currentProcessId < 0 || sharedData->relocAck[currentProcessId] < 0 ||
+        sharedData->relocAck[currentProcessId] == sharedData->relocGen)
+        return;
+    auto map = [this](int id)
+    { return id >= 0 && id < MAX_FCBS ? sharedData->relocMap[id] : id; };
+    currentSession.currentDirId = map(currentSession.currentDirId);
+    currentSession.pathDirId = map(currentSession.pathDirId);
+    for (FileDesc &desc : currentSession.openFiles)
     {
-        cout << "\n╔════════════════════════════════╗" << endl;
-        cout << "║    MiniFMS " << VERSION << "                ║" << endl;
-        cout << "║        文件管理系统              ║" << endl;
-        cout << "╠════════════════════════════════╣" << endl;
-        cout << "║  1.  用户注册                  ║" << endl;
-        cout << "║  2.  用户登录                  ║" << endl;
-        cout << "║  0.  退出系统                  ║" << endl;
-        cout << "╚════════════════════════════════╝" << endl;
-        cout << "\n请输入选项 (0-2): ";
+        desc.fcbId = map(desc.fcbId);
+    }
+    dentryCache.clear();
+    dentryCacheGen = -1;
+    sharedData->relocAck[currentProcessId] = sharedData->relocGen;
+}
 
-        string input;
-        if (!getline(cin, input))
+bool MiniFMS::relocateBlocks(const vector<int> &content, const vector<int> &newPos, const vector<int> &moved)
+{
+    // 先按新位置生成区段表：区段在移动边界处拆开，逻辑与物理都相邻的片段合并；超出容量则放弃本批
+    vector<Extent> rebuilt;
+    rebuilt.reserve(sharedData->extentCount + 16);
+    for (int i = 0; i < sharedData->extentCount; ++i)
+    {
+        const Extent &e = sharedData->extents[i];
+        for (int k = 0; k < e.blockCount; ++k)
         {
-            cout << "\n输入错误，正在保存数据..." << endl;
-            shouldExit = true;
-            break;
+            int block = newPos[e.startBlock + k];
+            if (!rebuilt.empty())
+            {
+                Extent &last = rebuilt.back();
+                if (last.fcbId == e.fcbId && last.fileBlock + last.blockCount == e.fileBlock + k &&
+                    last.startBlock + last.blockCount == block)
+                {
+                    last.blockCount++;
+                    continue;
+                }
+            }
+            Extent piece;
+            piece.fcbId = e.fcbId;
+            piece.fileBlock = e.fileBlock + k;
+            piece.startBlock = block;
+            piece.blockCount = 1;
+            rebuilt.push_back(piece);
         }
-
-        int choice;
-        try
+    }
+    if (static_cast<int>(rebuilt.size()) > MAX_EXTENTS)
+        return false;
+    vector<Extent> oldExtents(sharedData->extents, sharedData->extents + sharedData->extentCount);
+    memcpy(sharedData->extents, rebuilt.data(), sizeof(Extent) * rebuilt.size());
+    sharedData->extentCount = static_cast<int>(rebuilt.size());
+    markChangedRecords(oldExtents, sharedData->extents, sharedData->extentCount);
+    for (int i = 0; i < sharedData->frameCount; ++i)
+    {
+        Frame &f = sharedData->frames[i];
+        bool moved = false;
+        for (int k = 0; k < f.blockCount; ++k)
         {
-            choice = stoi(input);
-        }
-        catch (...)
-        {
-            cout << "\n无效的输入，请输入0-2之间的数字" << endl;
-            continue;
+            moved |= newPos[f.blocks[k]] != f.blocks[k];
+            f.blocks[k] = newPos[f.blocks[k]];
         }
+        if (moved)
+            markStoreDirty(&f, sizeof(Frame));
+    }
+    for (int i = 0; i < DEDUP_TABLE_SIZE && sharedData->dedupTableUsed > 0; ++i)
+    {
+        DedupEntry &entry = sharedData->dedupTable[i];
+        if (entry.blockPlusOne > 0)
+            entry.blockPlusOne = newPos[entry.blockPlusOne - 1] + 1;
+    }
 
-        if (choice == 1)
+    // 块内容与元数据逐环移动，只复制原来已分配的块；移动后空出的块残留旧数据，能归还物理页的直接归还
+    struct BlockMeta
+    {
+        bool used, hashed, sealed;
+        unsigned short refs;
+        uint64_t hash;
+        uint32_t crc;
+    };
+    auto load = [this](int b)
+    {
+        uint64_t bit = 1ULL << (b % 64);
+        BlockMeta m;
+        m.used = (sharedData->bitMap[b / 64] & bit) != 0;
+        m.hashed = (sharedData->hashValid[b / 64] & bit) != 0;
+        m.sealed = (sharedData->crcValid[b / 64] & bit) != 0;
+        m.refs = sharedData->blockRefs[b];
+        m.hash = sharedData->blockHash[b];
+        m.crc = sharedData->blockCrc[b];
+        return m;
+    };
+    vector<int> vacated;
+    auto store = [&](int b, const BlockMeta &m)
+    {
+        uint64_t bit = 1ULL << (b % 64);
+        sharedData->blockRefs[b] = m.refs;
+        sharedData->blockHash[b] = m.hash;
+        sharedData->hashValid[b / 64] = m.hashed ? sharedData->hashValid[b / 64] | bit : sharedData->hashValid[b / 64] & ~bit;
+        sharedData->blockCrc[b] = m.crc;
+        sharedData->crcValid[b / 64] = m.sealed ? sharedData->crcValid[b / 64] | bit : sharedData->crcValid[b / 64] & ~bit;
+        if (m.used)
         {
-            cout << "\n=== 用户注册 ===" << endl;
-            cout << "请输入用户名: ";
-            string username;
-            if (!getline(cin, username) || username.empty())
-            {
-                cout << "用户名不能为空！" << endl;
-                continue;
-            }
-
-            cout << "请输入密码: ";
-            string password;
-            if (!getline(cin, password) || password.empty())
-            {
-                cout << "密码不能为空！" << endl;
-                continue;
-            }
-
-            registerUser(username, password);
+            sharedData->bitMap[b / 64] |= bit;
+            sharedData->staleBitmap[b / 64] &= ~bit;
         }
-        else if (choice == 2)
+        else
         {
-            cout << "\n=== 用户登录 ===" << endl;
-            cout << "用户名: ";
-            string username;
-            if (!getline(cin, username) || username.empty())
+            sharedData->bitMap[b / 64] &= ~bit;
+            sharedData->staleBitmap[b / 64] |= bit;
+            vacated.push_back(b);
+        }
+    };
+    vector<char> &visited = defragBlockMark;
+    if (visited.empty())
+        visited.assign(MAX_BLOCKS, 0);
+    char saved[BLOCK_SIZE];
+    for (int s : moved)
+    {
+        if (visited[s] || content[s] == s)
+            continue;
+        BlockMeta first = load(s);
+        if (first.used)
+            memcpy(saved, sharedData->blockPool[s], BLOCK_SIZE);
+        for (int cur = s;;)
+        {
+            visited[cur] = 1;
+            int src = content[cur];
+            BlockMeta m = src == s ? first : load(src);
+            store(cur, m);
+            if (m.used)
             {
-                cout << "用户名不能为空！" << endl;
-                continue;
+                memcpy(sharedData->blockPool[cur], src == s ? saved : sharedData->blockPool[src], BLOCK_SIZE);
+                markBlocksDirty(cur, 1);
             }
+            if (src == s)
+                break;
+            cur = src;
+        }
+    }
+    for (int s : moved)
+        visited[s] = 0;
+    sort(vacated.begin(), vacated.end());
+    for (size_t i = 0; i < vacated.size();)
+    {
+        size_t j = i + 1;
+        while (j < vacated.size() && vacated[j] == vacated[j - 1] + 1)
+            ++j;
+        if (discardBlocks(vacated[i], static_cast<int>(j - i)))
+        {
+            for (size_t k = i; k < j; ++k)
+                sharedData->staleBitmap[vacated[k] / 64] &= ~(1ULL << (vacated[k] % 64));
+        }
+        i = j;
+    }
+    sharedData->layoutGen++;
+    return true;
+}
 
-            cout << "密码: ";
-            string password;
-            if (!getline(cin, password) || password.empty())
-            {
-                cout << "密码不能为空！" << endl;
-                continue;
-            }
+int MiniFMS::defragStep(int budget, bool &blocked)
+{
+    lockSharedMemory();
+    int moves = 0;
+    vector<int> &order = defragOrder, &touched = defragTouched;
+    defragFcbOrder(order);
+
+    // FCB：第 p 个目标槽位放 order[p]，占着该槽位的FCB换到它原来的位置；
+    // 有需要移动的FCB却不能发布重定位、或数据块被快照固定时，blocked 告诉调用者稍后重试
+    vector<int> &slot = defragSlot, &at = defragAt;
+    if (slot.empty())
+    {
+        slot.resize(MAX_FCBS);
+        at.resize(MAX_FCBS);
+        iota(slot.begin(), slot.end(), 0);
+        iota(at.begin(), at.end(), 0);
+    }
+    touched.clear();
+    int fcbMoves = 0;
+    for (int p = 0; p < static_cast<int>(order.size()) && fcbMoves < budget; ++p)
+    {
+        int want = order[p], from = slot[want], other = at[p];
+        if (from == p)
+            continue;
+        touched.push_back(p);
+        touched.push_back(from);
+        at[p] = want;
+        at[from] = other;
+        slot[want] = p;
+        slot[other] = from;
+        fcbMoves += 1 + sharedData->fcbUsed[other];
+    }
+    bool fcbBlocked = fcbMoves > 0 && !fcbRelocationAllowed();
+    blocked = fcbBlocked;
+    if (fcbMoves > 0 && !fcbBlocked)
+    {
+        relocateFcbs(slot);
+        for (int &id : order)
+            id = slot[id];
+        sharedData->defragFcbMoves += fcbMoves;
+        moves += fcbMoves;
+    }
+    // 置换表改动过的位置恰是 touched 中的槽位，复原为恒等排列供下一批使用
+    for (int p : touched)
+    {
+        slot[p] = p;
+        at[p] = p;
+    }
 
-            User *user = loginUser(username, password);
-            if (user)
-            {
-                currentSession.user = user;
-                currentSession.active = true;
-                currentSession.currentDirId = user->rootDirId;
+    // 数据块：同样逐个放到目标位置，被占用的块与之交换
+    vector<int> &blocks = defragBlocks;
+    defragBlockOrder(order, blocks);
+    vector<int> &content = defragContent, &where = defragWhere;
+    if (content.empty())
+    {
+        content.resize(MAX_BLOCKS);
+        where.resize(MAX_BLOCKS);
+        iota(content.begin(), content.end(), 0);
+        iota(where.begin(), where.end(), 0);
+    }
+    touched.clear();
+    int blockMoves = 0;
+    for (int p = 0; p < static_cast<int>(blocks.size()) && blockMoves < budget; ++p)
+    {
+        int want = blocks[p], from = where[want], other = content[p];
+        if (from == p)
+            continue;
+        touched.push_back(p);
+        touched.push_back(from);
+        content[p] = want;
+        content[from] = other;
+        where[want] = p;
+        where[other] = from;
+        blockMoves += 1 + (blockInUse(other) ? 1 : 0);
+    }
+    // 其他进程写快照期间按块号读取固定的数据块，这时不搬动
+    bool pinned = false;
+    for (int i = 0; i < MAX_PROCESSES; ++i)
+        pinned = pinned || (sharedData->processActive[i] && sharedData->snapshotPinned[i]);
+    blocked = blocked || (blockMoves > 0 && pinned);
+    if (blockMoves > 0 && !pinned && relocateBlocks(content, where, touched))
+    {
+        sharedData->defragBlockMoves += blockMoves;
+        moves += blockMoves;
+    }
+    for (int p : touched)
+    {
+        content[p] = p;
+        where[p] = p;
+    }
+    unlockSharedMemory();
+    return moves;
+}
 
-                // 启动自动保存线程
-                autoSaveThreadHandle = thread(&MiniFMS::autoSaveThread, this);
+void MiniFMS::showDefragStats()
+{
+    lockSharedMemory();
+    const vector<int> &order = defragOrder, &blocks = defragBlocks;
+    defragFcbOrder(defragOrder);
+    defragBlockOrder(order, defragBlocks);
+    int fcbCount = static_cast<int>(order.size());
+    int fcbMisplaced = 0, highest = 0, blockMisplaced = 0, files = 0, scattered = 0;
+    for (int p = 0; p < static_cast<int>(order.size()); ++p)
+    {
+        fcbMisplaced += order[p] != p;
+        highest = max(highest, order[p]);
+    }
+    for (int p = 0; p < static_cast<int>(blocks.size()); ++p)
+    {
+        blockMisplaced += blocks[p] != p;
+    }
+    // 数据不连续的文件：相邻两段区段物理上不相接
+    const Extent *ext = sharedData->extents;
+    for (int i = 0; i < sharedData->extentCount;)
+    {
+        bool contiguous = true;
+        int j = i + 1;
+        for (; j < sharedData->extentCount && ext[j].fcbId == ext[i].fcbId; ++j)
+            contiguous &= ext[j - 1].startBlock + ext[j - 1].blockCount == ext[j].startBlock;
+        files++;
+        scattered += contiguous ? 0 : 1;
+        i = j;
+    }
+    int extentCount = sharedData->extentCount, usedBlocks = MAX_BLOCKS - sharedData->freeBlockCount;
+    int batch = sharedData->defragBatch, interval = sharedData->defragIntervalMs;
+    long long fcbMoves = sharedData->defragFcbMoves, blockMoves = sharedData->defragBlockMoves;
+    unlockSharedMemory();
 
-                // 启动磁盘维护线程
-                diskMaintenanceThreadHandle = thread(&MiniFMS::diskMaintenanceThread, this);
+    cout << " 碎片整理统计：" << endl;
+    cout << " - FCB表：使用 " << fcbCount << " 个槽位，最高槽位 " << highest << "，不在目标位置 " << fcbMisplaced << " 个" << endl;
+    cout << " - 块池：已分配 " << usedBlocks << " 块，区段 " << extentCount << " 个，" << files << " 个文件中 "
+         << scattered << " 个数据不连续，不在目标位置 " << blockMisplaced << " 块" << endl;
+    cout << " - 累计移动：FCB " << fcbMoves << " 次，数据块 " << blockMoves << " 次" << endl;
+    if (batch > 0)
+        cout << " - 节流设置：每批 " << batch << " 次移动，间隔 " << interval << " 毫秒" << endl;
+    else
+        cout << " - 节流设置：后台整理已关闭" << endl;
+}
 
-                // 进入用户交互
-                userInteractionThread(currentSession);
+size_t MiniFMS::countFileLines(int fcbId)
+{
+    // 与 getline 的分行方式一致：末尾没有换行符的最后一段也算一行
+    size_t lines = 0;
+    char last = '\n';
+    visitFileData(fcbId, 0, string::npos, [&](string_view span)
+                  {
+                      lines += count(span.begin(), span.end(), '\n');
+                      last = span.back();
+                      return true; });
+    return lines + (last != '\n' ? 1 : 0);
+}
 
-                // 等待线程结束
-                cleanup();
+vector<string> MiniFMS::readFileLines(int fcbId, size_t firstLine, size_t maxLines)
+{
+    // 分段扫描文件内容，只保留需要的行，凑够行数即停止
+    vector<string> lines;
+    size_t lineNo = 0;
+    string line;
+    visitFileData(fcbId, 0, string::npos, [&](string_view span)
+                  {
+                      while (!span.empty() && lines.size() < maxLines)
+                      {
+                          size_t nl = span.find('\n');
+                          if (lineNo >= firstLine)
+                              line.append(span.substr(0, nl));
+                          if (nl == string_view::npos)
+                              break;
+                          if (lineNo++ >= firstLine)
+                              lines.push_back(move(line));
+                          line.clear();
+                          span.remove_prefix(nl + 1);
+                      }
+                      return lines.size() < maxLines; });
+    if (!line.empty() && lines.size() < maxLines)
+        lines.push_back(move(line));
+    return lines;
+}
 
-                // 重置用户状态
-                user->isActive = false;
-            }
+bool MiniFMS::writeFileRange(int fcbId, size_t offset, const char *data, size_t length)
+{
+    lockSharedMemory();
+    bool ok = copyIntoFile(fcbId, offset, data, length);
+    if (ok)
+        walAppend(WAL_WRITE, fcbId, 0, static_cast<int64_t>(offset), data, length);
+    unlockSharedMemory();
+    return ok;
+}
+
+vector<pair<size_t, size_t>> MiniFMS::fileDataRanges(int fcbId, size_t from)
+{
+    vector<pair<size_t, size_t>> ranges;
+    size_t size = sharedData->fcbs[fcbId].size;
+    if (sharedData->fileInline[fcbId] && from < size)
+        ranges.push_back(make_pair(from, size - from));
+    if (sharedData->fileCompressed[fcbId] && !sharedData->fileInline[fcbId])
+    {
+        for (int idx = findFrame(fcbId, static_cast<int>(min(from, size) / FRAME_SIZE)); idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId; ++idx)
+        {
+            const Frame &f = sharedData->frames[idx];
+            size_t begin = max(from, static_cast<size_t>(f.frame) * FRAME_SIZE);
+            size_t end = min(size, static_cast<size_t>(f.frame) * FRAME_SIZE + f.rawLength);
+            if (begin < end)
+                ranges.push_back(make_pair(begin, end - begin));
         }
-        else if (choice == 0)
+    }
+    int idx = findExtent(fcbId, static_cast<int>(min(from, size) / BLOCK_SIZE));
+    for (; idx < sharedData->extentCount && sharedData->extents[idx].fcbId == fcbId; ++idx)
+    {
+        const Extent &e = sharedData->extents[idx];
+        size_t begin = max(from, static_cast<size_t>(e.fileBlock) * BLOCK_SIZE);
+        size_t end = min(size, static_cast<size_t>(e.fileBlock + e.blockCount) * BLOCK_SIZE);
+        if (begin < end)
+            ranges.push_back(make_pair(begin, end - begin));
+    }
+    return ranges;
+}
+
+bool MiniFMS::shiftFileTail(int fcbId, size_t offset, size_t gap)
+{
+    size_t size = sharedData->fcbs[fcbId].size;
+    if (gap == 0 || offset >= size)
+        return true;
+    if (size + gap > MAX_FILE_SIZE)
+        return false;
+
+    if (sharedData->fileInline[fcbId])
+    {
+        // 内联文件的尾部不超过内联区大小
+        char tail[INLINE_DATA_SIZE];
+        size_t n = copyFromFile(fcbId, offset, size - offset, tail);
+        return copyIntoFile(fcbId, offset + gap, tail, n);
+    }
+
+    // 只搬动已分配的数据，空洞保持为空洞；原位置上没有被新数据覆盖的部分写0
+    vector<pair<size_t, size_t>> ranges = fileDataRanges(fcbId, offset);
+    bool compressed = sharedData->fileCompressed[fcbId] != 0;
+    size_t unit = compressed ? FRAME_SIZE : BLOCK_SIZE;
+
+    // 先按会被写到的块（压缩文件为帧）检查空间，保证不会搬到一半失败；
+    // 插入的数据随后写入 [offset, offset + gap)，一并计入
+    vector<int> touched;
+    auto touch = [&](size_t begin, size_t end)
+    {
+        for (size_t u = begin / unit; u <= (end - 1) / unit; ++u)
+            touched.push_back(static_cast<int>(u));
+    };
+    touch(offset, offset + gap);
+    for (const auto &r : ranges)
+    {
+        touch(r.first + gap, r.first + r.second + gap);
+        size_t from = max(r.first, offset + gap);
+        if (from < r.first + r.second)
+            touch(from, r.first + r.second);
+    }
+    sort(touched.begin(), touched.end());
+    touched.erase(unique(touched.begin(), touched.end()), touched.end());
+
+    long long needed = 0;
+    int newFrames = 0;
+    for (int u : touched)
+    {
+        if (compressed)
         {
-            cout << "\n正在保存系统数据..." << endl;
-            shouldExit = true;
-            if (saveDataToDisk(false))
+            int idx = findFrame(fcbId, u);
+            needed += FRAME_BLOCKS;
+            if (idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fcbId && sharedData->frames[idx].frame == u)
             {
-                cout << "系统数据已保存" << endl;
+                const Frame &f = sharedData->frames[idx];
+                for (int i = 0; i < f.blockCount; ++i)
+                    needed -= sharedData->blockRefs[f.blocks[i]] == 1 ? 1 : 0;
             }
             else
             {
-                cout << "警告：系统数据保存失败！" << endl;
+                newFrames++;
             }
-            cout << "感谢使用 MiniFMS，再见！" << endl;
+            continue;
+        }
+        // 未分配的块需要新块，共享的块写入前需要复制出私有块
+        int idx = findExtent(fcbId, u);
+        const Extent *e = idx < sharedData->extentCount ? &sharedData->extents[idx] : nullptr;
+        if (!e || e->fcbId != fcbId || e->fileBlock > u || sharedData->blockRefs[e->startBlock + (u - e->fileBlock)] > 1)
+            needed++;
+    }
+    if (needed > sharedData->freeBlockCount || sharedData->frameCount + newFrames > MAX_FRAMES ||
+        (!compressed && sharedData->extentCount + 2 * needed > MAX_EXTENTS))
+        return false;
+
+    // 从后往前每次搬动最多 1MB，目标位置总在尚未读取的源数据之后
+    const size_t chunkSize = 1 << 20;
+    vector<char> buffer(min(chunkSize, size - offset));
+    vector<char> zeros(buffer.size(), 0);
+    for (auto r = ranges.rbegin(); r != ranges.rend(); ++r)
+    {
+        size_t end = r->first + r->second;
+        while (end > r->first)
+        {
+            size_t begin = end - min(chunkSize, end - r->first);
+            size_t n = copyFromFile(fcbId, begin, end - begin, buffer.data());
+            size_t zeroFrom = max(begin, offset + gap), zeroTo = min(end, begin + gap);
+            if (zeroFrom < zeroTo && !copyIntoFile(fcbId, zeroFrom, zeros.data(), zeroTo - zeroFrom))
+                return false;
+            if (!copyIntoFile(fcbId, begin + gap, buffer.data(), n))
+                return false;
+            end = begin;
+        }
+    }
+    return copyIntoFile(fcbId, size + gap, nullptr, 0);
+}
+
+bool MiniFMS::insertFileData(int fcbId, size_t offset, const string &data)
+{
+    lockSharedMemory();
+    bool ok;
+    try
+    {
+        // 插入点之后的内容整体后移，再写入插入的数据
+        ok = shiftFileTail(fcbId, offset, data.length()) && copyIntoFile(fcbId, offset, data.data(), data.length());
+        if (ok)
+            walAppend(WAL_INSERT, fcbId, 0, static_cast<int64_t>(offset), data.data(), data.length());
+    }
+    catch (...)
+    {
+        unlockSharedMemory();
+        throw;
+    }
+    unlockSharedMemory();
+    return ok;
+}
+
+void MiniFMS::syncFcbColumns(int fcbId)
+{
+    const FCB &fcb = sharedData->fcbs[fcbId];
+    sharedData->fcbUsed[fcbId] = fcb.isused ? 1 : 0;
+    sharedData->fcbType[fcbId] = static_cast<unsigned char>(fcb.type);
+    sharedData->fcbParent[fcbId] = fcb.parentDir;
+    markFcbDirty(fcbId);
+}
+
+void MiniFMS::touchFcb(int fcbId, bool modified)
+{
+    lockSharedMemory();
+    if (modified)
+        sharedData->fcbs[fcbId].modifyTime = time(nullptr);
+    else
+        sharedData->fcbs[fcbId].accessTime = time(nullptr);
+    markFcbDirty(fcbId);
+    // 访问时间只随保存落盘，只读命令不产生日志记录
+    if (modified)
+        walLogAttr(fcbId);
+    unlockSharedMemory();
+}
+
+void MiniFMS::moveFCB(int fcbId, int targetDirId)
+{
+    lockSharedMemory();
+    long long movedBytes;
+    int movedFiles;
+    subtreeTotals(fcbId, movedBytes, movedFiles);
+    adjustAggregates(sharedData->fcbs[fcbId].parentDir, -movedBytes, -movedFiles);
+    dirHashRemove(fcbId);
+    nameIndexRemove(fcbId);
+    unlinkChild(fcbId);
+    sharedData->fcbs[fcbId].parentDir = targetDirId;
+    syncFcbColumns(fcbId);
+    adjustAggregates(targetDirId, movedBytes, movedFiles);
+    dirHashInsert(fcbId);
+    nameIndexInsert(fcbId);
+    linkChild(fcbId);
+    sharedData->namespaceGen++;
+    if (sharedData->fcbs[fcbId].type == 1)
+        sharedData->dirTreeGen++;
+    walAppend(WAL_MOVE, fcbId, targetDirId);
+    unlockSharedMemory();
+}
+
+void MiniFMS::rebuildFcbColumns()
+{
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        syncFcbColumns(i);
+    }
+}
+
+void MiniFMS::releaseFCB(int fcbId)
+{
+    lockSharedMemory();
+
+    FCB &fcb = sharedData->fcbs[fcbId];
+    bool wasUsed = fcb.isused;
+    bool wasDir = fcb.type == 1;
+    if (wasUsed)
+    {
+        // 从祖先目录的汇总中扣除（目录的子项通常已先行释放，汇总为0）
+        long long bytes;
+        int files;
+        subtreeTotals(fcbId, bytes, files);
+        adjustAggregates(fcb.parentDir, -bytes, -files);
+        sharedData->subtreeBytes[fcbId] = 0;
+        sharedData->subtreeFiles[fcbId] = 0;
+
+        dirHashRemove(fcbId);
+        nameIndexRemove(fcbId);
+        unlinkChild(fcbId);
+    }
+    sharedData->links[fcbId] = DirLink();
+
+    // 如果是文件，归还数据块或清空内联区
+    if (fcb.type == 0)
+    {
+        if (sharedData->fileInline[fcbId])
+            memset(sharedData->inlineData[fcbId], 0, min(fcb.size, static_cast<size_t>(INLINE_DATA_SIZE)));
+        sharedData->fileInline[fcbId] = 0;
+        sharedData->fileCompressed[fcbId] = 0;
+        freeFileExtents(fcbId);
+        freeFileFrames(fcbId);
+    }
+
+    fcb.isused = 0;
+    fcb.type = 0;
+    fcb.size = 0;
+    fcb.address = -1;
+    fcb.parentDir = -1;
+    fcb.owner = -1;
+    fcb.locked = false;
+    fcb.lockOwner = -1;
+    memset(fcb.name, 0, MAX_FILENAME_LEN);
+    syncFcbColumns(fcbId);
+
+    if (wasUsed)
+    {
+        freeFcbSlot(fcbId);
+        sharedData->namespaceGen++;
+        if (wasDir)
+            sharedData->dirTreeGen++;
+        walAppend(WAL_RELEASE, fcbId);
+    }
+
+    unlockSharedMemory();
+}
+
+void MiniFMS::userIndexInsert(int slot)
+{
+    User &user = sharedData->users[slot];
+    unsigned int h = hashName(user.username) & (USER_HASH_SIZE - 1);
+    for (int probe = 0; probe < USER_HASH_SIZE; ++probe)
+    {
+        if (sharedData->userHash[h] == -1)
+        {
+            sharedData->userHash[h] = slot;
             break;
         }
-        else
+        h = (h + 1) & (USER_HASH_SIZE - 1);
+    }
+
+    if (user.userId >= 0 && user.userId < USER_ID_TABLE_SIZE)
+    {
+        sharedData->userSlotById[user.userId] = slot;
+    }
+}
+
+void MiniFMS::rebuildUserIndex()
+{
+    for (int i = 0; i < USER_HASH_SIZE; ++i)
+    {
+        sharedData->userHash[i] = -1;
+    }
+    for (int i = 0; i < USER_ID_TABLE_SIZE; ++i)
+    {
+        sharedData->userSlotById[i] = -1;
+    }
+    for (int i = 0; i < MAX_USERS; ++i)
+    {
+        if (sharedData->users[i].isused)
         {
-            cout << "\n无效的选项，请重新选择！" << endl;
+            userIndexInsert(i);
+        }
+    }
+}
+
+int MiniFMS::findUserSlot(const string &username)
+{
+    if (!sharedData)
+        return -1;
+
+    unsigned int h = hashName(username.c_str()) & (USER_HASH_SIZE - 1);
+    for (int probe = 0; probe < USER_HASH_SIZE; ++probe)
+    {
+        int slot = sharedData->userHash[h];
+        if (slot == -1)
+            break;
+        if (sharedData->users[slot].isused &&
+            strcmp(sharedData->users[slot].username, username.c_str()) == 0)
+        {
+            return slot;
         }
+        h = (h + 1) & (USER_HASH_SIZE - 1);
+    }
+    return -1;
+}
+
+User *MiniFMS::findUserById(int userId)
+{
+    if (!sharedData || userId < 0)
+        return nullptr;
+
+    if (userId < USER_ID_TABLE_SIZE)
+    {
+        int slot = sharedData->userSlotById[userId];
+        if (slot >= 0 && sharedData->users[slot].isused && sharedData->users[slot].userId == userId)
+            return &sharedData->users[slot];
+        return nullptr;
+    }
+
+    // userId 超出直接映射表范围时退化为线性查找
+    for (int i = 0; i < MAX_USERS; ++i)
+    {
+        if (sharedData->users[i].isused && sharedData->users[i].userId == userId)
+            return &sharedData->users[i];
+    }
+    return nullptr;
+}
+
+int MiniFMS::createFCB(const string &name, int type, int owner, int parentDir, int fcbId)
+{
+    if (!sharedData)
+        return -1;
+
+    lock_guard<mutex> lock(diskMutex);
+    lockSharedMemory();
+
+    if (fcbId == -1)
+    {
+        fcbId = allocFcbSlot();
+    }
+    else
+    {
+        // 重放日志时使用原来的槽位，从空闲栈中取出
+        int *stack = sharedData->freeFcbStack;
+        int *pos = find(stack, stack + sharedData->freeFcbTop, fcbId);
+        if (pos == stack + sharedData->freeFcbTop)
+            fcbId = -1;
+        else
+            *pos = stack[--sharedData->freeFcbTop];
+    }
+    if (fcbId == -1)
+    {
+        unlockSharedMemory();
+        return -1;
+    }
+
+    FCB &fcb = sharedData->fcbs[fcbId];
+    fcb.isused = 1;
+    strncpy(fcb.name, name.c_str(), MAX_FILENAME_LEN - 1);
+    fcb.type = type;
+    fcb.owner = owner;
+    fcb.size = 0;
+    fcb.createTime = fcb.modifyTime = fcb.accessTime = time(nullptr);
+    fcb.locked = false;
+    fcb.lockOwner = -1;
+    fcb.parentDir = parentDir;
+    fcb.address = -1;                           // 文件内容超出内联区时才在区段表中分配数据块
+    sharedData->fileInline[fcbId] = type == 0; // 新文件从内联存储开始
+    sharedData->fileCompressed[fcbId] = type == 0 && sharedData->compressNewFiles;
+
+    syncFcbColumns(fcbId);
+    sharedData->subtreeBytes[fcbId] = 0;
+    sharedData->subtreeFiles[fcbId] = 0;
+    if (type == 0)
+        adjustAggregates(parentDir, 0, 1);
+    sharedData->links[fcbId] = DirLink();
+    dirHashInsert(fcbId);
+    nameIndexInsert(fcbId);
+    linkChild(fcbId);
+    sharedData->namespaceGen++;
+
+    // nextFcbId 仅作为高水位记录，保持与旧数据文件兼容
+    if (fcbId >= sharedData->nextFcbId)
+        sharedData->nextFcbId = fcbId + 1;
+    sharedData->modifyCount++;
+    walAppend(WAL_CREATE, fcbId, parentDir, 0, &fcb, sizeof(FCB), sharedData->fileCompressed[fcbId]);
+    unlockSharedMemory();
+
+    dataChanged = true;
+    notifyDataChange();
+
+    return fcbId;
+}
+
+bool MiniFMS::registerUser(const string &username, const string &password)
+{
+    if (!sharedData)
+        return false;
+
+    if (checkUserConflict(username))
+    {
+        cout << "用户名已存在!" << endl;
+        return false;
+    }
+
+    int userId = -1;
+    for (int i = 0; i < MAX_USERS; i++)
+    {
+        if (!sharedData->users[i].isused)
+        {
+            userId = i;
+            break;
+        }
+    }
+
+    if (userId == -1)
+    {
+        cout << "用户数量已达上限!" << endl;
+        return false;
+    }
+
+    User &user = sharedData->users[userId];
+    user.isused = 1;
+    user.userId = sharedData->nextUserId++;
+    strncpy(user.username, username.c_str(), sizeof(user.username) - 1);
+    strncpy(user.password, password.c_str(), sizeof(user.password) - 1);
+    user.locked = false;
+    user.loginFailCount = 0;
+    user.createTime = time(nullptr);
+
+    int rootDirId = createFCB(username, 1, user.userId, 0);
+    if (rootDirId == -1)
+    {
+        user.isused = 0;
+        cout << "创建用户目录失败!" << endl;
+        return false;
+    }
+
+    user.rootDirId = rootDirId;
+
+    lockSharedMemory();
+    userIndexInsert(userId);
+    markUserDirty(userId);
+    walLogUser(userId);
+    unlockSharedMemory();
+
+    cout << "用户注册成功!" << endl;
+
+    // 立即落盘：注册记录写入日志即可，日志未启用时完整保存
+    sharedData->modifyCount++;
+    dataChanged = true;
+    notifyDataChange();
+    if (walCommit() || saveDataToDisk(true))
+    {
+        cout << "用户数据已保存到磁盘" << endl;
+    }
+    else
+    {
+        cout << "警告：用户数据保存失败，请尽快手动保存！" << endl;
+    }
+
+    return true;
+}
+
+bool MiniFMS::checkUserConflict(const string &username)
+{
+    if (!sharedData)
+        return false;
+
+    return findUserSlot(username) != -1;
+}
+
+User *MiniFMS::loginUser(const string &username, const string &password)
+{
+    if (!sharedData)
+        return nullptr;
+
+    int slot = findUserSlot(username);
+    if (slot == -1)
+    {
+        cout << "用户不存在!" << endl;
+        return nullptr;
+    }
+
+    User &user = sharedData->users[slot];
+    if (user.locked)
+    {
+        cout << "账号已锁定!" << endl;
+        return nullptr;
+    }
+
+    if (strcmp(user.password, password.c_str()) == 0)
+    {
+        lockSharedMemory();
+        user.loginFailCount = 0;
+        user.isActive = true;
+        markUserDirty(slot);
+        walLogUser(slot);
+        unlockSharedMemory();
+        cout << "登录成功!" << endl;
+        showWelcome();
+        return &user;
+    }
+
+    lockSharedMemory();
+    user.loginFailCount++;
+    if (user.loginFailCount >= 3)
+        user.locked = true;
+    markUserDirty(slot);
+    walLogUser(slot);
+    unlockSharedMemory();
+    cout << "密码错误!" << endl;
+    if (user.locked)
+    {
+        cout << "账号已锁定!" << endl;
+    }
+    return nullptr;
+}
+
+string MiniFMS::getCurrentPath(int fcbId, int userId)
+{
+    if (!sharedData || fcbId <= 0 || fcbId >= MAX_FCBS)
+        return "/";
+
+    vector<string> pathParts;
+    int current = fcbId;
+
+    int userRootId = 0;
+    if (User *user = findUserById(userId))
+    {
+        userRootId = user->rootDirId;
+    }
+
+    while (current != 0 && current != userRootId && current != -1)
+    {
+        if (current >= MAX_FCBS || !sharedData->fcbs[current].isused)
+            break;
+        pathParts.push_back(string(sharedData->fcbs[current].name));
+        current = sharedData->fcbs[current].parentDir;
+    }
+
+    if (pathParts.empty())
+    {
+        return "/";
+    }
+
+    string path = "/";
+    for (auto it = pathParts.rbegin(); it != pathParts.rend(); ++it)
+    {
+        path += *it;
+        if (it + 1 != pathParts.rend())
+        {
+            path += "/";
+        }
+    }
+    return path;
+}
+
+const string &MiniFMS::sessionPath(Session *session)
+{
+    int gen = sharedData->dirTreeGen.load();
+    if (session->pathDirId != session->currentDirId || session->pathGen != gen)
+    {
+        session->currentPath = getCurrentPath(session->currentDirId, session->user->userId);
+        session->pathDirId = session->currentDirId;
+        session->pathGen = gen;
+    }
+    return session->currentPath;
+}
+
+void MiniFMS::changeDirectory(Session *session, int dirId)
+{
+    bool pathValid = session->pathDirId == session->currentDirId &&
+                     session->pathGen == sharedData->dirTreeGen.load();
+    int oldDirId = session->currentDirId;
+    session->currentDirId = dirId;
+    if (!pathValid)
+        return; // 缓存已失效，下次显示时重新计算
+
+    if (dirId == session->user->rootDirId)
+    {
+        session->currentPath = "/";
+    }
+    else if (sharedData->fcbs[dirId].parentDir == oldDirId)
+    {
+        // 进入子目录：追加一级
+        if (session->currentPath.length() > 1)
+            session->currentPath += '/';
+        session->currentPath += sharedData->fcbs[dirId].name;
+    }
+    else if (sharedData->fcbs[oldDirId].parentDir == dirId)
+    {
+        // 返回上级：去掉最后一级
+        size_t slash = session->currentPath.find_last_of('/');
+        session->currentPath.erase(slash == 0 ? 1 : slash);
+    }
+    else
+    {
+        session->pathDirId = -1;
+        return;
+    }
+    session->pathDirId = dirId;
+}
+
+string MiniFMS::formatTime(time_t t)
+{
+    char buffer[80];
+    struct tm *timeinfo = localtime(&t);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
+    return string(buffer);
+}
+
+void MiniFMS::showWelcome()
+{
+    cout << "\n╔══════════════════════════════════════╗" << endl;
+    cout << "║        Welcome to MiniFMS " << VERSION << "         ║" << endl;
+    cout << "║     Advanced File System Pro        ║" << endl;
+    cout << "║     Type 'help' for commands        ║" << endl;
+    cout << "╚══════════════════════════════════════╝" << endl
+         << endl;
+}
+
+void MiniFMS::showHelp()
+{
+    cout << "\n═══════════════ 命令列表 ═══════════════\n"
+         << endl;
+    cout << " 目录操作:" << endl;
+    cout << "  cd [目录名]          切换目录 (.. 返回上级)" << endl;
+    cout << "  dir                 显示当前目录内容（按名称排序）" << endl;
+    cout << "      --prefix [前缀]  只显示指定前缀的条目" << endl;
+    cout << "      --after [名称] --limit [N]  分页显示" << endl;
+    cout << "      --sort [name|size|mtime]    排序方式" << endl;
+    cout << "  mkdir [目录名]       创建目录" << endl;
+    cout << "  rmdir [目录名]       删除空目录" << endl;
+
+    cout << "\n 文件操作:" << endl;
+    cout << "  create [文件名]      创建文件" << endl;
+    cout << "  delete [文件名]      删除文件" << endl;
+    cout << "  open [文件名] [模式] 打开文件 (r/w/rw)" << endl;
+    cout << "  close [文件描述符]   关闭文件" << endl;
+    cout << "  read [文件描述符]    读取文件" << endl;
+    cout << "  write [文件描述符]   写入文件" << endl;
+    cout << "  copy [源] [目标]     复制文件" << endl;
+    cout << "  move [源] [目标]     移动文件" << endl;
+    cout << "  flock [文件名]       加锁/解锁文件" << endl;
+    cout << "  head -num [文件名]   显示文件前num行" << endl;
+    cout << "  tail -num [文件名]   显示文件后num行" << endl;
+    cout << "  find [目录] -name [模式] 按名称查找 (支持通配符)" << endl;
+    cout << "  lseek [文件描述符] [偏移量] 移动文件指针" << endl;
+    cout << "  stat [文件名]        显示文件的存储方式、占用块数和压缩比" << endl;
+    cout << "  compress [文件名] [on|off]  切换文件的压缩存储" << endl;
+    cout << "  compress --volume [on|off]  新建文件默认压缩存储" << endl;
+
+    cout << "\n 导入导出:" << endl;
+    cout << "  import [外部路径] [系统内文件名]  导入外部文件" << endl;
+    cout << "  export [系统内文件名] [外部路径]  导出文件到外部" << endl;
+
+    cout << "\n 系统功能:" << endl;
+    cout << "  tree [--sizes]      显示目录树 (--sizes 显示各目录汇总大小)" << endl;
+    cout << "  du [目录]           显示目录及其子目录的空间占用" << endl;
+    cout << "  du --verify         并行重算并校验目录汇总" << endl;
+    cout << "  verify [status]     后台校验数据块的CRC32C和区段引用，status 查看进度与结果" << endl;
+    cout << "  save                手动保存数据到磁盘（只写入上次保存以来修改过的页）" << endl;
+    cout << "  save --full [--v1|--v2] 完整写出 filesystem.dat 快照（默认带CRC32C校验，--v1/--v2 使用旧版本可读取的格式）" << endl;
+    cout << "  image [status|on|off]  映像模式：filesystem.img 直接映射为共享段" << endl;
+    cout << "  processes/ps        显示连接的进程" << endl;
+    cout << "  bench scan [轮数]   测试元数据全表扫描吞吐量" << endl;
+    cout << "  bench io [MB]       比较普通存储与压缩存储的读写吞吐量" << endl;
+    cout << "  dedup stats         显示数据块共享与去重统计" << endl;
+    cout << "  dedup throttle [每批块数] [间隔毫秒]  设置后台去重速度 (0 关闭)" << endl;
+    cout << "  dedup run           立即完成一轮完整的去重扫描" << endl;
+    cout << "  defrag              整理FCB表和块池：同一目录的子项相邻，文件数据连续" << endl;
+    cout << "  defrag stats        显示碎片情况和累计移动次数" << endl;
+    cout << "  defrag throttle [每批移动数] [间隔毫秒]  设置后台整理速度 (0 关闭)" << endl;
+    cout << "  help                显示本帮助" << endl;
+    cout << "  exit                退出系统" << endl;
+    cout << "\n═══════════════════════════════════════\n"
+         << endl;
+}
+
+void MiniFMS::createFile(Session *session, const string &fileName)
+{
+    if (!session || !sharedData)
+        return;
+
+    if (findFCB(session->currentDirId, fileName) != -1)
+    {
+        cout << "文件已存在: " << fileName << endl;
+        return;
+    }
+
+    int newFileId = createFCB(fileName, 0, session->user->userId, session->currentDirId);
+    if (newFileId != -1)
+    {
+        cout << "文件创建成功: " << fileName << endl;
+    }
+    else
+    {
+        cout << "文件创建失败" << endl;
+    }
+}
+
+void MiniFMS::deleteFile(Session *session, const string &fileName)
+{
+    if (!session || !sharedData)
+        return;
+
+    int fileId = findFCB(session->currentDirId, fileName);
+    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    {
+        cout << "文件不存在: " << fileName << endl;
+        return;
+    }
+
+    // 检查文件访问权限
+    if (!checkFileAccess(session, fileId, true))
+    {
+        return;
+    }
+
+    // 检查文件是否被打开
+    for (const auto &openFile : session->openFiles)
+    {
+        if (openFile.isOpen && openFile.fcbId == fileId)
+        {
+            cout << " 错误：文件正在使用中，请先关闭文件" << endl;
+            return;
+        }
+    }
+
+    releaseFCB(fileId);
+
+    cout << "文件删除成功: " << fileName << endl;
+    sharedData->modifyCount++;
+    dataChanged = true;
+    notifyDataChange();
+}
+
+void MiniFMS::listDirectory(Session *session, const DirListOptions &options)
+{
+    if (!session || !sharedData)
+        return;
+
+    int dirId = session->currentDirId;
+    const FCB *fcbs = sharedData->fcbs;
+    auto matchesPrefix = [&](int id)
+    {
+        return strncmp(fcbs[id].name, options.prefix.c_str(), options.prefix.length()) == 0;
+    };
+
+    // 从有序索引中取出本页条目（持锁期间只复制ID，输出在锁外进行）
+    vector<int> entries;
+    bool hasMore = false;
+
+    lockSharedMemory();
+    int pos = nameIndexLowerBound(dirId, options.prefix.c_str());
+    if (options.sortKey == 0)
+    {
+        // 按名称排序：游标直接二分定位
+        if (!options.after.empty())
+        {
+            int afterPos = nameIndexLowerBound(dirId, options.after.c_str());
+            if (afterPos < sharedData->nameIndexCount &&
+                fcbs[sharedData->nameIndex[afterPos]].parentDir == dirId &&
+                options.after == fcbs[sharedData->nameIndex[afterPos]].name)
+                afterPos++;
+            pos = max(pos, afterPos);
+        }
+        for (; pos < sharedData->nameIndexCount; ++pos)
+        {
+            int id = sharedData->nameIndex[pos];
+            if (fcbs[id].parentDir != dirId || !matchesPrefix(id))
+                break;
+            if (options.limit > 0 && entries.size() >= options.limit)
+            {
+                hasMore = true;
+                break;
+            }
+            entries.push_back(id);
+        }
+    }
+    else
+    {
+        // 按大小/修改时间排序：只取本目录的索引区间，再做部分排序
+        for (; pos < sharedData->nameIndexCount; ++pos)
+        {
+            int id = sharedData->nameIndex[pos];
+            if (fcbs[id].parentDir != dirId || !matchesPrefix(id))
+                break;
+            entries.push_back(id);
+        }
+    }
+    unlockSharedMemory();
+
+    auto sortValue = [&](int id) -> long long
+    {
+        if (options.sortKey == 1)
+            return fcbs[id].type == 1 ? 0 : static_cast<long long>(fcbs[id].size);
+        return static_cast<long long>(fcbs[id].modifyTime);
+    };
+    if (options.sortKey != 0)
+    {
+        // 从大到小排序，值相同时按名称
+        auto before = [&](int a, int b)
+        {
+            long long va = sortValue(a), vb = sortValue(b);
+            if (va != vb)
+                return va > vb;
+            return strcmp(fcbs[a].name, fcbs[b].name) < 0;
+        };
+
+        // 游标带上一页最后一项的排序值，该项在两页之间被修改或删除也能接着列出；
+        // 只有名称的旧游标按该条目当前的排序值定位
+        if (!options.after.empty())
+        {
+            long long cursorValue = 0;
+            string cursorName = options.after;
+            size_t colon = options.after.find(':');
+            bool valid = false;
+            if (colon != string::npos && colon > 0)
+            {
+                try
+                {
+                    size_t used;
+                    cursorValue = stoll(options.after.substr(0, colon), &used);
+                    valid = used == colon;
+                }
+                catch (const exception &)
+                {
+                    // 冒号前不是数字：整体按名称处理
+                }
+                if (valid)
+                    cursorName = options.after.substr(colon + 1);
+            }
+            if (!valid)
+            {
+                int cursor = findFCB(dirId, options.after);
+                valid = cursor != -1;
+                if (valid)
+                    cursorValue = sortValue(cursor);
+            }
+            if (valid)
+            {
+                entries.erase(remove_if(entries.begin(), entries.end(), [&](int id)
+                                        {
+                                            long long value = sortValue(id);
+                                            return value > cursorValue || (value == cursorValue && strcmp(fcbs[id].name, cursorName.c_str()) <= 0); }),
+                              entries.end());
+            }
+        }
+
+        if (options.limit > 0 && entries.size() > options.limit)
+        {
+            partial_sort(entries.begin(), entries.begin() + options.limit, entries.end(), before);
+            entries.resize(options.limit);
+            hasMore = true;
+        }
+        else
+        {
+            sort(entries.begin(), entries.end(), before);
+        }
+    }
+
+    cout << "\n目录内容 - " << sessionPath(session) << "\n"
+         << endl;
+    cout << "类型\t名称\t\t大小\t\t修改时间" << endl;
+    cout << "────────────────────────────────────────────────────────" << endl;
+
+    for (int i : entries)
+    {
+        string type = fcbs[i].type == 1 ? "DIR" : "FILE";
+        string name = string(fcbs[i].name);
+        string size = fcbs[i].type == 1 ? "<DIR>" : to_string(fcbs[i].size) + " bytes";
+        string mtime = formatTime(fcbs[i].modifyTime);
+
+        cout << type << "\t" << setw(15) << left << name << "\t"
+             << setw(12) << left << size << "\t" << mtime << endl;
+    }
+
+    if (entries.empty())
+    {
+        cout << (options.prefix.empty() && options.after.empty() ? "目录为空" : "没有匹配的条目") << endl;
+    }
+    else if (hasMore)
+    {
+        // 原样带上其余选项，按大小/时间排序时游标带排序值
+        static const char *sortNames[] = {"name", "size", "mtime"};
+        int last = entries.back();
+        string cursor = options.sortKey == 0 ? string(fcbs[last].name) : to_string(sortValue(last)) + ":" + fcbs[last].name;
+        cout << "\n 还有更多条目，继续查看: dir";
+        if (!options.prefix.empty())
+            cout << " --prefix " << options.prefix;
+        if (options.sortKey != 0)
+            cout << " --sort " << sortNames[options.sortKey];
+        cout << " --after " << cursor << " --limit " << options.limit << endl;
+    }
+    cout << endl;
+}
+
+void MiniFMS::showTree(Session *session, bool withSizes)
+{
+    if (!session || !sharedData)
+        return;
+
+    cout << "\n 目录树结构\n"
+         << endl;
+    showTreeRecursive(session->currentDirId, 0, session->user->userId, withSizes);
+    cout << endl;
+}
+
+void MiniFMS::showTreeRecursive(int fcbId, int depth, int userId, bool withSizes)
+{
+    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
+        return;
+
+    for (int i = 0; i < depth; ++i)
+    {
+        cout << "│   ";
+    }
+
+    FCB &fcb = sharedData->fcbs[fcbId];
+    if (fcb.type == 1)
+    {
+        cout << "├──" << fcb.name << "/";
+        if (withSizes)
+        {
+            cout << " (total: " << sharedData->subtreeBytes[fcbId] << " bytes, "
+                 << sharedData->subtreeFiles[fcbId] << " files)";
+        }
+        cout << endl;
+
+        for (int i = sharedData->links[fcbId].firstChild; i != -1; i = sharedData->links[i].nextSibling)
+        {
+            showTreeRecursive(i, depth + 1, userId, withSizes);
+        }
+    }
+    else
+    {
+        cout << "├──  " << fcb.name
+             << " (size: " << fcb.size
+             << ", mtime: " << formatTime(fcb.modifyTime) << ")" << endl;
+    }
+}
+
+void MiniFMS::userInteractionThread(Session &session)
+{
+    string inputBuffer;
+    getline(cin, inputBuffer);
+
+    while (session.active && !shouldExit)
+    {
+        cout << "\033[1;32m" << session.user->username << "@MiniFMS\033[0m:"
+             << "\033[1;34m" << sessionPath(&session) << "\033[0m$ ";
+
+        string cmdline;
+        getline(cin, cmdline);
+
+        if (cmdline == "exit" || shouldExit)
+        {
+            // 用户退出时保存数据
+            if (dataChanged)
+            {
+                cout << "正在保存会话数据..." << endl;
+                if (saveDataToDisk(true))
+                {
+                    cout << "会话数据已保存" << endl;
+                }
+                else
+                {
+                    cout << "警告：数据保存失败！" << endl;
+                }
+            }
+            session.active = false;
+            cout << "Bye! 感谢使用 MiniFMS." << endl;
+            shouldExit = true;
+            break;
+        }
+
+        if (cmdline.empty())
+            continue;
+
+        {
+            lock_guard<mutex> lock(queueMutex);
+            commandQueue.push(CommandRequest(&session, cmdline));
+        }
+        queueCv.notify_one();
+
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCv.wait(lock, [this]
+                         { return ready || shouldExit; });
+            if (shouldExit)
+            {
+                break;
+            }
+            ready = false;
+        }
+    }
+}
+
+void MiniFMS::diskMaintenanceThread()
+{
+    auto lastDedup = chrono::steady_clock::now(), lastDefrag = lastDedup;
+    while (!shouldExit)
+    {
+        CommandRequest req;
+        bool idle;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            int tick = min(sharedData->dedupIntervalMs, sharedData->defragIntervalMs);
+            idle = !queueCv.wait_for(lock, chrono::milliseconds(max(tick, 1)), [this]
+                                     { return !commandQueue.empty() || shouldExit; });
+
+            if (shouldExit)
+            {
+                break;
+            }
+
+            if (!idle)
+            {
+                req = commandQueue.front();
+                commandQueue.pop();
+            }
+        }
+
+        // 没有命令时应用其他进程发布的FCB重定位，再各做一批后台去重和整理，
+        // 批量大小和间隔分别由 dedup throttle 和 defrag throttle 设置
+        if (idle)
+        {
+            lockSharedMemory();
+            applyRelocation();
+            unlockSharedMemory();
+
+            scrubStep(SCRUB_BATCH);
+
+            auto now = chrono::steady_clock::now();
+            int batch = sharedData->dedupBatch;
+            if (batch > 0 && now - lastDedup >= chrono::milliseconds(sharedData->dedupIntervalMs))
+            {
+                dedupStep(batch);
+                lastDedup = now;
+            }
+            batch = sharedData->defragBatch;
+            int namespaceGen = sharedData->namespaceGen, layoutGen = sharedData->layoutGen;
+            if (batch > 0 && now - lastDefrag >= chrono::milliseconds(sharedData->defragIntervalMs) &&
+                (namespaceGen != defragCheckedNamespace || layoutGen != defragCheckedLayout))
+            {
+                bool blocked;
+                if (defragStep(batch, blocked) == 0 && !blocked)
+                {
+                    defragCheckedNamespace = namespaceGen;
+                    defragCheckedLayout = layoutGen;
+                }
+                lastDefrag = now;
+            }
+            continue;
+        }
+
+        lockSharedMemory();
+        applyRelocation();
+        sharedData->processBusy[currentProcessId] = 1;
+        unlockSharedMemory();
+
+        processCommand(req);
+
+        // 命令的日志记录落盘后才返回提示符
+        walCommit();
+
+        lockSharedMemory();
+        sharedData->processBusy[currentProcessId] = 0;
+        unlockSharedMemory();
+
+        {
+            lock_guard<mutex> lock(queueMutex);
+            ready = true;
+        }
+        queueCv.notify_one();
+    }
+}
+
+void MiniFMS::processCommand(CommandRequest &req)
+{
+    istringstream iss(req.commandLine);
+    string cmd;
+    vector<string> args;
+    iss >> cmd;
+    string arg;
+    while (iss >> arg)
+        args.push_back(arg); // 将命令行参数分割成多个字符串
+    if (cmd == "help")
+    {
+        showHelp();
+    }
+    else if (cmd == "dir")
+    {
+        DirListOptions options;
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            bool hasValue = i + 1 < args.size();
+            if (args[i] == "--prefix" && hasValue)
+                options.prefix = args[++i];
+            else if (args[i] == "--after" && hasValue)
+                options.after = args[++i];
+            else if (args[i] == "--limit" && hasValue)
+            {
+                try
+                {
+                    int limit = stoi(args[++i]);
+                    options.limit = limit > 0 ? static_cast<size_t>(limit) : 0;
+                }
+                catch (const exception &e)
+                {
+                    cout << " 参数错误: --limit 必须是数字" << endl;
+                    return;
+                }
+            }
+            else if (args[i] == "--sort" && hasValue)
+            {
+                string key = args[++i];
+                if (key == "name")
+                    options.sortKey = 0;
+                else if (key == "size")
+                    options.sortKey = 1;
+                else if (key == "mtime")
+                    options.sortKey = 2;
+                else
+                {
+                    cout << " 无效的排序方式，请使用 name/size/mtime" << endl;
+                    return;
+                }
+            }
+            else
+            {
+                cout << " 用法: dir [--prefix 前缀] [--after 名称] [--limit N] [--sort name|size|mtime]" << endl;
+                return;
+            }
+        }
+        listDirectory(req.session, options);
+    }
+    else if (cmd == "mkdir")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: mkdir [目录名]" << endl;
+        }
+        else
+        {
+            if (findFCB(req.session->currentDirId, args[0]) != -1)
+            {
+                cout << " 目录已存在: " << args[0] << endl;
+            }
+            else
+            {
+                int newDirId = createFCB(args[0], 1, req.session->user->userId, req.session->currentDirId);
+                if (newDirId != -1)
+                {
+                    cout << " 目录创建成功: " << args[0] << endl;
+                }
+                else
+                {
+                    cout << " 目录创建失败" << endl;
+                }
+            }
+        }
+    }
+    else if (cmd == "rmdir")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: rmdir [目录名]" << endl;
+            cout << " 说明: 删除指定的目录" << endl;
+            cout << " 选项: -f  强制删除非空目录" << endl;
+            return;
+        }
+
+        bool forceDelete = false;
+        string dirName = args[0];
+
+        // 检查是否有 -f 选项
+        if (args.size() > 1 && args[1] == "-f")
+        {
+            forceDelete = true;
+        }
+
+        int dirId = findFCB(req.session->currentDirId, dirName);
+        if (dirId == -1)
+        {
+            cout << " 错误: 目录不存在: " << dirName << endl;
+            return;
+        }
+
+        if (sharedData->fcbs[dirId].type != 1)
+        {
+            cout << " 错误: " << dirName << " 不是一个目录" << endl;
+            return;
+        }
+
+        // 检查是否有权限删除
+        if (sharedData->fcbs[dirId].owner != req.session->user->userId)
+        {
+            cout << " 错误: 权限不足，无法删除其他用户的目录" << endl;
+            return;
+        }
+
+        // 检查目录是否为空
+        bool isEmpty = sharedData->links[dirId].firstChild == -1;
+        int fileCount = sharedData->links[dirId].childCount;
+        vector<pair<int, string>> contents; // <fcbId, name>
+
+        for (int i = sharedData->links[dirId].firstChild; i != -1; i = sharedData->links[i].nextSibling)
+        {
+            contents.push_back({i, string(sharedData->fcbs[i].name)});
+        }
+
+        if (!isEmpty)
+        {
+            if (!forceDelete)
+            {
+                cout << " 错误: 目录不为空，使用 rmdir " << dirName << " -f 强制删除" << endl;
+                return;
+            }
+
+            cout << " 警告: 目录 " << dirName << " 不为空" << endl;
+            cout << " 包含 " << fileCount << " 个文件/子目录:" << endl;
+            for (const auto &item : contents)
+            {
+                string itemType = sharedData->fcbs[item.first].type == 1 ? "目录" : "文件";
+                cout << "   - " << itemType << ": " << item.second << endl;
+            }
+
+            cout << "\n 确认要删除此目录及其所有内容吗? (y/n): ";
+            string confirm;
+            if (!getline(cin, confirm))
+            {
+                cout << " 输入错误，操作已取消" << endl;
+                return;
+            }
+
+            if (confirm != "y" && confirm != "Y")
+            {
+                cout << " 操作已取消" << endl;
+                return;
+            }
+
+            cout << "\n 正在删除目录 " << dirName << " 及其内容..." << endl;
+
+            // 删除所有内容
+            for (const auto &item : contents)
+            {
+                int fcbId = item.first;
+                string itemType = sharedData->fcbs[fcbId].type == 1 ? "目录" : "文件";
+                cout << " - 删除" << itemType << ": " << item.second << endl;
+
+                // 清理FCB（子目录连同其内容一起删除，子项先于父项释放）
+                vector<int> subtree;
+                findAllFiles(subtree, fcbId);
+                for (auto it = subtree.rbegin(); it != subtree.rend(); ++it)
+                {
+                    releaseFCB(*it);
+                }
+            }
+        }
+
+        // 删除目录本身
+        releaseFCB(dirId);
+
+        cout << " 目录删除成功: " << dirName << endl;
+
+        // 保存更改：日志未启用时完整保存
+        sharedData->modifyCount++;
+        dataChanged = true;
+        if (!walCommit())
+            saveDataToDisk(true);
+    }
+    else if (cmd == "tree")
+    {
+        if (!args.empty() && args[0] != "--sizes")
+        {
+            cout << " 用法: tree [--sizes]" << endl;
+            return;
+        }
+        showTree(req.session, !args.empty());
+    }
+    else if (cmd == "du")
+    {
+        if (!args.empty() && args[0] == "--verify")
+        {
+            verifyAggregates(true);
+        }
+        else
+        {
+            showDiskUsage(req.session, args.empty() ? "." : args[0]);
+        }
+    }
+    else if (cmd == "compress")
+    {
+        if (args.size() >= 1 && args[0] == "--volume")
+        {
+            if (args.size() >= 2 && (args[1] == "on" || args[1] == "off"))
+            {
+                lockSharedMemory();
+                sharedData->compressNewFiles = args[1] == "on" ? 1 : 0;
+                walAppend(WAL_VOLUME, -1, sharedData->compressNewFiles);
+                unlockSharedMemory();
+                sharedData->modifyCount++;
+                dataChanged = true;
+            }
+            cout << " 新建文件默认存储方式: " << (sharedData->compressNewFiles ? "压缩" : "普通") << endl;
+        }
+        else if (args.empty() || (args.size() >= 2 && args[1] != "on" && args[1] != "off"))
+        {
+            cout << " 用法: compress [文件名] [on|off]" << endl;
+            cout << "       compress --volume [on|off]  设置新建文件的默认存储方式" << endl;
+        }
+        else
+        {
+            int fileId = findFCB(req.session->currentDirId, args[0]);
+            bool enable = args.size() < 2 || args[1] == "on";
+            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+            {
+                cout << " 文件不存在: " << args[0] << endl;
+            }
+            else if (!setFileCompression(fileId, enable))
+            {
+                cout << " 转换失败：磁盘空间不足" << endl;
+            }
+            else
+            {
+                cout << " 文件已改为" << (enable ? "压缩" : "普通") << "存储: " << args[0] << endl;
+                showFileStorage(fileId, args[0]);
+                sharedData->modifyCount++;
+                dataChanged = true;
+            }
+        }
+    }
+    else if (cmd == "stat")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: stat [文件名]" << endl;
+        }
+        else
+        {
+            int fileId = findFCB(req.session->currentDirId, args[0]);
+            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+                cout << " 文件不存在: " << args[0] << endl;
+            else
+                showFileStorage(fileId, args[0]);
+        }
+    }
+    else if (cmd == "verify")
+    {
+        if (args.empty())
+            startScrub();
+        else if (args[0] == "status")
+            showScrubStatus();
+        else
+            cout << " 用法: verify | verify status" << endl;
+    }
+    else if (cmd == "dedup")
+    {
+        if (!args.empty() && args[0] == "stats")
+        {
+            showDedupStats();
+        }
+        else if (!args.empty() && args[0] == "throttle" && args.size() >= 2)
+        {
+            try
+            {
+                int batch = stoi(args[1]);
+                int interval = args.size() >= 3 ? stoi(args[2]) : sharedData->dedupIntervalMs;
+                if (batch < 0 || interval <= 0)
+                    throw invalid_argument("range");
+                lockSharedMemory();
+                sharedData->dedupBatch = batch;
+                sharedData->dedupIntervalMs = interval;
+                unlockSharedMemory();
+                if (batch == 0)
+                    cout << " 后台去重已关闭" << endl;
+                else
+                    cout << " 后台去重：每批 " << batch << " 块，间隔 " << interval << " 毫秒" << endl;
+            }
+            catch (const exception &e)
+            {
+                cout << " 参数错误: 每批块数须为非负整数，间隔须为正整数" << endl;
+            }
+        }
+        else if (!args.empty() && args[0] == "run")
+        {
+            // 从头完整扫描一轮，不受节流设置影响
+            lockSharedMemory();
+            sharedData->dedupCursorFcb = 0;
+            sharedData->dedupCursorBlock = 0;
+            resetDedupTable();
+            unlockSharedMemory();
+            auto start = chrono::steady_clock::now();
+            long long examined = 0;
+            int step;
+            do
+            {
+                // 每批之间释放锁，其他进程的命令可以插入执行；不足一批说明本轮已扫描完
+                step = dedupStep(DEDUP_BATCH_DEFAULT);
+                examined += step;
+            } while (step == DEDUP_BATCH_DEFAULT);
+            double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << " 去重扫描完成：检查 " << examined << " 个逻辑块，用时 " << fixed << setprecision(1) << millis << " 毫秒" << endl;
+            cout.unsetf(ios::floatfield);
+            cout << setprecision(6);
+            showDedupStats();
+        }
+        else
+        {
+            cout << " 用法: dedup stats | dedup throttle [每批块数] [间隔毫秒] | dedup run" << endl;
+        }
+    }
+    else if (cmd == "defrag")
+    {
+        if (!args.empty() && args[0] == "stats")
+        {
+            showDefragStats();
+        }
+        else if (!args.empty() && args[0] == "throttle" && args.size() >= 2)
+        {
+            try
+            {
+                int batch = stoi(args[1]);
+                int interval = args.size() >= 3 ? stoi(args[2]) : sharedData->defragIntervalMs;
+                if (batch < 0 || interval <= 0)
+                    throw invalid_argument("range");
+                lockSharedMemory();
+                sharedData->defragBatch = batch;
+                sharedData->defragIntervalMs = interval;
+                unlockSharedMemory();
+                if (batch == 0)
+                    cout << " 后台整理已关闭" << endl;
+                else
+                    cout << " 后台整理：每批 " << batch << " 次移动，间隔 " << interval << " 毫秒" << endl;
+            }
+            catch (const exception &e)
+            {
+                cout << " 参数错误: 每批移动数须为非负整数，间隔须为正整数" << endl;
+            }
+        }
+        else if (args.empty())
+        {
+            // 一次完成全部整理；其他进程尚未确认上一批重定位时稍等后重试
+            auto start = chrono::steady_clock::now();
+            lockSharedMemory();
+            long long fcbBefore = sharedData->defragFcbMoves, blockBefore = sharedData->defragBlockMoves;
+            unlockSharedMemory();
+            bool blocked = false;
+            for (int round = 0; round < 100; ++round)
+            {
+                if (defragStep(INT_MAX, blocked) == 0 && !blocked)
+                    break;
+                if (blocked)
+                    this_thread::sleep_for(chrono::milliseconds(50));
+            }
+            lockSharedMemory();
+            long long fcbMoves = sharedData->defragFcbMoves - fcbBefore, blockMoves = sharedData->defragBlockMoves - blockBefore;
+            unlockSharedMemory();
+            double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << " 整理完成：移动FCB " << fcbMoves << " 次，数据块 " << blockMoves << " 次，用时 "
+                 << fixed << setprecision(1) << millis << " 毫秒" << endl;
+            cout.unsetf(ios::floatfield);
+            cout << setprecision(6);
+            if (blocked)
+                cout << " 警告：其他进程正在执行命令或写快照，整理未能完成，请稍后重试" << endl;
+            if (fcbMoves > 0 || blockMoves > 0)
+            {
+                sharedData->modifyCount++;
+                dataChanged = true;
+            }
+            showDefragStats();
+        }
+        else
+        {
+            cout << " 用法: defrag | defrag stats | defrag throttle [每批移动数] [间隔毫秒]" << endl;
+        }
+    }
+    else if (cmd == "save")
+    {
+        if (!args.empty() && args[0] == "--full")
+        {
+            // 完整快照用于备份，不影响页式存储；--v1/--v2 写出旧版本可以读取的格式
+            int version = DATA_VERSION;
+            if (args.size() > 1 && (args[1] == "--v1" || args[1] == "--v2"))
+                version = args[1][3] - '0';
+            lock_guard<mutex> lock(saveMutex);
+            if (!saveSnapshot(false, version))
+                cout << " 快照保存失败!" << endl;
+            return;
+        }
+        cout << " 正在保存数据到磁盘..." << endl;
+        if (saveDataToDisk(false)) // 显式使用非静默模式
+        {
+            cout << " 数据保存成功!" << endl;
+        }
+        else
+        {
+            cout << " 数据保存失败!" << endl;
+        }
+    }
+    else if (cmd == "image")
+    {
+        if (args.empty() || args[0] == "status")
+        {
+            showImageStatus();
+        }
+        else if (args[0] == "on")
+        {
+            if (imageMapped)
+                cout << " 已处于映像模式" << endl;
+            else if (switchImageMode(true))
+            {
+                cout << " 已切换到映像模式：" << IMAGE_FILE << " 直接作为共享段映射，启动时不再加载数据" << endl;
+                showImageStatus();
+            }
+        }
+        else if (args[0] == "off")
+        {
+            if (!imageMapped)
+                cout << " 当前不是映像模式" << endl;
+            else if (switchImageMode(false))
+            {
+                // 数据写入页式存储之后映像才可以删除，之后的修改重新记录日志
+                if (saveDataToDisk(false))
+                {
+                    remove(IMAGE_FILE);
+                    startWal();
+                    cout << " 已切换回共享内存模式" << endl;
+                }
+                else
+                {
+                    cout << " 警告：" << STORE_FILE << " 写入失败，映像文件已保留" << endl;
+                }
+            }
+        }
+        else
+        {
+            cout << " 用法: image [status|on|off]" << endl;
+        }
+    }
+    else if (cmd == "create")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: create [文件名]" << endl;
+        }
+        else
+        {
+            createFile(req.session, args[0]);
+        }
+    }
+    else if (cmd == "delete")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: delete [文件名]" << endl;
+        }
+        else
+        {
+            deleteFile(req.session, args[0]);
+        }
+    }
+    else if (cmd == "open")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: open [文件名] [模式] (r/w/rw)" << endl;
+            cout << " 示例: open test.txt r  # 以只读模式打开文件" << endl;
+            cout << " 注意: 同一文件不能重复打开，需要先close后才能重新open" << endl;
+        }
+        else
+        {
+            int fileId = findFCB(req.session->currentDirId, args[0]);
+            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+            {
+                cout << " 文件不存在: " << args[0] << endl;
+            }
+            else
+            {
+                int mode = 0;
+                if (args[1] == "w")
+                    mode = 1;
+                else if (args[1] == "rw")
+                    mode = 2;
+                else if (args[1] != "r")
+                {
+                    cout << " 无效的打开模式，请使用 r/w/rw" << endl;
+                    return;
+                }
+
+                // 检查文件是否已经被打开
+                bool alreadyOpen = false;
+                int existingFd = -1;
+                for (size_t i = 0; i < req.session->openFiles.size(); ++i)
+                {
+                    if (req.session->openFiles[i].isOpen &&
+                        req.session->openFiles[i].fcbId == fileId)
+                    {
+                        alreadyOpen = true;
+                        existingFd = static_cast<int>(i);
+                        break;
+                    }
+                }
+
+                if (alreadyOpen)
+                {
+                    string currentMode;
+                    switch (req.session->openFiles[existingFd].mode)
+                    {
+                    case 0:
+                        currentMode = "只读";
+                        break;
+                    case 1:
+                        currentMode = "只写";
+                        break;
+                    case 2:
+                        currentMode = "读写";
+                        break;
+                    }
+                    cout << " 错误：文件 " << args[0] << " 已经被打开" << endl;
+                    cout << " 当前打开状态：文件描述符 = " << existingFd << ", 模式 = " << currentMode << endl;
+                    cout << " 提示：如需以其他模式打开，请先使用 close " << existingFd << " 关闭文件" << endl;
+                }
+                else
+                {
+                    int fd = req.session->addOpenFile(fileId, mode);
+                    cout << " 文件打开成功，文件描述符: " << fd << endl;
+                }
+            }
+        }
+    }
+    else if (cmd == "close")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: close [文件描述符]" << endl;
+        }
+        else
+        {
+            try
+            {
+                int fd = stoi(args[0]);
+                if (req.session->closeFile(fd))
+                {
+                    cout << " 文件已关闭" << endl;
+                }
+                else
+                {
+                    cout << " 无效的文件描述符" << endl;
+                }
+            }
+            catch (const std::invalid_argument &e)
+            {
+                cout << " 文件描述符必须是数字: " << args[0] << endl;
+            }
+            catch (const std::out_of_range &e)
+            {
+                cout << " 文件描述符超出范围: " << args[0] << endl;
+            }
+        }
+    }
+    else if (cmd == "read")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: read [文件描述符] [可选:要读取的字节数]" << endl;
+            cout << " 示例: read 0     # 从当前位置读取到文件末尾" << endl;
+            cout << "       read 0 10  # 从当前位置读取10个字节" << endl;
+        }
+        else
+        {
+            try
+            {
+                int fd = stoi(args[0]);
+                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
+                    req.session->openFiles[fd].isOpen)
+                {
+                    FileDesc &fileDesc = req.session->openFiles[fd];
+                    if (fileDesc.mode == 1)
+                    {
+                        cout << " 文件以只写模式打开" << endl;
+                    }
+                    else
+                    {
+                        int fcbId = fileDesc.fcbId;
+                        size_t fileSize = sharedData->fcbs[fcbId].size;
+                        // 按长度分段输出文件内容，终端输出时不持有共享内存锁，内容中的空字符原样输出
+                        auto printSpan = [](string_view span)
+                        {
+                            cout.write(span.data(), span.size());
+                            return true;
+                        };
+
+                        // 如果指定了读取长度
+                        if (args.size() > 1)
+                        {
+                            size_t length = stoi(args[1]);
+                            if (fileDesc.position + length > fileSize)
+                            {
+                                cout << " 警告：请求读取的长度超出文件末尾，将只读取到文件末尾" << endl;
+                                length = fileDesc.position < fileSize ? fileSize - fileDesc.position : 0;
+                            }
+                            cout << " 从位置 " << fileDesc.position << " 读取 " << length << " 个字节:" << endl;
+                            visitFileData(fcbId, fileDesc.position, length, printSpan);
+                            cout << endl;
+                            fileDesc.position += length;
+                        }
+                        else
+                        {
+                            // 读取从当前位置到文件末尾的所有内容
+                            if (fileDesc.position >= fileSize)
+                            {
+                                cout << " 已到达文件末尾" << endl;
+                            }
+                            else
+                            {
+                                cout << " 从位置 " << fileDesc.position << " 读取到文件末尾:" << endl;
+                                visitFileData(fcbId, fileDesc.position, string::npos, printSpan);
+                                cout << endl;
+                                fileDesc.position = fileSize;
+                            }
+                        }
+
+                        touchFcb(fcbId, false);
+                        cout << " 当前文件指针位置：" << fileDesc.position << endl;
+                    }
+                }
+                else
+                {
+                    cout << " 无效的文件描述符" << endl;
+                }
+            }
+            catch (const std::invalid_argument &e)
+            {
+                cout << " 文件描述符必须是数字: " << args[0] << endl;
+            }
+            catch (const std::out_of_range &e)
+            {
+                cout << " 文件描述符超出范围: " << args[0] << endl;
+            }
+        }
+    }
+    else if (cmd == "write")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: write [文件描述符] [-a/-o]" << endl;
+            cout << " 选项: -a 从当前位置追加内容" << endl;
+            cout << "       -o 覆盖当前位置的内容" << endl;
+            cout << " 示例: write 0 -a  # 在当前位置追加内容" << endl;
+            cout << "       write 0 -o  # 覆盖当前位置的内容" << endl;
+        }
+        else
+        {
+            try
+            {
+                int fd = stoi(args[0]);
+                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
+                    req.session->openFiles[fd].isOpen)
+                {
+                    FileDesc &fileDesc = req.session->openFiles[fd];
+                    if (fileDesc.mode == 0)
+                    {
+                        cout << " 文件以只读模式打开" << endl;
+                        return;
+                    }
+
+                    // 检查文件访问权限
+                    if (!checkFileAccess(req.session, fileDesc.fcbId, true))
+                    {
+                        return;
+                    }
+
+                    bool isOverwrite = args.size() > 1 && args[1] == "-o";
+
+                    cout << " 请输入内容 (以EOF或单独的.结束): " << endl;
+                    string content, line;
+                    while (getline(cin, line) && line != ".")
+                    {
+                        content += line + "\n";
+                    }
+
+                    int fcbId = fileDesc.fcbId;
+
+                    // 根据写入模式处理内容：覆盖模式原地写入，追加模式在当前位置插入
+                    // 文件指针超出文件末尾时，中间部分读出为空字符
+                    bool written;
+                    if (isOverwrite)
+                    {
+                        written = writeFileRange(fcbId, fileDesc.position, content.data(), content.length());
+                    }
+                    else
+                    {
+                        written = insertFileData(fcbId, fileDesc.position, content);
+                    }
+
+                    if (!written)
+                    {
+                        cout << " 错误：磁盘空间不足，写入失败" << endl;
+                        return;
+                    }
+                    touchFcb(fcbId, true);
+
+                    // 更新文件指针位置
+                    fileDesc.position += content.length();
+
+                    cout << " 写入成功" << endl;
+                    cout << " - 写入字节数：" << content.length() << endl;
+                    cout << " - 当前文件指针位置：" << fileDesc.position << endl;
+                    cout << " - 当前文件大小：" << sharedData->fcbs[fcbId].size << endl;
+
+                    sharedData->modifyCount++;
+                    dataChanged = true;
+                }
+                else
+                {
+                    cout << " 无效的文件描述符" << endl;
+                }
+            }
+            catch (const exception &e)
+            {
+                cout << " 参数错误: " << e.what() << endl;
+            }
+        }
+    }
+    else if (cmd == "copy")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: copy [源文件名] [目标目录路径]" << endl;
+            cout << " 支持的路径格式：" << endl;
+            cout << "   - 相对路径: docs/backup/     # 当前目录下的子目录" << endl;
+            cout << "   - 上级目录: ../backup/       # 返回上级目录" << endl;
+            cout << "   - 绝对路径: /docs/backup/    # 从根目录开始" << endl;
+            cout << "   - 当前目录: ./backup/        # 当前目录" << endl;
+        }
+        else
+        {
+            // 检查源文件是否存在
+            int srcId = findFCB(req.session->currentDirId, args[0]);
+            if (srcId == -1 || sharedData->fcbs[srcId].type != 0)
+            {
+                cout << " 源文件不存在: " << args[0] << endl;
+                return;
+            }
+
+            // 解析目标路径
+            string targetPath = args[1];
+            if (targetPath.empty())
+            {
+                cout << " 错误：目标路径不能为空" << endl;
+                return;
+            }
+
+            // 确保路径以/结尾
+            if (targetPath[targetPath.length() - 1] != '/')
+            {
+                targetPath += '/';
+            }
+
+            // 移除末尾的/并查找目标目录
+            string pathForSearch = targetPath.substr(0, targetPath.length() - 1);
+            int targetDirId = findFCBByPath(req.session, pathForSearch);
+            if (targetDirId == -1)
+            {
+                cout << " 目标目录不存在: " << pathForSearch << endl;
+                return;
+            }
+
+            // 确认是目录
+            if (sharedData->fcbs[targetDirId].type != 1)
+            {
+                cout << " 错误：" << pathForSearch << " 不是一个目录" << endl;
+                return;
+            }
+
+            // 检查目标目录中是否已存在同名文件
+            if (findFCB(targetDirId, args[0]) != -1)
+            {
+                cout << " 目标目录中已存在同名文件: " << args[0] << endl;
+                return;
+            }
+
+            // 在目标目录中创建新文件
+            int newFileId = createFCB(args[0], 0, req.session->user->userId, targetDirId);
+            if (newFileId != -1)
+            {
+                // 复制文件内容：共享源文件的数据块，之后任一方写入时才复制出私有块
+                if (!copyFileData(srcId, newFileId))
+                {
+                    releaseFCB(newFileId);
+                    cout << " 文件复制失败：磁盘空间不足" << endl;
+                    return;
+                }
+                touchFcb(newFileId, true);
+
+                cout << " 文件复制成功: " << endl;
+                cout << " - 源文件: " << args[0] << endl;
+                cout << " - 目标位置: " << pathForSearch << "/" << args[0] << endl;
+                cout << " - 文件大小: " << sharedData->fcbs[newFileId].size << " 字节" << endl;
+
+                sharedData->modifyCount++;
+                dataChanged = true;
+            }
+            else
+            {
+                cout << " 文件复制失败" << endl;
+            }
+        }
+    }
+    else if (cmd == "move")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: move [源文件名] [目标目录路径]" << endl;
+            cout << " 支持的路径格式：" << endl;
+            cout << "   - 相对路径: docs/backup/     # 当前目录下的子目录" << endl;
+            cout << "   - 上级目录: ../backup/       # 返回上级目录" << endl;
+            cout << "   - 绝对路径: /docs/backup/    # 从根目录开始" << endl;
+            cout << "   - 当前目录: ./backup/        # 当前目录" << endl;
+        }
+        else
+        {
+            // 检查源文件是否存在
+            int srcId = findFCB(req.session->currentDirId, args[0]);
+            if (srcId == -1 || sharedData->fcbs[srcId].type != 0)
+            {
+                cout << " 源文件不存在: " << args[0] << endl;
+                return;
+            }
+
+            // 解析目标路径
+            string targetPath = args[1];
+            if (targetPath.empty())
+            {
+                cout << " 错误：目标路径不能为空" << endl;
+                return;
+            }
+
+            // 确保路径以/结尾
+            if (targetPath[targetPath.length() - 1] != '/')
+            {
+                targetPath += '/';
+            }
+
+            // 移除末尾的/并查找目标目录
+            string pathForSearch = targetPath.substr(0, targetPath.length() - 1);
+            int targetDirId = findFCBByPath(req.session, pathForSearch);
+            if (targetDirId == -1)
+            {
+                cout << " 目标目录不存在: " << pathForSearch << endl;
+                return;
+            }
+
+            // 确认是目录
+            if (sharedData->fcbs[targetDirId].type != 1)
+            {
+                cout << " 错误：" << pathForSearch << " 不是一个目录" << endl;
+                return;
+            }
+
+            // 检查目标目录中是否已存在同名文件
+            if (findFCB(targetDirId, args[0]) != -1)
+            {
+                cout << " 目标目录中已存在同名文件: " << args[0] << endl;
+                return;
+            }
+
+            // 移动文件（更新父目录，同步目录项索引）
+            moveFCB(srcId, targetDirId);
+            touchFcb(srcId, true);
+
+            cout << " 文件移动成功: " << endl;
+            cout << " - 源文件: " << args[0] << endl;
+            cout << " - 目标位置: " << pathForSearch << "/" << args[0] << endl;
+
+            sharedData->modifyCount++;
+            dataChanged = true;
+        }
+    }
+    else if (cmd == "flock")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: flock [文件名]" << endl;
+            cout << " 功能: 锁定/解锁文件，将文件设置为只读状态" << endl;
+            cout << " 说明: - 锁定的文件所有用户（包括锁定者）都只能读取" << endl;
+            cout << "       - 任何用户都不能修改锁定的文件" << endl;
+            cout << "       - 只有锁定者可以解锁文件" << endl;
+            cout << "       - 使用相同命令可以解锁文件" << endl;
+        }
+        else
+        {
+            int fileId = findFCB(req.session->currentDirId, args[0]);
+            if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+            {
+                cout << " 文件不存在: " << args[0] << endl;
+            }
+            else
+            {
+                FCB &fcb = sharedData->fcbs[fileId];
+
+                // 检查文件是否已经被打开
+                bool isFileOpen = false;
+                for (const auto &openFile : req.session->openFiles)
+                {
+                    if (openFile.isOpen && openFile.fcbId == fileId)
+                    {
+                        isFileOpen = true;
+                        break;
+                    }
+                }
+
+                if (fcb.locked)
+                {
+                    if (fcb.lockOwner == req.session->user->userId)
+                    {
+                        fcb.locked = false;
+                        fcb.lockOwner = -1;
+                        cout << " 文件解锁成功: " << args[0] << endl;
+
+                        // 显示文件状态
+                        cout << " 当前状态：" << endl;
+                        cout << " - 锁定状态：未锁定" << endl;
+                        cout << " - 文件现在可以读写" << endl;
+                    }
+                    else
+                    {
+                        cout << " 错误：文件当前被其他用户锁定" << endl;
+                        // 显示锁定信息
+                        if (User *owner = findUserById(fcb.lockOwner))
+                        {
+                            cout << " - 锁定者：" << owner->username << endl;
+                        }
+                        cout << " - 锁定时间：" << formatTime(fcb.modifyTime) << endl;
+                        cout << " - 文件处于只读状态" << endl;
+                    }
+                }
+                else
+                {
+                    if (isFileOpen)
+                    {
+                        cout << " 警告：文件已打开，建议先关闭文件再加锁" << endl;
+                    }
+
+                    fcb.locked = true;
+                    fcb.lockOwner = req.session->user->userId;
+                    fcb.modifyTime = time(nullptr);
+                    cout << " 文件加锁成功: " << args[0] << endl;
+
+                    // 显示文件状态
+                    cout << " 当前状态：" << endl;
+                    cout << " - 锁定状态：已锁定（只读）" << endl;
+                    cout << " - 锁定者：" << req.session->user->username << endl;
+                    cout << " - 锁定时间：" << formatTime(fcb.modifyTime) << endl;
+                    cout << " - 所有用户（包括锁定者）只能读取此文件" << endl;
+                }
+                lockSharedMemory();
+                markFcbDirty(fileId);
+                walLogAttr(fileId);
+                unlockSharedMemory();
+
+                // 标记数据已修改
+                sharedData->modifyCount++;
+                dataChanged = true;
+            }
+        }
+    }
+    else if (cmd == "head")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: head -num [文件名]" << endl;
+            cout << " 示例: head -5 test.txt  # 显示文件前5行" << endl;
+        }
+        else
+        {
+            try
+            {
+                string numStr = args[0];
+                if (numStr[0] != '-')
+                {
+                    cout << " 参数格式错误，应为 -num" << endl;
+                    return;
+                }
+                int numLines = stoi(numStr.substr(1));
+                if (numLines <= 0)
+                {
+                    cout << " 行数必须大于0" << endl;
+                    return;
+                }
+                showFileHead(req.session, args[1], numLines);
+            }
+            catch (const exception &e)
+            {
+                cout << " 参数错误: " << e.what() << endl;
+            }
+        }
+    }
+    else if (cmd == "tail")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: tail -num [文件名]" << endl;
+            cout << " 示例: tail -5 test.txt  # 显示文件后5行" << endl;
+        }
+        else
+        {
+            try
+            {
+                string numStr = args[0];
+                if (numStr[0] != '-')
+                {
+                    cout << " 参数格式错误，应为 -num" << endl;
+                    return;
+                }
+                int numLines = stoi(numStr.substr(1));
+                if (numLines <= 0)
+                {
+                    cout << " 行数必须大于0" << endl;
+                    return;
+                }
+                showFileTail(req.session, args[1], numLines);
+            }
+            catch (const exception &e)
+            {
+                cout << " 参数错误: " << e.what() << endl;
+            }
+        }
+    }
+    else if (cmd == "lseek")
+    {
+        if (args.size() < 2)
+        {
+            cout << " 用法: lseek [文件描述符] [偏移量]" << endl;
+            cout << " 示例: lseek 0 10  # 从当前位置向后移动10个字节" << endl;
+            cout << "       lseek 0 -5  # 从当前位置向前移动5个字节" << endl;
+        }
+        else
+        {
+            try
+            {
+                int fd = stoi(args[0]);
+                long long offset = stoll(args[1]);
+
+                if (fd >= 0 && fd < static_cast<int>(req.session->openFiles.size()) &&
+                    req.session->openFiles[fd].isOpen)
+                {
+                    FileDesc &fileDesc = req.session->openFiles[fd];
+                    int fcbId = fileDesc.fcbId;
+
+                    // 检查文件访问权限
+                    if (!checkFileAccess(req.session, fcbId, true))
+                    {
+                        return;
+                    }
+
+                    // 计算新位置：允许移动到文件末尾之后，之后的写入在中间留下空洞
+                    size_t fileSize = sharedData->fcbs[fcbId].size;
+                    long long target = static_cast<long long>(fileDesc.position) + offset;
+
+                    // 检查新位置是否有效
+                    if (target < 0 || static_cast<unsigned long long>(target) > MAX_FILE_SIZE)
+                    {
+                        cout << " 错误：移动位置超出文件范围" << endl;
+                        cout << " - 当前位置：" << fileDesc.position << endl;
+                        cout << " - 文件大小：" << fileSize << endl;
+                        cout << " - 请求偏移：" << offset << endl;
+                        return;
+                    }
+                    size_t newPosition = static_cast<size_t>(target);
+
+                    // 更新文件指针位置
+                    fileDesc.position = newPosition;
+                    cout << " 文件指针已移动到：" << newPosition << endl;
+                    if (newPosition > fileSize)
+                    {
+                        cout << " - 超出文件末尾 " << newPosition - fileSize << " 字节，写入后中间部分为空洞（读出为0）" << endl;
+                    }
+
+                    // 如果需要写入内容
+                    cout << " 是否要在当前位置写入内容？(y/n): ";
+                    string choice;
+                    getline(cin, choice);
+
+                    if (choice == "y" || choice == "Y")
+                    {
+                        if (fileDesc.mode == 0)
+                        {
+                            cout << " 错误：文件以只读模式打开" << endl;
+                            return;
+                        }
+
+                        cout << " 请输入要写入的内容：";
+                        string content;
+                        getline(cin, content);
+
+                        // 在指定位置插入新内容
+                        if (!insertFileData(fcbId, newPosition, content))
+                        {
+                            cout << " 错误：磁盘空间不足，写入失败" << endl;
+                            return;
+                        }
+                        touchFcb(fcbId, true);
+
+                        // 更新文件指针位置
+                        fileDesc.position += content.length();
+
+                        cout << " 内容写入成功" << endl;
+                        cout << " - 当前文件指针位置：" << fileDesc.position << endl;
+                        cout << " - 当前文件大小：" << sharedData->fcbs[fcbId].size << endl;
+
+                        sharedData->modifyCount++;
+                        dataChanged = true;
+                    }
+                }
+                else
+                {
+                    cout << " 无效的文件描述符" << endl;
+                }
+            }
+            catch (const std::invalid_argument &e)
+            {
+                cout << " 参数必须是数字" << endl;
+            }
+            catch (const std::out_of_range &e)
+            {
+                cout << " 参数超出范围" << endl;
+            }
+        }
+    }
+    else if (cmd == "cd")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: cd [目录名]" << endl;
+        }
+        else
+        {
+            if (args[0] == "..")
+            {
+                if (req.session->currentDirId != req.session->user->rootDirId)
+                {
+                    int parentId = sharedData->fcbs[req.session->currentDirId].parentDir;
+                    if (parentId >= 0)
+                    {
+                        changeDirectory(req.session, parentId);
+                        cout << " 已切换到上级目录" << endl;
+                    }
+                }
+                else
+                {
+                    cout << " 已在根目录" << endl;
+                }
+            }
+            else
+            {
+                int targetDir = findFCB(req.session->currentDirId, args[0]);
+                if (targetDir != -1 && sharedData->fcbs[targetDir].type == 1)
+                {
+                    changeDirectory(req.session, targetDir);
+                    touchFcb(targetDir, false);
+                    cout << " 已切换到目录: " << args[0] << endl;
+                }
+                else
+                {
+                    cout << " 目录不存在: " << args[0] << endl;
+                }
+            }
+        }
+    }
+    else if (cmd.empty())
+    {
+        // 空命令不处理
+    }
+    else if (cmd == "import")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: import [外部文件路径] [系统内文件名]" << endl;
+            cout << " 说明: 将外部文件导入到文件系统中" << endl;
+            return;
+        }
+
+        string externalPath = args[0];
+        string internalName = args.size() > 1 ? args[1] : externalPath.substr(externalPath.find_last_of("/\\") + 1);
+        importFile(req.session, externalPath, internalName);
+    }
+    else if (cmd == "export")
+    {
+        if (args.empty())
+        {
+            cout << " 用法: export [系统内文件名] [外部文件路径]" << endl;
+            cout << " 说明: 将文件系统中的文件导出到外部" << endl;
+            return;
+        }
+
+        string internalName = args[0];
+        string externalPath = args.size() > 1 ? args[1] : internalName;
+        exportFile(req.session, internalName, externalPath);
+    }
+    else if (cmd == "processes" || cmd == "ps")
+    {
+        showConnectedProcesses();
+    }
+    else if (cmd == "find")
+    {
+        // find [目录] -name [模式]
+        string dirPath = ".";
+        size_t i = 0;
+        if (!args.empty() && args[0] != "-name")
+        {
+            dirPath = args[0];
+            i = 1;
+        }
+        if (args.size() != i + 2 || args[i] != "-name" || args[i + 1].empty())
+        {
+            cout << " 用法: find [目录] -name [模式]" << endl;
+            cout << " 说明: 在目录及其所有子目录中按名称查找" << endl;
+            cout << "       模式含 * ? [ ] 时按通配符匹配，否则按子串匹配" << endl;
+            cout << " 示例: find -name log        # 名称中包含 log" << endl;
+            cout << "       find docs -name *.txt # docs 下所有 .txt 文件" << endl;
+            return;
+        }
+        findByName(req.session, dirPath, args[i + 1]);
+    }
+    else if (cmd == "bench")
+    {
+        runBenchmark(req.session, args);
+    }
+    else
+    {
+        cout << " " << cmd << ": command not found" << endl;
+        cout << " 输入 'help' 查看可用命令" << endl;
+    }
+}
+
+void MiniFMS::run()
+{
+    cout << "\n正在启动 MiniFMS Pro...\n"
+         << endl;
+
+    while (!shouldExit)
+    {
+        cout << "\n╔════════════════════════════════╗" << endl;
+        cout << "║    MiniFMS " << VERSION << "                ║" << endl;
+        cout << "║        文件管理系统              ║" << endl;
+        cout << "╠════════════════════════════════╣" << endl;
+        cout << "║  1.  用户注册                  ║" << endl;
+        cout << "║  2.  用户登录                  ║" << endl;
+        cout << "║  0.  退出系统                  ║" << endl;
+        cout << "╚════════════════════════════════╝" << endl;
+        cout << "\n请输入选项 (0-2): ";
+
+        string input;
+        if (!getline(cin, input))
+        {
+            cout << "\n输入错误，正在保存数据..." << endl;
+            shouldExit = true;
+            break;
+        }
+
+        int choice;
+        try
+        {
+            choice = stoi(input);
+        }
+        catch (...)
+        {
+            cout << "\n无效的输入，请输入0-2之间的数字" << endl;
+            continue;
+        }
+
+        if (choice == 1)
+        {
+            cout << "\n=== 用户注册 ===" << endl;
+            cout << "请输入用户名: ";
+            string username;
+            if (!getline(cin, username) || username.empty())
+            {
+                cout << "用户名不能为空！" << endl;
+                continue;
+            }
+
+            cout << "请输入密码: ";
+            string password;
+            if (!getline(cin, password) || password.empty())
+            {
+                cout << "密码不能为空！" << endl;
+                continue;
+            }
+
+            registerUser(username, password);
+        }
+        else if (choice == 2)
+        {
+            cout << "\n=== 用户登录 ===" << endl;
+            cout << "用户名: ";
+            string username;
+            if (!getline(cin, username) || username.empty())
+            {
+                cout << "用户名不能为空！" << endl;
+                continue;
+            }
+
+            cout << "密码: ";
+            string password;
+            if (!getline(cin, password) || password.empty())
+            {
+                cout << "密码不能为空！" << endl;
+                continue;
+            }
+
+            User *user = loginUser(username, password);
+            if (user)
+            {
+                currentSession.user = user;
+                currentSession.active = true;
+                // 从此持有FCB ID，需要跟随在线整理的重定位
+                lockSharedMemory();
+                currentSession.currentDirId = user->rootDirId;
+                sharedData->relocAck[currentProcessId] = sharedData->relocGen;
+                unlockSharedMemory();
+
+                // 启动自动保存线程
+                autoSaveThreadHandle = thread(&MiniFMS::autoSaveThread, this);
+
+                // 启动磁盘维护线程
+                diskMaintenanceThreadHandle = thread(&MiniFMS::diskMaintenanceThread, this);
+
+                // 进入用户交互
+                userInteractionThread(currentSession);
+
+                // 等待线程结束
+                cleanup();
+
+                // 重置用户状态
+                lockSharedMemory();
+                user->isActive = false;
+                markUserDirty(static_cast<int>(user - sharedData->users));
+                unlockSharedMemory();
+            }
+        }
+        else if (choice == 0)
+        {
+            cout << "\n正在保存系统数据..." << endl;
+            shouldExit = true;
+            if (saveDataToDisk(false))
+            {
+                cout << "系统数据已保存" << endl;
+            }
+            else
+            {
+                cout << "警告：系统数据保存失败！" << endl;
+            }
+            cout << "感谢使用 MiniFMS，再见！" << endl;
+            break;
+        }
+        else
+        {
+            cout << "\n无效的选项，请重新选择！" << endl;
+        }
+    }
+
+    // 确保所有资源都被清理
+    cleanup();
+}
+
+// 持久化功能实现
+bool MiniFMS::saveDataToDisk(bool silent)
+{
+    if (!sharedData)
+        return false;
+
+    lock_guard<mutex> lock(saveMutex);
+
+#ifndef _WIN32
+    if (imageMapped)
+        return syncImage(silent);
+#endif
+    return saveStore(silent);
+}
+
+void MiniFMS::markStoreDirty(const void *data, size_t length)
+{
+    if (length == 0)
+        return;
+    size_t offset = static_cast<size_t>(static_cast<const char *>(data) - reinterpret_cast<const char *>(sharedData));
+    size_t first = 1;
+    for (const StoreSegment &seg : STORE_SEGMENTS)
+    {
+        if (offset >= seg.offset && offset < seg.offset + seg.bytes)
+        {
+            size_t end = min(offset + length, seg.offset + seg.bytes);
+            size_t last = first + (end - 1 - seg.offset) / BLOCK_SIZE;
+            for (size_t page = first + (offset - seg.offset) / BLOCK_SIZE; page <= last; ++page)
+                sharedData->storeDirty[page / 64] |= 1ULL << (page % 64);
+            return;
+        }
+        first += STORE_SEGMENT_PAGES(seg.bytes);
+    }
+}
+
+bool MiniFMS::saveStore(bool silent)
+{
+    auto start = chrono::steady_clock::now();
+
+    // 同一时间只有一个进程写文件：持有者仍在运行时一直等待，不论它写了多久；
+    // 持有者已退出（或是本进程之前留下的，进程内的保存由 saveMutex 串行）时接手
+    int self = currentPid();
+    bool takeover = false;
+    for (;;)
+    {
+        lockSharedMemory();
+        int owner = sharedData->storeSaving;
+        if (owner == 0)
+            break;
+        if (owner == self || !processAlive(owner))
+        {
+            takeover = true;
+            break;
+        }
+        unlockSharedMemory();
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    sharedData->storeSaving = self;
+    // 异常退出的保存者可能已经取走并清空了脏页记录而没有写完，这些页只剩共享段中的内容，本次完整写入
+    if (takeover)
+        sharedData->storeId = 0;
+    uint64_t storeId = sharedData->storeId;
+    unlockSharedMemory();
+
+    // 文件不存在、布局不符、上次写入未完成或不是共享段同步过的文件时完整写入；
+    // 增量写入沿用文件中的页校验表，表与文件头的校验值不符时同样改为完整写入
+    static const char zeroPage[BLOCK_SIZE] = {0};
+    StoreHeader header;
+    vector<uint32_t> pageCrcs(STORE_PAGES);
+    bool incremental = false;
+    {
+        ifstream in(STORE_FILE, ios::binary);
+        incremental = storeId != 0 && in.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+                      memcmp(header.magic, STORE_MAGIC, 8) == 0 && header.version == STORE_VERSION &&
+                      header.layoutHash == storeLayoutHash() && header.storeId == storeId &&
+                      in.seekg(static_cast<streamoff>(STORE_CRC_PAGE) * BLOCK_SIZE) &&
+                      in.read(reinterpret_cast<char *>(pageCrcs.data()), sizeof(uint32_t) * STORE_PAGES) &&
+                      storeHeaderChecksum(header, pageCrcs) == header.checksum;
+    }
+    if (!incremental)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORE_MAGIC, 8);
+        header.version = STORE_VERSION;
+        header.layoutHash = storeLayoutHash();
+        header.storeId = static_cast<uint64_t>(chrono::system_clock::now().time_since_epoch().count()) | 1;
+        pageCrcs.assign(STORE_PAGES, crc32c(zeroPage, BLOCK_SIZE));
+    }
+
+    // 在锁内取出脏页记录并复制这些页的内容，写文件时不再持有锁；完整写入时全0的页和未分配的块保持为空洞
+    vector<size_t> pages;
+    vector<char> staged;
+    lockSharedMemory();
+    vector<uint64_t> dirty(sharedData->storeDirty, sharedData->storeDirty + STORE_PAGE_WORDS);
+    memset(sharedData->storeDirty, 0, sizeof(sharedData->storeDirty));
+    for (size_t page = 1; page < STORE_PAGES; ++page)
+    {
+        if (incremental && !((dirty[page / 64] >> (page % 64)) & 1))
+            continue;
+        size_t length = BLOCK_SIZE;
+        const char *data;
+        if (page >= STORE_BLOCK_PAGE)
+        {
+            int block = static_cast<int>(page - STORE_BLOCK_PAGE);
+            if (!blockInUse(block))
+                continue;
+            // 写出的块顺便封存校验值，之后 verify 只需比较
+            if (!((sharedData->crcValid[block / 64] >> (block % 64)) & 1))
+                sealBlock(block);
+            data = sharedData->blockPool[block];
+        }
+        else
+        {
+            data = storePageData(sharedData, page, length);
+            if (!incremental && memcmp(data, zeroPage, length) == 0)
+                continue;
+        }
+        pages.push_back(page);
+        staged.insert(staged.end(), data, data + length);
+        staged.resize(pages.size() * BLOCK_SIZE, 0);
+    }
+    header.saveCount++;
+    header.saveTime = time(nullptr);
+    header.modifyCount = sharedData->modifyCount;
+    header.nextUserId = sharedData->nextUserId;
+    header.nextFcbId = sharedData->nextFcbId;
+    header.compressNewFiles = sharedData->compressNewFiles;
+    header.extentCount = sharedData->extentCount;
+    header.frameCount = sharedData->frameCount;
+    // 复制出的内容包含日志中此位置之前的全部记录；当前日志切换为旧日志，保存完成后删除。
+    // 上一次保存失败留下的旧日志还在时不切换，本次保存完成后一并删除
+    uint64_t walId = sharedData->walId, checkpoint = sharedData->walLsn;
+    if (sharedData->walEnabled && sharedData->walLsn > sharedData->walBaseLsn && !sharedData->walOldPending)
+        walRotate();
+    unlockSharedMemory();
+
+    // 每页的校验值按写出的整页计算，校验表中有变化的页随之写出
+    size_t dataPages = pages.size();
+    vector<char> tableTouched(STORE_CRC_PAGES, incremental ? 0 : 1);
+    for (size_t i = 0; i < dataPages; ++i)
+    {
+        pageCrcs[pages[i]] = crc32c(&staged[i * BLOCK_SIZE], BLOCK_SIZE);
+        tableTouched[pages[i] * sizeof(uint32_t) / BLOCK_SIZE] = 1;
+    }
+    const char *table = reinterpret_cast<const char *>(pageCrcs.data());
+    size_t tableBytes = sizeof(uint32_t) * STORE_PAGES;
+    for (size_t t = 0; t < STORE_CRC_PAGES; ++t)
+    {
+        if (!tableTouched[t])
+            continue;
+        size_t from = t * BLOCK_SIZE, length = min(static_cast<size_t>(BLOCK_SIZE), tableBytes - from);
+        pages.push_back(STORE_CRC_PAGE + t);
+        staged.insert(staged.end(), table + from, table + from + length);
+        staged.resize(pages.size() * BLOCK_SIZE, 0);
+    }
+
+    // 连续的页合并成一次写入
+    auto writePages = [&pages, &staged](ostream &out)
+    {
+        for (size_t i = 0; i < pages.size();)
+        {
+            size_t j = i + 1;
+            while (j < pages.size() && pages[j] == pages[j - 1] + 1)
+                ++j;
+            out.seekp(static_cast<streamoff>(pages[i] * BLOCK_SIZE));
+            out.write(&staged[i * BLOCK_SIZE], static_cast<streamsize>((j - i) * BLOCK_SIZE));
+            i = j;
+        }
+        return out.good();
+    };
+    bool ok;
+    header.walId = walId;
+    header.walCheckpoint = checkpoint;
+    header.checksum = storeHeaderChecksum(header, pageCrcs);
+    if (incremental)
+    {
+        // 页面和新的文件头先整体写入页日志并落盘，再原地写入；原地写入中途崩溃时，
+        // 加载前按页日志重做，文件不会停留在新旧页面混合的状态
+        StoreJournalHeader journal;
+        memset(&journal, 0, sizeof(journal));
+        memcpy(journal.magic, STORE_JOURNAL_MAGIC, 8);
+        journal.pageCount = static_cast<uint32_t>(pages.size());
+        journal.storeId = header.storeId;
+        vector<char> body(reinterpret_cast<const char *>(&header), reinterpret_cast<const char *>(&header + 1));
+        for (size_t page : pages)
+        {
+            uint64_t number = page;
+            body.insert(body.end(), reinterpret_cast<const char *>(&number), reinterpret_cast<const char *>(&number + 1));
+        }
+        body.insert(body.end(), staged.begin(), staged.end());
+        journal.checksum = crc32c(body.data(), body.size());
+        {
+            ofstream file(STORE_JOURNAL_FILE, ios::binary | ios::trunc);
+            ok = file.is_open() && file.write(reinterpret_cast<const char *>(&journal), sizeof(journal)) &&
+                 file.write(body.data(), static_cast<streamsize>(body.size())) && file.flush();
+        }
+        ok = ok && syncFile(STORE_JOURNAL_FILE) && syncDirectory();
+        if (ok)
+        {
+            fstream file(STORE_FILE, ios::binary | ios::in | ios::out);
+            ok = file.is_open() && writePages(file) && file.seekp(0) &&
+                 file.write(reinterpret_cast<const char *>(&header), sizeof(header)) && file.flush();
+        }
+        ok = ok && syncFile(STORE_FILE);
+    }
+    else
+    {
+        // 完整写入先写临时文件再替换，旧文件在新文件写完之前保持可用；元数据段补足长度，加载时整段读取
+        string tempName = string(STORE_FILE) + ".tmp";
+        {
+            ofstream file(tempName, ios::binary | ios::trunc);
+            ok = file.is_open() && file.write(reinterpret_cast<const char *>(&header), sizeof(header)) &&
+                 file.seekp(static_cast<streamoff>(STORE_BLOCK_PAGE) * BLOCK_SIZE - 1) && file.put('\0') &&
+                 writePages(file) && file.flush();
+        }
+        ok = ok && syncFile(tempName.c_str());
+#ifdef _WIN32
+        if (ok)
+            remove(STORE_FILE);
+#endif
+        ok = ok && rename(tempName.c_str(), STORE_FILE) == 0 && syncDirectory();
+        if (!ok)
+            remove(tempName.c_str());
+    }
+
+    // 原地写入失败时页日志保留：加载时据此补完，下一次保存完整写入后它与新文件不再匹配
+    if (ok)
+        remove(STORE_JOURNAL_FILE);
+
+    lockSharedMemory();
+    sharedData->storeSaving = 0;
+    if (ok)
+    {
+        // 检查点已落盘，旧日志中的记录都包含在文件里
+        sharedData->walCheckpointLsn = max(sharedData->walCheckpointLsn, checkpoint);
+        if (sharedData->walOldPending)
+        {
+            remove(WAL_OLD_FILE);
+            sharedData->walOldPending = 0;
+        }
+        sharedData->storeId = header.storeId;
+        sharedData->storeSaves++;
+        sharedData->storePagesWritten += static_cast<long long>(dataPages);
+        sharedData->storeLastPages = static_cast<int>(dataPages);
+    }
+    else
+    {
+        // 文件状态未知，下一次保存完整写入
+        sharedData->storeId = 0;
+    }
+    unlockSharedMemory();
+
+    if (!ok)
+    {
+        if (!silent)
+            cerr << " 保存数据失败: 无法写入 " << STORE_FILE << endl;
+        return false;
+    }
+    dataChanged = false;
+
+    if (!silent)
+    {
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << " 数据已保存到 " << STORE_FILE << "（" << (incremental ? "增量" : "完整") << "写入 " << dataPages
+             << " 页，用时 " << fixed << setprecision(1) << millis << " 毫秒）" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+    return true;
+}
+
+bool MiniFMS::recoverStoreJournal()
+{
+    ifstream in(STORE_JOURNAL_FILE, ios::binary);
+    if (!in.is_open())
+        return true;
+
+    // 页日志不完整说明原地写入还没有开始，页式存储仍是上一次保存的内容
+    StoreJournalHeader journal;
+    StoreHeader current, header;
+    vector<char> body;
+    bool valid = in.read(reinterpret_cast<char *>(&journal), sizeof(journal)) &&
+                 memcmp(journal.magic, STORE_JOURNAL_MAGIC, 8) == 0 && journal.pageCount < STORE_FILE_PAGES;
+    if (valid)
+    {
+        // 先并行校验再读入，校验不符的页日志不占用内存
+        size_t bodySize = sizeof(StoreHeader) + static_cast<size_t>(journal.pageCount) * (sizeof(uint64_t) + BLOCK_SIZE);
+        vector<uint32_t> crcs;
+        vector<char> readable;
+        checksumFileRanges(STORE_JOURNAL_FILE, {{sizeof(journal), bodySize}}, crcs, readable);
+        valid = readable[0] && crcs[0] == journal.checksum;
+        if (valid)
+        {
+            body.resize(bodySize);
+            valid = static_cast<bool>(in.read(body.data(), static_cast<streamsize>(bodySize)));
+        }
+    }
+    in.close();
+    {
+        ifstream store(STORE_FILE, ios::binary);
+        valid = valid && store.read(reinterpret_cast<char *>(&current), sizeof(current)) &&
+                current.storeId == journal.storeId;
+    }
+    const uint64_t *numbers = reinterpret_cast<const uint64_t *>(body.data() + sizeof(StoreHeader));
+    for (uint32_t i = 0; valid && i < journal.pageCount; ++i)
+        valid = numbers[i] >= 1 && numbers[i] < STORE_FILE_PAGES;
+    if (!valid)
+    {
+        remove(STORE_JOURNAL_FILE);
+        return true;
+    }
+
+    // 页日志完整：重做全部页面和文件头，重复执行结果相同
+    memcpy(&header, body.data(), sizeof(header));
+    const char *data = body.data() + sizeof(StoreHeader) + sizeof(uint64_t) * journal.pageCount;
+    bool ok;
+    {
+        fstream file(STORE_FILE, ios::binary | ios::in | ios::out);
+        ok = file.is_open();
+        for (uint32_t i = 0; ok && i < journal.pageCount; ++i)
+        {
+            ok = file.seekp(static_cast<streamoff>(numbers[i] * BLOCK_SIZE)) &&
+                 file.write(data + static_cast<size_t>(i) * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        ok = ok && file.seekp(0) && file.write(reinterpret_cast<const char *>(&header), sizeof(header)) && file.flush();
+    }
+    if (!(ok && syncFile(STORE_FILE)))
+    {
+        cerr << " 按页日志补完上次保存失败，改为从 filesystem.dat 加载" << endl;
+        return false;
+    }
+    remove(STORE_JOURNAL_FILE);
+    cout << " 上次保存未完成，已按页日志补写 " << journal.pageCount << " 页" << endl;
+    return true;
+}
+
+bool MiniFMS::loadStore()
+{
+    if (!recoverStoreJournal())
+        return false;
+
+    ifstream file(STORE_FILE, ios::binary);
+    if (!file.is_open())
+        return false;
+
+    auto start = chrono::steady_clock::now();
+    StoreHeader header;
+    bool valid = file.read(reinterpret_cast<char *>(&header), sizeof(header)) && memcmp(header.magic, STORE_MAGIC, 8) == 0 &&
+                 (header.version == 1 || header.version == STORE_VERSION) && header.layoutHash == storeLayoutHash() &&
+                 header.extentCount >= 0 && header.extentCount <= MAX_EXTENTS &&
+                 header.frameCount >= 0 && header.frameCount <= MAX_FRAMES;
+    file.seekg(0, ios::end);
+    valid = valid && file.tellg() >= static_cast<streamoff>(STORE_BLOCK_PAGE) * BLOCK_SIZE;
+    if (!valid)
+    {
+        cerr << " 页式存储文件 " << STORE_FILE << " 不完整或与当前版本不一致，改为从 filesystem.dat 加载" << endl;
+        return false;
+    }
+
+    // 读入的记录在校验或检查失败时清除，交给 filesystem.dat 加载（内联区的未使用部分必须为0）；
+    // 损坏的文件连同日志改名保留，不会被之后的保存覆盖，日志的位置只对这个文件有意义
+    auto resetLoaded = [this]()
+    {
+        for (int i = 0; i < MAX_USERS; i++)
+            sharedData->users[i] = User();
+        for (int i = 0; i < MAX_FCBS; i++)
+            sharedData->fcbs[i] = FCB();
+        memset(sharedData->fileInline, 0, sizeof(sharedData->fileInline));
+        memset(sharedData->inlineData, 0, sizeof(sharedData->inlineData));
+        memset(sharedData->fileCompressed, 0, sizeof(sharedData->fileCompressed));
+        sharedData->extentCount = 0;
+        sharedData->frameCount = 0;
+    };
+    auto rejectStore = [this, &resetLoaded, &file](const string &reason)
+    {
+        file.close();
+        resetLoaded();
+        string kept = string(STORE_FILE) + ".bad";
+        rename(STORE_FILE, kept.c_str());
+        rename(WAL_FILE, (string(WAL_FILE) + ".bad").c_str());
+        rename(WAL_OLD_FILE, (string(WAL_OLD_FILE) + ".bad").c_str());
+        cerr << " 页式存储文件" << reason << "，已连同日志改名为 " << kept << " 等保留，改为从 filesystem.dat 加载" << endl;
+        return false;
+    };
+
+    // v2 起文件头和页校验表由文件头中的校验值保护；v1 文件没有校验表，照常加载，下次保存时完整写入
+    bool checked = header.version == STORE_VERSION;
+    vector<uint32_t> pageCrcs;
+    if (checked)
+    {
+        pageCrcs.resize(STORE_PAGES);
+        file.clear();
+        file.seekg(static_cast<streamoff>(STORE_CRC_PAGE) * BLOCK_SIZE);
+        if (!file.read(reinterpret_cast<char *>(pageCrcs.data()), sizeof(uint32_t) * STORE_PAGES) ||
+            storeHeaderChecksum(header, pageCrcs) != header.checksum)
+            return rejectStore("的文件头或页校验表校验失败");
+    }
+
+    // 元数据段整段读入；区段表和帧表只读有效记录所在的页，其余页保持未提交
+    vector<size_t> loadedPages;
+    size_t page = 1;
+    for (const StoreSegment &seg : STORE_SEGMENTS)
+    {
+        size_t bytes = seg.bytes;
+        if (seg.offset == offsetof(SharedData, blockPool))
+            break;
+        if (seg.offset == offsetof(SharedData, extents))
+            bytes = min(seg.bytes, STORE_SEGMENT_PAGES(sizeof(Extent) * header.extentCount) * BLOCK_SIZE);
+        else if (seg.offset == offsetof(SharedData, frames))
+            bytes = min(seg.bytes, STORE_SEGMENT_PAGES(sizeof(Frame) * header.frameCount) * BLOCK_SIZE);
+        file.clear();
+        file.seekg(static_cast<streamoff>(page * BLOCK_SIZE));
+        if (!file.read(reinterpret_cast<char *>(sharedData) + seg.offset, static_cast<streamsize>(bytes)))
+        {
+            cerr << " 读取页式存储文件失败，改为从 filesystem.dat 加载" << endl;
+            resetLoaded();
+            return false;
+        }
+        for (size_t k = 0; k < STORE_SEGMENT_PAGES(bytes); ++k)
+            loadedPages.push_back(page + k);
+        page += STORE_SEGMENT_PAGES(seg.bytes);
+    }
+
+    // 只读入区段表和帧表引用的块，连续的块一次读取；文件中缺失的块按0处理
+    vector<char> needed(MAX_BLOCKS, 0);
+    for (int i = 0; i < header.extentCount; ++i)
+    {
+        const Extent &e = sharedData->extents[i];
+        for (int k = 0; k < e.blockCount; ++k)
+        {
+            if (e.startBlock + k >= 0 && e.startBlock + k < MAX_BLOCKS)
+                needed[e.startBlock + k] = 1;
+        }
+    }
+    for (int i = 0; i < header.frameCount; ++i)
+    {
+        const Frame &f = sharedData->frames[i];
+        for (int k = 0; k < f.blockCount && k < FRAME_BLOCKS; ++k)
+        {
+            if (f.blocks[k] >= 0 && f.blocks[k] < MAX_BLOCKS)
+                needed[f.blocks[k]] = 1;
+        }
+    }
+
+    // 读入的元数据页和引用到的数据块页逐页与校验表比较，多个线程并行计算
+    unsigned workers = 0;
+    if (checked)
+    {
+        for (int b = 0; b < MAX_BLOCKS; ++b)
+        {
+            if (needed[b])
+                loadedPages.push_back(STORE_BLOCK_PAGE + b);
+        }
+        vector<FileRange> ranges;
+        for (size_t p : loadedPages)
+            ranges.push_back({static_cast<uint64_t>(p) * BLOCK_SIZE, BLOCK_SIZE});
+        vector<uint32_t> crcs;
+        vector<char> readable;
+        workers = checksumFileRanges(STORE_FILE, ranges, crcs, readable);
+        int mismatched = 0;
+        for (size_t k = 0; k < loadedPages.size(); ++k)
+            mismatched += readable[k] && crcs[k] == pageCrcs[loadedPages[k]] ? 0 : 1;
+        if (mismatched > 0)
+            return rejectStore("中有 " + to_string(mismatched) + " 页与校验表不符");
+    }
+
+    // 校验通过后检查记录之间的引用：下标越界的区段、帧、父目录或用户根目录不能交给重建
+    sharedData->extentCount = header.extentCount;
+    sharedData->frameCount = header.frameCount;
+    long long referenceErrors = countReferenceErrors(false);
+    if (referenceErrors > 0)
+        return rejectStore("中有 " + to_string(referenceErrors) + " 处记录引用不一致");
+
+    sharedData->modifyCount = header.modifyCount;
+    sharedData->nextUserId = header.nextUserId;
+    sharedData->nextFcbId = header.nextFcbId;
+    sharedData->compressNewFiles = header.compressNewFiles ? 1 : 0;
+    sharedData->walId = header.walId;
+    sharedData->walLsn = sharedData->walSyncedLsn = sharedData->walBaseLsn = sharedData->walCheckpointLsn = header.walCheckpoint;
+
+    for (int w = 0; w < BITMAP_WORDS; w++)
+    {
+        sharedData->staleBitmap[w] |= sharedData->bitMap[w];
+        sharedData->bitMap[w] = 0;
+    }
+    bool missing = false;
+    for (int b = 0; b < MAX_BLOCKS;)
+    {
+        if (!needed[b])
+        {
+            ++b;
+            continue;
+        }
+        int run = b;
+        while (b < MAX_BLOCKS && needed[b])
+            ++b;
+        file.clear();
+        file.seekg(static_cast<streamoff>(STORE_BLOCK_PAGE + run) * BLOCK_SIZE);
+        if (!file.read(sharedData->blockPool[run], static_cast<streamsize>(b - run) * BLOCK_SIZE))
+        {
+            size_t got = static_cast<size_t>(max(static_cast<streamsize>(0), file.gcount()));
+            memset(sharedData->blockPool[run] + got, 0, static_cast<size_t>(b - run) * BLOCK_SIZE - got);
+            file.clear();
+            missing = true;
+        }
+        for (int k = run; k < b; ++k)
+            sharedData->staleBitmap[k / 64] &= ~(1ULL << (k % 64));
+    }
+    file.close();
+
+    // 块引用计数、位图和各项索引由记录重新生成
+    recoverImageState();
+    sharedData->storeId = header.storeId;
+    memset(sharedData->storeDirty, 0, sizeof(sharedData->storeDirty));
+    sharedData->initialized = true;
+    if (missing)
+        cerr << " 警告：页式存储文件缺少部分数据块，缺失部分按0处理" << endl;
+    if (checked)
+    {
+        // 校验过的块直接封存文件中的校验值，verify 之后只需比较
+        for (int b = 0; b < MAX_BLOCKS; ++b)
+        {
+            if (needed[b] && !missing)
+            {
+                sharedData->blockCrc[b] = pageCrcs[STORE_BLOCK_PAGE + b];
+                sharedData->crcValid[b / 64] |= 1ULL << (b % 64);
+            }
+        }
+        const char *kernelName = nullptr;
+        crc32cKernel(&kernelName);
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << " 已校验 " << loadedPages.size() << " 页（" << workers << " 个线程，" << fixed << setprecision(1) << millis
+             << " ms，" << kernelName << "）" << endl;
+        cout.unsetf(ios::fixed);
+    }
+    else
+    {
+        cout << " 页式存储文件为旧版本格式，没有页校验表，下次保存时完整写入" << endl;
+    }
+
+    int userCount = 0, fcbCount = 0;
+    for (int i = 0; i < MAX_USERS; i++)
+        userCount += sharedData->users[i].isused ? 1 : 0;
+    for (int i = 0; i < MAX_FCBS; i++)
+        fcbCount += sharedData->fcbUsed[i];
+    cout << " 从文件 " << STORE_FILE << " 加载数据成功" << endl;
+    cout << " 已加载 " << userCount << " 个用户, " << fcbCount << " 个文件/目录" << endl;
+    return true;
+}
+
+bool MiniFMS::saveSnapshot(bool silent, int version)
+{
+    // 锁内只取一致视图：复制用户、FCB和各文件的区段表或帧表，并给这些表引用的数据块各加一次引用。
+    // 之后任何进程写这些块都会先复制出私有块（写时复制），后台整理也不搬动它们，块内容保持取视图时的状态；
+    // 序列化、计算校验值和写文件都在锁外进行，结束后再在锁内放开固定的块
+    struct FileView
+    {
+        int id;
+        FileLayout layout;
+        string inlineData;
+        vector<Extent> extents;
+        vector<Frame> frames;
+        vector<pair<size_t, size_t>> ranges; // 要写入内容段的已分配范围，已去掉共享段
+    };
+    vector<User> users;
+    vector<pair<int, FCB>> fcbs;
+    vector<FileView> files; // 有内容的普通文件，按槽位顺序
+    vector<int> pins;
+    vector<int> freeStack, compressedFiles;
+    vector<SharedRun> sharedRuns;
+    int modifyCount = 0, nextUserId = 0, nextFcbId = 0, volumeDefault = 0;
+    size_t dataFrom = version == 1 ? CONTENT_ROW_SIZE : 0;
+    bool locked = false, pinned = false, ok = false;
+    string tempName = DATA_FILE + ".tmp";
+    uint64_t written = 0;
+    string error;
+    try
+    {
+        lockSharedMemory();
+        locked = true;
+        for (int i = 0; i < MAX_USERS; i++)
+        {
+            if (sharedData->users[i].isused)
+                users.push_back(sharedData->users[i]);
+        }
+
+        // v1只写超长文件内容行之后的部分（旧版本不读取内容段，只能看到前 CONTENT_ROW_SIZE 字节），v2起写所有非空文件；
+        // 每个文件只写已分配的区段，空洞不占用磁盘空间；引用其他文件共享块的部分由共享块记录恢复
+        sharedRuns = collectSharedRuns();
+        map<int, vector<pair<size_t, size_t>>> skipped;
+        for (const SharedRun &run : sharedRuns)
+        {
+            skipped[run.dstId].push_back(make_pair(static_cast<size_t>(run.dstBlock) * BLOCK_SIZE,
+                                                   static_cast<size_t>(run.dstBlock + run.count) * BLOCK_SIZE));
+        }
+        for (int i = 0; i < MAX_FCBS; i++)
+        {
+            if (!sharedData->fcbUsed[i])
+                continue;
+            const FCB &fcb = sharedData->fcbs[i];
+            fcbs.push_back(make_pair(i, fcb));
+            if (fcb.type != 0 || fcb.size == 0)
+                continue;
+
+            FileView view;
+            view.id = i;
+            view.layout.size = fcb.size;
+            if (sharedData->fileInline[i])
+            {
+                view.inlineData.assign(sharedData->inlineData[i], fcb.size);
+            }
+            else if (sharedData->fileCompressed[i])
+            {
+                view.layout.compressed = true;
+                view.frames.assign(sharedData->frames + findFrame(i, 0), sharedData->frames + findFrame(i + 1, 0));
+                for (const Frame &f : view.frames)
+                    pins.insert(pins.end(), f.blocks, f.blocks + f.blockCount);
+            }
+            else
+            {
+                view.extents.assign(sharedData->extents + extentUpperBound(i - 1, INT_MAX), sharedData->extents + extentUpperBound(i, INT_MAX));
+                for (const Extent &e : view.extents)
+                {
+                    for (int b = e.startBlock; b < e.startBlock + e.blockCount; ++b)
+                        pins.push_back(b);
+                }
+            }
+            if (fcb.size > dataFrom)
+            {
+                view.ranges = fileDataRanges(i, dataFrom);
+                auto skip = skipped.find(i);
+                if (skip != skipped.end())
+                {
+                    // 去掉共享段，两者都按偏移升序排列
+                    vector<pair<size_t, size_t>> kept;
+                    for (const auto &range : view.ranges)
+                    {
+                        size_t begin = range.first, end = range.first + range.second;
+                        for (const auto &hole : skip->second)
+                        {
+                            if (hole.second <= begin || hole.first >= end)
+                                continue;
+                            if (hole.first > begin)
+                                kept.push_back(make_pair(begin, hole.first - begin));
+                            begin = max(begin, hole.second);
+                        }
+                        if (begin < end)
+                            kept.push_back(make_pair(begin, end - begin));
+                    }
+                    view.ranges.swap(kept);
+                }
+            }
+            files.push_back(move(view));
+        }
+        modifyCount = sharedData->modifyCount;
+        nextUserId = sharedData->nextUserId;
+        nextFcbId = sharedData->nextFcbId;
+        freeStack.assign(sharedData->freeFcbStack, sharedData->freeFcbStack + sharedData->freeFcbTop);
+        volumeDefault = sharedData->compressNewFiles;
+        for (int i = 0; i < MAX_FCBS; i++)
+        {
+            if (sharedData->fcbUsed[i] && sharedData->fileCompressed[i])
+                compressedFiles.push_back(i);
+        }
+        for (int b : pins)
+            sharedData->blockRefs[b]++;
+        if (currentProcessId >= 0)
+            sharedData->snapshotPinned[currentProcessId] = 1;
+        pinned = true;
+        unlockSharedMemory();
+        locked = false;
+
+        for (FileView &view : files)
+        {
+            view.layout.inlineData = view.inlineData.empty() ? nullptr : view.inlineData.data();
+            view.layout.extents = view.extents.data();
+            view.layout.extentCount = static_cast<int>(view.extents.size());
+            view.layout.frames = view.frames.data();
+            view.layout.frameCount = static_cast<int>(view.frames.size());
+        }
+
+        // 先写临时文件并落盘再替换，新快照完整落盘之前旧快照保持可用；
+        // 内容直接写入文件，不在内存中拼出整个快照
+        ofstream file(tempName, ios::binary | ios::trunc);
+        if (!file.is_open())
+            throw runtime_error("无法创建 " + tempName);
+        ChecksumWriter writer(file.rdbuf());
+        ostream out(&writer);
+
+        // 1. 写入文件头部标识和版本信息
+        const char MAGIC[] = "MINIFMS2";
+        out.write(MAGIC, 8);
+        out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+
+        // v3每段以标识、8字节长度和4字节CRC32C开头，写完一段后回填；段长度不含下一段的标识，
+        // 最后的结束段为空。v1/v2只有末尾的附加段带标识
+        vector<uint64_t> segmentStarts;
+        vector<pair<uint64_t, uint32_t>> segmentSums;
+        auto endSegment = [&]()
+        {
+            if (segmentSums.size() < segmentStarts.size())
+                segmentSums.push_back(make_pair(writer.count, writer.crc));
+        };
+        auto beginSegment = [&](const char *tag)
+        {
+            endSegment();
+            out.write(tag, 8);
+            if (version < 3)
+                return;
+            segmentStarts.push_back(writer.total);
+            char placeholder[12] = {0};
+            out.write(placeholder, sizeof(placeholder));
+            writer.restart();
+        };
+        // v3的用户和FCB记录各自带长度和校验值，段校验失败时仍能逐条保留完好的记录
+        auto putRecord = [&out](const string &record)
+        {
+            putField<uint16_t>(out, static_cast<uint16_t>(record.size()));
+            out.write(record.data(), static_cast<streamsize>(record.size()));
+            putField<uint32_t>(out, crc32c(record.data(), record.size()));
+        };
+
+        // 2. 写入用户数据
+        if (version >= 3)
+            beginSegment(USER_RECORD_TAG);
+        int userCount = static_cast<int>(users.size());
+        out.write(reinterpret_cast<const char *>(&userCount), sizeof(userCount));
+        for (const User &user : users)
+        {
+            if (version == 1)
+                out.write(reinterpret_cast<const char *>(&user), sizeof(User));
+            else if (version == 2)
+                putUserRecord(out, user);
+            else
+            {
+                ostringstream record(ios::binary);
+                putUserRecord(record, user);
+                putRecord(record.str());
+            }
+        }
+
+        // 3. 写入文件系统数据
+        if (version >= 3)
+            beginSegment(FCB_RECORD_TAG);
+        int fcbCount = static_cast<int>(fcbs.size());
+        out.write(reinterpret_cast<const char *>(&fcbCount), sizeof(fcbCount));
+
+        // 写入FCB和文件内容：v1每个文件带定长的内容行，其余内容写在末尾的内容段；v2的内容全部在内容段
+        vector<char> row(CONTENT_ROW_SIZE);
+        size_t nextView = 0;
+        for (const auto &entry : fcbs)
+        {
+            int i = entry.first;
+            const FCB &fcb = entry.second;
+            const FileView *view = nextView < files.size() && files[nextView].id == i ? &files[nextView++] : nullptr;
+            if (version == 1)
+            {
+                // v1格式用 address 记录FCB槽位
+                FCB record = fcb;
+                record.address = i;
+                out.write(reinterpret_cast<const char *>(&record), sizeof(FCB));
+                if (record.type == 0)
+                {
+                    fill(row.begin(), row.end(), 0);
+                    size_t done = 0;
+                    if (view)
+                        forEachSpan(view->layout, 0, CONTENT_ROW_SIZE, [&](string_view span)
+                                    {
+                                        memcpy(row.data() + done, span.data(), span.size());
+                                        done += span.size();
+                                        return true; });
+                    out.write(row.data(), CONTENT_ROW_SIZE);
+                }
+            }
+            else if (version == 2)
+            {
+                putFcbRecord(out, i, fcb);
+            }
+            else
+            {
+                ostringstream record(ios::binary);
+                putFcbRecord(record, i, fcb);
+                putRecord(record.str());
+            }
+        }
+
+        // 4. 写入系统状态
+        if (version >= 3)
+            beginSegment(SYSTEM_STATE_TAG);
+        out.write(reinterpret_cast<const char *>(&modifyCount), sizeof(modifyCount));
+        out.write(reinterpret_cast<const char *>(&nextUserId), sizeof(nextUserId));
+        out.write(reinterpret_cast<const char *>(&nextFcbId), sizeof(nextFcbId));
+
+        // 5. 写入FCB空闲栈（追加在末尾，旧版本读取到系统状态即停止）
+        int freeCount = static_cast<int>(freeStack.size());
+        beginSegment(FREE_LIST_TAG);
+        out.write(reinterpret_cast<const char *>(&freeCount), sizeof(freeCount));
+        out.write(reinterpret_cast<const char *>(freeStack.data()), sizeof(int) * freeCount);
+
+        // 6. 写入压缩存储设置（放在内容段之前，加载时其余内容可以直接按压缩方式写入）
+        int compressedCount = static_cast<int>(compressedFiles.size());
+        beginSegment(FILE_COMPRESS_TAG);
+        out.write(reinterpret_cast<const char *>(&volumeDefault), sizeof(volumeDefault));
+        out.write(reinterpret_cast<const char *>(&compressedCount), sizeof(compressedCount));
+        out.write(reinterpret_cast<const char *>(compressedFiles.data()), sizeof(int) * compressedCount);
+
+        // 7. 写入文件内容：从固定的块中读取，不持有锁
+        int longCount = 0;
+        for (const FileView &view : files)
+            longCount += view.layout.size > dataFrom ? 1 : 0;
+        beginSegment(FILE_DATA_TAG);
+        out.write(reinterpret_cast<const char *>(&longCount), sizeof(longCount));
+        for (const FileView &view : files)
+        {
+            if (view.layout.size <= dataFrom)
+                continue;
+            uint64_t size = view.layout.size;
+            int rangeCount = static_cast<int>(view.ranges.size());
+            out.write(reinterpret_cast<const char *>(&view.id), sizeof(view.id));
+            out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            out.write(reinterpret_cast<const char *>(&rangeCount), sizeof(rangeCount));
+            for (const auto &range : view.ranges)
+            {
+                uint64_t header[2] = {range.first, range.second};
+                out.write(reinterpret_cast<const char *>(header), sizeof(header));
+                forEachSpan(view.layout, range.first, range.second, [&out](string_view span)
+                            {
+                                out.write(span.data(), span.size());
+                                return true; });
+            }
+        }
+
+        // 8. 写入共享块记录（加载时在第7段之后恢复共享关系）
+        int sharedCount = static_cast<int>(sharedRuns.size());
+        beginSegment(FILE_SHARE_TAG);
+        out.write(reinterpret_cast<const char *>(&sharedCount), sizeof(sharedCount));
+        out.write(reinterpret_cast<const char *>(sharedRuns.data()), sizeof(SharedRun) * sharedCount);
+        if (version >= 3)
+            beginSegment(DATA_END_TAG);
+        endSegment();
+        written = writer.total;
+
+        // 回填各段的长度和校验值
+        ok = static_cast<bool>(out.flush());
+        for (size_t k = 0; ok && k < segmentStarts.size(); k++)
+        {
+            file.seekp(static_cast<streamoff>(segmentStarts[k]));
+            file.write(reinterpret_cast<const char *>(&segmentSums[k].first), sizeof(uint64_t));
+            file.write(reinterpret_cast<const char *>(&segmentSums[k].second), sizeof(uint32_t));
+            ok = static_cast<bool>(file);
+        }
+        ok = ok && file.flush();
+        file.close();
+    }
+    catch (const exception &e)
+    {
+        error = e.what();
+        ok = false;
+    }
+
+    if (locked || pinned)
+    {
+        if (!locked)
+            lockSharedMemory();
+        if (pinned)
+        {
+            for (int b : pins)
+                releaseBlocks(b, 1);
+            if (currentProcessId >= 0)
+                sharedData->snapshotPinned[currentProcessId] = 0;
+        }
+        unlockSharedMemory();
+    }
+
+    ok = ok && syncFile(tempName.c_str());
+#ifdef _WIN32
+    if (ok)
+        remove(DATA_FILE.c_str());
+#endif
+    ok = ok && rename(tempName.c_str(), DATA_FILE.c_str()) == 0 && syncDirectory();
+    if (!ok)
+    {
+        remove(tempName.c_str());
+        if (!silent)
+        {
+            if (!error.empty())
+                cerr << " 保存数据失败: " << error << endl;
+            else
+                cerr << " 无法写入数据文件 " << DATA_FILE << endl;
+        }
+        return false;
+    }
+    dataChanged = false;
+
+    if (!silent)
+    {
+        cout << " 数据已保存到文件 filesystem.dat（v" << version << " 格式，" << written << " 字节）" << endl;
+        cout << " 已保存 " << users.size() << " 个用户, " << fcbs.size() << " 个文件/目录" << endl;
+    }
+    return true;
+}
+
+bool MiniFMS::loadDataFromDisk()
+{
+    if (!sharedData)
+        return false;
+
+    // 页式存储文件优先，加载后重放检查点之后的日志；filesystem.dat 用于从旧版本升级或页式存储不可用时
+    if (loadStore())
+    {
+        recoverWal();
+        return true;
+    }
+
+    try
+    {
+        ifstream file("filesystem.dat", ios::binary);
+        if (!file.is_open())
+        {
+            cout << " 数据文件不存在，将创建新的文件系统" << endl;
+            return false;
+        }
+
+        // 1. 验证文件头部标识和版本
+        char magic[9] = {0};
+        file.read(magic, 8);
+        if (strcmp(magic, "MINIFMS2") != 0)
+        {
+            cerr << " 数据文件格式错误" << endl;
+            return false;
+        }
+
+        // v2与v1的区别只在用户和FCB记录：v2逐字段存放且不带内容行，文件内容全部在末尾的内容段；
+        // v3的每段都带长度和CRC32C，用户和FCB记录另外逐条带校验值
+        int version;
+        if (!file.read(reinterpret_cast<char *>(&version), sizeof(version)) ||
+            (version != 1 && version != 2 && version != DATA_VERSION))
+        {
+            cerr << " 数据文件版本不兼容" << endl;
+            return false;
+        }
+
+        // 清空现有数据 - 使用默认构造函数初始化
+        for (int i = 0; i < MAX_USERS; i++)
+        {
+            sharedData->users[i] = User();
+        }
+        for (int i = 0; i < MAX_FCBS; i++)
+        {
+            sharedData->fcbs[i] = FCB();
+        }
+        sharedData->extentCount = 0;
+        // 清空块池时不逐块清零：已分配过的块标记为残留旧数据，从未使用的页保持未提交
+        for (int w = 0; w < BITMAP_WORDS; w++)
+        {
+            sharedData->staleBitmap[w] |= sharedData->bitMap[w];
+            sharedData->bitMap[w] = 0;
+        }
+        memset(sharedData->blockRefs, 0, sizeof(sharedData->blockRefs));
+        memset(sharedData->hashValid, 0, sizeof(sharedData->hashValid));
+        memset(sharedData->crcValid, 0, sizeof(sharedData->crcValid));
+        memset(sharedData->fileCompressed, 0, sizeof(sharedData->fileCompressed));
+        sharedData->frameCount = 0;
+        sharedData->compressNewFiles = 0;
+        resetDedupTable();
+        sharedData->dedupCursorFcb = 0;
+        sharedData->dedupCursorBlock = 0;
+        sharedData->freeBlockCount = MAX_BLOCKS;
+        sharedData->blockHint = 0;
+
+        bool truncated = false;
+        bool freeListLoaded = false;
+        if (version == DATA_VERSION)
+        {
+            if (!loadChecksummedData(file, truncated, freeListLoaded))
+                return false;
+        }
+        else
+        {
+            // 2. 读取用户数据
+            int userCount;
+            if (!file.read(reinterpret_cast<char *>(&userCount), sizeof(userCount)) || userCount < 0 || userCount > MAX_USERS)
+            {
+                cerr << " 数据文件用户数量异常" << endl;
+                return false;
+            }
+
+            for (int i = 0; i < userCount; i++)
+            {
+                User user;
+                if (version == 1 ? !file.read(reinterpret_cast<char *>(&user), sizeof(User)) : !getUserRecord(file, user))
+                {
+                    cerr << " 数据文件用户记录不完整" << endl;
+                    return false;
+                }
+                sharedData->users[i] = user;
+            }
+
+            // 3. 读取文件系统数据
+            int fcbCount;
+            if (!file.read(reinterpret_cast<char *>(&fcbCount), sizeof(fcbCount)) || fcbCount < 0 || fcbCount > MAX_FCBS)
+            {
+                cerr << " 数据文件FCB数量异常" << endl;
+                return false;
+            }
+
+            vector<char> row(CONTENT_ROW_SIZE);
+            for (int i = 0; i < fcbCount; i++)
+            {
+                FCB fcb;
+                int fcbIndex = -1;
+                bool read = version == 1 ? static_cast<bool>(file.read(reinterpret_cast<char *>(&fcb), sizeof(FCB)))
+                                         : getFcbRecord(file, fcbIndex, fcb);
+                if (version == 1)
+                    fcbIndex = fcb.address;
+                // 槽位来自文件内容，越界或重复的记录不能用作下标
+                if (!read || fcbIndex < 0 || fcbIndex >= MAX_FCBS || sharedData->fcbs[fcbIndex].isused)
+                {
+                    cerr << " 数据文件FCB记录不完整" << endl;
+                    return false;
+                }
+                size_t recordedSize = fcb.size;
+                placeLoadedFcb(fcbIndex, fcb);
+
+                // 如果是文件类型，读取文件内容行并按实际大小写入数据块（仅v1）
+                if (fcb.type == 0 && version == 1)
+                {
+                    if (!file.read(row.data(), CONTENT_ROW_SIZE))
+                    {
+                        cerr << " 数据文件FCB记录不完整" << endl;
+                        return false;
+                    }
+                    size_t rowLength = min(recordedSize, static_cast<size_t>(CONTENT_ROW_SIZE));
+                    // 全0的内容行按空洞处理，不分配数据块
+                    if (all_of(row.begin(), row.begin() + rowLength, [](char c)
+                               { return c == 0; }))
+                    {
+                        writeFileRange(fcbIndex, rowLength, nullptr, 0);
+                    }
+                    else
+                    {
+                        truncated |= !writeFileRange(fcbIndex, 0, row.data(), rowLength);
+                    }
+                }
+            }
+
+            // 4. 读取系统状态
+            file.read(reinterpret_cast<char *>(&sharedData->modifyCount), sizeof(sharedData->modifyCount));
+            file.read(reinterpret_cast<char *>(&sharedData->nextUserId), sizeof(sharedData->nextUserId));
+            file.read(reinterpret_cast<char *>(&sharedData->nextFcbId), sizeof(sharedData->nextFcbId));
+
+            // 热点元数据列由FCB重新生成，后续重建均基于这些列
+            rebuildFcbColumns();
+
+            // 5. 依次读取末尾的附加段（FCB空闲栈、压缩设置、超长文件内容、共享块），按标识分派，
+            // 遇到未知或不完整的段即停止；旧文件没有空闲栈段或内容不一致时按FCB使用情况重建
+            char tag[8];
+            while (file.read(tag, 8))
+            {
+                if (!loadTailSegment(file, tag, truncated, freeListLoaded))
+                    break;
+            }
+        }
+        if (!freeListLoaded)
+        {
+            rebuildFreeFcbList();
+        }
+        if (truncated)
+        {
+            cerr << " 警告：磁盘空间不足，部分文件内容被截断" << endl;
+        }
+
+        file.close();
+
+        // 目录项索引、有序索引、子项链表和用户索引不落盘，加载后重建
+        rebuildDirHash();
+        rebuildNameIndex();
+        rebuildDirLinks();
+        rebuildUserIndex();
+        verifyAggregates(false); // 子树汇总同样不落盘，由并行重算生成
+        sharedData->initialized = true;
+
+        int userCount = 0, fcbCount = 0;
+        for (int i = 0; i < MAX_USERS; i++)
+            userCount += sharedData->users[i].isused ? 1 : 0;
+        for (int i = 0; i < MAX_FCBS; i++)
+            fcbCount += sharedData->fcbUsed[i];
+        cout << " 从文件 filesystem.dat 加载数据成功" << endl;
+        cout << " 已加载 " << userCount << " 个用户, " << fcbCount << " 个文件/目录" << endl;
+
+        return true;
+    }
+    catch (const exception &e)
+    {
+        cerr << " 加载数据失败: " << e.what() << endl;
+        return false;
+    }
+}
+
+void MiniFMS::placeLoadedFcb(int slot, FCB fcb)
+{
+    fcb.address = -1;
+    fcb.size = 0;
+    sharedData->fcbs[slot] = fcb;
+    sharedData->fileInline[slot] = fcb.type == 0;
+    memset(sharedData->inlineData[slot], 0, INLINE_DATA_SIZE);
+}
+
+bool MiniFMS::loadTailSegment(ifstream &file, const char *tag, bool &truncated, bool &freeListLoaded)
+{
+    if (memcmp(tag, FREE_LIST_TAG, 8) == 0)
+    {
+        freeListLoaded = loadFreeFcbList(file);
+        return freeListLoaded || file.good();
+    }
+    if (memcmp(tag, FILE_COMPRESS_TAG, 8) == 0)
+        return loadCompressionSettings(file);
+    if (memcmp(tag, FILE_DATA_TAG, 8) == 0 || memcmp(tag, FILE_DATA_TAG_FLAT, 8) == 0)
+        return loadLongFileData(file, memcmp(tag, FILE_DATA_TAG_FLAT, 8) == 0, truncated);
+    if (memcmp(tag, FILE_SHARE_TAG, 8) == 0)
+        return loadSharedBlocks(file);
+    return false;
+}
+
+bool MiniFMS::loadChecksummedData(ifstream &file, bool &truncated, bool &freeListLoaded)
+{
+    struct Segment
+    {
+        char tag[8];
+        uint64_t offset; // 内容在文件中的起点
+        uint64_t length;
+        uint32_t crc;
+        bool valid;
+    };
+    auto start = chrono::steady_clock::now();
+
+    // 1. 依次读取段头；段长度超出文件末尾说明段头损坏或文件被截断，之后的段无法定位
+    file.seekg(0, ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    uint64_t pos = 8 + sizeof(int);
+    vector<Segment> segments;
+    bool ended = false;
+    while (!ended && pos + 20 <= fileSize)
+    {
+        Segment seg;
+        file.seekg(static_cast<streamoff>(pos));
+        if (!file.read(seg.tag, 8) || !getField(file, seg.length) || !getField(file, seg.crc))
+            break;
+        seg.offset = pos + 20;
+        seg.valid = false;
+        if (seg.length > fileSize - seg.offset)
+            break;
+        segments.push_back(seg);
+        pos = seg.offset + seg.length;
+        ended = memcmp(seg.tag, DATA_END_TAG, 8) == 0;
+    }
+
+    // 2. 各段切块后由多个线程并行计算校验值
+    vector<FileRange> ranges;
+    uint64_t verifiedBytes = 0;
+    for (const Segment &seg : segments)
+    {
+        ranges.push_back({seg.offset, seg.length});
+        verifiedBytes += seg.length;
+    }
+    vector<uint32_t> segmentCrc;
+    vector<char> segmentRead;
+    unsigned workers = checksumFileRanges(DATA_FILE, ranges, segmentCrc, segmentRead);
+    for (size_t k = 0; k < segments.size(); k++)
+        segments[k].valid = segmentRead[k] && segmentCrc[k] == segments[k].crc;
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    auto findSegment = [&segments](const char *tag) -> Segment *
+    {
+        for (Segment &seg : segments)
+        {
+            if (memcmp(seg.tag, tag, 8) == 0)
+                return &seg;
+        }
+        return nullptr;
+    };
+    Segment *userSegment = findSegment(USER_RECORD_TAG), *fcbSegment = findSegment(FCB_RECORD_TAG);
+    if (!userSegment || !fcbSegment)
+    {
+        cerr << " 数据文件缺少用户或FCB记录段" << endl;
+        return false;
+    }
+
+    // 3. 用户和FCB记录逐条核对校验值：段校验失败时只丢弃损坏的记录；记录长度本身损坏时其后的记录无法定位
+    int badRecords = 0;
+    auto readRecords = [&](Segment &seg, int limit, const function<bool(istream &)> &parse)
+    {
+        string payload(seg.length, '\0');
+        file.clear();
+        file.seekg(static_cast<streamoff>(seg.offset));
+        file.read(&payload[0], static_cast<streamsize>(seg.length));
+        istringstream in(payload, ios::binary);
+        int count = 0;
+        if (!getField(in, count) || count < 0 || count > limit)
+        {
+            badRecords++;
+            return;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            uint16_t length = 0;
+            uint32_t crc = 0;
+            string record;
+            if (!getField(in, length))
+            {
+                badRecords += count - i;
+                return;
+            }
+            record.resize(length);
+            if (!in.read(&record[0], length) || !getField(in, crc))
+            {
+                badRecords += count - i;
+                return;
+            }
+            istringstream fields(record, ios::binary);
+            if (crc32c(record.data(), record.size()) != crc || !parse(fields))
+                badRecords++;
+        }
+    };
+    int userSlot = 0;
+    readRecords(*userSegment, MAX_USERS, [this, &userSlot](istream &in)
+                {
+                    User user;
+                    if (!getUserRecord(in, user))
+                        return false;
+                    sharedData->users[userSlot++] = user;
+                    return true; });
+    readRecords(*fcbSegment, MAX_FCBS, [this](istream &in)
+                {
+                    FCB fcb;
+                    int slot = -1;
+                    // 槽位来自文件内容，越界或重复的记录不能用作下标
+                    if (!getFcbRecord(in, slot, fcb) || slot < 0 || slot >= MAX_FCBS || sharedData->fcbs[slot].isused)
+                        return false;
+                    placeLoadedFcb(slot, fcb);
+                    return true; });
+    for (Segment *seg : {userSegment, fcbSegment})
+    {
+        if (!seg->valid)
+            cerr << " 警告：数据文件 " << string(seg->tag, 8) << " 段校验失败，已逐条检查记录" << endl;
+    }
+    if (badRecords > 0)
+        cerr << " 警告：" << badRecords << " 条用户或FCB记录损坏，已跳过" << endl;
+
+    // 热点元数据列由FCB重新生成，后续重建均基于这些列
+    rebuildFcbColumns();
+
+    // 4. 其余段按文件中的顺序读取，校验失败的段整段跳过；系统状态损坏时由已加载的记录推算
+    bool stateLoaded = false;
+    for (Segment &seg : segments)
+    {
+        if (&seg == userSegment || &seg == fcbSegment || memcmp(seg.tag, DATA_END_TAG, 8) == 0)
+            continue;
+        string tag(seg.tag, 8);
+        if (!seg.valid)
+        {
+            cerr << " 警告：数据文件 " << tag << " 段校验失败，已跳过" << endl;
+            continue;
+        }
+        file.clear();
+        file.seekg(static_cast<streamoff>(seg.offset));
+        if (tag == SYSTEM_STATE_TAG)
+        {
+            int32_t state[3];
+            stateLoaded = getField(file, state[0]) && getField(file, state[1]) && getField(file, state[2]);
+            if (stateLoaded)
+            {
+                sharedData->modifyCount = state[0];
+                sharedData->nextUserId = state[1];
+                sharedData->nextFcbId = state[2];
+            }
+        }
+        else if (!loadTailSegment(file, seg.tag, truncated, freeListLoaded))
+        {
+            cerr << " 警告：数据文件 " << tag << " 段无法识别或内容不完整，已跳过" << endl;
+        }
+    }
+    if (!stateLoaded)
+    {
+        int nextUserId = 1;
+        for (int i = 0; i < MAX_USERS; i++)
+        {
+            if (sharedData->users[i].isused)
+                nextUserId = max(nextUserId, sharedData->users[i].userId + 1);
+        }
+        sharedData->modifyCount = 0;
+        sharedData->nextUserId = nextUserId;
+        sharedData->nextFcbId = 1;
+        for (int i = 0; i < MAX_FCBS; i++)
+        {
+            if (sharedData->fcbs[i].isused)
+                sharedData->nextFcbId = i + 1;
+        }
+    }
+    if (!ended)
+        cerr << " 警告：数据文件缺少结束段，可能被截断" << endl;
+
+    const char *kernelName = nullptr;
+    crc32cKernel(&kernelName);
+    cout << " 已校验 " << segments.size() << " 个数据段（" << fixed << setprecision(1) << verifiedBytes / 1048576.0
+         << " MB，" << workers << " 个线程，" << elapsed << " ms，" << kernelName << "）" << endl;
+    cout.unsetf(ios::fixed);
+    return true;
+}
+
+bool MiniFMS::loadLongFileData(ifstream &file, bool flat, bool &truncated)
+{
+    int longCount = 0;
+    if (!file.read(reinterpret_cast<char *>(&longCount), sizeof(longCount)))
+        return false;
+
+    // 分段读入写入，压缩文件的逻辑大小可以超过块池，不能整段放进内存
+    const uint64_t chunkSize = 1 << 20;
+    string data;
+    for (int i = 0; i < longCount; i++)
+    {
+        int id;
+        uint64_t size;
+        int rangeCount = 1;
+        if (!file.read(reinterpret_cast<char *>(&id), sizeof(id)) ||
+            !file.read(reinterpret_cast<char *>(&size), sizeof(size)))
+            return false;
+        if (flat)
+            size += CONTENT_ROW_SIZE; // 早期格式记录的是剩余内容的长度
+        else if (!file.read(reinterpret_cast<char *>(&rangeCount), sizeof(rangeCount)) || size > MAX_FILE_SIZE)
+            return false;
+
+        bool valid = id >= 0 && id < MAX_FCBS && sharedData->fcbs[id].isused && sharedData->fcbs[id].type == 0;
+        for (int r = 0; r < rangeCount; r++)
+        {
+            uint64_t header[2] = {CONTENT_ROW_SIZE, size - CONTENT_ROW_SIZE};
+            if (!flat && !file.read(reinterpret_cast<char *>(header), sizeof(header)))
+                return false;
+            if (header[0] + header[1] > size)
+                return false;
+            for (uint64_t done = 0; done < header[1];)
+            {
+                data.resize(min(chunkSize, header[1] - done));
+                if (!file.read(&data[0], data.length()))
+                    return false;
+                if (valid)
+                    truncated |= !writeFileRange(id, header[0] + done, data.data(), data.length());
+                done += data.length();
+            }
+        }
+        // 末尾的空洞只体现在文件大小上
+        if (valid)
+            writeFileRange(id, size, nullptr, 0);
+    }
+    return true;
+}
+
+bool MiniFMS::loadCompressionSettings(ifstream &file)
+{
+    int volumeDefault = 0, count = 0;
+    if (!file.read(reinterpret_cast<char *>(&volumeDefault), sizeof(volumeDefault)) ||
+        !file.read(reinterpret_cast<char *>(&count), sizeof(count)) || count < 0 || count > MAX_FCBS)
+        return false;
+    vector<int> ids(count);
+    if (!file.read(reinterpret_cast<char *>(ids.data()), sizeof(int) * count))
+        return false;
+
+    // 该段位于超长文件内容之前：此时文件只载入了内容行，转换后其余内容直接按压缩方式写入
+    sharedData->compressNewFiles = volumeDefault ? 1 : 0;
+    for (int id : ids)
+    {
+        if (id >= 0 && id < MAX_FCBS && sharedData->fcbs[id].isused && sharedData->fcbs[id].type == 0)
+            setFileCompression(id, true);
+    }
+    return true;
+}
+
+bool MiniFMS::loadSharedBlocks(ifstream &file)
+{
+    int sharedCount = 0;
+    if (!file.read(reinterpret_cast<char *>(&sharedCount), sizeof(sharedCount)) ||
+        sharedCount < 0 || sharedCount > MAX_EXTENTS)
+        return false;
+
+    vector<SharedRun> runs(sharedCount);
+    if (!file.read(reinterpret_cast<char *>(runs.data()), sizeof(SharedRun) * sharedCount))
+        return false;
+
+    // 引用方在加载内容行时分配的私有块被共享块替换；源文件范围不完整的记录忽略，保留已加载的内容
+    auto validRange = [this](int id, int block, int count)
+    {
+        if (id < 0 || id >= MAX_FCBS || !sharedData->fcbs[id].isused || sharedData->fcbs[id].type != 0 ||
+            sharedData->fileInline[id] || sharedData->fileCompressed[id] || block < 0 || count <= 0)
+            return false;
+        size_t blocks = (sharedData->fcbs[id].size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        return static_cast<size_t>(block) + count <= blocks;
+    };
+    lockSharedMemory();
+    for (const SharedRun &run : runs)
+    {
+        if (validRange(run.dstId, run.dstBlock, run.count) && validRange(run.srcId, run.srcBlock, run.count))
+            shareFileBlocks(run.srcId, run.srcBlock, run.dstId, run.dstBlock, run.count);
+    }
+    unlockSharedMemory();
+    return true;
+}
+
+bool MiniFMS::loadFreeFcbList(ifstream &file)
+{
+    int freeCount = 0;
+    if (!file.read(reinterpret_cast<char *>(&freeCount), sizeof(freeCount)) ||
+        freeCount < 0 || freeCount >= MAX_FCBS)
+        return false;
+
+    vector<int> freeList(freeCount);
+    if (!file.read(reinterpret_cast<char *>(freeList.data()), sizeof(int) * freeCount))
+        return false;
+
+    // 空闲栈必须恰好覆盖所有未使用的非根槽位
+    vector<bool> seen(MAX_FCBS, false);
+    for (int id : freeList)
+    {
+        if (id <= 0 || id >= MAX_FCBS || seen[id] || sharedData->fcbs[id].isused)
+            return false;
+        seen[id] = true;
+    }
+    int unusedCount = 0;
+    for (int i = 1; i < MAX_FCBS; i++)
+    {
+        unusedCount += !sharedData->fcbUsed[i];
+    }
+    if (unusedCount != freeCount)
+        return false;
+
+    memcpy(sharedData->freeFcbStack, freeList.data(), sizeof(int) * freeCount);
+    sharedData->freeFcbTop = freeCount;
+    return true;
+}
+
+void MiniFMS::autoSaveThread()
+{
+    auto lastSave = chrono::steady_clock::now();
+    while (!shouldExit)
+    {
+        this_thread::sleep_for(chrono::seconds(1));
+
+        if (shouldExit)
+        {
+            break;
+        }
+
+        // 每30秒保存一次；日志增长过快时提前保存，保存即检查点，之前的日志随之删除
+        bool due = chrono::steady_clock::now() - lastSave >= chrono::seconds(30);
+        bool walFull = sharedData->walEnabled && sharedData->walLsn - sharedData->walCheckpointLsn >= WAL_CHECKPOINT_BYTES;
+        if (((due && dataChanged) || walFull) && sharedData->initialized)
+        {
+            // 静默保存，不显示任何消息
+            saveDataToDisk(true);
+        }
+        if (due || walFull)
+            lastSave = chrono::steady_clock::now();
+    }
+}
+
+void MiniFMS::showFileHead(Session *session, const string &fileName, int numLines)
+{
+    if (!session || !sharedData)
+        return;
+
+    int fileId = findFCB(session->currentDirId, fileName);
+    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    {
+        cout << " 文件不存在: " << fileName << endl;
+        return;
+    }
+
+    if (sharedData->fcbs[fileId].size == 0)
+    {
+        cout << " 文件为空" << endl;
+        return;
+    }
+
+    // 更新访问时间
+    touchFcb(fileId, false);
+
+    // 只读取前 numLines 行
+    vector<string> lines = readFileLines(fileId, 0, max(numLines, 0));
+
+    // 显示指定行数
+    int linesToShow = static_cast<int>(lines.size());
+    cout << "\n显示 " << fileName << " 的前 " << linesToShow << " 行：\n"
+         << endl;
+    for (int i = 0; i < linesToShow; ++i)
+    {
+        cout << setw(6) << (i + 1) << " | " << lines[i] << endl;
+    }
+    cout << endl;
+}
+
+void MiniFMS::showFileTail(Session *session, const string &fileName, int numLines)
+{
+    if (!session || !sharedData)
+        return;
+
+    int fileId = findFCB(session->currentDirId, fileName);
+    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    {
+        cout << " 文件不存在: " << fileName << endl;
+        return;
+    }
+
+    if (sharedData->fcbs[fileId].size == 0)
+    {
+        cout << " 文件为空" << endl;
+        return;
+    }
+
+    // 更新访问时间
+    touchFcb(fileId, false);
+
+    // 先统计总行数，再只读取最后 numLines 行
+    size_t totalLines = countFileLines(fileId);
+    size_t startLine = totalLines - min(totalLines, static_cast<size_t>(max(numLines, 0)));
+    vector<string> lines = readFileLines(fileId, startLine, totalLines - startLine);
+
+    // 显示指定行数
+    int linesToShow = static_cast<int>(lines.size());
+    cout << "\n显示 " << fileName << " 的后 " << linesToShow << " 行：\n"
+         << endl;
+    for (int i = 0; i < linesToShow; ++i)
+    {
+        cout << setw(6) << (startLine + i + 1) << " | " << lines[i] << endl;
+    }
+    cout << endl;
+}
+
+void MiniFMS::findAllFiles(vector<int> &files, int fcbId)
+{
+    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
+    {
+        cout << " 错误：无效的FCB ID: " << fcbId << endl;
+        return;
+    }
+
+    files.push_back(fcbId); // 先添加当前目录/文件
+
+    // 如果是目录，递归添加其中的内容（先序，父项总在子项之前）
+    if (sharedData->fcbs[fcbId].type == 1)
+    {
+        for (int i = sharedData->links[fcbId].firstChild; i != -1; i = sharedData->links[i].nextSibling)
+        {
+            findAllFiles(files, i);
+        }
+    }
+}
+
+void MiniFMS::deleteFCB(int fcbId)
+{
+    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
+    {
+        cout << " 错误：无效的FCB ID: " << fcbId << endl;
+        return;
+    }
+
+    lock_guard<mutex> lock(diskMutex); // Add mutex lock for thread safety
+
+    // 保存删除前的信息用于日志
+    string itemName = sharedData->fcbs[fcbId].name;
+    string itemType = sharedData->fcbs[fcbId].type == 1 ? "目录" : "文件";
+    int parentDir = sharedData->fcbs[fcbId].parentDir;
+
+    // 如果是目录，先删除其中的内容
+    if (sharedData->fcbs[fcbId].type == 1)
+    {
+        vector<int> childrenToDelete;
+        // 先收集整棵子树，避免在遍历过程中修改链表
+        findAllFiles(childrenToDelete, fcbId);
+        childrenToDelete.erase(childrenToDelete.begin());
+
+        // 删除所有子项（逆序，保证子项先于父项释放）
+        for (auto it = childrenToDelete.rbegin(); it != childrenToDelete.rend(); ++it)
+        {
+            int childId = *it;
+            string childName = sharedData->fcbs[childId].name;
+            string childType = sharedData->fcbs[childId].type == 1 ? "目录" : "文件";
+            cout << " - 删除" << childType << ": " << childName << endl;
+
+            // 清理子项的FCB
+            releaseFCB(childId);
+        }
+    }
+
+    // 从父目录中移除该FCB的引用
+    if (parentDir >= 0 && parentDir < MAX_FCBS && sharedData->fcbs[parentDir].isused)
+    {
+        // 更新父目录的修改时间
+        touchFcb(parentDir, true);
+        cout << " - 已从父目录 " << sharedData->fcbs[parentDir].name << " 中移除 " << itemType << ": " << itemName << endl;
+    }
+
+    // 清空当前FCB（同时归还数据块）
+    releaseFCB(fcbId);
+
+    // 标记数据已修改
+    sharedData->modifyCount++;
+    dataChanged = true;
+}
+
+// 导入外部文件到文件系统
+bool MiniFMS::importFile(Session *session, const string &externalPath, const string &internalName)
+{
+    // 检查文件是否已存在
+    if (findFCB(session->currentDirId, internalName) != -1)
+    {
+        cout << " 错误：文件已存在：" << internalName << endl;
+        return false;
+    }
+
+    // 读取外部文件
+    ifstream inFile(externalPath, ios::binary);
+    if (!inFile.is_open())
+    {
+        cout << " 错误：无法打开外部文件：" << externalPath << endl;
+        return false;
+    }
+
+    // 创建新文件
+    int newFileId = createFCB(internalName, 0, session->user->userId, session->currentDirId);
+    if (newFileId == -1)
+    {
+        cout << " 错误：创建文件失败" << endl;
+        return false;
+    }
+
+    // 分块读取并写入文件内容，按读到的字节数写入，内容中可以包含空字符
+    vector<char> buffer(1 << 20);
+    size_t imported = 0;
+    while (inFile.read(buffer.data(), buffer.size()) || inFile.gcount() > 0)
+    {
+        size_t n = static_cast<size_t>(inFile.gcount());
+        if (!writeFileRange(newFileId, imported, buffer.data(), n))
+        {
+            cout << " 错误：磁盘空间不足，无法导入" << endl;
+            deleteFCB(newFileId);
+            return false;
+        }
+        imported += n;
+    }
+    inFile.close();
+    touchFcb(newFileId, true);
+
+    cout << " 文件导入成功：" << internalName << endl;
+    cout << " - 大小：" << imported << " 字节" << endl;
+    cout << " - 修改时间：" << formatTime(sharedData->fcbs[newFileId].modifyTime) << endl;
+
+    sharedData->modifyCount++;
+    dataChanged = true;
+    return true;
+}
+
+// 导出文件到外部文件系统
+bool MiniFMS::exportFile(Session *session, const string &internalName, const string &externalPath)
+{
+    // 查找文件
+    int fileId = findFCB(session->currentDirId, internalName);
+    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    {
+        cout << " 错误：文件不存在：" << internalName << endl;
+        return false;
+    }
+
+    // 检查文件访问权限
+    if (!checkFileAccess(session, fileId, false))
+    {
+        return false;
+    }
+
+    // 写入外部文件
+    ofstream outFile(externalPath, ios::binary);
+    if (!outFile.is_open())
+    {
+        cout << " 错误：无法创建外部文件：" << externalPath << endl;
+        return false;
     }
 
-    // 确保所有资源都被清理
-    cleanup();
+    // 按 FCB.size 分段写出文件内容，写外部文件时不持有共享内存锁
+    visitFileData(fileId, 0, string::npos, [&outFile](string_view span)
+                  {
+                      outFile.write(span.data(), span.size());
+                      return true; });
+    outFile.close();
+
+    cout << " 文件导出成功：" << internalName << " -> " << externalPath << endl;
+    cout << " - 大小：" << sharedData->fcbs[fileId].size << " 字节" << endl;
+    cout << " - 修改时间：" << formatTime(sharedData->fcbs[fileId].modifyTime) << endl;
+
+    // 更新访问时间
+    touchFcb(fileId, false);
+    dataChanged = true;
+    return true;
 }
 
-// 持久化功能实现
-bool MiniFMS::saveDataToDisk(bool silent)
+// 通过路径查找FCB
+int MiniFMS::findFCBByPath(Session *session, const string &path)
 {
-    if (!sharedData)
-        return false;
+    if (!session || !sharedData)
+        return -1;
+    if (path.empty())
+        return -1;
 
-    lock_guard<mutex> lock(diskMutex);
+    int rootDirId = session->user->rootDirId;
 
-    try
+    // 处理特殊路径
+    if (path == "/")
     {
-        // 以二进制方式打开文件
-        ofstream file("filesystem.dat", ios::binary | ios::trunc);
-        if (!file.is_open())
-        {
-            if (!silent)
-                cerr << " 无法创建数据文件" << endl;
-            return false;
-        }
+        return rootDirId; // 返回用户的根目录
+    }
 
-        // 1. 写入文件头部标识和版本信息
-        const char MAGIC[] = "MINIFMS2";
-        file.write(MAGIC, 8);
-        int version = 1;
-        file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    // 确定起始目录：绝对路径从用户根目录开始
+    int startDir = path[0] == '/' ? rootDirId : session->currentDirId;
 
-        // 2. 写入用户数据
-        int userCount = 0;
-        for (int i = 0; i < MAX_USERS; i++)
+    // 分割路径，跳过空部分和当前目录符号
+    vector<string> parts;
+    size_t pos = 0;
+    while (pos <= path.length())
+    {
+        size_t next = path.find('/', pos);
+        if (next == string::npos)
+            next = path.length();
+        if (next > pos && path.compare(pos, next - pos, ".") != 0)
         {
-            if (sharedData->users[i].isused)
-                userCount++;
+            parts.push_back(path.substr(pos, next - pos));
         }
-        file.write(reinterpret_cast<const char *>(&userCount), sizeof(userCount));
+        pos = next + 1;
+    }
 
-        for (int i = 0; i < MAX_USERS; i++)
-        {
-            if (sharedData->users[i].isused)
-            {
-                file.write(reinterpret_cast<const char *>(&sharedData->users[i]), sizeof(User));
-            }
-        }
+    if (parts.empty())
+        return startDir;
 
-        // 3. 写入文件系统数据
-        int fcbCount = 0;
-        for (int i = 0; i < MAX_FCBS; i++)
-        {
-            if (sharedData->fcbs[i].isused)
-                fcbCount++;
-        }
-        file.write(reinterpret_cast<const char *>(&fcbCount), sizeof(fcbCount));
+    // 缓存键：用户根目录 + 起始目录 + 规范化后的路径
+    string key = to_string(rootDirId) + ":" + to_string(startDir);
+    for (const string &part : parts)
+    {
+        key += '/';
+        key += part;
+    }
 
-        // 写入FCB和文件内容
-        for (int i = 0; i < MAX_FCBS; i++)
+    int gen = sharedData->namespaceGen.load();
+    if (gen != dentryCacheGen)
+    {
+        dentryCache.clear();
+        dentryCacheGen = gen;
+    }
+    auto cached = dentryCache.find(key);
+    if (cached != dentryCache.end())
+    {
+        return cached->second;
+    }
+
+    // 遍历路径的每一部分
+    int currentDir = startDir;
+    for (const string &dirName : parts)
+    {
+        if (dirName == "..")
         {
-            if (sharedData->fcbs[i].isused)
-            {
-                // 写入FCB
-                file.write(reinterpret_cast<const char *>(&sharedData->fcbs[i]), sizeof(FCB));
-                // 如果是文件类型，写入文件内容
-                if (sharedData->fcbs[i].type == 0)
-                {
-                    file.write(sharedData->fileContents[i], sizeof(sharedData->fileContents[i]));
-                }
-            }
+            // 已经在根目录，无法再往上
+            if (currentDir == rootDirId)
+                continue;
+            currentDir = sharedData->fcbs[currentDir].parentDir;
         }
-
-        // 4. 写入系统状态
-        file.write(reinterpret_cast<const char *>(&sharedData->modifyCount), sizeof(sharedData->modifyCount));
-        file.write(reinterpret_cast<const char *>(&sharedData->nextUserId), sizeof(sharedData->nextUserId));
-        file.write(reinterpret_cast<const char *>(&sharedData->nextFcbId), sizeof(sharedData->nextFcbId));
-
-        file.flush();
-        file.close();
-        dataChanged = false;
-
-        if (!silent)
+        else
         {
-            cout << " 数据已保存到文件 filesystem.dat" << endl;
-            cout << " 已保存 " << userCount << " 个用户, " << fcbCount << " 个文件/目录" << endl;
+            currentDir = findFCB(currentDir, dirName);
         }
 
-        return true;
+        if (currentDir == -1)
+            break; // 路径中的某个部分不存在或父目录无效
     }
-    catch (const exception &e)
+
+    if (dentryCache.size() >= DENTRY_CACHE_LIMIT)
     {
-        if (!silent)
-            cerr << " 保存数据失败: " << e.what() << endl;
-        return false;
+        dentryCache.clear();
     }
+    dentryCache[key] = currentDir;
+    return currentDir;
 }
 
-bool MiniFMS::loadDataFromDisk()
+void MiniFMS::showDiskUsage(Session *session, const string &dirPath)
 {
-    if (!sharedData)
-        return false;
+    if (!session || !sharedData)
+        return;
 
-    try
+    int dirId = findFCBByPath(session, dirPath);
+    if (dirId == -1 || sharedData->fcbs[dirId].type != 1)
     {
-        ifstream file("filesystem.dat", ios::binary);
-        if (!file.is_open())
-        {
-            cout << " 数据文件不存在，将创建新的文件系统" << endl;
-            return false;
-        }
+        cout << " 目录不存在: " << dirPath << endl;
+        return;
+    }
 
-        // 1. 验证文件头部标识和版本
-        char magic[9] = {0};
-        file.read(magic, 8);
-        if (strcmp(magic, "MINIFMS2") != 0)
-        {
-            cerr << " 数据文件格式错误" << endl;
-            return false;
-        }
+    cout << "\n 空间占用 - " << dirPath << "\n"
+         << endl;
+    cout << " 字节数\t\t文件数\t\t目录" << endl;
+    cout << " ────────────────────────────────────────" << endl;
 
-        int version;
-        file.read(reinterpret_cast<char *>(&version), sizeof(version));
-        if (version != 1)
+    // 每个子目录直接读取汇总值，O(子项数)
+    lockSharedMemory();
+    for (int i = sharedData->links[dirId].firstChild; i != -1; i = sharedData->links[i].nextSibling)
+    {
+        if (sharedData->fcbs[i].type == 1)
         {
-            cerr << " 数据文件版本不兼容" << endl;
-            return false;
+            cout << " " << sharedData->subtreeBytes[i] << "\t\t" << sharedData->subtreeFiles[i]
+                 << "\t\t" << sharedData->fcbs[i].name << "/" << endl;
         }
+    }
+    long long totalBytes = sharedData->subtreeBytes[dirId];
+    int totalFiles = sharedData->subtreeFiles[dirId];
+    unlockSharedMemory();
 
-        // 2. 读取用户数据
-        int userCount;
-        file.read(reinterpret_cast<char *>(&userCount), sizeof(userCount));
+    cout << " " << totalBytes << "\t\t" << totalFiles << "\t\t(合计)" << endl
+         << endl;
+}
 
-        // 清空现有数据 - 使用默认构造函数初始化
-        for (int i = 0; i < MAX_USERS; i++)
-        {
-            sharedData->users[i] = User();
-        }
+bool MiniFMS::verifyAggregates(bool report)
+{
+    if (!sharedData)
+        return false;
 
-        for (int i = 0; i < userCount; i++)
-        {
-            User user;
-            file.read(reinterpret_cast<char *>(&user), sizeof(User));
-            sharedData->users[i] = user;
-        }
+    auto start = chrono::steady_clock::now();
+    unsigned workers = max(1u, min(8u, thread::hardware_concurrency()));
 
-        // 3. 读取文件系统数据
-        int fcbCount;
-        file.read(reinterpret_cast<char *>(&fcbCount), sizeof(fcbCount));
+    // 校验期间阻止其他进程修改，保证看到一致的快照
+    lockSharedMemory();
 
-        // 清空现有数据 - 使用默认构造函数初始化
-        for (int i = 0; i < MAX_FCBS; i++)
+    // 每个线程负责FCB表的一段，把文件大小累加到各自的局部数组，最后归并
+    vector<vector<long long>> partBytes(workers, vector<long long>(MAX_FCBS, 0));
+    vector<vector<int>> partFiles(workers, vector<int>(MAX_FCBS, 0));
+    vector<thread> pool;
+    for (unsigned w = 0; w < workers; ++w)
+    {
+        pool.emplace_back([this, w, workers, &partBytes, &partFiles]()
+                          {
+                              int begin = static_cast<int>(static_cast<long long>(MAX_FCBS) * w / workers);
+                              int end = static_cast<int>(static_cast<long long>(MAX_FCBS) * (w + 1) / workers);
+                              for (int i = begin; i < end; ++i)
+                              {
+                                  if (!sharedData->fcbUsed[i] || sharedData->fcbType[i] != 0)
+                                      continue;
+                                  long long size = static_cast<long long>(sharedData->fcbs[i].size);
+                                  int p = sharedData->fcbParent[i];
+                                  for (int steps = 0; p >= 0 && p < MAX_FCBS && steps < MAX_FCBS; ++steps)
+                                  {
+                                      partBytes[w][p] += size;
+                                      partFiles[w][p] += 1;
+                                      p = sharedData->fcbParent[p];
+                                  }
+                              } });
+    }
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+
+    int checked = 0, mismatched = 0;
+    for (int i = 0; i < MAX_FCBS; ++i)
+    {
+        long long bytes = 0;
+        int files = 0;
+        for (unsigned w = 0; w < workers; ++w)
         {
-            sharedData->fcbs[i] = FCB();
+            bytes += partBytes[w][i];
+            files += partFiles[w][i];
         }
-        memset(sharedData->fileContents, 0, sizeof(sharedData->fileContents)); // 这个是普通数组，可以用memset
+        if (!sharedData->fcbUsed[i] || sharedData->fcbType[i] != 1)
+            continue;
 
-        for (int i = 0; i < fcbCount; i++)
+        checked++;
+        if (bytes != sharedData->subtreeBytes[i] || files != sharedData->subtreeFiles[i])
         {
-            FCB fcb;
-            file.read(reinterpret_cast<char *>(&fcb), sizeof(FCB));
-            int fcbIndex = fcb.address;
-            sharedData->fcbs[fcbIndex] = fcb;
-
-            // 如果是文件类型，读取文件内容
-            if (fcb.type == 0)
+            mismatched++;
+            if (report)
             {
-                file.read(sharedData->fileContents[fcbIndex], sizeof(sharedData->fileContents[fcbIndex]));
+                cout << " - 修复 " << sharedData->fcbs[i].name << ": " << sharedData->subtreeBytes[i]
+                     << " -> " << bytes << " 字节, " << sharedData->subtreeFiles[i] << " -> " << files << " 个文件" << endl;
             }
         }
-
-        // 4. 读取系统状态
-        file.read(reinterpret_cast<char *>(&sharedData->modifyCount), sizeof(sharedData->modifyCount));
-        file.read(reinterpret_cast<char *>(&sharedData->nextUserId), sizeof(sharedData->nextUserId));
-        file.read(reinterpret_cast<char *>(&sharedData->nextFcbId), sizeof(sharedData->nextFcbId));
-
-        file.close();
-        sharedData->initialized = true;
-
-        cout << " 从文件 filesystem.dat 加载数据成功" << endl;
-        cout << " 已加载 " << userCount << " 个用户, " << fcbCount << " 个文件/目录" << endl;
-
-        return true;
+        sharedData->subtreeBytes[i] = bytes;
+        sharedData->subtreeFiles[i] = files;
     }
-    catch (const exception &e)
+    unlockSharedMemory();
+
+    if (report)
     {
-        cerr << " 加载数据失败: " << e.what() << endl;
-        return false;
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << " 汇总校验完成: " << checked << " 个目录, " << mismatched << " 处不一致（"
+             << workers << " 个线程, 用时 " << fixed << setprecision(2) << millis << " 毫秒）" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
     }
+    return mismatched == 0;
 }
 
-void MiniFMS::autoSaveThread()
+void MiniFMS::findByName(Session *session, const string &dirPath, const string &pattern)
 {
-    while (!shouldExit)
+    if (!session || !sharedData)
+        return;
+
+    int rootId = findFCBByPath(session, dirPath);
+    if (rootId == -1 || sharedData->fcbs[rootId].type != 1)
     {
-        this_thread::sleep_for(chrono::seconds(30)); // 每30秒检查一次
+        cout << " 目录不存在: " << dirPath << endl;
+        return;
+    }
 
-        if (shouldExit)
-        {
-            break;
-        }
+    static const char *kernelName = nullptr;
+    static const NameSearchKernel kernel = selectNameSearchKernel(&kernelName);
+
+    bool isGlob = pattern.find_first_of("*?[") != string::npos;
+    string literal = isGlob ? longestGlobLiteral(pattern) : pattern;
+
+    auto start = chrono::steady_clock::now();
+
+    vector<int> subtree;
+    findAllFiles(subtree, rootId);
+
+    vector<int> matches;
+    bool literalFits = literal.length() < MAX_FILENAME_LEN;
+    for (size_t k = 1; k < subtree.size() && literalFits; ++k)
+    {
+        const char *name = sharedData->fcbs[subtree[k]].name;
+        if (!literal.empty() && !kernel(name, literal.c_str(), literal.length()))
+            continue;
+        if (isGlob && !globMatch(pattern.c_str(), name))
+            continue;
+        matches.push_back(subtree[k]);
+    }
 
-        if (dataChanged && sharedData && sharedData->initialized)
+    double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    cout << "\n 查找结果 (模式: " << pattern << (isGlob ? "，通配符" : "，子串") << ")\n"
+         << endl;
+    for (int id : matches)
+    {
+        // 从匹配项向上拼出相对于查找起点的路径
+        string path = sharedData->fcbs[id].name;
+        for (int p = sharedData->fcbs[id].parentDir; p != rootId && p >= 0; p = sharedData->fcbs[p].parentDir)
         {
-            // 静默保存，不显示任何消息
-            saveDataToDisk(true);
+            path = string(sharedData->fcbs[p].name) + "/" + path;
         }
+        cout << (sharedData->fcbs[id].type == 1 ? " DIR\t" : " FILE\t") << "./" << path << endl;
     }
+    cout << "\n 共找到 " << matches.size() << " 项（扫描 " << subtree.size() - 1
+         << " 项，用时 " << fixed << setprecision(1) << micros << " 微秒，内核: " << kernelName << "）" << endl;
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6) << endl;
 }
 
-void MiniFMS::showFileHead(Session *session, const string &fileName, int numLines)
+// 性能测试：比较不同数据布局下的全表扫描吞吐量
+void MiniFMS::runBenchmark(Session *session, const vector<string> &args)
 {
     if (!session || !sharedData)
         return;
 
-    int fileId = findFCB(session->currentDirId, fileName);
-    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    if (!args.empty() && args[0] == "io")
     {
-        cout << " 文件不存在: " << fileName << endl;
+        int megabytes = 8;
+        try
+        {
+            if (args.size() > 1)
+                megabytes = min(16, max(1, stoi(args[1])));
+        }
+        catch (const exception &e)
+        {
+            cout << " 大小必须是数字: " << args[1] << endl;
+            return;
+        }
+        runIoBenchmark(session, megabytes);
         return;
     }
 
-    // 读取文件内容
-    string content = string(sharedData->fileContents[fileId]);
-    if (content.empty())
+    if (args.empty() || args[0] != "scan")
     {
-        cout << " 文件为空" << endl;
+        cout << " 用法: bench scan [轮数] | bench io [MB]" << endl;
+        cout << " 说明: scan 统计当前目录的子项数，比较FCB结构体数组、热点列和子项链表三种扫描方式" << endl;
+        cout << "       io   写入文本数据后比较普通存储与压缩存储的读写吞吐量和占用空间" << endl;
         return;
     }
 
-    // 更新访问时间
-    sharedData->fcbs[fileId].accessTime = time(nullptr);
+    int rounds = 200;
+    if (args.size() > 1)
+    {
+        try
+        {
+            rounds = max(1, stoi(args[1]));
+        }
+        catch (const exception &e)
+        {
+            cout << " 轮数必须是数字: " << args[1] << endl;
+            return;
+        }
+    }
 
-    // 分行处理
-    istringstream iss(content);
-    string line;
-    vector<string> lines;
-    while (getline(iss, line))
+    // 每轮重新读取目标目录，防止编译器把整轮扫描提到循环外
+    volatile int target = session->currentDirId;
+    const FCB *fcbs = sharedData->fcbs;
+    const unsigned char *used = sharedData->fcbUsed;
+    const int *parent = sharedData->fcbParent;
+    const DirLink *links = sharedData->links;
+
+    struct BenchResult
+    {
+        const char *name;
+        size_t bytesPerRound;
+        double micros;
+        long long hits;
+        long long entries; // 每轮实际访问的表项数，用于计算吞吐量
+    };
+
+    // fullScan 为 true 时每轮访问全部 MAX_FCBS 个槽位，否则只访问列出的子项（即匹配数）
+    auto measure = [&](const char *name, size_t bytesPerRound, bool fullScan, auto scan)
     {
-        lines.push_back(line);
+        long long hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            hits += scan(target);
+        }
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        return BenchResult{name, bytesPerRound, micros, hits / rounds, fullScan ? MAX_FCBS : hits / rounds};
+    };
+
+    vector<BenchResult> results;
+    results.push_back(measure("FCB结构体数组", sizeof(FCB) * MAX_FCBS, true, [&](int dirId)
+                              {
+                                  int n = 0;
+                                  for (int i = 0; i < MAX_FCBS; ++i)
+                                  {
+                                      if (fcbs[i].isused && fcbs[i].parentDir == dirId)
+                                          n++;
+                                  }
+                                  return n; }));
+    results.push_back(measure("热点元数据列", (sizeof(unsigned char) + sizeof(int)) * MAX_FCBS, true, [&](int dirId)
+                              {
+                                  int n = 0;
+                                  for (int i = 0; i < MAX_FCBS; ++i)
+                                  {
+                                      n += used[i] & (parent[i] == dirId);
+                                  }
+                                  return n; }));
+    results.push_back(measure("子项链表", sizeof(DirLink) * links[session->currentDirId].childCount, false, [&](int dirId)
+                              {
+                                  int n = 0;
+                                  for (int i = links[dirId].firstChild; i != -1; i = links[i].nextSibling)
+                                      n++;
+                                  return n; }));
+
+    cout << "\n 元数据扫描测试（" << MAX_FCBS << " 个FCB槽位，" << rounds << " 轮）\n"
+         << endl;
+    cout << " 方式\t\t每轮耗时(us)\t吞吐量(M条/秒)\t每轮读取(KB)\t匹配数" << endl;
+    cout << " ────────────────────────────────────────────────────────────────────" << endl;
+    for (const BenchResult &r : results)
+    {
+        double perRound = r.micros / rounds;
+        double throughput = perRound > 0 ? r.entries / perRound : 0;
+        cout << " " << r.name << "\t" << fixed << setprecision(2) << perRound << "\t\t"
+             << throughput << "\t\t" << r.bytesPerRound / 1024.0 << "\t\t" << r.hits << endl;
     }
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6) << endl;
+}
 
-    // 显示指定行数
-    int linesToShow = min(numLines, static_cast<int>(lines.size()));
-    cout << "\n显示 " << fileName << " 的前 " << linesToShow << " 行：\n"
+void MiniFMS::runIoBenchmark(Session *session, int megabytes)
+{
+    // 生成类似日志的文本：时间、级别、模块和数字字段，接近实际卷上的内容
+    size_t total = static_cast<size_t>(megabytes) << 20;
+    string text;
+    text.reserve(total + 256);
+    unsigned int seed = 12345;
+    const char *levels[] = {"INFO", "WARN", "DEBUG", "ERROR"};
+    const char *modules[] = {"scheduler", "storage", "network", "auth", "cache"};
+    char line[256];
+    for (int n = 0; text.size() < total; ++n)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int len = snprintf(line, sizeof(line), "2026-10-16 %02d:%02d:%02d.%03u [%s] %s: request id=%u user=%u status=%d latency=%ums\n",
+                           (n / 3600) % 24, (n / 60) % 60, n % 60, seed % 1000, levels[(seed >> 8) % 4], modules[(seed >> 12) % 5],
+                           seed % 100000, (seed >> 4) % 500, (seed >> 10) % 7 == 0 ? 500 : 200, (seed >> 16) % 300);
+        text.append(line, len);
+    }
+    text.resize(total);
+
+    struct IoResult
+    {
+        const char *name;
+        double writeMBps;
+        double readMBps;
+        double randomPerSecond;
+        long long blocks;
+    };
+    vector<IoResult> results;
+    const size_t chunk = 64 * 1024;
+    const int randomReads = 2000;
+
+    for (int compressed = 0; compressed <= 1; ++compressed)
+    {
+        string name = compressed ? ".bench_io_lz" : ".bench_io_plain";
+        if (findFCB(session->currentDirId, name) != -1)
+        {
+            cout << " 当前目录中已存在测试文件: " << name << endl;
+            return;
+        }
+        int fileId = createFCB(name, 0, session->user->userId, session->currentDirId);
+        if (fileId == -1 || !setFileCompression(fileId, compressed))
+        {
+            cout << " 无法创建测试文件" << endl;
+            return;
+        }
+
+        IoResult r{compressed ? "压缩存储" : "普通存储", 0, 0, 0, 0};
+        auto start = chrono::steady_clock::now();
+        bool ok = true;
+        for (size_t off = 0; ok && off < total; off += chunk)
+        {
+            ok = writeFileRange(fileId, off, text.data() + off, min(chunk, total - off));
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (!ok)
+        {
+            releaseFCB(fileId);
+            cout << " 测试文件写入失败：磁盘空间不足" << endl;
+            return;
+        }
+        r.writeMBps = megabytes / max(seconds, 1e-9);
+
+        // 顺序读同样按 64KB 复制出来，与 read/export 的用法一致
+        vector<char> readBuffer(chunk);
+        start = chrono::steady_clock::now();
+        size_t checksum = 0;
+        for (size_t off = 0; off < total; off += chunk)
+        {
+            checksum += readFileRange(fileId, off, chunk, readBuffer.data());
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        r.readMBps = megabytes / max(seconds, 1e-9);
+
+        // 随机位置读取 4KB，相当于 lseek 后 read
+        char buffer[BLOCK_SIZE];
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < randomReads; ++i)
+        {
+            seed = seed * 1103515245u + 12345u;
+            checksum += readFileRange(fileId, (static_cast<size_t>(seed) * 7919) % (total - BLOCK_SIZE), BLOCK_SIZE, buffer);
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        r.randomPerSecond = randomReads / max(seconds, 1e-9);
+
+        lockSharedMemory();
+        for (int idx = findExtent(fileId, 0); idx < sharedData->extentCount && sharedData->extents[idx].fcbId == fileId; ++idx)
+            r.blocks += sharedData->extents[idx].blockCount;
+        for (int idx = findFrame(fileId, 0); idx < sharedData->frameCount && sharedData->frames[idx].fcbId == fileId; ++idx)
+            r.blocks += sharedData->frames[idx].blockCount;
+        unlockSharedMemory();
+
+        releaseFCB(fileId);
+        results.push_back(r);
+        (void)checksum;
+    }
+
+    cout << "\n 读写吞吐量测试（" << megabytes << " MB 日志文本，顺序写入每次 " << chunk / 1024 << " KB，随机读 " << randomReads << " 次 4KB）\n"
          << endl;
-    for (int i = 0; i < linesToShow; ++i)
+    cout << " 方式\t\t写入(MB/s)\t顺序读(MB/s)\t随机读(次/秒)\t占用块数\t压缩比" << endl;
+    cout << " ────────────────────────────────────────────────────────────────────────────" << endl;
+    for (const IoResult &r : results)
     {
-        cout << setw(6) << (i + 1) << " | " << lines[i] << endl;
+        cout << " " << r.name << "\t" << fixed << setprecision(1) << r.writeMBps << "\t\t" << r.readMBps << "\t\t"
+             << r.randomPerSecond << "\t\t" << r.blocks << "\t\t" << setprecision(2)
+             << static_cast<double>(total) / max(1LL, r.blocks * BLOCK_SIZE) << endl;
     }
-    cout << endl;
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6) << endl;
 }
 
-void MiniFMS::showFileTail(Session *session, const string &fileName, int numLines)
+// 进程间通信方法实现
+bool MiniFMS::initSharedMemory()
 {
-    if (!session || !sharedData)
-        return;
+#ifdef _WIN32
+    // 创建共享内存
+    hMapFile = CreateFileMappingA(
+        INVALID_HANDLE_VALUE,
+        NULL,
+        PAGE_READWRITE,
+        0,
+        SHARED_MEMORY_SIZE,
+        SHARED_MEMORY_NAME);
 
-    int fileId = findFCB(session->currentDirId, fileName);
-    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+    if (hMapFile == NULL)
     {
-        cout << " 文件不存在: " << fileName << endl;
-        return;
+        cerr << "无法创建文件映射: " << GetLastError() << endl;
+        return false;
     }
-
-    // 读取文件内容
-    string content = string(sharedData->fileContents[fileId]);
-    if (content.empty())
+    // 映射已存在时不是本进程创建的，重新初始化会覆盖其他进程正在使用的数据
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
     {
-        cout << " 文件为空" << endl;
-        return;
+        cerr << "共享内存已存在但无法连接" << endl;
+        CloseHandle(hMapFile);
+        hMapFile = NULL;
+        return false;
     }
 
-    // 更新访问时间
-    sharedData->fcbs[fileId].accessTime = time(nullptr);
+    sharedData = (SharedData *)MapViewOfFile(
+        hMapFile,
+        FILE_MAP_ALL_ACCESS,
+        0,
+        0,
+        SHARED_MEMORY_SIZE);
 
-    // 分行处理
-    istringstream iss(content);
-    string line;
-    vector<string> lines;
-    while (getline(iss, line))
+    if (sharedData == NULL)
     {
-        lines.push_back(line);
+        cerr << "无法映射视图: " << GetLastError() << endl;
+        CloseHandle(hMapFile);
+        hMapFile = NULL;
+        return false;
     }
 
-    // 显示指定行数
-    int startLine = max(0, static_cast<int>(lines.size()) - numLines);
-    int linesToShow = min(numLines, static_cast<int>(lines.size()));
-    cout << "\n显示 " << fileName << " 的后 " << linesToShow << " 行：\n"
-         << endl;
-    for (int i = startLine; i < static_cast<int>(lines.size()); ++i)
+    // 创建互斥锁
+    hMutex = CreateMutexA(NULL, FALSE, SHARED_MUTEX_NAME);
+    if (hMutex == NULL)
     {
-        cout << setw(6) << (i + 1) << " | " << lines[i] << endl;
+        cerr << "无法创建互斥锁: " << GetLastError() << endl;
+        return false;
     }
-    cout << endl;
-}
 
-void MiniFMS::findAllFiles(vector<int> &files, int fcbId)
-{
-    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
+    // 创建事件对象
+    hChangeEvent = CreateEventA(NULL, TRUE, FALSE, CHANGE_EVENT_NAME);
+    if (hChangeEvent == NULL)
     {
-        cout << " 错误：无效的FCB ID: " << fcbId << endl;
-        return;
+        cerr << "无法创建事件对象: " << GetLastError() << endl;
+        return false;
     }
 
-    files.push_back(fcbId); // 先添加当前目录/文件
+    // 初始化共享数据
+    new (sharedData) SharedData();
 
-    // 如果是目录，添加其中的内容
-    if (sharedData->fcbs[fcbId].type == 1)
+#else
+    // Linux实现：只有本进程新建的共享内存才能设置大小和初始化。已存在时说明其他进程刚刚创建、
+    // 还没有初始化完，或者连接失败的原因不在共享内存本身；截断正在使用的共享内存会让其他进程访问时收到
+    // SIGBUS，所以这时只等待后重新连接，仍连接不上则放弃
+    shmFd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shmFd == -1 && errno == EEXIST)
     {
-        for (int i = 0; i < MAX_FCBS; i++)
+        for (int attempt = 0; attempt < 200; ++attempt)
         {
-            if (sharedData->fcbs[i].isused && sharedData->fcbs[i].parentDir == fcbId)
-            {
-                files.push_back(i);
-            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+            if (connectToSharedMemory())
+                return true;
         }
+        cerr << "共享内存 " << SHARED_MEMORY_NAME << " 已存在但无法连接；确认没有 MiniFMS 进程在运行后删除 /dev/shm/"
+             << SHARED_MEMORY_NAME << " 再启动" << endl;
+        return false;
     }
-}
-
-void MiniFMS::deleteFCB(int fcbId)
-{
-    if (!sharedData || fcbId < 0 || fcbId >= MAX_FCBS || !sharedData->fcbs[fcbId].isused)
+    if (shmFd == -1)
     {
-        cout << " 错误：无效的FCB ID: " << fcbId << endl;
-        return;
+        cerr << "无法创建共享内存: " << strerror(errno) << endl;
+        return false;
     }
 
-    lock_guard<mutex> lock(diskMutex); // Add mutex lock for thread safety
+    // 新建的共享内存长度为0，扩展后全部是尚未提交的全0页；之后任何一步失败都删除它，不留下未初始化的段
+    auto fail = [this](const char *what)
+    {
+        cerr << what << strerror(errno) << endl;
+        if (sharedData && sharedData != MAP_FAILED)
+            munmap(sharedData, SHARED_MEMORY_SIZE);
+        sharedData = nullptr;
+        close(shmFd);
+        shmFd = -1;
+        shm_unlink(SHARED_MEMORY_NAME);
+        return false;
+    };
+    if (ftruncate(shmFd, SHARED_MEMORY_SIZE) == -1)
+        return fail("无法设置共享内存大小: ");
 
-    // 保存删除前的信息用于日志
-    string itemName = sharedData->fcbs[fcbId].name;
-    string itemType = sharedData->fcbs[fcbId].type == 1 ? "目录" : "文件";
-    int parentDir = sharedData->fcbs[fcbId].parentDir;
+    // MAP_NORESERVE：不为整个映射预留交换空间，内存占用随实际写入的数据增长
+    sharedData = (SharedData *)mmap(NULL, SHARED_MEMORY_SIZE,
+                                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, shmFd, 0);
+    if (sharedData == MAP_FAILED)
+        return fail("无法映射共享内存: ");
 
-    // 如果是目录，先删除其中的内容
-    if (sharedData->fcbs[fcbId].type == 1)
-    {
-        vector<int> childrenToDelete;
-        // 先收集所有子项，避免在遍历过程中修改数据
-        for (int i = 0; i < MAX_FCBS; i++)
-        {
-            if (sharedData->fcbs[i].isused && sharedData->fcbs[i].parentDir == fcbId)
-            {
-                childrenToDelete.push_back(i);
-            }
-        }
+    // 先初始化共享数据再创建信号量：其他进程打开信号量之后看到的总是初始化完成的段
+    new (sharedData) SharedData();
+    if (sem_init(&sharedData->walSyncDone, 1, 0) == -1)
+        return fail("无法创建日志同步信号量: ");
 
-        // 删除所有子项
-        for (int childId : childrenToDelete)
-        {
-            string childName = sharedData->fcbs[childId].name;
-            string childType = sharedData->fcbs[childId].type == 1 ? "目录" : "文件";
-            cout << " - 删除" << childType << ": " << childName << endl;
+    // 创建信号量
+    shmMutex = sem_open(SHARED_MUTEX_NAME, O_CREAT, 0666, 1);
+    if (shmMutex == SEM_FAILED)
+        return fail("无法创建互斥信号量: ");
 
-            // 清理子项的FCB
-            sharedData->fcbs[childId].isused = 0;
-            sharedData->fcbs[childId].type = 0;
-            sharedData->fcbs[childId].size = 0;
-            sharedData->fcbs[childId].address = -1;
-            sharedData->fcbs[childId].parentDir = -1;
-            sharedData->fcbs[childId].owner = -1;
-            sharedData->fcbs[childId].locked = false;
-            sharedData->fcbs[childId].lockOwner = -1;
-            memset(sharedData->fcbs[childId].name, 0, MAX_FILENAME_LEN);
+    string eventName = CHANGE_EVENT_NAME + processName;
+    changeEvent = sem_open(eventName.c_str(), O_CREAT, 0666, 0);
+    if (changeEvent == SEM_FAILED)
+        return fail("无法创建事件信号量: ");
+#endif
 
-            // 如果是文件，清空内容
-            if (sharedData->fcbs[childId].type == 0)
-            {
-                memset(sharedData->fileContents[childId], 0, sizeof(sharedData->fileContents[childId]));
-            }
-        }
-    }
+    cout << "共享内存初始化成功" << endl;
+    return true;
+}
 
-    // 释放数据块
-    int blockId = sharedData->fcbs[fcbId].address;
-    while (blockId != -1 && blockId < MAX_BLOCKS)
-    {
-        int nextBlock = fatBlock[blockId];
-        fatBlock[blockId] = 0; // 标记为空闲
-        bitMap[blockId] = 0;   // 更新位图
-        blockId = nextBlock;
-    }
+bool MiniFMS::connectToSharedMemory()
+{
+#ifdef _WIN32
+    // 打开现有的共享内存
+    hMapFile = OpenFileMappingA(
+        FILE_MAP_ALL_ACCESS,
+        FALSE,
+        SHARED_MEMORY_NAME);
 
-    // 从父目录中移除该FCB的引用
-    if (parentDir >= 0 && parentDir < MAX_FCBS && sharedData->fcbs[parentDir].isused)
+    if (hMapFile == NULL)
     {
-        // 更新父目录的修改时间
-        sharedData->fcbs[parentDir].modifyTime = time(nullptr);
-        cout << " - 已从父目录 " << sharedData->fcbs[parentDir].name << " 中移除 " << itemType << ": " << itemName << endl;
+        return false; // 共享内存不存在
     }
 
-    // 清空当前FCB
-    sharedData->fcbs[fcbId].isused = 0;
-    sharedData->fcbs[fcbId].type = 0;
-    sharedData->fcbs[fcbId].size = 0;
-    sharedData->fcbs[fcbId].address = -1;
-    sharedData->fcbs[fcbId].parentDir = -1;
-    sharedData->fcbs[fcbId].owner = -1;
-    sharedData->fcbs[fcbId].locked = false;
-    sharedData->fcbs[fcbId].lockOwner = -1;
-    memset(sharedData->fcbs[fcbId].name, 0, MAX_FILENAME_LEN);
+    sharedData = (SharedData *)MapViewOfFile(
+        hMapFile,
+        FILE_MAP_ALL_ACCESS,
+        0,
+        0,
+        SHARED_MEMORY_SIZE);
 
-    // 如果是文件，清空文件内容
-    if (sharedData->fcbs[fcbId].type == 0)
+    if (sharedData == NULL)
     {
-        memset(sharedData->fileContents[fcbId], 0, sizeof(sharedData->fileContents[fcbId]));
+        CloseHandle(hMapFile);
+        hMapFile = NULL;
+        return false;
     }
 
-    // 标记数据已修改
-    sharedData->modifyCount++;
-    dataChanged = true;
-}
-
-// 导入外部文件到文件系统
-bool MiniFMS::importFile(Session *session, const string &externalPath, const string &internalName)
-{
-    // 检查文件是否已存在
-    if (findFCB(session->currentDirId, internalName) != -1)
+    // 打开互斥锁
+    hMutex = OpenMutexA(SYNCHRONIZE, FALSE, SHARED_MUTEX_NAME);
+    if (hMutex == NULL)
     {
-        cout << " 错误：文件已存在：" << internalName << endl;
         return false;
     }
 
-    // 读取外部文件
-    ifstream inFile(externalPath, ios::binary);
-    if (!inFile.is_open())
+    // 打开事件对象
+    hChangeEvent = OpenEventA(EVENT_ALL_ACCESS, FALSE, CHANGE_EVENT_NAME);
+    if (hChangeEvent == NULL)
     {
-        cout << " 错误：无法打开外部文件：" << externalPath << endl;
         return false;
     }
 
-    // 读取文件内容
-    stringstream buffer;
-    buffer << inFile.rdbuf();
-    string content = buffer.str();
-    inFile.close();
-
-    // 创建新文件
-    int newFileId = createFCB(internalName, 0, session->user->userId, session->currentDirId);
-    if (newFileId == -1)
+#else
+    // Linux实现
+    shmFd = shm_open(SHARED_MEMORY_NAME, O_RDWR, 0666);
+    if (shmFd == -1)
     {
-        cout << " 错误：创建文件失败" << endl;
-        return false;
+        return attachImage(); // 共享内存不存在：映像模式下共享段就是映像文件
     }
 
-    // 写入文件内容
-    if (content.length() >= sizeof(sharedData->fileContents[newFileId]))
+    // 长度不符说明创建者还没有设置大小（或是其他布局留下的段），映射后访问会收到 SIGBUS
+    auto fail = [this]()
     {
-        cout << " 错误：文件太大，超出系统限制" << endl;
-        deleteFCB(newFileId);
+        if (sharedData && sharedData != MAP_FAILED)
+            munmap(sharedData, SHARED_MEMORY_SIZE);
+        sharedData = nullptr;
+        close(shmFd);
+        shmFd = -1;
         return false;
+    };
+    struct stat st;
+    if (fstat(shmFd, &st) == -1 || static_cast<size_t>(st.st_size) != SHARED_MEMORY_SIZE)
+        return fail();
+
+    // MAP_NORESERVE：不为整个映射预留交换空间，内存占用随实际写入的数据增长
+    sharedData = (SharedData *)mmap(NULL, SHARED_MEMORY_SIZE,
+                                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, shmFd, 0);
+    if (sharedData == MAP_FAILED)
+        return fail();
+
+    // 打开信号量
+    shmMutex = sem_open(SHARED_MUTEX_NAME, 0);
+    if (shmMutex == SEM_FAILED)
+        return fail();
+
+    string eventName = CHANGE_EVENT_NAME + processName;
+    changeEvent = sem_open(eventName.c_str(), O_CREAT, 0666, 0);
+    if (changeEvent == SEM_FAILED)
+    {
+        sem_close(shmMutex);
+        return fail();
     }
+#endif
 
-    strncpy(sharedData->fileContents[newFileId], content.c_str(), sizeof(sharedData->fileContents[newFileId]) - 1);
-    sharedData->fcbs[newFileId].size = content.length();
-    sharedData->fcbs[newFileId].modifyTime = time(nullptr);
+    return true;
+}
 
-    cout << " 文件导入成功：" << internalName << endl;
-    cout << " - 大小：" << content.length() << " 字节" << endl;
-    cout << " - 修改时间：" << formatTime(sharedData->fcbs[newFileId].modifyTime) << endl;
+#ifndef _WIN32
+// pwrite 直到写完或出错
+static bool writeFully(int fd, const void *data, size_t length, off_t offset)
+{
+    const char *p = static_cast<const char *>(data);
+    while (length > 0)
+    {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
 
-    sharedData->modifyCount++;
-    dataChanged = true;
+// 把共享段写入新建的 fd 的 base 偏移处：只写非0的元数据页和已分配的块，其余部分在目标中保持为空洞
+static bool writeSharedSegment(const SharedData *data, int fd, off_t base)
+{
+    const char *begin = reinterpret_cast<const char *>(data);
+    const size_t pageCount = SHARED_MEMORY_SIZE / BLOCK_SIZE;
+    const size_t poolPage = offsetof(SharedData, blockPool) / BLOCK_SIZE;
+    static const char zeroPage[BLOCK_SIZE] = {0};
+    auto needed = [&](size_t page)
+    {
+        if (page >= poolPage)
+        {
+            size_t b = page - poolPage;
+            return ((data->bitMap[b / 64] >> (b % 64)) & 1) != 0;
+        }
+        return memcmp(begin + page * BLOCK_SIZE, zeroPage, BLOCK_SIZE) != 0;
+    };
+    for (size_t page = 0; page < pageCount;)
+    {
+        if (!needed(page))
+        {
+            ++page;
+            continue;
+        }
+        size_t start = page;
+        while (page < pageCount && needed(page))
+            ++page;
+        if (!writeFully(fd, begin + start * BLOCK_SIZE, (page - start) * BLOCK_SIZE,
+                        base + static_cast<off_t>(start * BLOCK_SIZE)))
+            return false;
+    }
     return true;
 }
+#endif
 
-// 导出文件到外部文件系统
-bool MiniFMS::exportFile(Session *session, const string &internalName, const string &externalPath)
+bool MiniFMS::attachImage()
 {
-    // 查找文件
-    int fileId = findFCB(session->currentDirId, internalName);
-    if (fileId == -1 || sharedData->fcbs[fileId].type != 0)
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(IMAGE_FILE, O_RDWR);
+    if (fd == -1)
+        return false;
+
+    // 拿得到排他锁说明没有进程在使用映像，本进程负责冷启动；否则等冷启动的进程降为共享锁后再映射
+    bool coldStart = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    if (!coldStart && flock(fd, LOCK_SH) == -1)
     {
-        cout << " 错误：文件不存在：" << internalName << endl;
+        close(fd);
         return false;
     }
 
-    // 检查文件访问权限
-    if (!checkFileAccess(session, fileId, false))
+    ImageHeader header;
+    struct stat st;
+    bool valid = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                 fstat(fd, &st) == 0 && memcmp(header.magic, IMAGE_MAGIC, 8) == 0 &&
+                 header.layoutVersion == IMAGE_LAYOUT_VERSION && header.dataSize == SHARED_MEMORY_SIZE &&
+                 header.layoutHash == imageLayoutHash() &&
+                 static_cast<uint64_t>(st.st_size) >= IMAGE_HEADER_SIZE + SHARED_MEMORY_SIZE;
+    if (!valid)
     {
+        cerr << " 映像文件 " << IMAGE_FILE << " 与当前版本的数据布局不一致，改为从数据文件加载" << endl;
+        close(fd);
         return false;
     }
 
-    // 写入外部文件
-    ofstream outFile(externalPath, ios::binary);
-    if (!outFile.is_open())
+    // 启动只需一次映射，数据页在首次访问时由内核从映像读入
+    void *base = mmap(NULL, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IMAGE_HEADER_SIZE);
+    if (base == MAP_FAILED)
     {
-        cout << " 错误：无法创建外部文件：" << externalPath << endl;
+        cerr << " 无法映射映像文件: " << strerror(errno) << endl;
+        close(fd);
         return false;
     }
 
-    // 获取文件内容
-    string content = string(sharedData->fileContents[fileId]);
-    outFile.write(content.c_str(), sharedData->fcbs[fileId].size);
-    outFile.close();
+    // 冷启动时没有其他进程，上次异常退出残留的信号量可以安全地重建
+    if (coldStart)
+        sem_unlink(SHARED_MUTEX_NAME);
+    shmMutex = coldStart ? sem_open(SHARED_MUTEX_NAME, O_CREAT, 0666, 1) : sem_open(SHARED_MUTEX_NAME, 0);
+    string eventName = CHANGE_EVENT_NAME + processName;
+    changeEvent = sem_open(eventName.c_str(), O_CREAT, 0666, 0);
+    if (shmMutex == SEM_FAILED || changeEvent == SEM_FAILED)
+    {
+        cerr << " 无法打开信号量: " << strerror(errno) << endl;
+        munmap(base, SHARED_MEMORY_SIZE);
+        close(fd);
+        return false;
+    }
 
-    cout << " 文件导出成功：" << internalName << " -> " << externalPath << endl;
-    cout << " - 大小：" << sharedData->fcbs[fileId].size << " 字节" << endl;
-    cout << " - 修改时间：" << formatTime(sharedData->fcbs[fileId].modifyTime) << endl;
+    sharedData = static_cast<SharedData *>(base);
+    imageFd = fd;
+    imageMapped = true;
+    if (!coldStart)
+        return true;
 
-    // 更新访问时间
-    sharedData->fcbs[fileId].accessTime = time(nullptr);
-    dataChanged = true;
+    // 进程表只对本次运行有效
+    sharedData->processCount = 0;
+    for (int i = 0; i < MAX_PROCESSES; ++i)
+    {
+        sharedData->processActive[i] = false;
+        sharedData->processBusy[i] = 0;
+        sharedData->snapshotPinned[i] = 0;
+        memset(sharedData->processNames[i], 0, sizeof(sharedData->processNames[i]));
+    }
+    sharedData->storeSaving = 0;
+    sharedData->walEnabled = 0;
+    sharedData->walSyncing = 0;
+    sharedData->walSyncWaiters = 0;
+    sem_init(&sharedData->walSyncDone, 1, 0); // 映像中保存的是上次运行的信号量状态
+    if (!header.clean)
+    {
+        cout << " 映像上次未正常关闭，正在重建块状态和索引..." << endl;
+        recoverImageState();
+    }
+    // 运行期间映像头标记为未关闭，直到最后一个进程退出前同步完成
+    header.clean = 0;
+    writeFully(fd, &header, sizeof(header), 0);
+    fdatasync(fd);
+    flock(fd, LOCK_SH);
     return true;
+#endif
 }
 
-// 通过路径查找FCB
-int MiniFMS::findFCBByPath(Session *session, const string &path)
+void MiniFMS::recoverImageState()
 {
-    if (!session || !sharedData)
-        return -1;
-    if (path.empty())
-        return -1;
+    // 异常退出时内核可能只写回了部分页面：以FCB、区段表和帧表为准，重新统计块引用并重建派生索引
+    sharedData->extentCount = max(0, min(sharedData->extentCount, MAX_EXTENTS));
+    sharedData->frameCount = max(0, min(sharedData->frameCount, MAX_FRAMES));
+    memset(sharedData->blockRefs, 0, sizeof(sharedData->blockRefs));
+    auto addRef = [this](int block)
+    {
+        if (block >= 0 && block < MAX_BLOCKS)
+            sharedData->blockRefs[block]++;
+    };
+    for (int i = 0; i < sharedData->extentCount; ++i)
+    {
+        const Extent &e = sharedData->extents[i];
+        for (int k = 0; k < e.blockCount && k < MAX_BLOCKS; ++k)
+            addRef(e.startBlock + k);
+    }
+    for (int i = 0; i < sharedData->frameCount; ++i)
+    {
+        const Frame &f = sharedData->frames[i];
+        for (int k = 0; k < f.blockCount && k < FRAME_BLOCKS; ++k)
+            addRef(f.blocks[k]);
+    }
+    sharedData->freeBlockCount = MAX_BLOCKS;
+    for (int b = 0; b < MAX_BLOCKS; ++b)
+    {
+        uint64_t bit = 1ULL << (b % 64);
+        if (sharedData->blockRefs[b])
+        {
+            sharedData->bitMap[b / 64] |= bit;
+            sharedData->freeBlockCount--;
+        }
+        else if (sharedData->bitMap[b / 64] & bit)
+        {
+            sharedData->bitMap[b / 64] &= ~bit;
+            sharedData->staleBitmap[b / 64] |= bit;
+        }
+    }
+    sharedData->blockHint = 0;
+    memset(sharedData->hashValid, 0, sizeof(sharedData->hashValid));
+    memset(sharedData->crcValid, 0, sizeof(sharedData->crcValid)); // 映像未正常关闭时校验值与块内容可能不同步落盘
+    memset(sharedData->dedupTable, 0, sizeof(sharedData->dedupTable));
+    sharedData->dedupTableUsed = 0;
+    sharedData->dedupCursorFcb = 0;
+    sharedData->dedupCursorBlock = 0;
+    sharedData->storeId = 0; // 脏页记录可能不完整，下一次增量保存改为完整写入
+
+    rebuildFcbColumns();
+    rebuildFreeFcbList();
+    rebuildDirHash();
+    rebuildNameIndex();
+    rebuildDirLinks();
+    rebuildUserIndex();
+    verifyAggregates(false);
+}
 
-    // 处理特殊路径
-    if (path == "/")
+bool MiniFMS::syncImage(bool silent)
+{
+#ifdef _WIN32
+    (void)silent;
+    return false;
+#else
+    auto start = chrono::steady_clock::now();
+    // 内核按页记录映射中被修改过的部分，msync 只写回这些脏页，未变化的元数据和数据块不产生磁盘写入
+    bool ok = msync(sharedData, SHARED_MEMORY_SIZE, MS_SYNC) == 0;
+    ImageHeader header;
+    ok = ok && pread(imageFd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    if (ok)
+    {
+        header.syncCount++;
+        header.syncTime = time(nullptr);
+        header.clean = sharedData->processCount == 0; // 最后一个进程退出前的同步
+        ok = writeFully(imageFd, &header, sizeof(header), 0) && fdatasync(imageFd) == 0;
+    }
+    if (!ok)
     {
-        return session->user->rootDirId; // 返回用户的根目录
+        if (!silent)
+            cerr << " 同步映像失败: " << strerror(errno) << endl;
+        return false;
     }
+    dataChanged = false;
 
-    // 确定起始目录
-    int currentDir = session->currentDirId;
+    if (!silent)
+    {
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << " 数据已同步到映像 " << IMAGE_FILE << "（用时 " << fixed << setprecision(1) << millis << " 毫秒）" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+    return true;
+#endif
+}
 
-    // 分割路径
-    vector<string> parts;
-    stringstream ss(path);
-    string part;
+bool MiniFMS::switchImageMode(bool enable)
+{
+#ifdef _WIN32
+    (void)enable;
+    cout << " 当前平台不支持映像模式" << endl;
+    return false;
+#else
+    if (enable == imageMapped)
+        return true;
 
-    // 检查是否是绝对路径
-    bool isAbsolutePath = !path.empty() && path[0] == '/';
-    if (isAbsolutePath)
+    // 切换期间本进程的自动保存不能写入旧的后备对象
+    lock_guard<mutex> save(saveMutex);
+    lock_guard<mutex> lock(diskMutex);
+    lockSharedMemory();
+    if (sharedData->processCount != 1)
     {
-        currentDir = session->user->rootDirId;
+        unlockSharedMemory();
+        cout << " 切换存储模式前请先关闭其他进程" << endl;
+        return false;
     }
 
-    // 使用/分割路径
-    while (getline(ss, part, '/'))
+    // 先把当前内容完整写入新的后备对象，再用 MAP_FIXED 在原地址替换映射：
+    // 地址不变，本进程各线程持有的指针继续有效；持有锁期间内容不会变化
+    bool ok;
+    if (enable)
     {
-        if (part.empty() || part == ".")
-            continue; // 跳过空部分和当前目录符号
-        parts.push_back(part);
+        // 映像由内核写回，崩溃后从映像本身恢复，不再记录日志
+        int walWasEnabled = sharedData->walEnabled;
+        sharedData->walEnabled = 0;
+        string tempName = string(IMAGE_FILE) + ".tmp";
+        int fd = open(tempName.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+        ImageHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, IMAGE_MAGIC, 8);
+        header.layoutVersion = IMAGE_LAYOUT_VERSION;
+        header.dataSize = SHARED_MEMORY_SIZE;
+        header.layoutHash = imageLayoutHash();
+        header.syncTime = time(nullptr);
+        ok = fd != -1 && ftruncate(fd, IMAGE_HEADER_SIZE + SHARED_MEMORY_SIZE) == 0 &&
+             writeSharedSegment(sharedData, fd, IMAGE_HEADER_SIZE) &&
+             writeFully(fd, &header, sizeof(header), 0) && fsync(fd) == 0 && flock(fd, LOCK_SH) == 0 &&
+             rename(tempName.c_str(), IMAGE_FILE) == 0;
+        ok = ok && mmap(sharedData, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                        fd, IMAGE_HEADER_SIZE) != MAP_FAILED;
+        if (ok)
+        {
+            close(shmFd);
+            shm_unlink(SHARED_MEMORY_NAME);
+            shmFd = -1;
+            imageFd = fd;
+            imageMapped = true;
+        }
+        else
+        {
+            cout << " 创建映像失败: " << strerror(errno) << endl;
+            if (fd != -1)
+                close(fd);
+            unlink(tempName.c_str());
+            unlink(IMAGE_FILE);
+            sharedData->walEnabled = walWasEnabled;
+        }
     }
-
-    if (parts.empty())
-        return currentDir;
-
-    // 遍历路径的每一部分
-    for (const string &dirName : parts)
+    else
     {
-        if (dirName == "..")
+        // 映像文件保留到页式存储写完为止，由调用者删除
+        int fd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_RDWR, 0666);
+        ok = fd != -1 && ftruncate(fd, 0) == 0 && ftruncate(fd, SHARED_MEMORY_SIZE) == 0 &&
+             writeSharedSegment(sharedData, fd, 0) &&
+             mmap(sharedData, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE | MAP_FIXED,
+                  fd, 0) != MAP_FAILED;
+        if (ok)
         {
-            // 返回上级目录
-            if (currentDir == session->user->rootDirId)
-            {
-                // 已经在根目录，无法再往上
-                continue;
-            }
-            FCB &currentFCB = sharedData->fcbs[currentDir];
-            currentDir = currentFCB.parentDir;
-            if (currentDir == -1)
-            {
-                return -1; // 无效的父目录
-            }
+            close(imageFd);
+            imageFd = -1;
+            imageMapped = false;
+            shmFd = fd;
         }
         else
         {
-            int nextId = findFCB(currentDir, dirName);
-            if (nextId == -1)
+            cout << " 创建共享内存失败: " << strerror(errno) << endl;
+            if (fd != -1)
             {
-                return -1; // 路径中的某个部分不存在
+                close(fd);
+                shm_unlink(SHARED_MEMORY_NAME);
             }
-            currentDir = nextId;
         }
     }
-
-    return currentDir;
+    unlockSharedMemory();
+    return ok;
+#endif
 }
 
-// 进程间通信方法实现
-bool MiniFMS::initSharedMemory()
+void MiniFMS::showImageStatus()
 {
-#ifdef _WIN32
-    // 创建共享内存
-    hMapFile = CreateFileMappingA(
-        INVALID_HANDLE_VALUE,
-        NULL,
-        PAGE_READWRITE,
-        0,
-        SHARED_MEMORY_SIZE,
-        SHARED_MEMORY_NAME);
-
-    if (hMapFile == NULL)
+    if (!imageMapped)
     {
-        cerr << "无法创建文件映射: " << GetLastError() << endl;
-        return false;
+        // 待写入的页数在锁内统计，与下一次保存取出的脏页记录一致
+        lockSharedMemory();
+        int pending = 0;
+        for (size_t w = 0; w < STORE_PAGE_WORDS; ++w)
+            pending += __builtin_popcountll(sharedData->storeDirty[w]);
+        bool full = sharedData->storeId == 0;
+        long long saves = sharedData->storeSaves, written = sharedData->storePagesWritten;
+        int lastPages = sharedData->storeLastPages;
+        unlockSharedMemory();
+        ifstream file(STORE_FILE, ios::binary | ios::ate);
+        cout << " 存储模式: 共享内存，增量保存到 " << STORE_FILE << endl;
+        if (file.is_open())
+            cout << " 存储文件: " << static_cast<long long>(file.tellg()) / 1024 << " KB（共 " << STORE_PAGES << " 页，空洞不占用磁盘）" << endl;
+        cout << " 待保存: " << (full ? "下次保存完整写入" : to_string(pending) + " 页") << endl;
+        cout << " 增量保存次数: " << saves << "，上次写入 " << lastPages << " 页，累计写入 " << written << " 页" << endl;
+        lockSharedMemory();
+        bool walEnabled = sharedData->walEnabled;
+        uint64_t walBytes = sharedData->walLsn - sharedData->walCheckpointLsn;
+        long long records = sharedData->walRecords, commits = sharedData->walCommits, syncs = sharedData->walSyncs;
+        unlockSharedMemory();
+        if (walEnabled)
+            cout << " 预写日志: 检查点之后 " << walBytes / 1024 << " KB，累计 " << records << " 条记录，" << commits
+                 << " 次提交合并为 " << syncs << " 次同步" << endl;
+        else
+            cout << " 预写日志: 未启用" << endl;
+        return;
     }
-
-    sharedData = (SharedData *)MapViewOfFile(
-        hMapFile,
-        FILE_MAP_ALL_ACCESS,
-        0,
-        0,
-        SHARED_MEMORY_SIZE);
-
-    if (sharedData == NULL)
+#ifndef _WIN32
+    ImageHeader header;
+    struct stat st;
+    if (pread(imageFd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) || fstat(imageFd, &st) != 0)
     {
-        cerr << "无法映射视图: " << GetLastError() << endl;
-        CloseHandle(hMapFile);
-        hMapFile = NULL;
-        return false;
+        cout << " 无法读取映像信息: " << strerror(errno) << endl;
+        return;
     }
+    time_t syncTime = static_cast<time_t>(header.syncTime);
+    cout << " 存储模式: 映像映射 (" << IMAGE_FILE << "，布局版本 " << header.layoutVersion << ")" << endl;
+    cout << " 映像大小: " << st.st_size / 1024 << " KB，实际占用 " << st.st_blocks * 512 / 1024 << " KB" << endl;
+    cout << " 同步次数: " << header.syncCount << "，上次同步: " << formatTime(syncTime) << endl;
+#endif
+}
 
-    // 创建互斥锁
-    hMutex = CreateMutexA(NULL, FALSE, SHARED_MUTEX_NAME);
-    if (hMutex == NULL)
+void MiniFMS::walAppend(int type, int fcbId, int arg, int64_t value, const void *data, size_t length, int flags)
+{
+#ifdef _WIN32
+    (void)type, (void)fcbId, (void)arg, (void)value, (void)data, (void)length, (void)flags;
+#else
+    if (!sharedData->walEnabled)
+        return;
+    WalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.lsn = sharedData->walLsn;
+    rec.length = static_cast<uint32_t>(length);
+    rec.type = static_cast<uint16_t>(type);
+    rec.flags = static_cast<uint16_t>(flags);
+    rec.fcbId = fcbId;
+    rec.arg = arg;
+    rec.value = value;
+    rec.checksum = walChecksum(rec, static_cast<const char *>(data));
+
+    // 记录头和数据一次写入页缓存，落盘由命令结束时的 walCommit 统一等待
+    walBuffer.resize(sizeof(rec) + length);
+    memcpy(walBuffer.data(), &rec, sizeof(rec));
+    if (length > 0)
+        memcpy(walBuffer.data() + sizeof(rec), data, length);
+    off_t offset = static_cast<off_t>(sizeof(WalHeader) + rec.lsn - sharedData->walBaseLsn);
+    if (!walOpen() || !writeFully(walFd, walBuffer.data(), walBuffer.size(), offset))
     {
-        cerr << "无法创建互斥锁: " << GetLastError() << endl;
-        return false;
+        // 日志在出错的位置截止，之后的修改只随保存落盘
+        cerr << " 警告：写入日志失败（" << strerror(errno) << "），之后的修改在下次保存前可能因崩溃丢失" << endl;
+        sharedData->walEnabled = 0;
+        return;
     }
+    sharedData->walLsn += walBuffer.size();
+    sharedData->walRecords++;
+    walPending = sharedData->walLsn;
+#endif
+}
 
-    // 创建事件对象
-    hChangeEvent = CreateEventA(NULL, TRUE, FALSE, CHANGE_EVENT_NAME);
-    if (hChangeEvent == NULL)
+bool MiniFMS::walCommit()
+{
+#ifdef _WIN32
+    return false;
+#else
+    lockSharedMemory();
+    uint64_t target = walPending;
+    if (sharedData->walEnabled && sharedData->walSyncedLsn < target)
+        sharedData->walCommits++;
+    while (sharedData->walEnabled && sharedData->walSyncedLsn < target)
     {
-        cerr << "无法创建事件对象: " << GetLastError() << endl;
-        return false;
+        int64_t now = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (sharedData->walSyncing && now - sharedData->walSyncStart < WAL_SYNC_TIMEOUT_MS)
+        {
+            // 其他进程正在同步：睡眠到它结束时释放信号量，最长到超时接手的时刻；醒来后本进程的记录
+            // 可能已经落盘，否则由本进程发起下一次同步。信号量可能留有超时等待者没有取走的计数，多醒一次无妨
+            int64_t waitMs = sharedData->walSyncStart + WAL_SYNC_TIMEOUT_MS - now;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += waitMs / 1000;
+            deadline.tv_nsec += (waitMs % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            sharedData->walSyncWaiters++;
+            unlockSharedMemory();
+            sem_timedwait(&sharedData->walSyncDone, &deadline);
+            lockSharedMemory();
+            sharedData->walSyncWaiters--;
+            continue;
+        }
+
+        // 一次同步覆盖日志当前末尾之前的全部记录，包括其他进程追加后正在等待的记录
+        uint64_t upto = sharedData->walLsn;
+        int fd = walOpen() ? dup(walFd) : -1;
+        if (fd == -1)
+            break;
+        sharedData->walSyncing = 1;
+        sharedData->walSyncStart = now;
+        unlockSharedMemory();
+        bool synced = fdatasync(fd) == 0;
+        close(fd);
+        lockSharedMemory();
+        sharedData->walSyncing = 0;
+        if (synced)
+        {
+            sharedData->walSyncedLsn = max(sharedData->walSyncedLsn, upto);
+            sharedData->walSyncs++;
+        }
+        // 成功或失败都唤醒等待者：成功时它们的记录多半已覆盖，失败时由它们之一重试
+        for (int i = 0; i < sharedData->walSyncWaiters; ++i)
+            sem_post(&sharedData->walSyncDone);
+        if (!synced)
+            break;
     }
+    bool ok = sharedData->walEnabled && sharedData->walSyncedLsn >= target;
+    unlockSharedMemory();
+    return ok;
+#endif
+}
 
-    // 初始化共享数据
-    new (sharedData) SharedData();
+bool MiniFMS::walOpen()
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (walFd >= 0 && walFdGeneration == sharedData->walGeneration)
+        return true;
+    if (walFd >= 0)
+        close(walFd);
+    walFd = open(WAL_FILE, O_RDWR);
+    walFdGeneration = sharedData->walGeneration;
+    return walFd >= 0;
+#endif
+}
 
+bool MiniFMS::walCreate(uint64_t baseLsn)
+{
+#ifdef _WIN32
+    (void)baseLsn;
+    return false;
 #else
-    // Linux实现
-    shmFd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_RDWR, 0666);
-    if (shmFd == -1)
+    WalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, 8);
+    header.version = WAL_VERSION;
+    header.walId = sharedData->walId;
+    header.baseLsn = baseLsn;
+    int fd = open(WAL_FILE, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd == -1 || !writeFully(fd, &header, sizeof(header), 0) || fsync(fd) != 0 || !syncDirectory())
     {
-        cerr << "无法创建共享内存: " << strerror(errno) << endl;
+        if (fd != -1)
+            close(fd);
         return false;
     }
+    if (walFd >= 0)
+        close(walFd);
+    walFd = fd;
+    sharedData->walBaseLsn = baseLsn;
+    sharedData->walGeneration++;
+    walFdGeneration = sharedData->walGeneration;
+    return true;
+#endif
+}
 
-    if (ftruncate(shmFd, SHARED_MEMORY_SIZE) == -1)
+bool MiniFMS::walRotate()
+{
+#ifdef _WIN32
+    return false;
+#else
+    // 先把当前日志同步到末尾，切换之后等待中的提交只需同步新日志
+    if (!walOpen() || fdatasync(walFd) != 0)
+        return false;
+    sharedData->walSyncedLsn = max(sharedData->walSyncedLsn, sharedData->walLsn);
+    if (rename(WAL_FILE, WAL_OLD_FILE) != 0)
+        return false;
+    if (!walCreate(sharedData->walLsn))
     {
-        cerr << "无法设置共享内存大小: " << strerror(errno) << endl;
-        close(shmFd);
-        shmFd = -1;
+        if (rename(WAL_OLD_FILE, WAL_FILE) != 0)
+            sharedData->walEnabled = 0;
         return false;
     }
+    sharedData->walOldPending = 1;
+    return true;
+#endif
+}
 
-    sharedData = (SharedData *)mmap(NULL, SHARED_MEMORY_SIZE,
-                                    PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
-    if (sharedData == MAP_FAILED)
+void MiniFMS::recoverWal()
+{
+#ifndef _WIN32
+    // 旧版本保存的页式存储没有日志标识，其后的修改不在任何日志中
+    if (sharedData->walId == 0)
+        return;
+    uint64_t next = sharedData->walCheckpointLsn;
+    int replayed = 0, failed = 0;
+    if (replayWalFile(WAL_OLD_FILE, next, replayed, failed)) // 上次保存未完成时留下的旧日志在前
+        replayWalFile(WAL_FILE, next, replayed, failed);
+    sharedData->walLsn = sharedData->walSyncedLsn = next;
+    walCheckpointNeeded = replayed > 0;
+    if (replayed > 0)
+        cout << " 从日志重放 " << replayed << " 条修改记录" << endl;
+    if (failed > 0)
+        cerr << " 警告：" << failed << " 条日志记录重放失败（空间不足或记录与数据不符）" << endl;
+#endif
+}
+
+bool MiniFMS::replayWalFile(const char *path, uint64_t &next, int &replayed, int &failed)
+{
+    ifstream file(path, ios::binary);
+    if (!file.is_open())
+        return true;
+    WalHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || memcmp(header.magic, WAL_MAGIC, 8) != 0 ||
+        header.version != WAL_VERSION || header.walId != sharedData->walId)
     {
-        cerr << "无法映射共享内存: " << strerror(errno) << endl;
-        close(shmFd);
-        shmFd = -1;
-        return false;
+        cerr << " 日志文件 " << path << " 与数据文件不匹配，已忽略" << endl;
+        return true;
     }
-
-    // 创建信号量
-    mutex = sem_open(SHARED_MUTEX_NAME, O_CREAT, 0666, 1);
-    if (mutex == SEM_FAILED)
+    if (header.baseLsn > next)
     {
-        cerr << "无法创建互斥信号量: " << strerror(errno) << endl;
+        cerr << " 警告：日志文件 " << path << " 与数据文件之间缺少记录，未重放" << endl;
         return false;
     }
 
-    string eventName = CHANGE_EVENT_NAME + processName;
-    changeEvent = sem_open(eventName.c_str(), O_CREAT, 0666, 0);
-    if (changeEvent == SEM_FAILED)
+    // 位置不连续、长度异常或校验和不符说明到达了崩溃时没有写完的末尾
+    uint64_t lsn = header.baseLsn;
+    WalRecord rec;
+    vector<char> data;
+    while (file.read(reinterpret_cast<char *>(&rec), sizeof(rec)))
     {
-        cerr << "无法创建事件信号量: " << strerror(errno) << endl;
-        return false;
+        if (rec.lsn != lsn || rec.length > (1U << 30))
+            return false;
+        data.resize(rec.length + 1);
+        if (!file.read(data.data(), rec.length) || walChecksum(rec, data.data()) != rec.checksum)
+            return false;
+        lsn += sizeof(rec) + rec.length;
+        if (rec.lsn < next)
+            continue; // 已包含在页式存储中
+        if (!replayWalRecord(rec, data.data()))
+            failed++;
+        replayed++;
+        next = lsn;
     }
-
-    // 初始化共享数据
-    new (sharedData) SharedData();
-#endif
-
-    cout << "共享内存初始化成功" << endl;
     return true;
 }
 
-bool MiniFMS::connectToSharedMemory()
+bool MiniFMS::replayWalRecord(const WalRecord &rec, const char *data)
 {
-#ifdef _WIN32
-    // 打开现有的共享内存
-    hMapFile = OpenFileMappingA(
-        FILE_MAP_ALL_ACCESS,
-        FALSE,
-        SHARED_MEMORY_NAME);
+    auto validFcb = [](int id)
+    { return id >= 0 && id < MAX_FCBS; };
+    if (rec.type != WAL_VOLUME && rec.type != WAL_USER && rec.type != WAL_RELOC && !validFcb(rec.fcbId))
+        return false;
 
-    if (hMapFile == NULL)
+    // 与原操作调用相同的函数（各自加锁），日志记录期间已关闭，重放不会再次写入日志
+    switch (rec.type)
     {
-        return false; // 共享内存不存在
-    }
-
-    sharedData = (SharedData *)MapViewOfFile(
-        hMapFile,
-        FILE_MAP_ALL_ACCESS,
-        0,
-        0,
-        SHARED_MEMORY_SIZE);
-
-    if (sharedData == NULL)
+    case WAL_CREATE:
     {
-        CloseHandle(hMapFile);
-        hMapFile = NULL;
-        return false;
+        FCB fcb;
+        if (rec.length != sizeof(FCB))
+            return false;
+        memcpy(&fcb, data, sizeof(FCB));
+        fcb.name[MAX_FILENAME_LEN - 1] = '\0';
+        if (createFCB(fcb.name, fcb.type, fcb.owner, fcb.parentDir, rec.fcbId) != rec.fcbId)
+            return false;
+        lockSharedMemory();
+        FCB &created = sharedData->fcbs[rec.fcbId];
+        created.createTime = fcb.createTime;
+        created.modifyTime = fcb.modifyTime;
+        created.accessTime = fcb.accessTime;
+        sharedData->fileCompressed[rec.fcbId] = rec.flags ? 1 : 0;
+        markFcbDirty(rec.fcbId);
+        unlockSharedMemory();
+        return true;
     }
-
-    // 打开互斥锁
-    hMutex = OpenMutexA(SYNCHRONIZE, FALSE, SHARED_MUTEX_NAME);
-    if (hMutex == NULL)
-    {
-        return false;
+    case WAL_RELEASE:
+        releaseFCB(rec.fcbId);
+        return true;
+    case WAL_WRITE:
+        return writeFileRange(rec.fcbId, static_cast<size_t>(rec.value), data, rec.length);
+    case WAL_INSERT:
+        return insertFileData(rec.fcbId, static_cast<size_t>(rec.value), string(data, rec.length));
+    case WAL_COPY:
+        return validFcb(rec.arg) && copyFileData(rec.fcbId, rec.arg);
+    case WAL_MOVE:
+        if (!validFcb(rec.arg))
+            return false;
+        moveFCB(rec.fcbId, rec.arg);
+        return true;
+    case WAL_COMPRESS:
+        return setFileCompression(rec.fcbId, rec.arg != 0);
     }
 
-    // 打开事件对象
-    hChangeEvent = OpenEventA(EVENT_ALL_ACCESS, FALSE, CHANGE_EVENT_NAME);
-    if (hChangeEvent == NULL)
+    bool ok = true;
+    lockSharedMemory();
+    switch (rec.type)
     {
-        return false;
-    }
-
-#else
-    // Linux实现
-    shmFd = shm_open(SHARED_MEMORY_NAME, O_RDWR, 0666);
-    if (shmFd == -1)
+    case WAL_VOLUME:
+        sharedData->compressNewFiles = rec.arg ? 1 : 0;
+        break;
+    case WAL_ATTR:
     {
-        return false; // 共享内存不存在
+        FCB &fcb = sharedData->fcbs[rec.fcbId];
+        fcb.locked = rec.flags != 0;
+        fcb.lockOwner = rec.arg;
+        fcb.modifyTime = static_cast<time_t>(rec.value);
+        markFcbDirty(rec.fcbId);
+        break;
+    }
+    case WAL_USER:
+        ok = rec.arg >= 0 && rec.arg < MAX_USERS && rec.length == sizeof(User);
+        if (ok)
+        {
+            memcpy(&sharedData->users[rec.arg], data, sizeof(User));
+            sharedData->nextUserId = static_cast<int>(rec.value);
+            markUserDirty(rec.arg);
+            rebuildUserIndex();
+        }
+        break;
+    case WAL_RELOC:
+        ok = rec.length == sizeof(int) * MAX_FCBS;
+        if (ok)
+        {
+            const int *to = reinterpret_cast<const int *>(data);
+            relocateFcbs(vector<int>(to, to + MAX_FCBS));
+        }
+        break;
+    default:
+        ok = false;
     }
+    unlockSharedMemory();
+    return ok;
+}
 
-    sharedData = (SharedData *)mmap(NULL, SHARED_MEMORY_SIZE,
-                                    PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
-    if (sharedData == MAP_FAILED)
+void MiniFMS::startWal()
+{
+#ifndef _WIN32
+    if (imageMapped)
+        return;
+    if (sharedData->walId == 0)
     {
-        close(shmFd);
-        shmFd = -1;
-        return false;
+        sharedData->walId = static_cast<uint64_t>(chrono::system_clock::now().time_since_epoch().count()) | 1;
+        walCheckpointNeeded = true;
     }
 
-    // 打开信号量
-    mutex = sem_open(SHARED_MUTEX_NAME, 0);
-    if (mutex == SEM_FAILED)
+    // 重放过的修改和新的日志标识先写入页式存储，之后旧日志才可以丢弃
+    if (walCheckpointNeeded)
     {
-        return false;
+        lock_guard<mutex> lock(saveMutex);
+        if (!saveStore(true))
+        {
+            cerr << " 警告：无法写入 " << STORE_FILE << "，本次运行不记录日志" << endl;
+            return;
+        }
     }
-
-    string eventName = CHANGE_EVENT_NAME + processName;
-    changeEvent = sem_open(eventName.c_str(), O_CREAT, 0666, 0);
-    if (changeEvent == SEM_FAILED)
+    remove(WAL_OLD_FILE);
+    if (!walCreate(sharedData->walLsn))
     {
-        return false;
+        cerr << " 警告：无法创建日志文件 " << WAL_FILE << "，本次运行不记录日志" << endl;
+        return;
     }
+    sharedData->walOldPending = 0;
+    sharedData->walSyncedLsn = sharedData->walCheckpointLsn = sharedData->walLsn;
+    sharedData->walEnabled = 1;
+    walCheckpointNeeded = false;
 #endif
-
-    return true;
 }
 
 bool MiniFMS::acquireProcessSlot()
@@ -2854,6 +9610,9 @@ bool MiniFMS::acquireProcessSlot()
             strncpy(sharedData->processNames[i], processName.c_str(), 63);
             sharedData->processNames[i][63] = '\0';
             sharedData->processCount++;
+            sharedData->relocAck[i] = -1;
+            sharedData->processBusy[i] = 0;
+            sharedData->snapshotPinned[i] = 0;
             currentProcessId = i;
             lastKnownChangeId = sharedData->lastChangeId.load();
 
@@ -2886,7 +9645,7 @@ void MiniFMS::lockSharedMemory()
 #ifdef _WIN32
     WaitForSingleObject(hMutex, INFINITE);
 #else
-    sem_wait(mutex);
+    sem_wait(shmMutex);
 #endif
 }
 
@@ -2895,7 +9654,7 @@ void MiniFMS::unlockSharedMemory()
 #ifdef _WIN32
     ReleaseMutex(hMutex);
 #else
-    sem_post(mutex);
+    sem_post(shmMutex);
 #endif
 }
 
@@ -3015,4 +9774,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}